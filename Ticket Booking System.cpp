@@ -1,624 +1,11264 @@
-// Ticket Booking System
-//
-
-// main.cpp
-
-#include <iostream>
-#include <string>
-#include <sstream>
-#include <vector>
-#include <ctime>
-#include <cstdlib>
-#include <cctype>
-#ifdef _WIN32
-#include <windows.h>
-#else
-#include <unistd.h>
-#endif
-
-
-using namespace std;
-
-// Helper to convert various types to string (no std::to_string in C++98) 
-template <typename T>
-string toString(const T& value) {
-    ostringstream oss;
-    oss << value;
-    return oss.str();
-}
-
-// Represents a single seat in a show
-class Seat {
-public:
-    int row;
-    int number;
-    bool isBooked;
-    Seat() : row(0), number(0), isBooked(false) {}
-    Seat(int r, int n) : row(r), number(n), isBooked(false) {}
-};
-
-// Represents an individual show (concert, movie or bus trip)
-class Show {
-private:
-    string title;
-    string dateTime;
-    Seat** seats;
-    int rows, cols;
-    double price;       // ticket price in PKR
-
-public:
-    Show(const string& t, const string& dt, int r, int c, double p)
-        : title(t), dateTime(dt), rows(r), cols(c), price(p)
-    {
-        // allocate a 2D array of Seat
-        seats = new Seat*[rows];
-        for (int i = 0; i < rows; ++i) {
-            seats[i] = new Seat[cols];
-            for (int j = 0; j < cols; ++j) {
-                seats[i][j] = Seat(i+1, j+1);
-            }
-        }
-    }
-
-    ~Show() {
-        // free the 2D array
-        for (int i = 0; i < rows; ++i) {
-            delete[] seats[i];
-        }
-        delete[] seats;
-    }
-
-    string getTitle()    const { return title; }
-    string getDateTime() const { return dateTime; }
-    double getPrice()    const { return price;   }
-
-    void setTitle(const string& t)      { title = t; }
-    void setDateTime(const string& dt)  { dateTime = dt; }
-
-    // Print all unbooked seats
-    void displayAvailableSeats() const {
-        cout << "Available seats for \"" << title 
-             << "\" on " << dateTime
-             << " [Ticket Price: PKR " << price << "]\n";
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < cols; ++j) {
-                if (!seats[i][j].isBooked) {
-                    cout << "[" << seats[i][j].row
-                         << "," << seats[i][j].number << "] ";
-                }
-            }
-            cout << "\n";
-        }
-    }
-
-    // Try to book a seat; return false if out of range or already booked
-    bool bookSeat(int r, int c) {
-        if (r < 1 || r > rows || c < 1 || c > cols) return false;
-        if (seats[r-1][c-1].isBooked)             return false;
-        seats[r-1][c-1].isBooked = true;
-        return true;
-    }
-};
-
-
-
-
-// Holds a dynamic list of Shows under one category
-
-class Category {
-private:
-    string name;
-    vector<Show*> shows;
-
-public:
-    Category(const string& n) : name(n) {}
-
-    ~Category() {
-        for (size_t i = 0; i < shows.size(); ++i) {
-            delete shows[i];
-        }
-    }
-
-    string getName() const { return name; }
-    void   setName(const string& n) { name = n; }
-
-    int    getCount() const { return (int)shows.size(); }
-
-    // Return pointer to the i-th show, or NULL if out of range
-    Show*  getShow(int idx) const {
-        if (idx < 0 || idx >= getCount()) return NULL;
-        return shows[idx];
-    }
-
-    // List all shows in this category
-  /*  void listShows() const {
-        for (int i = 0; i < getCount(); ++i) {
-            Show* s = shows[i];
-            cout << (i+1) << ". "
-                 << s->getTitle()
-                 << " at " << s->getDateTime() << "\n";
-        }
-    } */
-    
-
-
-void listShows() const {
-    time_t now = time(NULL);
-    tm currentTime = *localtime(&now);
-    
-    for (int i = 0; i < getCount(); ++i) {
-        Show* s = shows[i];
-        tm showTime = s->getDateTime();
-        
-        // Calculate time difference in days
-        double diff = difftime(mktime(&showTime), mktime(&currentTime)) / (60 * 60 * 24);
-        
-        // Display only shows within the next three days
-        if (diff >= 0 && diff <= 3) {
-            std::cout << (i+1) << ". "
-                      << s->getTitle()
-                      << " at " << s->getDateTime() << "\n";
-        }
-    }
-}
-
-    // Add a new show (including ticket price)
-    void addShow(const string& title,
-                 const string& dt,
-                 int rows, int cols,
-                 double price)
-    {
-        shows.push_back(new Show(title, dt, rows, cols, price));
-    }
-
-    // Remove a show by index; returns false if index invalid
-    bool removeShow(int idx) {
-        if (idx < 0 || idx >= getCount()) return false;
-        delete shows[idx];
-        shows.erase(shows.begin() + idx);
-        return true;
-    }
-
-    // Edit an existing show's title and/or datetime (price unchanged)
-    bool editShow(int idx,
-                  const string& newTitle,
-                  const string& newDateTime)
-    {
-        Show* s = getShow(idx);
-        if (!s) return false;
-        s->setTitle(newTitle);
-        s->setDateTime(newDateTime);
-        return true;
-    }
-};
-
-
-
-
-
-
-// Records a completed booking
-struct Booking {
-    string id;
-    Show*  show;
-    int    row, col;
-    Booking(const string& i, Show* s, int r, int c)
-        : id(i), show(s), row(r), col(c) {}
-};
-
-
-
-
-// Simulates a payment gateway
-class PaymentProcessor {
-public:
-    static bool processPayment(double amount) {
-        cout << "\n=== Payment Processing ===\n";
-        cout << "Amount to pay: PKR " << amount << "\n";
-
-        cout << "Enter card number: ";
-        string card; cin >> card;
-
-        cout << "Enter expiry date (MM/YY): ";
-        string exp;  cin >> exp;
-
-        cout << "Enter CVV: ";
-        string cvv;  cin >> cvv;
-
-        cout << "Processing";
-        // simple delay animation
-        for (int i = 0; i < 3; ++i) {
-            cout << ".";
-            cout.flush();
-#ifdef _WIN32
-            Sleep(500);
-#else
-            usleep(500000);
-#endif
-        }
-        cout << "\nPayment successful!\n";
-        return true;
-    }
-};
-
-
-
-
-
-
-// Main system orchestrating categories, shows, bookings and admin/user dashboards
-class TicketBookingSystem {
-private:
-    vector<Category*> categories;
-    vector<Booking*>  bookings;
-    const string      adminUser = "admin";
-    const string      adminPass = "admin";
-
-    // Generate a random 5-digit booking ID
-    string generateBookingID() {
-        static bool seeded = false;
-        if (!seeded) {
-            srand((unsigned)time(NULL));
-            seeded = true;
-        }
-        int id = rand() % 90000 + 10000;  // 1000099999
-        return "BK" + toString(id);
-    }
-
-    // Record a successful booking
-    void addBookingRecord(const string& id, Show* s, int r, int c) {
-        bookings.push_back(new Booking(id, s, r, c));
-    }
-
-    // Admin dashboard
-    void adminMenu() {
-        while (true) {
-            cout << "\n--- Admin Menu ---\n"
-                 << "1. View booked tickets\n"
-                 << "2. New Booking & Manage categories\n"
-                 << "0. Logout\n"
-                 << "Choice: ";
-            int choice; cin >> choice;
-
-            if (choice == 1) {
-                if (bookings.empty()) {
-                    cout << "No bookings have been made yet.\n";
-                } else {
-                    cout << "\nBooked Tickets:\n";
-                    for (size_t i = 0; i < bookings.size(); ++i) {
-                        Booking* b = bookings[i];
-                        cout << (i+1) << ". ID: " << b->id
-                             << ", Show: " << b->show->getTitle()
-                             << ", When: " << b->show->getDateTime()
-                             << ", Seat: [" << b->row << "," << b->col << "]\n";
-                    }
-                }
-            }
-            else if (choice == 2) {
-                // Category management
-                while (true) {
-                    cout << "\n--- Book Tickets ---\n";
-                    for (size_t i = 0; i < categories.size(); ++i) {
-                        cout << (i+1) << ". " << categories[i]->getName() << "\n";
-                    }
-                    
-                    // Add new Category
-                    cout << "\n--- Manage Categories ---\n";
-                    cout << (categories.size()+1)
-                         << ". Add new category\n"
-                         << (categories.size()+2)
-                         << ". Delete category\n"
-                         << (categories.size()+3)
-                         << ". Rename category\n"
-                         << (categories.size()+4)
-                         << ". Back\n"
-                         << "Choice: ";
-                    int c; cin >> c;
-
-					
-                    int n = (int)categories.size();
-                    if (c >= 1 && c <= n) {
-                        // manage a specific category
-                        Category* cat = categories[c-1];
-                        while (true) {
-                            cout << "\n--- Category: " << cat->getName() << " ---\n"
-                                 << "1. List shows\n"
-                                 << "2. Add show\n"
-                                 << "3. Edit show\n"
-                                 << "4. Delete show\n"
-                                 << "0. Back\n"
-                                 << "Choice: ";
-                            int sub; cin >> sub;
-                            if (sub == 1) {
-                                cat->listShows();
-                            }
-                            else if (sub == 2) {
-                                string t, dt;
-                                int r, co;
-                                double p;
-                                cout << "Enter new show title: ";
-                                cin.ignore(); getline(cin, t);
-                                cout << "Enter date/time: ";
-                                getline(cin, dt);
-                                cout << "Enter rows and cols: ";
-                                cin >> r >> co;
-                                cout << "Enter ticket price (PKR): ";
-                                cin >> p;
-                                cat->addShow(t, dt, r, co, p);
-                                cout << "Show added.\n";
-                            }
-                            else if (sub == 3) {
-                                cat->listShows();
-                                cout << "Enter show number to edit: ";
-                                int si; cin >> si;
-                                if (si < 1 || si > cat->getCount()) {
-                                    cout << "Invalid number.\n";
-                                } else {
-                                    string nt, ndt;
-                                    cout << "Enter new title: ";
-                                    cin.ignore(); getline(cin, nt);
-                                    cout << "Enter new date/time: ";
-                                    getline(cin, ndt);
-                                    cat->editShow(si-1, nt, ndt);
-                                    cout << "Show updated.\n";
-                                }
-                            }
-                            else if (sub == 4) {
-                                cat->listShows();
-                                cout << "Enter show number to delete: ";
-                                int si; cin >> si;
-                                if (cat->removeShow(si-1)) {
-                                    cout << "Show deleted.\n";
-                                } else {
-                                    cout << "Invalid number.\n";
-                                }
-                            }
-                            else if (sub == 0) {
-                                break;
-                            }
-                            else {
-                                cout << "Invalid choice.\n";
-                            }
-                        }
-                    }
-                    else if (c == n+1) {
-                        // add category
-                        cout << "Enter new category name: ";
-                        string nm;
-                        cin.ignore(); getline(cin, nm);
-                        categories.push_back(new Category(nm));
-                        cout << "Category added.\n";
-                    }
-                    else if (c == n+2) {
-                        // delete category
-                        cout << "Enter category number to delete: ";
-                        int di; cin >> di;
-                        if (di >= 1 && di <= n) {
-                            delete categories[di-1];
-                            categories.erase(categories.begin() + (di-1));
-                            cout << "Category deleted.\n";
-                        } else {
-                            cout << "Invalid number.\n";
-                        }
-                    }
-                    else if (c == n+3) {
-                        // rename category
-                        cout << "Enter category number to rename: ";
-                        int ri; cin >> ri;
-                        if (ri >= 1 && ri <= n) {
-                            cout << "Enter new name: ";
-                            string nn;
-                            cin.ignore(); getline(cin, nn);
-                            categories[ri-1]->setName(nn);
-                            cout << "Category renamed.\n";
-                        } else {
-                            cout << "Invalid number.\n";
-                        }
-                    }
-                    else if (c == n+4) {
-                        break;
-                    }
-                    else {
-                        cout << "Invalid choice.\n";
-                    }
-                }
-            }
-            else if (choice == 0) {
-                cout << "Logging out of admin.\n";
-                break;
-            }
-            else {
-                cout << "Invalid choice.\n";
-            }
-        }
-    }
-
-    // User dashboard
-    void userMenu() {
-        while (true) {
-            cout << "\n--- User Menu ---\n";
-            for (size_t i = 0; i < categories.size(); ++i) {
-                cout << (i+1) << ". " << categories[i]->getName() << "\n";
-            }
-            cout << (categories.size()+1) << ". Back to main menu\n";
-            cout << "Select category: ";
-            int c; cin >> c;
-            if (c == (int)categories.size()+1) break;
-            if (c < 1 || c > (int)categories.size()) {
-                cout << "Invalid category.\n";
-                continue;
-            }
-            Category* cat = categories[c-1];
-            cout << "\n--- " << cat->getName() << " ---\n";
-            cat->listShows();
-            cout << "Select show number (or 0 to go back): ";
-            int s; cin >> s;
-            if (s == 0) continue;
-            Show* sel = cat->getShow(s-1);
-            if (!sel) {
-                cout << "Invalid show.\n";
-                continue;
-            }
-            sel->displayAvailableSeats();
-            cout << "Enter row and seat number to book: ";
-            int r, co; cin >> r >> co;
-            if (!sel->bookSeat(r, co)) {
-                cout << "Seat unavailable.\n";
-                continue;
-            }
-            double price = sel->getPrice();
-            if (!PaymentProcessor::processPayment(price)) {
-                cout << "Payment failed.\n";
-                continue;
-            }
-            string bid = generateBookingID();
-            cout << "\nBooking confirmed! ID = " << bid << "\n";
-            addBookingRecord(bid, sel, r, co);
-        }
-    }
-
-    // Display help information
-    void displayHelp() {
-        cout << "\n=== Help ===\n";
-        cout << "1. Select 'Admin Login' to manage shows and bookings (admin credentials required).\n";
-        cout << "2. Select 'User' to browse categories and book tickets.\n";
-        cout << "3. Follow on-screen prompts to select shows, seats, and complete payment.\n";
-        cout << "4. For support, use the 'Contact Us' option.\n";
-    }
-
-    // Display contact information
-    void displayContact() {
-        cout << "\n=== Contact Us ===\n";
-        cout << "FAST University Islamabad\n";
-        cout << "Phone: (051) 111 128 128\n";
-        cout << "Email: info@fastbookingsystem.com\n";
-    }
-
-public:
-    TicketBookingSystem() {
-        // Movies
-        Category* movies = new Category("Movies");
-        movies->addShow("Umro Ayyar: A New Beginning",   "2025-04-14 10:00", 5, 10, 800.0);
-        movies->addShow("Paddington in Peru",            "2025-04-14 14:00", 5, 10, 750.0);
-        movies->addShow("Despicable Me 4",               "2025-04-14 18:00", 5, 10, 700.0);
-        movies->addShow("Khel Khel Mein",                "2025-04-15 10:00", 5, 10, 820.0);
-        movies->addShow("Lilo & Stitch",                 "2025-04-15 14:00", 5, 10, 770.0);
-        movies->addShow("The Family Plan 2",             "2025-04-15 18:00", 5, 10, 730.0);
-        movies->addShow("Dushman-e-Jaan",                "2025-04-16 10:00", 5, 10, 810.0);
-        movies->addShow("How to Train Your Dragon",      "2025-04-16 14:00", 5, 10, 760.0);
-        movies->addShow("Encanto",                       "2025-04-16 18:00", 5, 10, 720.0);
-        movies->addShow("Peechay Tou Dekho",             "2025-04-17 10:00", 5, 10, 830.0);
-        movies->addShow("The Super Mario Bros. Movie",   "2025-04-17 14:00", 5, 10, 780.0);
-        movies->addShow("Minions: The Rise of Gru",      "2025-04-17 18:00", 5, 10, 740.0);
-        movies->addShow("Laal Kabootar",                 "2025-04-18 10:00", 5, 10, 840.0);
-        movies->addShow("Wish",                          "2025-04-18 14:00", 5, 10, 790.0);
-        movies->addShow("Kung Fu Panda 4",               "2025-04-18 18:00", 5, 10, 750.0);
-        categories.push_back(movies);
-
-        // Concerts
-        Category* concerts = new Category("Concerts");
-        concerts->addShow("Pakistan Fest 2025 @ Jilani Park, Lahore",      "2025-02-14 to 02-16", 10, 20, 2500.0);
-        concerts->addShow("Shaam-e-Suroor (Qawwali & DJ Night)",           "2025-05-14",           8, 16, 1800.0);
-        concerts->addShow("Soundwaves S1 (Mustafa Zahid Live)",            "2025-05-18",           8, 16, 2000.0);
-        concerts->addShow("Colour Fest Islamabad",                        "2025-05-24",           8, 16, 1500.0);
-        concerts->addShow("Soul Fest @ Dring Stadium, Bahawalpur",        "2025-05-24 to 05-25",  8, 16, 1600.0);
-        concerts->addShow("PSL X Opening Ceremony ft. Abida Parveen",     "2025-04-11",           8, 16, 3000.0);
-        concerts->addShow("MHB Tribute to Nusrat Fateh Ali Khan",         "2025-04-19",           8, 16, 2200.0);
-        concerts->addShow("Mekaal Hasan Band Live @ Lok Virsa",           "2025-04-26",           8, 16, 2100.0);
-        concerts->addShow("Biggest Sufi & Qawwali Night 2025",            "2025-02-01",           8, 16, 1900.0);
-        concerts->addShow("6th Sindh Sufi Melo 2025",                     "2025-02-08 to 02-09",  8, 16, 1750.0);
-        concerts->addShow("Banjo ke Rung: Ustad Sabzal ke Sang",          "2024-04-27",           8, 16, 1600.0);
-        concerts->addShow("The Raah e Ishq Live Show",                    "2024-05-25",           8, 16, 1700.0);
-        concerts->addShow("Mehfil-e-Qawwali",                             "2024-06-02",           8, 16, 1550.0);
-        concerts->addShow("Summer Fiesta (Aima Baig, Bilal & DJ Night)",  "TBA",                  8, 16,    0.0);
-        concerts->addShow("MediaBiz Music Fest (Gul Panra Live)",         "2019-04-27",           8, 16, 1400.0);
-        categories.push_back(concerts);
-
-        // Buses
-        Category* buses = new Category("Buses");
-        buses->addShow("Lahore to Islamabad (Business Class)",    "07:0011:00", 5, 4, 1200.0);
-        buses->addShow("Karachi to Multan (Economy Class)",       "09:3015:15", 5, 4,  850.0);
-        buses->addShow("Islamabad to Peshawar (Executive Class)", "18:0020:30", 5, 4, 1000.0);
-        buses->addShow("Rawalpindi to Swat (Economy Class)",      "08:0012:00", 5, 4,  900.0);
-        buses->addShow("Multan to Lahore (Business Class)",       "17:0020:00", 5, 4, 1150.0);
-        buses->addShow("Quetta to Karachi (Sleeper Class)",       "21:0007:00", 5, 4, 1400.0);
-        buses->addShow("Peshawar to Muzaffarabad (Std Class)",    "10:0015:00", 5, 4,  950.0);
-        buses->addShow("Hyderabad to Sukkur (Economy Class)",     "06:3010:45", 5, 4,  800.0);
-        buses->addShow("Faisalabad to Rawalpindi (Business)",     "13:0017:30", 5, 4, 1100.0);
-        buses->addShow("Sialkot to Lahore (Economy Class)",       "07:3009:00", 5, 4,  700.0);
-        buses->addShow("Gilgit to Islamabad (Executive Class)",   "06:0012:00", 5, 4, 1300.0);
-        buses->addShow("Bahawalpur to Karachi (Sleeper)",         "20:0006:00", 5, 4, 1450.0);
-        buses->addShow("Gwadar to Quetta (Standard Class)",       "16:0022:00", 5, 4, 1250.0);
-        buses->addShow("Skardu to Lahore (Business Class)",       "09:0015:00", 5, 4, 1350.0);
-        buses->addShow("Kashmir to Islamabad (Economy Class)",    "11:0014:30", 5, 4,  780.0);
-        categories.push_back(buses);
-    }
-
-    ~TicketBookingSystem() {
-        for (size_t i = 0; i < categories.size(); ++i) {
-            delete categories[i];
-        }
-        for (size_t i = 0; i < bookings.size(); ++i) {
-            delete bookings[i];
-        }
-    }
-
-    // Entry point
-    void run() {
-        while (true) {
-            cout << "\n**********************************\n";
-            cout << "       FAST BOOKING SYSTEM       \n";
-            cout << "**********************************\n";
-            cout << "Address: FAST University Islamabad\n";
-            cout << "Contact: (051) 111 128 128\n";
-            cout << "\n=== Main Menu ===\n";
-            cout << "1. Admin Login\n";
-            cout << "2. User\n";
-            cout << "3. Help\n";
-            cout << "4. Contact Us\n";
-            cout << "0. Exit\n";
-            cout << "Choice: ";
-            int choice; cin >> choice;
-
-            if (choice == 1) {
-                // Admin authentication
-                cout << "Username: ";
-                string u; cin >> u;
-                cout << "Password: ";
-                string p; cin >> p;
-                if (u == adminUser && p == adminPass) {
-                    cout << "Login successful.\n";
-                    adminMenu();
-                } else {
-                    cout << "Invalid credentials.\n";
-                }
-            }
-            else if (choice == 2) {
-                userMenu();
-            }
-            else if (choice == 3) {
-                displayHelp();
-            }
-            else if (choice == 4) {
-                displayContact();
-            }
-            else if (choice == 0) {
-                cout << "Goodbye!\n";
-                break;
-            }
-            else {
-                cout << "Invalid choice.\n";
-            }
-        }
-    }
-};
-
-
-
-
-int main() {
-    TicketBookingSystem app;
-    app.run();
-    return 0;
-}
-
+// Ticket Booking System
+//
+
+// main.cpp
+
+#include <iostream>
+#include <string>
+#include <sstream>
+#include <vector>
+#include <ctime>
+#include <cstdlib>
+#include <cmath>
+#include <cctype>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <random>
+#include <unordered_map>
+#include <map>
+#include <climits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TBS_SSE2 1
+#endif
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <malloc.h>
+#endif
+
+
+using namespace std;
+
+// Helper to convert various types to string (no std::to_string in C++98) 
+template <typename T>
+string toString(const T& value) {
+    ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+// Bit helpers used by the packed seat map
+inline int countTrailingZeros(uint64_t w) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanForward64(&idx, w);
+    return (int)idx;
+#else
+    return __builtin_ctzll(w);
+#endif
+}
+
+inline int countLeadingZeros(uint64_t w) {
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanReverse64(&idx, w);
+    return 63 - (int)idx;
+#else
+    return __builtin_clzll(w);
+#endif
+}
+
+// ---------------------------------------------------------------------
+// Metrics: per-thread counters and latency histograms, added up on read.
+// A thread only ever writes its own block, with plain relaxed stores,
+// so the hot paths share no cache lines and take no locks. Timers on
+// paths that take nanoseconds count every call but time one call in
+// `sample`. Build with -DTBS_NO_METRICS to compile every probe out.
+// ---------------------------------------------------------------------
+enum MetricTimer {
+    T_BOOK_SEAT,        // Show::bookSeat
+    T_HOLD_SEATS,       // HoldManager::hold / holdBlock
+    T_BOOKING_ID,       // BookingEngine::generateBookingID
+    T_PAYMENT,          // a charge, from submit until its completion ran
+    T_GATEWAY_BATCH,    // one gateway round trip
+    T_ADMIN_LISTING,    // the admin "view booked tickets" loop
+    T_HTTP_REQUEST,     // BookingHttpApi::handle
+    TIMER_KINDS
+};
+
+enum MetricCounter {
+    C_PAYMENTS_APPROVED,
+    C_PAYMENTS_DECLINED,
+    C_HOLDS_EXPIRED,
+    C_BOOKINGS_CANCELLED,
+    C_REFUNDS_ISSUED,
+    C_REFUNDS_FAILED,
+    C_QUEUE_JOINED,
+    C_QUEUE_ADMITTED,
+    C_QUEUE_TURNED_AWAY,
+    COUNTER_KINDS
+};
+
+struct MetricInfo {
+    const char* name;
+    const char* help;
+    uint64_t    sample;     // timers: time one call in this many (a power of two)
+};
+
+static const MetricInfo TIMER_INFO[TIMER_KINDS] = {
+    { "tbs_book_seat",       "Show::bookSeat",                          256 },
+    { "tbs_hold_seats",      "Seat holds (single seats and best blocks)", 16 },
+    { "tbs_booking_id",      "Booking id generation",                   256 },
+    { "tbs_payment",         "Card charges, submit to completion",        1 },
+    { "tbs_gateway_batch",   "Payment gateway round trips",               1 },
+    { "tbs_admin_listing",   "Admin listing of every booking",            1 },
+    { "tbs_http_request",    "HTTP API requests",                         1 }
+};
+
+static const MetricInfo COUNTER_INFO[COUNTER_KINDS] = {
+    { "tbs_payments_approved_total",  "Charges the gateway approved", 0 },
+    { "tbs_payments_declined_total",  "Charges the gateway declined", 0 },
+    { "tbs_holds_expired_total",      "Seat holds that ran out before payment", 0 },
+    { "tbs_bookings_cancelled_total", "Bookings cancelled", 0 },
+    { "tbs_refunds_issued_total",     "Refunds the gateway paid out", 0 },
+    { "tbs_refunds_failed_total",     "Refunds the gateway refused", 0 },
+    { "tbs_waiting_room_joined_total",   "Clients who joined an on-sale line", 0 },
+    { "tbs_waiting_room_admitted_total", "Clients let through to seat selection", 0 },
+    { "tbs_waiting_room_turned_away_total", "Seat requests refused for want of an admitted ticket", 0 }
+};
+
+// HDR-style latency histogram over nanoseconds: values below 32 get a
+// bucket each, then every power of two is split into 32 buckets, so a
+// bucket is never wider than ~3% of its values. Tops out at 2^36 ns
+// (about 69 s). Written by one thread, read by any.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 5;
+    static const int MAX_BITS = 36;
+    static const int BUCKETS  = (MAX_BITS - SUB_BITS + 1) << SUB_BITS;
+
+    static int bucketOf(uint64_t ns) {
+        if (ns >= ((uint64_t)1 << MAX_BITS)) return BUCKETS - 1;
+        if (ns < ((uint64_t)1 << SUB_BITS)) return (int)ns;
+        int msb = 63 - countLeadingZeros(ns);
+        return ((msb - SUB_BITS + 1) << SUB_BITS) + (int)((ns >> (msb - SUB_BITS)) & ((1 << SUB_BITS) - 1));
+    }
+
+    // Middle of a bucket's range
+    static double bucketValue(int b) {
+        if (b < (1 << SUB_BITS)) return b;
+        int shift = (b >> SUB_BITS) - 1;
+        uint64_t lo = (uint64_t)((1 << SUB_BITS) + (b & ((1 << SUB_BITS) - 1))) << shift;
+        return lo + ((uint64_t)1 << shift) / 2.0;
+    }
+
+    atomic<uint64_t> counts[BUCKETS];
+    atomic<uint64_t> total, sumNs, maxNs;
+
+    LatencyHistogram() : total(0), sumNs(0), maxNs(0) {
+        for (int i = 0; i < BUCKETS; ++i) counts[i].store(0, memory_order_relaxed);
+    }
+
+    // Owner thread only: no read-modify-write needed
+    void record(uint64_t ns) {
+        atomic<uint64_t>& c = counts[bucketOf(ns)];
+        c.store(c.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        total.store(total.load(memory_order_relaxed) + 1, memory_order_relaxed);
+        sumNs.store(sumNs.load(memory_order_relaxed) + ns, memory_order_relaxed);
+        if (ns > maxNs.load(memory_order_relaxed)) maxNs.store(ns, memory_order_relaxed);
+    }
+};
+
+// Several threads' histograms added together
+struct LatencySummary {
+    vector<uint64_t> counts;
+    uint64_t         total, sumNs, maxNs;
+
+    LatencySummary() : counts(LatencyHistogram::BUCKETS, 0), total(0), sumNs(0), maxNs(0) {}
+
+    void add(const LatencyHistogram& h) {
+        for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) counts[i] += h.counts[i].load(memory_order_relaxed);
+        total += h.total.load(memory_order_relaxed);
+        sumNs += h.sumNs.load(memory_order_relaxed);
+        maxNs  = max(maxNs, h.maxNs.load(memory_order_relaxed));
+    }
+
+    // Value at quantile q (0..1) in ns, 0 if nothing was recorded
+    double quantile(double q) const {
+        uint64_t seen = 0, want = (uint64_t)ceil(q * total);
+        if (total == 0) return 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= max(want, (uint64_t)1)) return min(LatencyHistogram::bucketValue(i), (double)maxNs);
+        }
+        return (double)maxNs;
+    }
+};
+
+class Metrics {
+public:
+    struct Block {
+        atomic<uint64_t> counters[COUNTER_KINDS];
+        atomic<uint64_t> calls[TIMER_KINDS];
+        LatencyHistogram timers[TIMER_KINDS];
+        bool             inUse;     // owned by a live thread (registry lock)
+        Block() : inUse(true) {
+            for (int i = 0; i < COUNTER_KINDS; ++i) counters[i].store(0, memory_order_relaxed);
+            for (int i = 0; i < TIMER_KINDS; ++i) calls[i].store(0, memory_order_relaxed);
+        }
+    };
+
+    // This thread's block
+    static Block& local() {
+        Block* b = current();
+        return b ? *b : attach();
+    }
+
+    static void count(MetricCounter c, uint64_t n = 1) {
+#ifndef TBS_NO_METRICS
+        atomic<uint64_t>& v = local().counters[c];
+        v.store(v.load(memory_order_relaxed) + n, memory_order_relaxed);
+#else
+        (void)c; (void)n;
+#endif
+    }
+
+    // A latency measured elsewhere (e.g. across threads); counts as a call
+    static void record(MetricTimer t, uint64_t ns) {
+#ifndef TBS_NO_METRICS
+        Block& b = local();
+        b.calls[t].store(b.calls[t].load(memory_order_relaxed) + 1, memory_order_relaxed);
+        b.timers[t].record(ns);
+#else
+        (void)t; (void)ns;
+#endif
+    }
+
+    static uint64_t counter(MetricCounter c) {
+        lock_guard<mutex> g(registryLock());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < registry().size(); ++i) sum += registry()[i]->counters[c].load(memory_order_relaxed);
+        return sum;
+    }
+
+    static uint64_t calls(MetricTimer t) {
+        lock_guard<mutex> g(registryLock());
+        uint64_t sum = 0;
+        for (size_t i = 0; i < registry().size(); ++i) sum += registry()[i]->calls[t].load(memory_order_relaxed);
+        return sum;
+    }
+
+    static LatencySummary timer(MetricTimer t) {
+        LatencySummary s;
+        lock_guard<mutex> g(registryLock());
+        for (size_t i = 0; i < registry().size(); ++i) s.add(registry()[i]->timers[t]);
+        return s;
+    }
+
+    // Everything in the Prometheus text exposition format
+    static string prometheus() {
+#ifdef TBS_NO_METRICS
+        return "# metrics compiled out (TBS_NO_METRICS)\n";
+#else
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        ostringstream out;
+        for (int c = 0; c < COUNTER_KINDS; ++c) {
+            out << "# HELP " << COUNTER_INFO[c].name << " " << COUNTER_INFO[c].help << "\n"
+                << "# TYPE " << COUNTER_INFO[c].name << " counter\n"
+                << COUNTER_INFO[c].name << " " << counter((MetricCounter)c) << "\n";
+        }
+        for (int t = 0; t < TIMER_KINDS; ++t) {
+            const MetricInfo& m = TIMER_INFO[t];
+            LatencySummary s = timer((MetricTimer)t);
+            out << "# HELP " << m.name << "_calls_total " << m.help << ": calls\n"
+                << "# TYPE " << m.name << "_calls_total counter\n"
+                << m.name << "_calls_total " << calls((MetricTimer)t) << "\n"
+                << "# HELP " << m.name << "_seconds " << m.help << ": latency";
+            if (m.sample > 1) out << " of one call in " << m.sample;
+            out << "\n# TYPE " << m.name << "_seconds summary\n";
+            for (size_t q = 0; q < sizeof quantiles / sizeof quantiles[0]; ++q) {
+                out << m.name << "_seconds{quantile=\"" << quantiles[q] << "\"} "
+                    << s.quantile(quantiles[q]) * 1e-9 << "\n";
+            }
+            out << m.name << "_seconds_sum " << s.sumNs * 1e-9 << "\n"
+                << m.name << "_seconds_count " << s.total << "\n";
+        }
+        return out.str();
+#endif
+    }
+
+private:
+    // Hands the block back for reuse when its thread exits; its numbers
+    // stay in the totals and the next thread keeps adding to them
+    struct Owner {
+        Block* block;
+        ~Owner() {
+            if (!block) return;
+            lock_guard<mutex> g(registryLock());
+            block->inUse = false;
+            current() = NULL;
+        }
+    };
+
+    static mutex& registryLock() { static mutex m; return m; }
+    static vector<Block*>& registry() { static vector<Block*> blocks; return blocks; }
+    static Block*& current() { static thread_local Block* b = NULL; return b; }
+
+    static Block& attach() {
+        static thread_local Owner owner = { NULL };
+        lock_guard<mutex> g(registryLock());
+        Block* b = NULL;
+        for (size_t i = 0; i < registry().size() && !b; ++i) {
+            if (!registry()[i]->inUse) b = registry()[i];
+        }
+        if (b) b->inUse = true;
+        else {
+            b = new Block();
+            registry().push_back(b);
+        }
+        owner.block = b;
+        current() = b;
+        return *b;
+    }
+};
+
+// Times the enclosing scope into one of the timers
+class ScopedTimer {
+#ifndef TBS_NO_METRICS
+private:
+    Metrics::Block*                   block;
+    MetricTimer                       kind;
+    bool                              timing;
+    chrono::steady_clock::time_point  start;
+
+public:
+    explicit ScopedTimer(MetricTimer t) : block(&Metrics::local()), kind(t) {
+        uint64_t n = block->calls[t].load(memory_order_relaxed);
+        block->calls[t].store(n + 1, memory_order_relaxed);
+        timing = (n & (TIMER_INFO[t].sample - 1)) == 0;
+        if (timing) start = chrono::steady_clock::now();
+    }
+
+    ~ScopedTimer() {
+        if (!timing) return;
+        block->timers[kind].record((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count());
+    }
+#else
+public:
+    explicit ScopedTimer(MetricTimer) {}
+#endif
+};
+
+// Slots for one type carved out of large chunks: addresses never move,
+// destroy() recycles a slot, and dropping the pool frees whole chunks.
+// Objects still alive at that point are not destructed, so owners
+// destroy whatever needs a destructor first.
+template <typename T>
+class ObjectPool {
+private:
+    static const size_t CHUNK = 256;
+
+    union Slot {
+        Slot* next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+
+    mutex         lock;
+    vector<Slot*> chunks;
+    size_t        used;         // slots handed out from the newest chunk
+    Slot*         freeList;
+    size_t        live;
+
+    ObjectPool(const ObjectPool&);
+    ObjectPool& operator=(const ObjectPool&);
+
+public:
+    ObjectPool() : used(CHUNK), freeList(NULL), live(0) {}
+
+    ~ObjectPool() {
+        for (size_t i = 0; i < chunks.size(); ++i) delete[] chunks[i];
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+        void* p;
+        {
+            lock_guard<mutex> g(lock);
+            if (freeList) {
+                p = freeList;
+                freeList = freeList->next;
+            } else {
+                if (used == CHUNK) { chunks.push_back(new Slot[CHUNK]); used = 0; }
+                p = &chunks.back()[used++];
+            }
+            ++live;
+        }
+        return new (p) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T* obj) {
+        if (!obj) return;
+        obj->~T();
+        Slot* s = reinterpret_cast<Slot*>(obj);
+        lock_guard<mutex> g(lock);
+        s->next  = freeList;
+        freeList = s;
+        --live;
+    }
+
+    size_t size()       const { return live; }
+    size_t chunkCount() const { return chunks.size(); }
+};
+
+// Epoch-based reclamation. A reader pins the current epoch with a Guard
+// for as long as it uses pointers found in shared structures; pinning
+// is a load, a store and a fence, so reads never wait. A writer that
+// unlinks an object hands it to a Reclaimer instead of freeing it, and
+// it is freed once every thread pinned at the time has let go. Guards
+// nest. A thread's slot is reused by the next new thread once it exits.
+class Epoch {
+public:
+    class Guard {
+    public:
+        Guard()  { enter(); }
+        ~Guard() { leave(); }
+    private:
+        Guard(const Guard&);
+        Guard& operator=(const Guard&);
+    };
+
+    // Close the current epoch (after an unlink); returns its number
+    static uint64_t advance() { return clock().fetch_add(1, memory_order_seq_cst); }
+
+    // Wait until every guard entered before the call has been left (but
+    // the caller's own)
+    static void synchronize() {
+        uint64_t closed = advance();
+        Slot*    self   = &local();
+        while (true) {
+            atomic_thread_fence(memory_order_seq_cst);
+            uint64_t oldest = IDLE;
+            {
+                lock_guard<mutex> g(registryLock());
+                for (size_t i = 0; i < registry().size(); ++i) {
+                    if (registry()[i] != self) oldest = min(oldest, registry()[i]->pinned.load(memory_order_acquire));
+                }
+            }
+            if (oldest > closed) return;
+            this_thread::yield();
+        }
+    }
+
+    // Oldest epoch some thread is still pinned at (UINT64_MAX if none)
+    static uint64_t oldestPinned() {
+        atomic_thread_fence(memory_order_seq_cst);
+        uint64_t oldest = IDLE;
+        lock_guard<mutex> g(registryLock());
+        for (size_t i = 0; i < registry().size(); ++i) {
+            oldest = min(oldest, registry()[i]->pinned.load(memory_order_acquire));
+        }
+        return oldest;
+    }
+
+private:
+    static const uint64_t IDLE = UINT64_MAX;
+
+    struct alignas(64) Slot {
+        atomic<uint64_t> pinned;    // IDLE when outside every guard
+        int              depth;     // owner thread only
+        bool             inUse;     // owned by a live thread (registry lock)
+        Slot() : pinned(IDLE), depth(0), inUse(true) {}
+    };
+
+    struct Owner {
+        Slot* slot;
+        ~Owner() {
+            if (!slot) return;
+            lock_guard<mutex> g(registryLock());
+            slot->inUse = false;
+        }
+    };
+
+    static atomic<uint64_t>& clock() { static atomic<uint64_t> e(1); return e; }
+    static mutex& registryLock() { static mutex m; return m; }
+    static vector<Slot*>& registry() { static vector<Slot*> slots; return slots; }
+
+    static Slot& local() {
+        static thread_local Owner owner = { NULL };
+        if (owner.slot) return *owner.slot;
+        lock_guard<mutex> g(registryLock());
+        for (size_t i = 0; i < registry().size() && !owner.slot; ++i) {
+            if (!registry()[i]->inUse) owner.slot = registry()[i];
+        }
+        if (owner.slot) owner.slot->inUse = true;
+        else {
+            owner.slot = new Slot();
+            registry().push_back(owner.slot);
+        }
+        return *owner.slot;
+    }
+
+    static void enter() {
+        Slot& s = local();
+        if (s.depth++ > 0) return;
+        s.pinned.store(clock().load(memory_order_relaxed), memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);     // pin before reading any pointer
+    }
+
+    static void leave() {
+        Slot& s = local();
+        if (--s.depth == 0) s.pinned.store(IDLE, memory_order_release);
+    }
+};
+
+// Objects unlinked by a writer, freed once no reader can still hold
+// them. Whatever is left when the owner goes away is freed then (the
+// owner guarantees no readers are left).
+class Reclaimer {
+private:
+    struct Retired {
+        uint64_t         epoch;
+        function<void()> free;
+    };
+    mutex          lock;
+    deque<Retired> pending;
+
+public:
+    ~Reclaimer() { drain(); }
+
+    template <typename T>
+    void retire(T* obj) { retire([obj]() { delete obj; }); }
+
+    void retire(function<void()> free) {
+        Retired r = { Epoch::advance(), free };
+        {
+            lock_guard<mutex> g(lock);
+            pending.push_back(r);
+        }
+        collect();
+    }
+
+    // Free everything no reader can reach any more; returns how many
+    size_t collect() {
+        uint64_t oldest = Epoch::oldestPinned();
+        vector<function<void()> > ready;
+        {
+            lock_guard<mutex> g(lock);
+            while (!pending.empty() && pending.front().epoch < oldest) {
+                ready.push_back(pending.front().free);
+                pending.pop_front();
+            }
+        }
+        for (size_t i = 0; i < ready.size(); ++i) ready[i]();
+        return ready.size();
+    }
+
+    // Free everything now; only when no reader is left
+    void drain() {
+        deque<Retired> all;
+        {
+            lock_guard<mutex> g(lock);
+            all.swap(pending);
+        }
+        for (size_t i = 0; i < all.size(); ++i) all[i].free();
+    }
+
+    size_t waiting() {
+        lock_guard<mutex> g(lock);
+        return pending.size();
+    }
+};
+
+// An array of T* changed by one writer at a time and read by any number
+// of threads without locks, under an Epoch::Guard. Slots are atomic, so
+// set() is seen whole or not at all. Appends fill spare capacity and
+// then publish the new size; growing or erasing builds a new block and
+// retires the old one. A View is one block: a consistent list even if
+// the writer moves on meanwhile.
+template <typename T>
+class PublishedArray {
+private:
+    struct Block {
+        size_t         capacity;
+        atomic<size_t> count;
+        atomic<T*>*    items;
+        explicit Block(size_t cap) : capacity(cap), count(0), items(new atomic<T*>[cap]()) {}
+        ~Block() { delete[] items; }
+    };
+
+    atomic<Block*> current;
+    Reclaimer*     reclaimer;       // NULL: old blocks go at once (no concurrent readers)
+
+    PublishedArray(const PublishedArray&);
+    PublishedArray& operator=(const PublishedArray&);
+
+    // New block of capacity cap holding items [0, n) of b, except skip
+    Block* copy(const Block* b, size_t cap, size_t n, size_t skip = SIZE_MAX) const {
+        Block* nb = new Block(cap);
+        size_t k = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (i != skip) nb->items[k++].store(b->items[i].load(memory_order_relaxed), memory_order_relaxed);
+        }
+        nb->count.store(k, memory_order_relaxed);
+        return nb;
+    }
+
+    void publish(Block* b) {
+        Block* old = current.exchange(b, memory_order_acq_rel);
+        if (reclaimer) reclaimer->retire(old);
+        else           delete old;
+    }
+
+public:
+    class View {
+    private:
+        const Block* b;
+        size_t       n;
+    public:
+        explicit View(const Block* block) : b(block), n(block->count.load(memory_order_acquire)) {}
+        size_t size() const { return n; }
+        T* operator[](size_t i) const { return b->items[i].load(memory_order_acquire); }
+    };
+
+    explicit PublishedArray(Reclaimer* r = NULL) : current(new Block(4)), reclaimer(r) {}
+    ~PublishedArray() { delete current.load(); }
+
+    View   view() const { return View(current.load(memory_order_acquire)); }
+    size_t size() const { return current.load(memory_order_acquire)->count.load(memory_order_acquire); }
+
+    // i-th item, or NULL if there is none (any more)
+    T* get(size_t i) const {
+        const Block* b = current.load(memory_order_acquire);
+        return i < b->count.load(memory_order_acquire) ? b->items[i].load(memory_order_acquire) : NULL;
+    }
+
+    // Writer side
+    void set(size_t i, T* item) { current.load(memory_order_relaxed)->items[i].store(item, memory_order_release); }
+
+    void push_back(T* item) {
+        Block* b = current.load(memory_order_relaxed);
+        size_t n = b->count.load(memory_order_relaxed);
+        if (n == b->capacity) {
+            b = copy(b, 2 * n, n);
+            b->items[n].store(item, memory_order_relaxed);
+            b->count.store(n + 1, memory_order_relaxed);
+            publish(b);
+            return;
+        }
+        b->items[n].store(item, memory_order_release);
+        b->count.store(n + 1, memory_order_release);
+    }
+
+    void erase(size_t i) {
+        Block* b = current.load(memory_order_relaxed);
+        size_t n = b->count.load(memory_order_relaxed);
+        if (i < n) publish(copy(b, b->capacity, n, i));
+    }
+
+    // Grow to n items, new ones NULL
+    void resize(size_t n) {
+        Block* b = current.load(memory_order_relaxed);
+        if (n <= b->count.load(memory_order_relaxed)) return;
+        if (n > b->capacity) {
+            publish(b = copy(b, max(n, 2 * b->capacity), b->count.load(memory_order_relaxed)));
+        }
+        b->count.store(n, memory_order_release);
+    }
+
+    void reserve(size_t n) {
+        Block* b = current.load(memory_order_relaxed);
+        if (n > b->capacity) publish(copy(b, n, b->count.load(memory_order_relaxed)));
+    }
+
+    void clear() { publish(new Block(4)); }
+};
+
+// Row/seat coordinates (1-based) of a single seat in a show
+struct Seat {
+    int row;
+    int number;
+    Seat() : row(0), number(0) {}
+    Seat(int r, int n) : row(r), number(n) {}
+};
+
+// When a show runs, parsed once from its free-form date/time text
+enum ScheduleKind {
+    SCHEDULE_TBA,       // no usable date ("TBA", anything unparseable)
+    SCHEDULE_DATED,     // start/end are epoch seconds
+    SCHEDULE_DAILY      // start/end are seconds after local midnight, every day
+};
+
+struct ShowTime {
+    ScheduleKind kind;
+    time_t       start, end;
+    ShowTime() : kind(SCHEDULE_TBA), start(0), end(0) {}
+};
+
+// Read exactly n digits at text[pos]; -1 if they are not all digits
+static int readDigits(const string& text, size_t& pos, int n) {
+    if (pos + n > text.size()) return -1;
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        char ch = text[pos + i];
+        if (ch < '0' || ch > '9') return -1;
+        v = v * 10 + (ch - '0');
+    }
+    pos += n;
+    return v;
+}
+
+// "H:MM" or "HH:MM" -> seconds after midnight, or -1
+static long readClock(const string& text, size_t& pos) {
+    size_t p = pos;
+    int h = readDigits(text, p, 2);
+    if (h < 0) { p = pos; h = readDigits(text, p, 1); }
+    if (h < 0 || h > 23 || p >= text.size() || text[p] != ':') return -1;
+    ++p;
+    int m = readDigits(text, p, 2);
+    if (m < 0 || m > 59) return -1;
+    pos = p;
+    return h * 3600L + m * 60L;
+}
+
+static int daysInMonth(int y, int mo) {
+    static const int days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    bool leap = (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+    return (mo == 2 && leap) ? 29 : days[mo - 1];
+}
+
+// mktime takes a process-wide lock and a season of shows keeps landing
+// on the same few dates, so each thread remembers recent midnights.
+static time_t localEpoch(int y, int mo, int d, long secs) {
+    struct Midnight { int date; time_t at; };
+    static thread_local Midnight recent[64];
+    int date = (y * 100 + mo) * 100 + d;
+    Midnight& m = recent[((uint32_t)date * 2654435761u) >> 26];
+    if (m.date != date) {
+        tm t;
+        memset(&t, 0, sizeof t);
+        t.tm_year  = y - 1900;
+        t.tm_mon   = mo - 1;
+        t.tm_mday  = d;
+        t.tm_isdst = -1;
+        m.at   = mktime(&t);
+        m.date = date;
+    }
+    return m.at + secs;
+}
+
+// localtime shares one buffer across threads; this does not
+static tm localTime(time_t at) {
+    tm t;
+#ifdef _WIN32
+    localtime_s(&t, &at);
+#else
+    localtime_r(&at, &t);
+#endif
+    return t;
+}
+
+// Understands the formats the catalog uses:
+//   "2025-04-14 10:00"      one performance
+//   "2025-05-14"            all day
+//   "2025-02-14 to 02-16"   multi-day (also "to 2025-02-16")
+//   "07:00-11:00"           daily departure (any separator, may pass midnight)
+// Everything else (e.g. "TBA") is SCHEDULE_TBA.
+inline ShowTime parseShowTime(const string& text) {
+    ShowTime st;
+    size_t pos = 0;
+    while (pos < text.size() && isspace((unsigned char)text[pos])) ++pos;
+
+    size_t p = pos;
+    int y = readDigits(text, p, 4);
+    if (y >= 0 && p < text.size() && text[p] == '-') {
+        ++p;
+        int mo = readDigits(text, p, 2);
+        if (mo < 1 || mo > 12 || p >= text.size() || text[p] != '-') return st;
+        ++p;
+        int d = readDigits(text, p, 2);
+        if (d < 1 || d > daysInMonth(y, mo)) return st;
+        while (p < text.size() && text[p] == ' ') ++p;
+        long clock = readClock(text, p);
+        st.kind  = SCHEDULE_DATED;
+        st.start = localEpoch(y, mo, d, clock < 0 ? 0 : clock);
+        st.end   = clock < 0 ? localEpoch(y, mo, d, 86400) - 1 : st.start;
+        while (p < text.size() && text[p] == ' ') ++p;
+        if (text.compare(p, 2, "to") == 0) {
+            p += 2;
+            while (p < text.size() && text[p] == ' ') ++p;
+            size_t q = p;
+            int y2 = readDigits(text, q, 4);
+            if (y2 >= 0 && q < text.size() && text[q] == '-') p = q + 1;
+            else y2 = y;
+            int mo2 = readDigits(text, p, 2);
+            int d2  = (p < text.size() && text[p] == '-') ? (++p, readDigits(text, p, 2)) : -1;
+            if (mo2 >= 1 && mo2 <= 12 && d2 >= 1 && d2 <= daysInMonth(y2, mo2)) {
+                st.end = localEpoch(y2, mo2, d2, 86400) - 1;
+            }
+        }
+        if (st.start == (time_t)-1 || st.end < st.start) st = ShowTime();
+        return st;
+    }
+
+    p = pos;
+    long from = readClock(text, p);
+    if (from < 0) return st;
+    while (p < text.size() && !isdigit((unsigned char)text[p])) ++p;    // "-", en dash, " to "
+    long to = readClock(text, p);
+    st.kind  = SCHEDULE_DAILY;
+    st.start = from;
+    st.end   = to < 0 ? from : (to < from ? to + 86400 : to);
+    return st;
+}
+
+// Lifecycle of a seat: free -> held (awaiting payment) -> sold
+enum SeatState { SEAT_FREE, SEAT_HELD, SEAT_SOLD };
+
+// How to rank blocks of adjacent seats for a group booking. A block
+// costs rowWeight per row away from the preferred row plus centerWeight
+// per seat between its middle and the middle of the row; lowest wins.
+struct SeatPreference {
+    int    row;             // preferred row; 0 means the middle row
+    double rowWeight;
+    double centerWeight;
+    SeatPreference(int r = 0, double rw = 1.0, double cw = 1.0)
+        : row(r), rowWeight(rw), centerWeight(cw) {}
+
+    int homeRow(int rows) const { return (row >= 1 && row <= rows) ? row : (rows + 1) / 2; }
+};
+
+// One seat-map transition: count seats from (row, col) are now in state
+struct SeatChange {
+    uint64_t  version;
+    int       row, col, count;
+    SeatState state;
+};
+
+// LEB128-style unsigned varints for the compact seat-map encodings
+inline void putVarint(string& out, uint64_t v) {
+    while (v >= 0x80) { out += (char)(v | 0x80); v >>= 7; }
+    out += (char)v;
+}
+
+inline bool getVarint(const string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; pos < in.size() && shift < 64; shift += 7) {
+        unsigned char b = (unsigned char)in[pos++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Money is counted in paisa (1/100 PKR) so fares add up exactly
+typedef int64_t Paisa;
+
+inline Paisa paisaFromRupees(double pkr) { return (Paisa)llround(pkr * 100.0); }
+
+// "800" or "812.50": rupees, with paisa only when there are some
+inline string formatRupees(Paisa p) {
+    string out = p < 0 ? "-" : "";
+    uint64_t v = p < 0 ? (uint64_t)-p : (uint64_t)p;
+    out += toString(v / 100);
+    if (v % 100) {
+        out += '.';
+        out += (char)('0' + v % 100 / 10);
+        out += (char)('0' + v % 10);
+    }
+    return out;
+}
+
+// "812.5", "812.50" or "1,200" -> paisa, exactly; false for anything
+// else (negative amounts and fractions of a paisa included)
+inline bool parseRupees(const string& text, Paisa& out) {
+    Paisa v = 0;
+    int   digits = 0, decimals = -1;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char ch = text[i];
+        if (ch >= '0' && ch <= '9') {
+            if (decimals == 2 || v > (Paisa)1e15) return false;
+            v = v * 10 + (ch - '0');
+            ++digits;
+            if (decimals >= 0) ++decimals;
+        }
+        else if (ch == '.' && decimals < 0 && digits > 0) decimals = 0;
+        else if (ch == ',' && decimals < 0 && digits > 0) continue;
+        else return false;
+    }
+    if (digits == 0) return false;
+    for (int i = max(decimals, 0); i < 2; ++i) v *= 10;
+    out = v;
+    return true;
+}
+
+// The wall clock a fare is quoted at: now, plus the local midnight
+// before it that daily departures are timed from. Each thread works out
+// midnight once a day.
+struct PriceClock {
+    time_t now;
+    time_t midnight;
+
+    static PriceClock current() {
+        static thread_local time_t cachedMidnight = 0;
+        PriceClock c;
+        c.now = time(NULL);
+        if (c.now < cachedMidnight || c.now >= cachedMidnight + 86400) {
+            tm local = localTime(c.now);
+            cachedMidnight = c.now - (local.tm_hour * 3600L + local.tm_min * 60L + local.tm_sec);
+        }
+        c.midnight = cachedMidnight;
+        return c;
+    }
+};
+
+// Demand pricing. A seat's fare is its show's base price scaled, in
+// basis points (10000 = x1), by
+//   - its zone: zones split the rows front to back by percentage, and
+//     each row behind the first row of its zone takes rowStepBp off;
+//   - occupancy: the share of the show's seats already held or sold;
+//   - time to showtime: whole hours until the show starts.
+// A step applies from its threshold up to the next step's. compile()
+// flattens the occupancy and time steps into tables by percent and by
+// hour, and each venue layout flattens the zones into a factor per row
+// (VenueLayout::rowFactors), so a quote is three array lookups and a
+// few multiplies.
+struct PricingPolicy {
+    struct Step {
+        int from;
+        int bp;
+    };
+    static const int MAX_HOURS = 168;   // a week or more out prices the same
+
+    vector<Step> zones;         // from: first row, as % of the rows from the front
+    int          rowStepBp;
+    vector<Step> occupancy;     // from: % of seats taken
+    vector<Step> hoursLeft;     // from: hours until the start (past starts count as 0)
+    Paisa        roundTo;       // fares round to a multiple of this
+
+    int surgeBp[101];
+    int decayBp[MAX_HOURS + 1];
+
+    // No adjustments: every seat costs the base price
+    PricingPolicy() : rowStepBp(0), roundTo(1) { compile(); }
+
+    // Front rows dearer, surge as the show fills, last-minute discounts
+    static PricingPolicy standard() {
+        static const Step zoneSteps[]  = { { 0, 12000 }, { 30, 10000 }, { 70, 8500 } };
+        static const Step surgeSteps[] = { { 0, 10000 }, { 50, 11000 }, { 75, 12500 }, { 90, 15000 } };
+        static const Step timeSteps[]  = { { 0, 8000 }, { 3, 9000 }, { 24, 10000 } };
+        PricingPolicy p;
+        p.zones.assign(zoneSteps, zoneSteps + 3);
+        p.rowStepBp = 200;
+        p.occupancy.assign(surgeSteps, surgeSteps + 4);
+        p.hoursLeft.assign(timeSteps, timeSteps + 3);
+        p.roundTo = 100;
+        p.compile();
+        return p;
+    }
+
+    // bp of the step x falls in (x1 before the first step)
+    static int stepAt(const vector<Step>& steps, int x, int* index = NULL) {
+        int bp = 10000, at = -1;
+        for (size_t i = 0; i < steps.size() && steps[i].from <= x; ++i) { bp = steps[i].bp; at = (int)i; }
+        if (index) *index = at;
+        return bp;
+    }
+
+    // Call after changing the steps
+    void compile() {
+        for (int pct = 0; pct <= 100; ++pct) surgeBp[pct] = stepAt(occupancy, pct);
+        for (int h = 0; h <= MAX_HOURS; ++h) decayBp[h] = stepAt(hoursLeft, h);
+    }
+
+    // Basis points of the base price for row r of rows (its zone, less
+    // the row steps behind the zone's first row)
+    int rowBp(int r, int rows) const {
+        int zone = -1;
+        int bp   = stepAt(zones, (r - 1) * 100 / rows, &zone);
+        if (zone >= 0) {
+            int first = (zones[zone].from * rows + 99) / 100 + 1;     // first row of the zone
+            bp = max(0, bp - rowStepBp * (r - first));
+        }
+        return bp;
+    }
+
+    // Base price scaled for row r of rows (before occupancy and time)
+    Paisa rowFare(Paisa base, int r, int rows) const { return base * rowBp(r, rows) / 10000; }
+
+    // Whether o prices rows the same (same zones and row step)
+    bool sameRows(const PricingPolicy& o) const {
+        if (rowStepBp != o.rowStepBp || zones.size() != o.zones.size()) return false;
+        for (size_t i = 0; i < zones.size(); ++i) {
+            if (zones[i].from != o.zones[i].from || zones[i].bp != o.zones[i].bp) return false;
+        }
+        return true;
+    }
+
+    // Fare for a seat whose row fare is fare, with taken of seats gone and
+    // secondsLeft until the start (LLONG_MAX if the date is not known)
+    Paisa quote(Paisa fare, int taken, int seats, long long secondsLeft) const {
+        int pct = seats > 0 ? (int)((int64_t)max(taken, 0) * 100 / seats) : 0;
+        long long h = secondsLeft <= 0 ? 0 : secondsLeft / 3600;
+        int   decay = decayBp[min(h, (long long)MAX_HOURS)];
+        Paisa v     = fare * surgeBp[min(pct, 100)];
+        Paisa unit  = (Paisa)100000000 * roundTo;
+        // v * decay / unit, rounded, without forming v * decay (which
+        // overflows from a base fare of about PKR 4.6 crore)
+        return ((v / unit) * decay + ((v % unit) * decay + unit / 2) / unit) * roundTo;
+    }
+};
+
+// What pricing makes of a show's base price in one row: fare =
+// (base * bp / 10000 * percent + 50) / 100, the zone's basis points
+// then the seat class percent
+struct RowFactor {
+    int32_t bp;
+    int32_t percent;
+
+    Paisa fare(Paisa base) const { return (base * bp / 10000 * percent + 50) / 100; }
+};
+
+// A show's descriptive text, dateTime parsed once. Never changed after
+// it is published: an edit publishes a new label and retires the old
+// one, so readers under an Epoch::Guard never see a half-written title.
+struct ShowLabel {
+    string   title, dateTime;
+    ShowTime when;
+    ShowLabel(const string& t, const string& dt, const ShowTime& st) : title(t), dateTime(dt), when(st) {}
+};
+
+// Seat block: one contiguous run of 64-bit words laid out as
+//   [free bits][sold bits][int32 free seats per row]
+// with one bit per seat, row-major. A set free bit means the seat is
+// free, a set sold bit means it is paid for, neither means held.
+struct SeatBlock {
+    static const int WORD_BITS = 64;
+
+    // Words of free (or sold) bits for the given dimensions
+    static size_t bitWords(int r, int c) { return ((size_t)r * c + WORD_BITS - 1) / WORD_BITS; }
+
+    // Size in words of a whole block
+    static size_t words(int r, int c) { return 2 * bitWords(r, c) + ((size_t)r + 1) / 2; }
+
+    // Fill a block with every seat free
+    static void init(uint64_t* b, int r, int c) {
+        size_t n = bitWords(r, c);
+        for (size_t w = 0; w < n; ++w) {
+            b[w] = ~(uint64_t)0;
+            b[n + w] = 0;
+        }
+        // clear the padding bits past the last seat
+        int tail = (int)(((size_t)r * c) % WORD_BITS);
+        if (tail != 0) b[n - 1] = ((uint64_t)1 << tail) - 1;
+        b[words(r, c) - 1] = 0;
+        int32_t* counts = (int32_t*)(b + 2 * n);
+        for (int i = 0; i < r; ++i) counts[i] = c;
+    }
+
+    // Mark one seat sold; false if it was not free
+    static bool sell(uint64_t* b, int r, int c, int row, int col) {
+        if (row < 1 || row > r || col < 1 || col > c) return false;
+        size_t n   = bitWords(r, c);
+        size_t idx = (size_t)(row-1) * c + (col-1);
+        uint64_t bit = (uint64_t)1 << (idx % WORD_BITS);
+        if (!(b[idx / WORD_BITS] & bit)) return false;
+        b[idx / WORD_BITS]     &= ~bit;
+        b[n + idx / WORD_BITS] |= bit;
+        --((int32_t*)(b + 2 * n))[row-1];
+        return true;
+    }
+};
+
+// A venue's seating, shared by every show held there: its size, aisles
+// and other places with no seat to sell, wheelchair spaces, and seat
+// classes priced in percent of the base fare. Never changed once built.
+// Shows start out reading its pristine seat block (every sellable seat
+// free) and copy it on their first hold, so a show nobody has booked
+// owns no seat state at all. Fares are shared the same way: one table
+// of row factors per way of pricing rows, whatever the base price.
+//
+// Spec: clauses separated by ';', the size first:
+//   ROWSxCOLS                     8x17
+//   aisle C[,C...]                columns with no seats
+//   blocked R:C[-C2][,...]        seats (or runs) that are not sold
+//   accessible R:C[-C2][,...]     wheelchair spaces
+//   class R1-R2 NAME PCT%         rows R1..R2 cost PCT% of the base fare
+//                                 (NAME is one word)
+class VenueLayout {
+public:
+    struct SeatClass {
+        string name;
+        int    fromRow, toRow;
+        int    percent;
+    };
+
+private:
+    int    id;                  // 0 for a plain ROWSxCOLS layout
+    int    rows, cols, capacity;
+    string spec;                // canonical: clauses trimmed, joined by "; "
+    vector<uint64_t>  blocked, accessible;  // a bit per seat, row-major
+    vector<SeatClass> classes;
+    vector<int>       rowPercent;           // fare percent per row
+    vector<uint64_t>  pristine;             // seat block with nothing sold
+
+    // Row factors per pricing policy, newest first. Added with a CAS and
+    // only freed with the layout; policies that price rows alike share
+    // an entry, so there are as many as there are distinct zonings.
+    struct Factors {
+        PricingPolicy     policy;
+        vector<RowFactor> rows;
+        Factors*          next;
+    };
+    mutable atomic<Factors*> factors;
+
+    friend class LayoutLibrary;     // numbers defined layouts
+
+    VenueLayout() : id(0), rows(0), cols(0), capacity(0), factors(NULL) {}
+
+    static bool bit(const vector<uint64_t>& bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; }
+    static void setBit(vector<uint64_t>& bits, size_t i)    { bits[i / 64] |= (uint64_t)1 << (i % 64); }
+
+    // "R:C" or "R:C1-C2", marking each seat in bits
+    bool seatRun(const string& text, vector<uint64_t>& bits) {
+        int r = 0, c1 = 0, c2 = 0;
+        char sep = 0;
+        int got = sscanf(text.c_str(), "%d:%d%c%d", &r, &c1, &sep, &c2);
+        if (got == 2) c2 = c1;
+        else if (got != 4 || sep != '-') return false;
+        if (r < 1 || r > rows || c1 < 1 || c2 < c1 || c2 > cols) return false;
+        for (int c = c1; c <= c2; ++c) setBit(bits, (size_t)(r-1) * cols + (c-1));
+        return true;
+    }
+
+    static vector<string> split(const string& text, char sep) {
+        vector<string> out;
+        size_t pos = 0;
+        while (pos <= text.size()) {
+            size_t end = text.find(sep, pos);
+            if (end == string::npos) end = text.size();
+            size_t a = text.find_first_not_of(" \t", pos);
+            size_t b = text.find_last_not_of(" \t", end == 0 ? 0 : end - 1);
+            if (a != string::npos && a < end && b != string::npos && b >= a) out.push_back(text.substr(a, b - a + 1));
+            pos = end + 1;
+        }
+        return out;
+    }
+
+    // Apply one clause after the size; false (with error) if malformed
+    bool clause(const string& text, string& error) {
+        size_t sp = text.find(' ');
+        string word = text.substr(0, sp), rest = sp == string::npos ? "" : text.substr(sp + 1);
+        if (word == "aisle") {
+            vector<string> cs = split(rest, ',');
+            if (cs.empty()) { error = "aisle needs a column"; return false; }
+            for (size_t i = 0; i < cs.size(); ++i) {
+                int c = atoi(cs[i].c_str());
+                if (c < 1 || c > cols) { error = "aisle column out of range: " + cs[i]; return false; }
+                for (int r = 1; r <= rows; ++r) setBit(blocked, (size_t)(r-1) * cols + (c-1));
+            }
+            return true;
+        }
+        if (word == "blocked" || word == "accessible") {
+            vector<string> runs = split(rest, ',');
+            if (runs.empty()) { error = word + " needs seats"; return false; }
+            for (size_t i = 0; i < runs.size(); ++i) {
+                if (!seatRun(runs[i], word == "blocked" ? blocked : accessible)) {
+                    error = "bad seat " + runs[i] + " (want row:col or row:col-col)";
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (word == "class") {
+            SeatClass sc;
+            char name[64] = "";
+            if (sscanf(rest.c_str(), "%d-%d %63s %d%%", &sc.fromRow, &sc.toRow, name, &sc.percent) != 4
+                || sc.fromRow < 1 || sc.toRow < sc.fromRow || sc.toRow > rows || sc.percent < 1) {
+                error = "bad class '" + rest + "' (want R1-R2 NAME PCT%)";
+                return false;
+            }
+            sc.name = name;
+            for (int r = sc.fromRow; r <= sc.toRow; ++r) rowPercent[r-1] = sc.percent;
+            classes.push_back(sc);
+            return true;
+        }
+        error = "unknown clause '" + word + "'";
+        return false;
+    }
+
+    void finish() {
+        pristine.assign(SeatBlock::words(rows, cols), 0);
+        SeatBlock::init(&pristine[0], rows, cols);
+        capacity = rows * cols;
+        for (int r = 1; r <= rows; ++r) {
+            for (int c = 1; c <= cols; ++c) {
+                if (isBlocked(r, c) && SeatBlock::sell(&pristine[0], rows, cols, r, c)) --capacity;
+            }
+        }
+    }
+
+public:
+    // Plain rows x cols, every seat sold at the row's policy fare
+    VenueLayout(int r, int c) : id(0), rows(r), cols(c), factors(NULL) {
+        spec = toString(r) + "x" + toString(c);
+        blocked.assign(SeatBlock::bitWords(r, c), 0);
+        accessible = blocked;
+        rowPercent.assign(r, 100);
+        finish();
+    }
+
+    ~VenueLayout() {
+        for (Factors* f = factors.load(); f; ) {
+            Factors* next = f->next;
+            delete f;
+            f = next;
+        }
+    }
+
+    // Build from a spec; NULL (with error) if it does not parse
+    static VenueLayout* parse(const string& text, string& error) {
+        vector<string> parts = split(text, ';');
+        int r = 0, c = 0;
+        char x = 0, extra = 0;
+        if (parts.empty() || sscanf(parts[0].c_str(), "%d%c%d%c", &r, &x, &c, &extra) != 3
+            || (x != 'x' && x != 'X') || r < 1 || c < 1 || r > 1000 || c > 1000) {
+            error = "a layout starts with its size, ROWSxCOLS (each 1-1000)";
+            return NULL;
+        }
+        VenueLayout* l = new VenueLayout();
+        l->rows = r; l->cols = c;
+        l->blocked.assign(SeatBlock::bitWords(r, c), 0);
+        l->accessible = l->blocked;
+        l->rowPercent.assign(r, 100);
+        l->spec = toString(r) + "x" + toString(c);
+        for (size_t i = 1; i < parts.size(); ++i) {
+            if (!l->clause(parts[i], error)) { delete l; return NULL; }
+            l->spec += "; " + parts[i];
+        }
+        l->finish();
+        if (l->capacity == 0) { error = "no seats left to sell"; delete l; return NULL; }
+        return l;
+    }
+
+    int    getId()       const { return id; }
+    int    getRows()     const { return rows; }
+    int    getCols()     const { return cols; }
+    int    getCapacity() const { return capacity; }
+    const string& getSpec() const { return spec; }
+    const vector<SeatClass>& seatClasses() const { return classes; }
+    bool   hasAccessible() const {
+        for (size_t i = 0; i < accessible.size(); ++i) if (accessible[i]) return true;
+        return false;
+    }
+
+    // Class of row r ("" if it has none)
+    string className(int r) const {
+        for (size_t i = 0; i < classes.size(); ++i) {
+            if (r >= classes[i].fromRow && r <= classes[i].toRow) return classes[i].name;
+        }
+        return "";
+    }
+
+    bool isBlocked(int r, int c) const    { return bit(blocked, (size_t)(r-1) * cols + (c-1)); }
+    bool isAccessible(int r, int c) const { return bit(accessible, (size_t)(r-1) * cols + (c-1)); }
+
+    // Seat block every show here starts from (read-only)
+    const uint64_t* pristineBlock() const { return &pristine[0]; }
+
+    // Factor per row under policy (see RowFactor), made once and shared
+    // by every show here priced alike, whatever its base price
+    const RowFactor* rowFactors(const PricingPolicy& policy) const {
+        Factors* head = factors.load(memory_order_acquire);
+        for (Factors* f = head; f; f = f->next) {
+            if (f->policy.sameRows(policy)) return &f->rows[0];
+        }
+        Factors* made = new Factors();
+        made->policy = policy;
+        made->rows.resize(rows);
+        for (int r = 1; r <= rows; ++r) {
+            made->rows[r-1].bp      = policy.rowBp(r, rows);
+            made->rows[r-1].percent = rowPercent[r-1];
+        }
+        // entries only ever go on the front: recheck what was added since
+        made->next = head;
+        while (!factors.compare_exchange_weak(made->next, made, memory_order_acq_rel)) {
+            for (Factors* f = made->next; f != head; f = f->next) {
+                if (f->policy.sameRows(policy)) { delete made; return &f->rows[0]; }
+            }
+            head = made->next;
+        }
+        return &made->rows[0];
+    }
+};
+
+// The layouts one engine's shows use. Plain ROWSxCOLS layouts are made
+// on first use; layouts defined from a spec are numbered from 1 so the
+// journal and snapshots can refer to them. Layouts live as long as the
+// library, so shows hold plain pointers to them.
+class LayoutLibrary {
+private:
+    mutable mutex        lock;
+    unordered_map<uint64_t, VenueLayout*> plainBySize;
+    unordered_map<string, int>            idBySpec;
+    vector<VenueLayout*> defined;       // id - 1
+
+    LayoutLibrary(const LayoutLibrary&);
+    LayoutLibrary& operator=(const LayoutLibrary&);
+
+public:
+    LayoutLibrary() {}
+    ~LayoutLibrary() {
+        for (unordered_map<uint64_t, VenueLayout*>::iterator it = plainBySize.begin(); it != plainBySize.end(); ++it) {
+            delete it->second;
+        }
+        for (size_t i = 0; i < defined.size(); ++i) delete defined[i];
+    }
+
+    const VenueLayout* plain(int rows, int cols) {
+        lock_guard<mutex> g(lock);
+        VenueLayout*& l = plainBySize[(uint64_t)(uint32_t)rows << 32 | (uint32_t)cols];
+        if (!l) l = new VenueLayout(rows, cols);
+        return l;
+    }
+
+    // Layout for spec, defined now if it is new (as number `want` when
+    // replaying). NULL with error if the spec is invalid or `want` is
+    // taken by another layout. *added says whether it was new.
+    const VenueLayout* define(const string& spec, string& error, bool* added = NULL, int want = 0) {
+        if (added) *added = false;
+        VenueLayout* parsed = VenueLayout::parse(spec, error);
+        if (!parsed) return NULL;
+        lock_guard<mutex> g(lock);
+        unordered_map<string, int>::iterator it = idBySpec.find(parsed->getSpec());
+        if (it != idBySpec.end()) {
+            delete parsed;
+            if (want && want != it->second) { error = "layout defined twice"; return NULL; }
+            return defined[it->second - 1];
+        }
+        int id = want ? want : (int)defined.size() + 1;
+        if ((size_t)id <= defined.size() && defined[id - 1]) {
+            delete parsed;
+            error = "layout number " + toString(id) + " is taken";
+            return NULL;
+        }
+        parsed->id = id;
+        if ((size_t)id > defined.size()) defined.resize(id, NULL);
+        defined[id - 1] = parsed;
+        idBySpec[parsed->getSpec()] = id;
+        if (added) *added = true;
+        return parsed;
+    }
+
+    // Defined layout by number, or NULL
+    const VenueLayout* get(int id) const {
+        lock_guard<mutex> g(lock);
+        return id >= 1 && (size_t)id <= defined.size() ? defined[id - 1] : NULL;
+    }
+
+    // Every defined layout, by number
+    vector<const VenueLayout*> all() const {
+        lock_guard<mutex> g(lock);
+        vector<const VenueLayout*> out;
+        for (size_t i = 0; i < defined.size(); ++i) if (defined[i]) out.push_back(defined[i]);
+        return out;
+    }
+};
+
+// Represents an individual show (concert, movie or bus trip)
+class Show {
+private:
+    int    id;          // stable id, survives restarts via the journal
+    atomic<const ShowLabel*> label;     // NULL while the text is still in a mapped image
+    const char* titleRef;
+    const char* dateRef;
+    uint32_t    titleLen, dateLen;
+    ShowTime    mappedWhen;
+    atomic<int> slot;       // position within its category
+    int         categoryId; // the category it was added to
+    atomic<bool> removed;   // unlinked from the catalog, waiting to be freed
+    int rows, cols;
+    const VenueLayout* layout;  // NULL: plain rows x cols with a private block
+    int   capacity;             // seats that can be sold
+    Paisa price;        // base ticket price
+
+    // Compiled pricing: the policy's tables and a factor per row (NULL:
+    // every seat costs the base price). The factors belong to the
+    // layout, or to the show if it has none.
+    const PricingPolicy* pricing;
+    const RowFactor*     rowFactors;
+
+    // Seat block (see SeatBlock). Words are claimed with CAS so many
+    // threads can book the same show. The block is read-only at first,
+    // either the layout's pristine block or one in a mapped snapshot
+    // image, and becomes a private copy on the first write
+    // (copy-on-write).
+    const uint64_t*   mappedBlock;
+    atomic<uint64_t*> ownBlock;
+    size_t            wordCount;
+    atomic<int>       freeCount;  // free seats left in the whole show
+
+    // Per-row hint of the longest run of free seats, packed as
+    // (version << 32 | run). The hint never drops below the real run:
+    // releases bump the version and raise it, holds and searches lower it
+    // with a CAS that fails if a release got in between. Built on first
+    // use so mapped shows do not touch their seat pages at startup.
+    atomic<atomic<uint64_t>*> runHints;
+
+    // Every seat transition bumps the version. Once somebody asks for
+    // changes, the transitions are also kept in a ring of the last
+    // CHANGE_LOG_SIZE versions so a poller can fetch just what moved.
+    // Slot v % size holds version v when its stamp says v; the stamp is
+    // zeroed while the slot is rewritten (a seqlock), so readers never
+    // block writers.
+    static const size_t CHANGE_LOG_SIZE = 1024;
+    struct ChangeLog {
+        atomic<uint64_t> base;      // versions after this one are logged
+        atomic<uint64_t> stamp[CHANGE_LOG_SIZE];
+        atomic<uint64_t> data[CHANGE_LOG_SIZE];     // seat | count << 32 | state << 48
+    };
+    atomic<uint64_t>   seatVersion;
+    atomic<ChangeLog*> changeLog;
+
+    static const int      WORD_BITS = SeatBlock::WORD_BITS;
+    static const uint64_t RUN_MASK  = 0xffffffffu;
+
+    int seatIndex(int r, int c) const { return (r-1) * cols + (c-1); }
+
+    const uint64_t* block() const {
+        uint64_t* own = ownBlock.load(memory_order_acquire);
+        return own ? own : mappedBlock;
+    }
+    atomic<uint64_t>* freeBits() const {
+        return (atomic<uint64_t>*)const_cast<uint64_t*>(block());
+    }
+    atomic<uint64_t>* soldBits() const { return freeBits() + wordCount; }
+    atomic<int>*      rowFree()  const { return (atomic<int>*)(freeBits() + 2 * wordCount); }
+
+    // Bits [from, to) that fall inside from's word
+    static uint64_t wordMask(size_t from, size_t to) {
+        int lo = (int)(from % WORD_BITS);
+        int n  = (int)min((size_t)(WORD_BITS - lo), to - from);
+        return (n == WORD_BITS ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1)) << lo;
+    }
+
+    // First seat in [from, to) that is free (or not free), else to
+    size_t scanSeats(size_t from, size_t to, bool wantFree) const {
+        atomic<uint64_t>* bits = freeBits();
+        while (from < to) {
+            size_t   w    = from / WORD_BITS;
+            uint64_t word = bits[w].load(memory_order_acquire);
+            if (!wantFree) word = ~word;
+            word &= ~(uint64_t)0 << (from % WORD_BITS);
+            if (word) return min(to, w * WORD_BITS + countTrailingZeros(word));
+            from = (w + 1) * WORD_BITS;
+        }
+        return to;
+    }
+
+    // Start of the run of free seats that ends just before from (>= lo)
+    size_t freeRunStart(size_t from, size_t lo) const {
+        atomic<uint64_t>* bits = freeBits();
+        while (from > lo) {
+            size_t   w     = (from - 1) / WORD_BITS;
+            int      top   = (int)((from - 1) % WORD_BITS);
+            uint64_t taken = ~bits[w].load(memory_order_acquire)
+                           & (~(uint64_t)0 >> (WORD_BITS - 1 - top));
+            if (taken) return max(lo, w * WORD_BITS + WORD_BITS - countLeadingZeros(taken));
+            from = w * WORD_BITS;
+        }
+        return lo;
+    }
+
+    int longestFreeRun(int r) const {
+        size_t pos = seatIndex(r, 1), end = pos + cols;
+        int best = 0;
+        while (end - pos > (size_t)best) {
+            size_t s = scanSeats(pos, end, true);
+            if (s == end) break;
+            pos = scanSeats(s, end, false);
+            best = max(best, (int)(pos - s));
+        }
+        return best;
+    }
+
+    atomic<uint64_t>* hints() {
+        atomic<uint64_t>* h = runHints.load(memory_order_acquire);
+        if (h) return h;
+        h = new atomic<uint64_t>[rows];
+        for (int i = 0; i < rows; ++i) h[i].store((uint64_t)cols, memory_order_relaxed);
+        atomic<uint64_t>* expected = NULL;
+        if (!runHints.compare_exchange_strong(expected, h, memory_order_acq_rel)) {
+            delete[] h;
+            return expected;
+        }
+        return h;
+    }
+
+    // Lower a row's hint to its real longest run unless a release raced us
+    void lowerHint(int r, uint64_t seen, int longest) {
+        if ((uint64_t)longest < (seen & RUN_MASK)) {
+            runHints.load(memory_order_acquire)[r-1].compare_exchange_strong(
+                seen, (seen & ~RUN_MASK) | (uint64_t)longest, memory_order_acq_rel);
+        }
+    }
+
+    // Seats [from, to) of row r were just taken
+    void seatsTaken(int r, size_t from, size_t to) {
+        atomic<uint64_t>* h = runHints.load(memory_order_acquire);
+        if (!h) return;
+        uint64_t seen = h[r-1].load(memory_order_acquire);
+        size_t rowStart = seatIndex(r, 1), rowEnd = rowStart + cols;
+        // only splitting a longest run can shorten the row's longest run
+        size_t runLen = scanSeats(to, rowEnd, false) - freeRunStart(from, rowStart);
+        if (runLen >= (seen & RUN_MASK)) lowerHint(r, seen, longestFreeRun(r));
+    }
+
+    // Seats [from, to) of row r were just freed
+    void seatsFreed(int r, size_t from, size_t to) {
+        atomic<uint64_t>* h = runHints.load(memory_order_acquire);
+        if (!h) return;
+        size_t rowStart = seatIndex(r, 1), rowEnd = rowStart + cols;
+        uint64_t run = scanSeats(to, rowEnd, false) - freeRunStart(from, rowStart);
+        uint64_t cur = h[r-1].load(memory_order_acquire), next;
+        do {
+            next = (((cur >> 32) + 1) << 32) | max(cur & RUN_MASK, run);
+        } while (!h[r-1].compare_exchange_weak(cur, next, memory_order_acq_rel));
+    }
+
+    // Seats [from, to) just moved to state st
+    void seatsChanged(size_t from, size_t to, SeatState st) {
+        uint64_t v = seatVersion.fetch_add(1) + 1;
+        ChangeLog* log = changeLog.load();
+        if (!log) return;
+        size_t i = v % CHANGE_LOG_SIZE;
+        log->stamp[i].store(0);
+        log->data[i].store((uint64_t)from | (uint64_t)(to - from) << 32 | (uint64_t)st << 48);
+        log->stamp[i].store(v);
+    }
+
+    ChangeLog* changes() {
+        ChangeLog* log = changeLog.load();
+        if (log) return log;
+        log = new ChangeLog();
+        for (size_t i = 0; i < CHANGE_LOG_SIZE; ++i) log->stamp[i].store(0);
+        // nothing is known to be logged until the log is published
+        log->base.store(UINT64_MAX);
+        ChangeLog* expected = NULL;
+        if (!changeLog.compare_exchange_strong(expected, log)) {
+            delete log;
+            return expected;
+        }
+        // writers that bumped the version before seeing the log are not
+        // in it, so only what comes after the version seen now is
+        log->base.store(seatVersion.load());
+        return log;
+    }
+
+    // Make sure the block is private before a write
+    void makeWritable() {
+        if (ownBlock.load(memory_order_acquire)) return;
+        uint64_t* copy = new uint64_t[SeatBlock::words(rows, cols)];
+        memcpy(copy, mappedBlock, SeatBlock::words(rows, cols) * sizeof(uint64_t));
+        uint64_t* expected = NULL;
+        if (!ownBlock.compare_exchange_strong(expected, copy, memory_order_acq_rel)) {
+            delete[] copy;      // another writer got there first
+        }
+    }
+
+public:
+    Show(int i, const string& t, const string& dt, int r, int c, Paisa p)
+        : Show(i, t, dt, parseShowTime(dt), r, c, p) {}
+
+    // dt already parsed into st (bulk import parses off the main thread)
+    Show(int i, const string& t, const string& dt, const ShowTime& st, int r, int c, Paisa p)
+        : id(i), label(new ShowLabel(t, dt, st)), titleRef(NULL), dateRef(NULL),
+          titleLen(0), dateLen(0), slot(0), categoryId(0), removed(false),
+          rows(r), cols(c), layout(NULL), capacity(r * c), price(p), pricing(NULL), rowFactors(NULL),
+          mappedBlock(NULL), ownBlock(NULL), wordCount(SeatBlock::bitWords(r, c)),
+          freeCount(r * c), runHints(NULL), seatVersion(0), changeLog(NULL)
+    {
+        uint64_t* b = new uint64_t[SeatBlock::words(rows, cols)];
+        SeatBlock::init(b, rows, cols);
+        ownBlock.store(b, memory_order_release);
+    }
+
+    // Show held in a venue layout: reads the layout's pristine block
+    // until its first hold
+    Show(int i, const string& t, const string& dt, const ShowTime& st, const VenueLayout* l, Paisa p)
+        : id(i), label(new ShowLabel(t, dt, st)), titleRef(NULL), dateRef(NULL),
+          titleLen(0), dateLen(0), slot(0), categoryId(0), removed(false),
+          rows(l->getRows()), cols(l->getCols()), layout(l), capacity(l->getCapacity()),
+          price(p), pricing(NULL), rowFactors(NULL),
+          mappedBlock(l->pristineBlock()), ownBlock(NULL), wordCount(SeatBlock::bitWords(rows, cols)),
+          freeCount(l->getCapacity()), runHints(NULL), seatVersion(0), changeLog(NULL) {}
+
+    // Show whose text and seat block live in a mapped snapshot image
+    // (l may be NULL for a plain rows x cols show)
+    Show(int i, const char* t, uint32_t tLen, const char* dt, uint32_t dtLen,
+         const ShowTime& st, int r, int c, const VenueLayout* l, Paisa p,
+         const uint64_t* mapped, int freeSeats)
+        : id(i), label(NULL), titleRef(t), dateRef(dt), titleLen(tLen), dateLen(dtLen),
+          mappedWhen(st), slot(0), categoryId(0), removed(false), rows(r), cols(c), layout(l),
+          capacity(l ? l->getCapacity() : r * c), price(p), pricing(NULL), rowFactors(NULL),
+          mappedBlock(mapped), ownBlock(NULL), wordCount(SeatBlock::bitWords(r, c)),
+          freeCount(freeSeats), runHints(NULL), seatVersion(0), changeLog(NULL) {}
+
+    ~Show() {
+        delete label.load();
+        delete[] ownBlock.load();
+        delete[] runHints.load();
+        delete changeLog.load();
+        if (!layout) delete[] rowFactors;
+    }
+
+    int    getId()       const { return id;      }
+    string getTitle() const {
+        const ShowLabel* l = label.load(memory_order_acquire);
+        return l ? l->title : string(titleRef, titleLen);
+    }
+    string getDateTime() const {
+        const ShowLabel* l = label.load(memory_order_acquire);
+        return l ? l->dateTime : string(dateRef, dateLen);
+    }
+    const ShowTime& getShowTime() const {
+        const ShowLabel* l = label.load(memory_order_acquire);
+        return l ? l->when : mappedWhen;
+    }
+    Paisa  getPrice()    const { return price;   }
+    int    getSlot()     const { return slot.load(memory_order_relaxed); }
+    void   setSlot(int i)      { slot.store(i, memory_order_relaxed); }
+    int    getCategoryId() const { return categoryId; }
+    void   setCategoryId(int c)  { categoryId = c; }
+    bool   isRemoved()   const { return removed.load(memory_order_acquire); }
+    void   markRemoved()       { removed.store(true, memory_order_release); }
+    int    getRows()     const { return rows;    }
+    int    getCols()     const { return cols;    }
+    int    getCapacity() const { return capacity; }
+    const VenueLayout* getLayout() const { return layout; }
+
+    // No seat here (aisle or blocked) / a wheelchair space
+    bool isBlocked(int r, int c) const    { return layout && validSeat(r, c) && layout->isBlocked(r, c); }
+    bool isAccessible(int r, int c) const { return layout && validSeat(r, c) && layout->isAccessible(r, c); }
+
+    // Owns a copy of its seat block (i.e. has been booked, or has no layout)
+    bool ownsSeats() const { return ownBlock.load(memory_order_acquire) != NULL; }
+
+    // Price seats by policy (which must outlive the show); NULL for the
+    // base price everywhere. Not safe while the show is being quoted.
+    void setPricing(const PricingPolicy* policy) {
+        if (!layout) delete[] rowFactors;
+        rowFactors = NULL;
+        pricing    = policy;
+        if (!policy) return;
+        if (layout) {
+            rowFactors = layout->rowFactors(*policy);
+            return;
+        }
+        RowFactor* own = new RowFactor[rows];
+        for (int r = 1; r <= rows; ++r) {
+            own[r-1].bp      = policy->rowBp(r, rows);
+            own[r-1].percent = 100;
+        }
+        rowFactors = own;
+    }
+
+    // Seconds from the clock to the next start (negative once a dated
+    // show has begun, LLONG_MAX if it has no date)
+    long long secondsToStart(const PriceClock& clock) const {
+        const ShowTime& when = getShowTime();
+        if (when.kind == SCHEDULE_DATED) return (long long)(when.start - clock.now);
+        if (when.kind != SCHEDULE_DAILY) return LLONG_MAX;
+        long long next = (long long)(clock.midnight + when.start - clock.now);
+        return next < 0 ? next + 86400 : next;
+    }
+
+    // Current fare for one seat in row r. ownSeats are seats the buyer
+    // has already taken, so a hold is not priced against itself.
+    Paisa quote(int r, const PriceClock& clock, int ownSeats = 0) const {
+        if (!pricing || r < 1 || r > rows) return price;
+        return pricing->quote(rowFactors[r-1].fare(price), capacity - seatsLeft() - ownSeats,
+                              capacity, secondsToStart(clock));
+    }
+
+    // Publish new text; the old label goes to r (or is freed at once
+    // when there is no reclaimer, i.e. no concurrent readers)
+    void relabel(const string& t, const string& dt, Reclaimer* r) {
+        const ShowLabel* old = label.exchange(new ShowLabel(t, dt, parseShowTime(dt)), memory_order_acq_rel);
+        if (!old)   return;
+        if (r)      r->retire(const_cast<ShowLabel*>(old));
+        else        delete old;
+    }
+
+    // Seats left in the whole show / in one row
+    int seatsLeft() const { return freeCount.load(memory_order_relaxed); }
+    int seatsLeftInRow(int r) const {
+        if (r < 1 || r > rows) return 0;
+        return rowFree()[r-1].load(memory_order_relaxed);
+    }
+
+    bool validSeat(int r, int c) const {
+        return r >= 1 && r <= rows && c >= 1 && c <= cols;
+    }
+
+    SeatState seatState(int r, int c) const {
+        int idx = seatIndex(r, c);
+        uint64_t bit = (uint64_t)1 << (idx % WORD_BITS);
+        if (freeBits()[idx / WORD_BITS].load(memory_order_acquire) & bit) return SEAT_FREE;
+        if (soldBits()[idx / WORD_BITS].load(memory_order_acquire) & bit) return SEAT_SOLD;
+        return SEAT_HELD;
+    }
+
+    // Find the first free seat at or after (r, c) in row-major order.
+    // Returns false if every remaining seat is booked.
+    bool findNextFreeSeat(int r, int c, Seat& out) const {
+        if (seatsLeft() == 0) return false;
+        if (r < 1) { r = 1; c = 1; }
+        if (c < 1) c = 1;
+        if (r > rows || (r == rows && c > cols)) return false;
+        atomic<uint64_t>* bits = freeBits();
+        int    idx  = seatIndex(r, c);
+        size_t w    = idx / WORD_BITS;
+        uint64_t word = bits[w].load(memory_order_acquire)
+                      & (~(uint64_t)0 << (idx % WORD_BITS));
+        while (word == 0) {
+            if (++w == wordCount) return false;
+            word = bits[w].load(memory_order_acquire);
+        }
+        int found = (int)(w * WORD_BITS) + countTrailingZeros(word);
+        out = Seat(found / cols + 1, found % cols + 1);
+        return true;
+    }
+
+    // Print all unbooked seats, a row per line with its current fare
+    void displayAvailableSeats() const {
+        cout << "Available seats for \"" << getTitle() 
+             << "\" on " << getDateTime()
+             << " (" << seatsLeft() << " left)\n";
+        PriceClock clock = PriceClock::current();
+        Seat s(1, 1);
+        bool more = findNextFreeSeat(1, 1, s);
+        for (int r = 1; r <= rows; ++r) {
+            string cls = layout ? layout->className(r) : "";
+            cout << "Row " << r << (cls.empty() ? "" : " " + cls)
+                 << " [PKR " << formatRupees(quote(r, clock)) << "]: ";
+            for (; more && s.row == r; more = findNextFreeSeat(s.row, s.number + 1, s)) {
+                cout << "[" << s.row << "," << s.number << "]"      // (r, cols+1) wraps
+                     << (isAccessible(s.row, s.number) ? "* " : " ");
+            }
+            cout << "\n";
+        }
+        if (layout && layout->hasAccessible()) cout << "* wheelchair space\n";
+    }
+
+    // Seat-map version: bumped by every hold, sale and release
+    uint64_t getSeatVersion() const { return seatVersion.load(); }
+
+    // Transitions after version `since`, oldest first; upTo gets the
+    // version they bring a map to. False if `since` is older than the
+    // change log (or unknown): fetch a full map instead. The log starts
+    // on the first call, so older versions always need the full map.
+    bool changesSince(uint64_t since, vector<SeatChange>& out, uint64_t& upTo) {
+        ChangeLog* log = changes();
+        uint64_t now = seatVersion.load();
+        if (since < log->base || since > now || now - since > (uint64_t)CHANGE_LOG_SIZE) return false;
+        upTo = since;
+        for (uint64_t v = since + 1; v <= now; ++v) {
+            size_t   i     = v % CHANGE_LOG_SIZE;
+            uint64_t first = log->stamp[i].load();
+            if (first > v) return false;        // already overwritten
+            if (first != v) break;              // writer still busy: stop here
+            uint64_t d = log->data[i].load();
+            if (log->stamp[i].load() != v) return false;
+            size_t from = (size_t)(d & 0xffffffffu);
+            SeatChange ch;
+            ch.version = v;
+            ch.row     = (int)(from / cols) + 1;
+            ch.col     = (int)(from % cols) + 1;
+            ch.count   = (int)((d >> 32) & 0xffff);
+            ch.state   = (SeatState)((d >> 48) & 3);
+            out.push_back(ch);
+            upTo = v;
+        }
+        return true;
+    }
+
+    // Whole seat map: 'F', version, rows, cols, then runs of seats in one
+    // state as varint(length << 2 | state). A map too scattered for runs
+    // to pay off goes as 'P' instead, four 2-bit states per byte. Returns
+    // the version; anything newer comes through changesSince().
+    uint64_t encodeSeatMap(string& out) const {
+        uint64_t version = seatVersion.load();  // before the bits, see seatsChanged
+        size_t   start   = out.size();
+        out += 'F';
+        putVarint(out, version);
+        putVarint(out, (uint64_t)rows);
+        putVarint(out, (uint64_t)cols);
+        size_t header = out.size() - start;
+        atomic<uint64_t>* freeWords = freeBits();
+        atomic<uint64_t>* soldWords = soldBits();
+        size_t total = (size_t)rows * cols, run = 0;
+        int    runState = -1;
+        for (size_t w = 0; w < wordCount; ++w) {
+            uint64_t f  = freeWords[w].load(memory_order_acquire);
+            uint64_t sd = soldWords[w].load(memory_order_acquire);
+            size_t   n  = min((size_t)WORD_BITS, total - w * WORD_BITS);
+            // whole word in one state: extend the run in one step
+            int whole = f == ~(uint64_t)0 ? SEAT_FREE : (f | sd) == 0 ? SEAT_HELD
+                      : (f == 0 && sd == ~(uint64_t)0) ? SEAT_SOLD : -1;
+            if (whole >= 0 && n == (size_t)WORD_BITS) {
+                if (whole != runState) {
+                    if (run) putVarint(out, (uint64_t)run << 2 | (uint64_t)runState);
+                    runState = whole; run = 0;
+                }
+                run += n;
+                continue;
+            }
+            for (size_t b = 0; b < n; ++b) {
+                int st = (f >> b) & 1 ? SEAT_FREE : (sd >> b) & 1 ? SEAT_SOLD : SEAT_HELD;
+                if (st != runState) {
+                    if (run) putVarint(out, (uint64_t)run << 2 | (uint64_t)runState);
+                    runState = st; run = 0;
+                }
+                ++run;
+            }
+        }
+        if (run) putVarint(out, (uint64_t)run << 2 | (uint64_t)runState);
+        if (out.size() - start - header > (total + 3) / 4) {
+            out.resize(start + header);
+            out[start] = 'P';
+            out.resize(start + header + (total + 3) / 4, '\0');
+            char* packed = &out[start + header];
+            for (size_t w = 0; w < wordCount; ++w) {
+                uint64_t f  = freeWords[w].load(memory_order_acquire);
+                uint64_t sd = soldWords[w].load(memory_order_acquire);
+                size_t   n  = min((size_t)WORD_BITS, total - w * WORD_BITS);
+                for (size_t b = 0; b < n; ++b) {
+                    int    st = (f >> b) & 1 ? SEAT_FREE : (sd >> b) & 1 ? SEAT_SOLD : SEAT_HELD;
+                    size_t i  = w * WORD_BITS + b;
+                    packed[i / 4] |= (char)(st << (2 * (i % 4)));
+                }
+            }
+        }
+        return version;
+    }
+
+    // What a client showing version `since` needs to catch up: a delta
+    // ('D', version, change count, then varint(seat), varint(count << 2 |
+    // state) per change) or, when `since` is too old, a full map.
+    // Returns the version the update brings the client to.
+    uint64_t encodeSeatUpdate(uint64_t since, string& out) {
+        vector<SeatChange> delta;
+        uint64_t upTo = 0;
+        if (!changesSince(since, delta, upTo)) return encodeSeatMap(out);
+        out += 'D';
+        putVarint(out, upTo);
+        putVarint(out, delta.size());
+        for (size_t i = 0; i < delta.size(); ++i) {
+            putVarint(out, (uint64_t)seatIndex(delta[i].row, delta[i].col));
+            putVarint(out, (uint64_t)delta[i].count << 2 | (uint64_t)delta[i].state);
+        }
+        return upTo;
+    }
+
+    // Try to hold a free seat; return false if out of range or taken.
+    // Safe to call from many threads: exactly one caller wins each seat.
+    bool holdSeat(int r, int c) { return holdBlock(r, c, 1); }
+
+    // Mark a held seat as paid for
+    void confirmSeat(int r, int c) { confirmBlock(r, c, 1); }
+
+    // Return a held seat to the free pool
+    void releaseSeat(int r, int c) { releaseBlock(r, c, 1); }
+
+    // Hold n adjacent seats (r, c) .. (r, c+n-1), all or nothing. Words are
+    // claimed in order; if one is no longer free the earlier ones are
+    // given back, so a failed attempt leaves nothing held.
+    bool holdBlock(int r, int c, int n) {
+        if (n < 1 || !validSeat(r, c) || c + n - 1 > cols) return false;
+        size_t from = seatIndex(r, c), to = from + n;
+        uint64_t first = wordMask(from, to);
+        if ((freeBits()[from / WORD_BITS].load(memory_order_acquire) & first) != first) return false;
+        makeWritable();
+        atomic<uint64_t>* bits = freeBits();
+        for (size_t i = from; i < to; i = (i / WORD_BITS + 1) * WORD_BITS) {
+            uint64_t mask = wordMask(i, to);
+            atomic<uint64_t>& word = bits[i / WORD_BITS];
+            uint64_t cur = word.load(memory_order_relaxed);
+            do {
+                if ((cur & mask) != mask) {
+                    for (size_t j = from; j < i; j = (j / WORD_BITS + 1) * WORD_BITS) {
+                        bits[j / WORD_BITS].fetch_or(wordMask(j, i), memory_order_acq_rel);
+                    }
+                    if (i > from) {
+                        seatsFreed(r, from, i);
+                        seatsChanged(from, i, SEAT_FREE);   // a map read meanwhile saw them held
+                    }
+                    return false;
+                }
+            } while (!word.compare_exchange_weak(cur, cur & ~mask,
+                                                 memory_order_acq_rel,
+                                                 memory_order_relaxed));
+        }
+        rowFree()[r-1].fetch_sub(n, memory_order_relaxed);
+        freeCount.fetch_sub(n, memory_order_relaxed);
+        seatsTaken(r, from, to);
+        seatsChanged(from, to, SEAT_HELD);
+        return true;
+    }
+
+    // Mark a held block as paid for
+    void confirmBlock(int r, int c, int n) {
+        atomic<uint64_t>* sold = soldBits();
+        size_t from = seatIndex(r, c), to = from + n;
+        for (size_t i = from; i < to; i = (i / WORD_BITS + 1) * WORD_BITS) {
+            sold[i / WORD_BITS].fetch_or(wordMask(i, to), memory_order_acq_rel);
+        }
+        seatsChanged(from, to, SEAT_SOLD);
+    }
+
+    // Return a held block to the free pool
+    void releaseBlock(int r, int c, int n) {
+        atomic<uint64_t>* bits = freeBits();
+        size_t from = seatIndex(r, c), to = from + n;
+        for (size_t i = from; i < to; i = (i / WORD_BITS + 1) * WORD_BITS) {
+            bits[i / WORD_BITS].fetch_or(wordMask(i, to), memory_order_acq_rel);
+        }
+        rowFree()[r-1].fetch_add(n, memory_order_relaxed);
+        freeCount.fetch_add(n, memory_order_relaxed);
+        seatsFreed(r, from, to);
+        seatsChanged(from, to, SEAT_FREE);
+    }
+
+    // Cost of the block of n seats starting at (r, c); lower is better
+    double blockCost(const SeatPreference& pref, int r, int c, int n) const {
+        double centre = (cols + 1) / 2.0;
+        return pref.rowWeight * abs(r - pref.homeRow(rows))
+             + pref.centerWeight * fabs(c + (n - 1) / 2.0 - centre);
+    }
+
+    // Best block of n adjacent free seats. Rows are visited outwards from
+    // the preferred row and skipped on their free count or run hint, and
+    // the walk stops once the row distance alone costs more than the best
+    // block so far; within a row only the free runs are visited.
+    bool findBestBlock(int n, const SeatPreference& pref, Seat& out) {
+        if (n < 1 || n > cols || seatsLeft() < n) return false;
+        atomic<uint64_t>* h = hints();
+        int    home   = pref.homeRow(rows);
+        double centre = (cols + 1) / 2.0;
+        double best   = -1;
+        for (int d = 0; d < rows; ++d) {
+            if (best >= 0 && pref.rowWeight * d >= best) break;
+            for (int side = -1; side <= 1; side += 2) {
+                int r = home + side * d;
+                if ((d == 0 && side > 0) || r < 1 || r > rows) continue;
+                if (rowFree()[r-1].load(memory_order_relaxed) < n) continue;
+                uint64_t seen = h[r-1].load(memory_order_acquire);
+                if ((int)(seen & RUN_MASK) < n) continue;
+
+                size_t rowStart = seatIndex(r, 1), pos = rowStart, end = rowStart + cols;
+                int longest = 0;
+                while (pos < end) {
+                    size_t s = scanSeats(pos, end, true);
+                    if (s == end) break;
+                    pos = scanSeats(s, end, false);
+                    int len = (int)(pos - s);
+                    longest = max(longest, len);
+                    if (len < n) continue;
+                    // the start inside this run that puts the block nearest the centre
+                    int lo = (int)(s - rowStart) + 1, hi = lo + len - n;
+                    int c  = (int)floor(centre - (n - 1) / 2.0 + 0.5);
+                    c = max(lo, min(hi, c));
+                    double cost = blockCost(pref, r, c, n);
+                    if (best < 0 || cost < best) { best = cost; out = Seat(r, c); }
+                }
+                lowerHint(r, seen, longest);
+            }
+        }
+        return best >= 0;
+    }
+
+    // Find and hold the best block; retries if another thread takes it first
+    bool holdBestBlock(int n, const SeatPreference& pref, Seat& first) {
+        while (findBestBlock(n, pref, first)) {
+            if (holdBlock(first.row, first.number, n)) return true;
+        }
+        return false;
+    }
+
+    // Find, hold and confirm the best block of n seats in one step
+    bool bookBestBlock(int n, const SeatPreference& pref, Seat& first) {
+        if (!holdBestBlock(n, pref, first)) return false;
+        confirmBlock(first.row, first.number, n);
+        return true;
+    }
+
+    // Give a sold seat back to the free pool (its booking was cancelled)
+    void refundSeat(int r, int c) { refundSeats(r, c, 1); }
+
+    // Free n sold seats from (r, c) in one pass over the bitmaps
+    void refundSeats(int r, int c, int n) {
+        makeWritable();
+        atomic<uint64_t>* sold = soldBits();
+        size_t from = seatIndex(r, c), to = from + n;
+        for (size_t i = from; i < to; i = (i / WORD_BITS + 1) * WORD_BITS) {
+            sold[i / WORD_BITS].fetch_and(~wordMask(i, to), memory_order_acq_rel);
+        }
+        releaseBlock(r, c, n);
+    }
+
+    // Hold and confirm in one step; return false if out of range or taken
+    bool bookSeat(int r, int c) {
+        ScopedTimer timer(T_BOOK_SEAT);
+        if (!holdSeat(r, c)) return false;
+        confirmSeat(r, c);
+        return true;
+    }
+};
+
+
+
+
+// Client-side copy of a show's seat map, kept current from the updates
+// made by Show::encodeSeatUpdate()
+class SeatMapReplica {
+private:
+    vector<uint8_t> states;     // SeatState per seat, row-major
+    uint64_t        version;
+    int             rows, cols;
+
+public:
+    SeatMapReplica() : version(0), rows(0), cols(0) {}
+
+    uint64_t getVersion() const { return version; }
+    bool     ready()      const { return rows > 0; }
+    SeatState state(int r, int c) const { return (SeatState)states[(size_t)(r-1) * cols + (c-1)]; }
+
+    // Apply a full map or a delta; false if the update is malformed
+    bool apply(const string& in) {
+        size_t   pos = 1;
+        uint64_t v;
+        if (in.empty() || !getVarint(in, pos, v)) return false;
+        if (in[0] == 'F' || in[0] == 'P') {
+            uint64_t r, c;
+            if (!getVarint(in, pos, r) || !getVarint(in, pos, c) || r * c == 0) return false;
+            size_t total = (size_t)(r * c), at = 0;
+            states.assign(total, (uint8_t)SEAT_FREE);
+            if (in[0] == 'P') {
+                if (in.size() - pos != (total + 3) / 4) return false;
+                for (; at < total; ++at) {
+                    states[at] = (uint8_t)(((unsigned char)in[pos + at / 4] >> (2 * (at % 4))) & 3);
+                }
+            }
+            while (pos < in.size() && in[0] == 'F') {
+                uint64_t packed;
+                if (!getVarint(in, pos, packed) || at + (packed >> 2) > total) return false;
+                memset(&states[0] + at, (int)(packed & 3), (size_t)(packed >> 2));
+                at += (size_t)(packed >> 2);
+            }
+            if (at != total) return false;
+            rows = (int)r; cols = (int)c;
+        }
+        else if (in[0] == 'D') {
+            uint64_t n;
+            if (!ready() || !getVarint(in, pos, n)) return false;
+            for (uint64_t i = 0; i < n; ++i) {
+                uint64_t seat, packed;
+                if (!getVarint(in, pos, seat) || !getVarint(in, pos, packed)) return false;
+                if (seat + (packed >> 2) > states.size()) return false;
+                memset(&states[0] + seat, (int)(packed & 3), (size_t)(packed >> 2));
+            }
+        }
+        else return false;
+        version = v;
+        return true;
+    }
+};
+
+
+
+
+// Time-sorted index of shows for "what runs between T1 and T2" queries:
+// a binary search followed by a contiguous scan. Inserts in time order
+// are appends; out-of-order inserts wait in a small pending run that is
+// sorted and merged on the next query. Daily departures are kept apart
+// and matched by time of day.
+class ScheduleIndex {
+private:
+    struct Entry {
+        time_t start;
+        Show*  show;
+        bool operator<(const Entry& o) const {
+            return start != o.start ? start < o.start : show < o.show;
+        }
+    };
+
+    mutable mutex         lock;
+    mutable vector<Entry> sorted;
+    mutable vector<Entry> pending;
+    vector<Show*>         daily;
+
+    void mergePending() const {
+        if (pending.empty()) return;
+        sort(pending.begin(), pending.end());
+        size_t mid = sorted.size();
+        sorted.insert(sorted.end(), pending.begin(), pending.end());
+        inplace_merge(sorted.begin(), sorted.begin() + mid, sorted.end());
+        pending.clear();
+    }
+
+    static bool dailyRunsIn(const ShowTime& st, time_t from, time_t to) {
+        if (to - from >= 86400) return true;
+        tm local = localTime(from);
+        long secs = local.tm_hour * 3600L + local.tm_min * 60L + local.tm_sec;
+        time_t next = from + ((st.start - secs) % 86400 + 86400) % 86400;
+        return next < to;
+    }
+
+public:
+    void add(Show* s) {
+        const ShowTime& st = s->getShowTime();
+        lock_guard<mutex> g(lock);
+        if (st.kind == SCHEDULE_DAILY) { daily.push_back(s); return; }
+        if (st.kind != SCHEDULE_DATED) return;
+        Entry e = { st.start, s };
+        if (pending.empty() && (sorted.empty() || !(e < sorted.back()))) sorted.push_back(e);
+        else pending.push_back(e);
+    }
+
+    // Remove using the schedule the show was added with
+    void remove(Show* s, const ShowTime& st) {
+        lock_guard<mutex> g(lock);
+        if (st.kind == SCHEDULE_DAILY) {
+            daily.erase(std::remove(daily.begin(), daily.end(), s), daily.end());
+            return;
+        }
+        if (st.kind != SCHEDULE_DATED) return;
+        mergePending();
+        Entry e = { st.start, s };
+        vector<Entry>::iterator it = lower_bound(sorted.begin(), sorted.end(), e);
+        if (it != sorted.end() && it->show == s) sorted.erase(it);
+    }
+
+    void clear() {
+        lock_guard<mutex> g(lock);
+        sorted.clear(); pending.clear(); daily.clear();
+    }
+
+    // Shows starting in [from, to), in start order, daily departures last
+    void between(time_t from, time_t to, vector<Show*>& out) const {
+        lock_guard<mutex> g(lock);
+        mergePending();
+        Entry key = { from, NULL };
+        for (vector<Entry>::const_iterator it = lower_bound(sorted.begin(), sorted.end(), key);
+             it != sorted.end() && it->start < to; ++it) {
+            out.push_back(it->show);
+        }
+        for (size_t i = 0; i < daily.size(); ++i) {
+            if (dailyRunsIn(daily[i]->getShowTime(), from, to)) out.push_back(daily[i]);
+        }
+    }
+
+    size_t size() const {
+        lock_guard<mutex> g(lock);
+        return sorted.size() + pending.size() + daily.size();
+    }
+};
+
+
+
+
+// One search result: a show (by id) or a category (by id)
+struct SearchHit {
+    bool isCategory;
+    int  id;
+};
+
+// Inverted index over show titles and category names with type-ahead.
+// Text is split into words, lower-cased and folded so that common
+// spellings of the same Roman Urdu word meet ("Noor"/"Nur",
+// "Ayyar"/"Ayar", "Qasim"/"Kasim"); the word as written is indexed too,
+// so a half-typed word still finds it. Urdu script is kept as words
+// with the Arabic-keyboard letter forms mapped to the Urdu ones and the
+// optional vowel marks dropped. Each word has a sorted posting list of
+// documents (show ids, categories tagged with the top bit). Words also
+// live in a byte trie whose nodes remember the most frequent words
+// below them, so completing a prefix never walks the subtree.
+class SearchIndex {
+private:
+    static const uint32_t CATEGORY_DOC = 0x80000000u;
+    static const int      TOP = 8;      // completions kept per trie node
+    static const int      NARROW = 16;  // a prefix with at most this many words is
+                                        // searched as their union
+
+    struct Term {
+        string           text;
+        vector<uint32_t> docs;          // sorted
+        int              node;          // trie node where the word ends
+    };
+
+    struct Node {
+        vector<pair<unsigned char, int> > edges;    // sorted by byte
+        int parent;
+        int term;                   // word ending here, or -1
+        int top[TOP];               // most frequent words in this subtree
+        int topCount;
+        int words;                  // words in this subtree
+        Node() : parent(-1), term(-1), topCount(0), words(0) { memset(top, 0, sizeof top); }
+    };
+
+    mutable mutex                 lock;
+    vector<Term>                  terms;
+    unordered_map<string, int>    termIds;
+    vector<Node>                  nodes;
+
+    // Forward index, for checking prefixes and for removal: the word ids
+    // of each document sit in one arena, as (offset << 16 | count) per
+    // document. Re-indexing appends, and the arena is compacted once
+    // more than half of it is stale.
+    vector<int>      arena;
+    vector<uint64_t> showSpans;         // by show id
+    vector<uint64_t> categorySpans;     // by category id
+    size_t           stale;
+
+    // Append one code point as UTF-8
+    static void putUtf8(string& out, uint32_t cp) {
+        if (cp < 0x80)       out += (char)cp;
+        else if (cp < 0x800) { out += (char)(0xC0 | cp >> 6); out += (char)(0x80 | (cp & 0x3F)); }
+        else {
+            out += (char)(0xE0 | cp >> 12);
+            out += (char)(0x80 | ((cp >> 6) & 0x3F));
+            out += (char)(0x80 | (cp & 0x3F));
+        }
+    }
+
+    // Next code point from UTF-8 text; invalid bytes come back as 0xFFFD
+    static uint32_t nextCodePoint(const string& s, size_t& i) {
+        unsigned char c = (unsigned char)s[i++];
+        if (c < 0x80) return c;
+        int extra = (c >> 5) == 6 ? 1 : (c >> 4) == 14 ? 2 : 0;
+        if (extra == 0 || i + extra > s.size()) return 0xFFFD;
+        uint32_t cp = c & (extra == 1 ? 0x1F : 0x0F);
+        for (int k = 0; k < extra; ++k) {
+            unsigned char b = (unsigned char)s[i];
+            if ((b >> 6) != 2) return 0xFFFD;
+            cp = cp << 6 | (b & 0x3F);
+            ++i;
+        }
+        return cp;
+    }
+
+    static bool arabicLetter(uint32_t cp) {
+        return (cp >= 0x0620 && cp <= 0x064A) || (cp >= 0x0660 && cp <= 0x0669)
+            || (cp >= 0x0671 && cp <= 0x06D3) || (cp >= 0x06F0 && cp <= 0x06F9)
+            || (cp >= 0x0750 && cp <= 0x077F);
+    }
+
+    // Roman Urdu spelling folds on a lower-case Latin word (or on the
+    // start of one, which keeps a final 'y')
+    static string foldLatin(const string& w, bool whole = true) {
+        string out;
+        for (size_t i = 0; i < w.size(); ++i) {
+            char c = w[i];
+            if (c == 'q') c = 'k';
+            if (i + 1 < w.size() && w[i+1] == c && (c == 'e' || c == 'o')) {
+                out += c == 'e' ? 'i' : 'u';    // ee -> i, oo -> u
+                ++i;
+                continue;
+            }
+            if (!out.empty() && out[out.size()-1] == c && !isdigit((unsigned char)c)) continue;
+            out += c;
+        }
+        if (whole && out.size() > 1 && out[out.size()-1] == 'y') out[out.size()-1] = 'i';
+        return out;
+    }
+
+    static void flushWord(string& w, vector<string>& words, vector<string>* raw) {
+        bool latin = (unsigned char)w[0] < 0x80;
+        words.push_back(latin ? foldLatin(w) : w);
+        if (raw) raw->push_back(w);
+        w.clear();
+    }
+
+    // Next trie node for byte b below node n (created if asked)
+    int child(int n, unsigned char b, bool create) {
+        vector<pair<unsigned char, int> >& e = nodes[n].edges;
+        vector<pair<unsigned char, int> >::iterator it =
+            lower_bound(e.begin(), e.end(), make_pair(b, INT_MIN));
+        if (it != e.end() && it->first == b) return it->second;
+        if (!create) return -1;
+        int idx = (int)nodes.size();
+        it = e.insert(it, make_pair(b, idx));   // before push_back: e is in nodes
+        nodes.push_back(Node());
+        nodes.back().parent = n;
+        return idx;
+    }
+
+    int findNode(const string& prefix) const {
+        int n = 0;
+        for (size_t i = 0; i < prefix.size() && n >= 0; ++i) {
+            const vector<pair<unsigned char, int> >& e = nodes[n].edges;
+            vector<pair<unsigned char, int> >::const_iterator it =
+                lower_bound(e.begin(), e.end(), make_pair((unsigned char)prefix[i], INT_MIN));
+            n = (it != e.end() && it->first == (unsigned char)prefix[i]) ? it->second : -1;
+        }
+        return n;
+    }
+
+    bool ranksBefore(int a, int b) const {
+        size_t da = terms[a].docs.size(), db = terms[b].docs.size();
+        return da != db ? da > db : a < b;
+    }
+
+    // A word just gained a document: move it up the top lists on its path
+    void promote(int t) {
+        for (int n = terms[t].node; n >= 0; n = nodes[n].parent) {
+            Node& node = nodes[n];
+            int pos = 0;
+            while (pos < node.topCount && node.top[pos] != t) ++pos;
+            if (pos == node.topCount) {
+                if (node.topCount < TOP) ++node.topCount;
+                else if (!ranksBefore(t, node.top[TOP-1])) continue;
+                pos = node.topCount - 1;
+            }
+            while (pos > 0 && ranksBefore(t, node.top[pos-1])) {
+                node.top[pos] = node.top[pos-1];
+                --pos;
+            }
+            node.top[pos] = t;
+        }
+    }
+
+    // A word just lost a document: rebuild the top lists on its path from
+    // the children's (a word can drop out and another one take its place)
+    void demote(int t) {
+        for (int n = terms[t].node; n >= 0; n = nodes[n].parent) {
+            Node& node = nodes[n];
+            int pool[TOP * 2];
+            int count = 0;
+            if (node.term >= 0 && !terms[node.term].docs.empty()) pool[count++] = node.term;
+            node.topCount = count;
+            node.top[0]   = count ? pool[0] : 0;
+            for (size_t e = 0; e < node.edges.size(); ++e) {
+                const Node& c = nodes[node.edges[e].second];
+                // merge the child's list into ours, keeping the best TOP
+                int merged = 0;
+                int i = 0, j = 0;
+                while (merged < TOP && (i < node.topCount || j < c.topCount)) {
+                    bool mine = j == c.topCount || (i < node.topCount && ranksBefore(node.top[i], c.top[j]));
+                    pool[merged++] = mine ? node.top[i++] : c.top[j++];
+                }
+                memcpy(node.top, pool, merged * sizeof(int));
+                node.topCount = merged;
+            }
+        }
+    }
+
+    uint64_t& span(uint32_t doc) {
+        vector<uint64_t>& spans = (doc & CATEGORY_DOC) ? categorySpans : showSpans;
+        size_t i = doc & ~CATEGORY_DOC;
+        if (i >= spans.size()) spans.resize(i + 1, 0);
+        return spans[i];
+    }
+
+    uint64_t spanOf(uint32_t doc) const {
+        const vector<uint64_t>& spans = (doc & CATEGORY_DOC) ? categorySpans : showSpans;
+        size_t i = doc & ~CATEGORY_DOC;
+        return i < spans.size() ? spans[i] : 0;
+    }
+
+    int wordId(const string& w) {
+        unordered_map<string, int>::iterator it = termIds.find(w);
+        if (it != termIds.end()) return it->second;
+        int n = 0;
+        for (size_t i = 0; i < w.size(); ++i) n = child(n, (unsigned char)w[i], true);
+        for (int up = n; up >= 0; up = nodes[up].parent) ++nodes[up].words;
+        int t = (int)terms.size();
+        Term term;
+        term.text = w;
+        term.node = n;
+        terms.push_back(term);
+        nodes[n].term = t;
+        termIds[w] = t;
+        return t;
+    }
+
+    void addDoc(uint32_t doc, const string& text) {
+        lock_guard<mutex> g(lock);
+        removeDoc(doc);
+        vector<string> raw;
+        vector<string> words = tokenize(text, &raw);
+        for (size_t i = 0; i < raw.size(); ++i) {
+            if (raw[i] != words[i]) words.push_back(raw[i]);
+        }
+        uint64_t start = arena.size();
+        for (size_t i = 0; i < words.size() && i < 0xffff; ++i) {
+            int t = wordId(words[i]);
+            vector<uint32_t>& d = terms[t].docs;
+            if (d.empty() || d.back() < doc) d.push_back(doc);
+            else {
+                vector<uint32_t>::iterator at = lower_bound(d.begin(), d.end(), doc);
+                if (*at == doc) continue;       // repeated word
+                d.insert(at, doc);
+            }
+            arena.push_back(t);
+            promote(t);
+        }
+        span(doc) = start << 16 | (arena.size() - start);
+    }
+
+    // Drop a document (lock held)
+    void removeDoc(uint32_t doc) {
+        uint64_t& sp = span(doc);
+        size_t from = (size_t)(sp >> 16), count = (size_t)(sp & 0xffff);
+        for (size_t k = 0; k < count; ++k) {
+            int t = arena[from + k];
+            vector<uint32_t>& d = terms[t].docs;
+            vector<uint32_t>::iterator at = lower_bound(d.begin(), d.end(), doc);
+            if (at != d.end() && *at == doc) d.erase(at);
+            demote(t);
+        }
+        sp = 0;
+        stale += count;
+        if (stale > 1024 && stale * 2 > arena.size()) compact();
+    }
+
+    void compact() {
+        vector<int> fresh;
+        fresh.reserve(arena.size() - stale);
+        for (int pass = 0; pass < 2; ++pass) {
+            vector<uint64_t>& spans = pass == 0 ? showSpans : categorySpans;
+            for (size_t i = 0; i < spans.size(); ++i) {
+                size_t from = (size_t)(spans[i] >> 16), count = (size_t)(spans[i] & 0xffff);
+                uint64_t start = fresh.size();
+                fresh.insert(fresh.end(), arena.begin() + from, arena.begin() + from + count);
+                spans[i] = count ? (start << 16 | count) : 0;
+            }
+        }
+        arena.swap(fresh);
+        stale = 0;
+    }
+
+    // A partly typed word: as written and folded
+    struct Prefix {
+        string raw, folded;
+    };
+
+    // Does some word of doc start with the prefix?
+    bool hasPrefix(uint32_t doc, const Prefix& p) const {
+        uint64_t sp = spanOf(doc);
+        size_t from = (size_t)(sp >> 16), count = (size_t)(sp & 0xffff);
+        for (size_t k = 0; k < count; ++k) {
+            const string& w = terms[arena[from + k]].text;
+            if (w.compare(0, p.raw.size(), p.raw) == 0 || w.compare(0, p.folded.size(), p.folded) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Every word below node n with documents, unless there are more than max
+    bool collectWords(int n, size_t max, vector<int>& out) const {
+        if (n < 0) return true;
+        if (nodes[n].words > (int)max) return false;
+        int t = nodes[n].term;
+        if (t >= 0 && !terms[t].docs.empty() && find(out.begin(), out.end(), t) == out.end()) {
+            out.push_back(t);
+        }
+        for (size_t e = 0; e < nodes[n].edges.size(); ++e) {
+            if (!collectWords(nodes[n].edges[e].second, max, out)) return false;
+        }
+        return true;
+    }
+
+    // First position at or after pos whose doc is >= target (galloping)
+    static size_t seek(const vector<uint32_t>& d, size_t pos, uint32_t target) {
+        size_t step = 1, hi = pos;
+        while (hi < d.size() && d[hi] < target) { pos = hi + 1; hi += step; step <<= 1; }
+        return lower_bound(d.begin() + pos, d.begin() + min(hi + 1, d.size()), target) - d.begin();
+    }
+
+    bool prefixesMatch(uint32_t doc, const vector<Prefix>& prefixes) const {
+        for (size_t p = 0; p < prefixes.size(); ++p) {
+            if (!hasPrefix(doc, prefixes[p])) return false;
+        }
+        return true;
+    }
+
+    // Docs in [lo, hi) that are in some list of every group and have
+    // every (wide) prefix, in order, appended to out until it holds
+    // limit. A leapfrog join: each group in turn jumps to the first doc
+    // it has at or after the current candidate.
+    void intersect(const vector<vector<int> >& groups, const vector<Prefix>& prefixes,
+                   uint64_t lo, uint64_t hi, size_t limit, vector<uint32_t>& out) const {
+        vector<vector<size_t> > pos(groups.size());
+        for (size_t g = 0; g < groups.size(); ++g) pos[g].assign(groups[g].size(), 0);
+        uint64_t doc = lo;
+        while (out.size() < limit && doc < hi) {
+            bool aligned = true;
+            for (size_t g = 0; g < groups.size() && aligned; ++g) {
+                uint64_t next = hi;
+                for (size_t w = 0; w < groups[g].size(); ++w) {
+                    const vector<uint32_t>& d = terms[groups[g][w]].docs;
+                    pos[g][w] = seek(d, pos[g][w], (uint32_t)doc);
+                    if (pos[g][w] < d.size()) next = min(next, (uint64_t)d[pos[g][w]]);
+                }
+                if (next >= hi) return;
+                if (next > doc) { doc = next; aligned = false; }
+            }
+            if (!aligned) continue;
+            if (prefixesMatch((uint32_t)doc, prefixes)) out.push_back((uint32_t)doc);
+            ++doc;
+        }
+    }
+
+public:
+    SearchIndex() : stale(0) { clear(); }
+
+    void clear() {
+        lock_guard<mutex> g(lock);
+        terms.clear();
+        termIds.clear();
+        nodes.clear();
+        nodes.push_back(Node());     // the root
+        arena.clear();
+        showSpans.clear();
+        categorySpans.clear();
+        stale = 0;
+    }
+
+    // Searchable words of a text, in order (duplicates kept); *raw, if
+    // given, gets each word as written (lower-cased, not folded)
+    static vector<string> tokenize(const string& text, vector<string>* raw = NULL) {
+        vector<string> words;
+        string latin, urdu;
+        size_t i = 0;
+        while (true) {
+            uint32_t cp = i < text.size() ? nextCodePoint(text, i) : 0;
+            if (cp < 0x80 && isalnum((int)cp)) {
+                latin += (char)tolower((int)cp);
+                continue;
+            }
+            if (cp == 0x064A || cp == 0x0649) cp = 0x06CC;         // Arabic yeh -> Farsi yeh
+            if (cp == 0x0643) cp = 0x06A9;                         // Arabic kaf -> keheh
+            if (cp == 0x0647) cp = 0x06C1;                         // heh -> heh goal
+            if ((cp >= 0x064B && cp <= 0x065F) || cp == 0x0670 || cp == 0x0640) continue;  // marks
+            if (arabicLetter(cp)) {
+                if (!latin.empty()) flushWord(latin, words, raw);
+                putUtf8(urdu, cp);
+                continue;
+            }
+            if (!latin.empty()) flushWord(latin, words, raw);
+            if (!urdu.empty())  flushWord(urdu, words, raw);
+            if (i >= text.size()) break;
+        }
+        return words;
+    }
+
+    // (Re)index a show's title or a category's name
+    void addShow(int showId, const string& title)   { addDoc((uint32_t)showId, title); }
+    void addCategory(int catId, const string& name) { addDoc(CATEGORY_DOC | (uint32_t)catId, name); }
+
+    void removeShow(int showId) {
+        lock_guard<mutex> g(lock);
+        removeDoc((uint32_t)showId);
+    }
+    void removeCategory(int catId) {
+        lock_guard<mutex> g(lock);
+        removeDoc(CATEGORY_DOC | (uint32_t)catId);
+    }
+
+    // Most frequent words starting with prefix (prefix is tokenized like text)
+    vector<string> complete(const string& prefix, size_t limit) const {
+        vector<string> out, raw;
+        tokenize(prefix, &raw);
+        if (raw.empty()) return out;
+        lock_guard<mutex> g(lock);
+        int n = findNode(raw.back());
+        vector<string> folded;      // one spelling of each word
+        for (int i = 0; n >= 0 && i < nodes[n].topCount && out.size() < limit; ++i) {
+            const string& w = terms[nodes[n].top[i]].text;
+            string f = (unsigned char)w[0] < 0x80 ? foldLatin(w) : w;
+            if (find(folded.begin(), folded.end(), f) != folded.end()) continue;
+            folded.push_back(f);
+            out.push_back(w);
+        }
+        return out;
+    }
+
+    // Documents containing every word of the query. With asPrefix (type-
+    // ahead) the last word may be incomplete; an earlier word that is not
+    // a known word is taken as a prefix too. Known words, and prefixes
+    // that only a few words start with, are joined exactly; other
+    // prefixes are checked on the candidates. A query made only of such
+    // wide prefixes starts from the most frequent words the first one
+    // completes to. Categories come first, then shows by id.
+    vector<SearchHit> search(const string& query, size_t limit, bool asPrefix = true) const {
+        vector<SearchHit> hits;
+        vector<string> raw;
+        vector<string> words = tokenize(query, &raw);
+        if (words.empty() || limit == 0) return hits;
+        lock_guard<mutex> g(lock);
+        vector<vector<int> > groups;    // each query word: the words that may stand for it
+        vector<Prefix>       wide;      // prefixes too common to expand
+        for (size_t i = 0; i < words.size(); ++i) {
+            unordered_map<string, int>::const_iterator it = termIds.find(words[i]);
+            bool known = it != termIds.end() && !terms[it->second].docs.empty();
+            if (known && !(asPrefix && i + 1 == words.size())) {
+                groups.push_back(vector<int>(1, it->second));
+                continue;
+            }
+            if (!asPrefix) return hits;
+            Prefix p;
+            p.raw    = raw[i];
+            p.folded = raw[i] == words[i] ? raw[i] : foldLatin(raw[i], false);
+            vector<int> narrow;
+            if (collectWords(findNode(p.raw), NARROW, narrow)
+                && collectWords(findNode(p.folded), NARROW, narrow)) {
+                if (narrow.empty()) return hits;
+                groups.push_back(narrow);
+            }
+            else wide.push_back(p);
+        }
+        if (groups.empty()) {
+            // start from the most frequent completions of the first prefix
+            vector<int> top;
+            const string forms[2] = { wide[0].raw, wide[0].folded };
+            for (int f = 0; f < 2; ++f) {
+                int n = findNode(forms[f]);
+                for (int k = 0; n >= 0 && k < nodes[n].topCount; ++k) {
+                    if (find(top.begin(), top.end(), nodes[n].top[k]) == top.end()) top.push_back(nodes[n].top[k]);
+                }
+            }
+            groups.push_back(top);
+            wide.erase(wide.begin());
+        }
+        // the cheapest group leads
+        vector<size_t> sizes(groups.size(), 0);
+        for (size_t g = 0; g < groups.size(); ++g) {
+            for (size_t w = 0; w < groups[g].size(); ++w) sizes[g] += terms[groups[g][w]].docs.size();
+        }
+        for (size_t g = 1; g < groups.size(); ++g) {
+            if (sizes[g] < sizes[0]) { swap(groups[g], groups[0]); swap(sizes[g], sizes[0]); }
+        }
+
+        // categories (top bit) sort last in the lists but are listed first
+        vector<uint32_t> docs;
+        intersect(groups, wide, CATEGORY_DOC, (uint64_t)UINT32_MAX + 1, limit, docs);
+        intersect(groups, wide, 0, CATEGORY_DOC, limit, docs);
+        for (size_t i = 0; i < docs.size(); ++i) {
+            SearchHit h = { (docs[i] & CATEGORY_DOC) != 0, (int)(docs[i] & ~CATEGORY_DOC) };
+            hits.push_back(h);
+        }
+        return hits;
+    }
+
+    size_t wordCount() const {
+        lock_guard<mutex> g(lock);
+        return termIds.size();
+    }
+};
+
+
+
+
+// Holds a dynamic list of Shows under one category. The list and the
+// name are published for lock-free readers (under an Epoch::Guard);
+// one writer at a time changes them, retiring whatever it replaces.
+
+class Category {
+private:
+    int    id;
+    atomic<const string*> name;
+    PublishedArray<Show>  shows;
+    ScheduleIndex schedule;     // this category's shows by start time
+    ObjectPool<Show>& pool;     // where its shows live
+    Reclaimer*        reclaimer;    // NULL: no concurrent readers, free at once
+
+    void retireShow(Show* s) {
+        if (!reclaimer) { pool.destroy(s); return; }
+        ObjectPool<Show>* p = &pool;
+        reclaimer->retire([p, s]() { p->destroy(s); });
+    }
+
+public:
+    Category(int i, const string& n, ObjectPool<Show>& p, Reclaimer* r = NULL)
+        : id(i), name(new string(n)), shows(r), pool(p), reclaimer(r) {}
+
+    ~Category() {
+        PublishedArray<Show>::View all = shows.view();
+        for (size_t i = 0; i < all.size(); ++i) {
+            pool.destroy(all[i]);
+        }
+        delete name.load();
+    }
+
+    int    getId()   const { return id; }
+    string getName() const { return *name.load(memory_order_acquire); }
+    void   setName(const string& n) {
+        const string* old = name.exchange(new string(n), memory_order_acq_rel);
+        if (reclaimer) reclaimer->retire(const_cast<string*>(old));
+        else           delete old;
+    }
+
+    int    getCount() const { return (int)shows.size(); }
+
+    // Return pointer to the i-th show, or NULL if out of range
+    Show*  getShow(int idx) const {
+        if (idx < 0) return NULL;
+        return shows.get(idx);
+    }
+
+    // Every show as of now, in slot order
+    PublishedArray<Show>::View allShows() const { return shows.view(); }
+
+    // List all shows in this category
+    void listAllShows() const {
+        PublishedArray<Show>::View all = shows.view();
+        for (int i = 0; i < (int)all.size(); ++i) {
+            Show* s = all[i];
+            cout << (i+1) << ". "
+                 << s->getTitle()
+                 << " at " << s->getDateTime() << "\n";
+        }
+    }
+
+    // Append shows starting in [from, to) in time order; returns the count
+    size_t showsBetween(time_t from, time_t to, vector<Show*>& out) const {
+        size_t before = out.size();
+        schedule.between(from, to, out);
+        return out.size() - before;
+    }
+
+    // List shows starting in [from, to) in time order, numbered by position
+    int listShows(time_t from, time_t to) const {
+        vector<Show*> found;
+        showsBetween(from, to, found);
+        for (size_t i = 0; i < found.size(); ++i) {
+            Show* s = found[i];
+            cout << (s->getSlot()+1) << ". "
+                 << s->getTitle()
+                 << " at " << s->getDateTime() << "\n";
+        }
+        return (int)found.size();
+    }
+
+    // Display only shows within the next three days
+    void listShows() const {
+        time_t now = time(NULL);
+        if (listShows(now, now + 3 * 24 * 60 * 60) == 0) {
+            cout << "No shows in the next three days.\n";
+        }
+    }
+
+    // Add a new show (including its base ticket price)
+    Show* addShow(int showId,
+                  const string& title,
+                  const string& dt,
+                  int rows, int cols,
+                  Paisa price)
+    {
+        return addShow(pool.create(showId, title, dt, rows, cols, price));
+    }
+
+    // Same, with dt already parsed
+    Show* addShow(int showId, const string& title, const string& dt, const ShowTime& when,
+                  int rows, int cols, Paisa price)
+    {
+        return addShow(pool.create(showId, title, dt, when, rows, cols, price));
+    }
+
+    // Same, held in a venue layout
+    Show* addShow(int showId, const string& title, const string& dt, const ShowTime& when,
+                  const VenueLayout* layout, Paisa price)
+    {
+        return addShow(pool.create(showId, title, dt, when, layout, price));
+    }
+
+    void reserve(size_t n) { shows.reserve(n); }
+
+    // Take ownership of a show built in this category's pool
+    Show* addShow(Show* s) {
+        s->setSlot(getCount());
+        s->setCategoryId(id);
+        shows.push_back(s);
+        schedule.add(s);
+        return s;
+    }
+
+    // Remove a show by index; returns false if index invalid. The show
+    // is freed once no reader can still be looking at it.
+    bool removeShow(int idx) {
+        Show* s = getShow(idx);
+        if (!s) return false;
+        schedule.remove(s, s->getShowTime());
+        shows.erase(idx);
+        for (int i = idx; i < getCount(); ++i) shows.get(i)->setSlot(i);
+        retireShow(s);
+        return true;
+    }
+
+    // Edit an existing show's title and/or datetime (price unchanged)
+    bool editShow(int idx,
+                  const string& newTitle,
+                  const string& newDateTime)
+    {
+        Show* s = getShow(idx);
+        if (!s) return false;
+        ShowTime old = s->getShowTime();
+        s->relabel(newTitle, newDateTime, reclaimer);
+        schedule.remove(s, old);
+        schedule.add(s);
+        return true;
+    }
+};
+
+
+
+
+
+
+enum BookingState { BOOKING_ACTIVE, BOOKING_CANCELLED };
+
+// Records a completed booking. Kept small and flat: the show is an
+// interned handle (its id), resolved through the catalog when needed.
+struct Booking {
+    uint64_t        id;
+    int32_t         showId;
+    int32_t         row, col;
+    atomic<int32_t> state;      // BookingState; only ever goes active -> cancelled
+    Paisa           fare;       // what the seat sold for
+    int64_t         soldAt;     // unix seconds; 0 if unknown (older stores)
+    Booking(uint64_t i, int s, int r, int c, Paisa f, int64_t at)
+        : id(i), showId(s), row(r), col(c), state(BOOKING_ACTIVE), fare(f), soldAt(at) {}
+
+    bool active() const { return state.load(memory_order_acquire) == BOOKING_ACTIVE; }
+};
+
+// Append-only booking log stored densely in append order. Records live in
+// chunks that double in size (1K, 1K, 2K, 4K, ...), so a record's address
+// never changes, appends never copy, and dropping the log frees about
+// log2(n) blocks. Writers claim a slot with one atomic add and bump their
+// chunk's filled count once the record is written; readers wait for the
+// slots they read to be filled.
+class BookingLog {
+private:
+    static const int BASE_BITS  = 10;
+    static const int MAX_CHUNKS = 64 - BASE_BITS;
+
+    struct Chunk {
+        atomic<Booking*> records;
+        atomic<uint64_t> filled;
+    };
+
+    Chunk            chunks[MAX_CHUNKS];
+    atomic<uint64_t> nextSeq;
+    mutex            growLock;
+
+    BookingLog(const BookingLog&);
+    BookingLog& operator=(const BookingLog&);
+
+    // Chunk k holds slots [base << k) - base, (base << (k+1)) - base)
+    static int chunkOf(uint64_t seq, uint64_t& offset) {
+        uint64_t j   = seq + ((uint64_t)1 << BASE_BITS);
+        int      top = 63 - countLeadingZeros(j);
+        offset = j - ((uint64_t)1 << top);
+        return top - BASE_BITS;
+    }
+    static uint64_t chunkSize(int k)  { return (uint64_t)1 << (BASE_BITS + k); }
+    static uint64_t chunkStart(int k) { return chunkSize(k) - ((uint64_t)1 << BASE_BITS); }
+
+    Booking* chunkRecords(int k) {
+        Booking* rec = chunks[k].records.load(memory_order_acquire);
+        if (rec) return rec;
+        lock_guard<mutex> g(growLock);
+        rec = chunks[k].records.load(memory_order_relaxed);
+        if (!rec) {
+            rec = static_cast<Booking*>(::operator new(chunkSize(k) * sizeof(Booking)));
+            chunks[k].records.store(rec, memory_order_release);
+        }
+        return rec;
+    }
+
+    // Wait until every slot of chunk k below limit is written
+    void waitFilled(int k, uint64_t limit) const {
+        uint64_t want = min(chunkSize(k), limit - chunkStart(k));
+        while (chunks[k].filled.load(memory_order_acquire) < want) this_thread::yield();
+    }
+
+public:
+    BookingLog() : nextSeq(0) {
+        for (int k = 0; k < MAX_CHUNKS; ++k) {
+            chunks[k].records.store(NULL, memory_order_relaxed);
+            chunks[k].filled.store(0, memory_order_relaxed);
+        }
+    }
+
+    ~BookingLog() {
+        for (int k = 0; k < MAX_CHUNKS; ++k) ::operator delete(chunks[k].records.load());
+    }
+
+    // Store a record; the returned pointer stays valid for the log's life
+    Booking* append(uint64_t id, int showId, int row, int col, Paisa fare, int64_t soldAt) {
+        uint64_t offset;
+        int k = chunkOf(nextSeq.fetch_add(1, memory_order_relaxed), offset);
+        Booking* b = new (chunkRecords(k) + offset) Booking(id, showId, row, col, fare, soldAt);
+        chunks[k].filled.fetch_add(1, memory_order_release);
+        return b;
+    }
+
+    size_t size() const { return (size_t)nextSeq.load(memory_order_relaxed); }
+    bool   empty() const { return size() == 0; }
+
+    // Visit every record appended so far, in append order
+    template <typename Visit>
+    void forEach(Visit visit) const {
+        uint64_t n = nextSeq.load(memory_order_acquire);
+        for (int k = 0; k < MAX_CHUNKS && chunkStart(k) < n; ++k) {
+            waitFilled(k, n);
+            const Booking* rec = chunks[k].records.load(memory_order_acquire);
+            uint64_t count = min(chunkSize(k), n - chunkStart(k));
+            for (uint64_t i = 0; i < count; ++i) visit(rec[i]);
+        }
+    }
+};
+
+// Which sales a report counts
+struct SalesFilter {
+    int     showId;         // -1: every show
+    int     categoryId;     // -1: every category
+    int64_t from, to;       // sold in [from, to), unix seconds; 0: open-ended
+    SalesFilter() : showId(-1), categoryId(-1), from(0), to(0) {}
+};
+
+// Net sales: seats sold less seats cancelled, and what they brought in
+struct SalesTotals {
+    Paisa   revenue;
+    int64_t seats;
+    SalesTotals() : revenue(0), seats(0) {}
+    void add(const SalesTotals& o) { revenue += o.revenue; seats += o.seats; }
+};
+
+enum SalesKey { SALES_BY_SHOW, SALES_BY_CATEGORY };
+
+// Sales ledger for reports, stored column by column: one row per seat
+// sold and one more (fare negated, units -1) when it is cancelled, so a
+// report is a scan over a few dense arrays. Rows live in 64K-row
+// segments that never move; an append claims a row with one atomic add
+// and readers wait for the rows they read to be written, as in
+// BookingLog. Times are seconds since EPOCH in 32 bits (2020 to 2088),
+// four to an SSE2 register. Scans split the segments between threads,
+// each adding into its own partial result.
+class SalesColumns {
+public:
+    static const int     SEGMENT_BITS = 16;
+    static const size_t  SEGMENT_ROWS = (size_t)1 << SEGMENT_BITS;
+    static const int64_t EPOCH        = 1577836800;     // 2020-01-01 00:00 UTC
+
+private:
+    static const size_t  MAX_SEGMENTS = (size_t)1 << 15;    // 2G rows
+    static const size_t  ROWS_PER_THREAD = 4 * SEGMENT_ROWS;
+
+    struct Segment {
+        int32_t show[SEGMENT_ROWS];
+        int32_t category[SEGMENT_ROWS];
+        int32_t at[SEGMENT_ROWS];       // seconds since EPOCH
+        int32_t seat[SEGMENT_ROWS];     // row << 16 | col
+        int64_t fare[SEGMENT_ROWS];     // paisa; negative for a cancellation
+        int8_t  units[SEGMENT_ROWS];    // +1 sold, -1 cancelled
+        atomic<uint32_t> filled;
+    };
+
+    // A filter in column terms
+    struct Bounds {
+        int32_t show, category;         // -1: any
+        int32_t from, to;               // at in [from, to)
+        bool    everything;
+    };
+
+    atomic<Segment*>* segments;
+    atomic<uint64_t>  nextRow;
+    mutex             growLock;
+
+    SalesColumns(const SalesColumns&);
+    SalesColumns& operator=(const SalesColumns&);
+
+    static int32_t columnTime(int64_t t) {
+        return (int32_t)max((int64_t)INT32_MIN, min((int64_t)INT32_MAX, t - EPOCH));
+    }
+
+    static Bounds bounds(const SalesFilter& f) {
+        Bounds b;
+        b.show     = f.showId;
+        b.category = f.categoryId;
+        b.from     = f.from ? columnTime(f.from) : INT32_MIN;
+        b.to       = f.to   ? columnTime(f.to)   : INT32_MAX;
+        b.everything = b.show < 0 && b.category < 0 && !f.from && !f.to;
+        return b;
+    }
+
+    static bool matches(const Segment& s, size_t i, const Bounds& b) {
+        return (b.show < 0 || s.show[i] == b.show) && (b.category < 0 || s.category[i] == b.category)
+            && s.at[i] >= b.from && (s.at[i] < b.to || b.to == INT32_MAX);
+    }
+
+    Segment* segmentFor(size_t k) {
+        Segment* s = segments[k].load(memory_order_acquire);
+        if (s) return s;
+        lock_guard<mutex> g(growLock);
+        s = segments[k].load(memory_order_relaxed);
+        if (!s) {
+            s = new Segment;
+            s->filled.store(0, memory_order_relaxed);
+            segments[k].store(s, memory_order_release);
+        }
+        return s;
+    }
+
+    void append(int showId, int categoryId, int row, int col, Paisa fare, int64_t at, int8_t units) {
+        uint64_t i = nextRow.fetch_add(1, memory_order_relaxed);
+        Segment* s = segmentFor((size_t)(i >> SEGMENT_BITS));
+        size_t   o = (size_t)(i & (SEGMENT_ROWS - 1));
+        s->show[o]     = showId;
+        s->category[o] = categoryId;
+        s->at[o]       = columnTime(at);
+        s->seat[o]     = row << 16 | col;
+        s->fare[o]     = fare;
+        s->units[o]    = units;
+        s->filled.fetch_add(1, memory_order_release);
+    }
+
+    // Totals of rows [0, n) of one segment, the plain way
+    static void totalsScalar(const Segment& s, size_t n, const Bounds& b, SalesTotals& out) {
+        for (size_t i = 0; i < n; ++i) {
+            if (b.everything || matches(s, i, b)) {
+                out.revenue += s.fare[i];
+                out.seats   += s.units[i];
+            }
+        }
+    }
+
+#ifdef TBS_SSE2
+    static int64_t lanes(__m128i v) {
+        int64_t x[2];
+        _mm_storeu_si128((__m128i*)x, v);
+        return x[0] + x[1];
+    }
+
+    // Same, four rows at a time. An unfiltered sum adds fares two to a
+    // register and counts units with a byte sum (units + 1 is 0 or 2);
+    // a filter becomes a 32-bit lane mask, widened to mask the fares.
+    static void totalsVector(const Segment& s, size_t n, const Bounds& b, SalesTotals& out) {
+        size_t  i = 0;
+        __m128i rev0 = _mm_setzero_si128(), rev1 = _mm_setzero_si128();
+        if (b.everything) {
+            __m128i rev2 = _mm_setzero_si128(), rev3 = _mm_setzero_si128();
+            __m128i units = _mm_setzero_si128();
+            const __m128i one = _mm_set1_epi8(1), zero = _mm_setzero_si128();
+            for (; i + 16 <= n; i += 16) {
+                const __m128i* f = (const __m128i*)(s.fare + i);
+                rev0 = _mm_add_epi64(rev0, _mm_add_epi64(_mm_load_si128(f),     _mm_load_si128(f + 4)));
+                rev1 = _mm_add_epi64(rev1, _mm_add_epi64(_mm_load_si128(f + 1), _mm_load_si128(f + 5)));
+                rev2 = _mm_add_epi64(rev2, _mm_add_epi64(_mm_load_si128(f + 2), _mm_load_si128(f + 6)));
+                rev3 = _mm_add_epi64(rev3, _mm_add_epi64(_mm_load_si128(f + 3), _mm_load_si128(f + 7)));
+                __m128i u = _mm_add_epi8(_mm_load_si128((const __m128i*)(s.units + i)), one);
+                units = _mm_add_epi64(units, _mm_sad_epu8(u, zero));
+            }
+            out.revenue += lanes(_mm_add_epi64(_mm_add_epi64(rev0, rev1), _mm_add_epi64(rev2, rev3)));
+            out.seats   += lanes(units) - (int64_t)i;
+        } else {
+            const __m128i show = _mm_set1_epi32(b.show), category = _mm_set1_epi32(b.category);
+            const __m128i fromMinus1 = _mm_set1_epi32(b.from == INT32_MIN ? INT32_MIN : b.from - 1);
+            const __m128i to = _mm_set1_epi32(b.to);
+            const __m128i all = _mm_set1_epi32(-1);
+            __m128i seats = _mm_setzero_si128();
+            for (; i + 4 <= n; i += 4) {
+                __m128i m = all;
+                if (b.show >= 0) {
+                    m = _mm_and_si128(m, _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(s.show + i)), show));
+                }
+                if (b.category >= 0) {
+                    m = _mm_and_si128(m, _mm_cmpeq_epi32(_mm_load_si128((const __m128i*)(s.category + i)), category));
+                }
+                if (b.from != INT32_MIN || b.to != INT32_MAX) {
+                    __m128i at = _mm_load_si128((const __m128i*)(s.at + i));
+                    if (b.from != INT32_MIN) m = _mm_and_si128(m, _mm_cmpgt_epi32(at, fromMinus1));
+                    if (b.to != INT32_MAX)   m = _mm_and_si128(m, _mm_cmplt_epi32(at, to));
+                }
+                const __m128i* f = (const __m128i*)(s.fare + i);
+                rev0 = _mm_add_epi64(rev0, _mm_and_si128(_mm_load_si128(f),     _mm_unpacklo_epi32(m, m)));
+                rev1 = _mm_add_epi64(rev1, _mm_and_si128(_mm_load_si128(f + 1), _mm_unpackhi_epi32(m, m)));
+                // four units bytes sign-extended to 32-bit lanes
+                int32_t four;
+                memcpy(&four, s.units + i, 4);
+                __m128i u = _mm_cvtsi32_si128(four);
+                u = _mm_unpacklo_epi8(u, u);
+                u = _mm_srai_epi32(_mm_unpacklo_epi16(u, u), 24);
+                seats = _mm_add_epi32(seats, _mm_and_si128(u, m));
+            }
+            out.revenue += lanes(_mm_add_epi64(rev0, rev1));
+            int32_t x[4];
+            _mm_storeu_si128((__m128i*)x, seats);
+            out.seats += (int64_t)x[0] + x[1] + x[2] + x[3];    // at most 16K per lane per segment
+        }
+        for (; i < n; ++i) {
+            if (b.everything || matches(s, i, b)) {
+                out.revenue += s.fare[i];
+                out.seats   += s.units[i];
+            }
+        }
+    }
+#endif
+
+    static int defaultThreads(uint64_t rows) {
+        int cores = max(1, (int)thread::hardware_concurrency());
+        return (int)min((uint64_t)cores, 1 + rows / ROWS_PER_THREAD);
+    }
+
+    // Run kernel(segment, rows, partial) over every row appended so far on
+    // `threads` threads (0: by size), each with its own partial result
+    template <typename Part, typename Kernel>
+    vector<Part> scan(int threads, const Part& zero, Kernel kernel) const {
+        uint64_t n    = nextRow.load(memory_order_acquire);
+        size_t   segs = (size_t)((n + SEGMENT_ROWS - 1) >> SEGMENT_BITS);
+        for (size_t k = 0; k < segs; ++k) {
+            uint64_t want = min((uint64_t)SEGMENT_ROWS, n - ((uint64_t)k << SEGMENT_BITS));
+            while (segments[k].load(memory_order_acquire) == NULL
+                   || segments[k].load(memory_order_acquire)->filled.load(memory_order_acquire) < want) {
+                this_thread::yield();
+            }
+        }
+        if (threads <= 0) threads = defaultThreads(n);
+        threads = max(1, min(threads, (int)segs));
+        vector<Part>   parts(threads, zero);
+        atomic<size_t> nextSegment(0);
+        auto work = [&](int t) {
+            for (size_t k; (k = nextSegment.fetch_add(1, memory_order_relaxed)) < segs; ) {
+                size_t rows = (size_t)min((uint64_t)SEGMENT_ROWS, n - ((uint64_t)k << SEGMENT_BITS));
+                kernel(*segments[k].load(memory_order_acquire), rows, parts[t]);
+            }
+        };
+        vector<thread> helpers;
+        for (int t = 1; t < threads; ++t) helpers.push_back(thread(work, t));
+        work(0);
+        for (size_t t = 0; t < helpers.size(); ++t) helpers[t].join();
+        return parts;
+    }
+
+public:
+    SalesColumns() : segments(new atomic<Segment*>[MAX_SEGMENTS]), nextRow(0) {
+        for (size_t k = 0; k < MAX_SEGMENTS; ++k) segments[k].store(NULL, memory_order_relaxed);
+    }
+
+    ~SalesColumns() {
+        for (size_t k = 0; k < MAX_SEGMENTS; ++k) delete segments[k].load();
+        delete[] segments;
+    }
+
+    void sold(int showId, int categoryId, int row, int col, Paisa fare, int64_t at) {
+        append(showId, categoryId, row, col, fare, at, 1);
+    }
+    void cancelled(int showId, int categoryId, int row, int col, Paisa fare, int64_t at) {
+        append(showId, categoryId, row, col, -fare, at, -1);
+    }
+
+    size_t rows() const { return (size_t)nextRow.load(memory_order_relaxed); }
+
+    // Net sales matching f. vectorized false runs the plain loop instead
+    // of the SSE2 one (the same numbers, for comparison).
+    SalesTotals totals(const SalesFilter& f = SalesFilter(), int threads = 0, bool vectorized = true) const {
+        Bounds b = bounds(f);
+        vector<SalesTotals> parts = scan(threads, SalesTotals(),
+            [&](const Segment& s, size_t n, SalesTotals& out) {
+#ifdef TBS_SSE2
+                if (vectorized) { totalsVector(s, n, b, out); return; }
+#endif
+                totalsScalar(s, n, b, out);
+            });
+        SalesTotals sum;
+        for (size_t i = 0; i < parts.size(); ++i) sum.add(parts[i]);
+        return sum;
+    }
+
+    // Net sales matching f per show or category id below keys (index =
+    // id); rows with other ids are left out
+    vector<SalesTotals> groupBy(SalesKey key, size_t keys, const SalesFilter& f = SalesFilter(),
+                                int threads = 0) const {
+        Bounds b = bounds(f);
+        vector<vector<SalesTotals> > parts = scan(threads, vector<SalesTotals>(keys),
+            [&](const Segment& s, size_t n, vector<SalesTotals>& out) {
+                const int32_t* ids = key == SALES_BY_SHOW ? s.show : s.category;
+                SalesTotals*   acc = out.empty() ? NULL : &out[0];
+                for (size_t i = 0; i < n; ++i) {
+                    if ((uint32_t)ids[i] >= keys || !(b.everything || matches(s, i, b))) continue;
+                    acc[ids[i]].revenue += s.fare[i];
+                    acc[ids[i]].seats   += s.units[i];
+                }
+            });
+        vector<SalesTotals> sum(keys);
+        for (size_t t = 0; t < parts.size(); ++t) {
+            for (size_t k = 0; k < keys; ++k) sum[k].add(parts[t][k]);
+        }
+        return sum;
+    }
+
+    // Net sales matching f in `buckets` consecutive windows of
+    // bucketSeconds from start (sales velocity); later and earlier rows
+    // are left out
+    vector<SalesTotals> byTime(int64_t start, int bucketSeconds, size_t buckets,
+                               const SalesFilter& f = SalesFilter(), int threads = 0) const {
+        Bounds  b    = bounds(f);
+        int64_t lo   = start - EPOCH;
+        uint64_t width = (uint64_t)max(1, bucketSeconds);
+        uint64_t span  = width * buckets;
+        double   inv   = 1.0 / (double)width;
+        vector<vector<SalesTotals> > parts = scan(threads, vector<SalesTotals>(buckets),
+            [&](const Segment& s, size_t n, vector<SalesTotals>& out) {
+                SalesTotals* acc = out.empty() ? NULL : &out[0];
+                for (size_t i = 0; i < n; ++i) {
+                    uint64_t d = (uint64_t)((int64_t)s.at[i] - lo);     // huge if before start
+                    if (d >= span || !(b.everything || matches(s, i, b))) continue;
+                    // divide by multiplying, then fix the rounding
+                    uint64_t q = (uint64_t)((double)d * inv);
+                    if (q * width > d) --q;
+                    else if ((q + 1) * width <= d) ++q;
+                    acc[q].revenue += s.fare[i];
+                    acc[q].seats   += s.units[i];
+                }
+            });
+        vector<SalesTotals> sum(buckets);
+        for (size_t t = 0; t < parts.size(); ++t) {
+            for (size_t k = 0; k < buckets; ++k) sum[k].add(parts[t][k]);
+        }
+        return sum;
+    }
+};
+
+
+
+
+// Booking ids are plain 64-bit numbers shown as "BK" + at least 5 digits
+inline string formatBookingID(uint64_t id) {
+    string digits = toString(id);
+    if (digits.size() < 5) digits.insert(0, 5 - digits.size(), '0');
+    return "BK" + digits;
+}
+
+// Accepts "BK00042", "bk42" or "42"; returns 0 if not a booking id
+inline uint64_t parseBookingID(const string& text) {
+    size_t i = 0;
+    if (text.size() >= 2 && toupper((unsigned char)text[0]) == 'B'
+                         && toupper((unsigned char)text[1]) == 'K') i = 2;
+    if (i == text.size()) return 0;
+    uint64_t id = 0;
+    for (; i < text.size(); ++i) {
+        if (!isdigit((unsigned char)text[i])) return 0;
+        id = id * 10 + (uint64_t)(text[i] - '0');
+    }
+    return id;
+}
+
+// Unique booking ids without a shared counter on the hot path: each
+// thread leases a block of ids from one atomic and hands them out
+// locally. After a restart observe() moves past every id already used.
+class BookingIdGenerator {
+private:
+    static const uint64_t BLOCK = 1024;
+
+    struct Lease {
+        uint64_t owner;     // serial of the generator the block came from
+        uint64_t next, end;
+    };
+
+    atomic<uint64_t> nextBlock;
+    uint64_t         serial;
+
+    static uint64_t newSerial() {
+        static atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+
+public:
+    BookingIdGenerator() : nextBlock(0), serial(newSerial()) {}
+
+    uint64_t next() {
+        static thread_local Lease lease = { 0, 0, 0 };
+        if (lease.owner != serial || lease.next == lease.end) {
+            uint64_t block = nextBlock.fetch_add(1, memory_order_relaxed);
+            lease.owner = serial;
+            lease.next  = block * BLOCK + 1;    // id 0 is never issued
+            lease.end   = (block + 1) * BLOCK + 1;
+        }
+        return lease.next++;
+    }
+
+    // Never issue ids at or below one already in use
+    void observe(uint64_t id) {
+        uint64_t want = id / BLOCK + 1;
+        uint64_t cur  = nextBlock.load(memory_order_relaxed);
+        while (cur < want && !nextBlock.compare_exchange_weak(cur, want)) {}
+    }
+};
+
+// Booking id -> record index. Open addressing with linear probing in
+// power-of-two tables, split into shards by hash so concurrent writers
+// rarely share a lock. Lookup, insert and erase are O(1) expected;
+// erase uses backward-shift deletion so no tombstones build up.
+class BookingIndex {
+private:
+    static const int SHARDS = 64;
+
+    struct Slot {
+        uint64_t key;       // 0 = empty
+        Booking* value;
+    };
+
+    struct Shard {
+        mutex        lock;
+        vector<Slot> slots;
+        size_t       count;
+        Shard() : count(0) {}
+    };
+
+    Shard shards[SHARDS];
+
+    static uint64_t mix(uint64_t x) {
+        x ^= x >> 33; x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    static void insertSlot(vector<Slot>& slots, uint64_t key, Booking* value) {
+        size_t mask = slots.size() - 1;
+        size_t i = (size_t)(mix(key) >> 6) & mask;
+        while (slots[i].key != 0 && slots[i].key != key) i = (i + 1) & mask;
+        slots[i].key   = key;
+        slots[i].value = value;
+    }
+
+    static void grow(Shard& sh) {
+        vector<Slot> bigger(sh.slots.empty() ? 16 : sh.slots.size() * 2);
+        for (size_t i = 0; i < bigger.size(); ++i) { bigger[i].key = 0; bigger[i].value = NULL; }
+        for (size_t i = 0; i < sh.slots.size(); ++i) {
+            if (sh.slots[i].key) insertSlot(bigger, sh.slots[i].key, sh.slots[i].value);
+        }
+        sh.slots.swap(bigger);
+    }
+
+    // Slot holding key, or -1
+    static long findSlot(const Shard& sh, uint64_t key) {
+        if (sh.slots.empty()) return -1;
+        size_t mask = sh.slots.size() - 1;
+        size_t i = (size_t)(mix(key) >> 6) & mask;
+        while (sh.slots[i].key != 0) {
+            if (sh.slots[i].key == key) return (long)i;
+            i = (i + 1) & mask;
+        }
+        return -1;
+    }
+
+    Shard& shardFor(uint64_t key) { return shards[mix(key) & (SHARDS - 1)]; }
+
+public:
+    // Insert or replace; key must be non-zero
+    void insert(uint64_t key, Booking* value) {
+        Shard& sh = shardFor(key);
+        lock_guard<mutex> g(sh.lock);
+        if ((sh.count + 1) * 4 > sh.slots.size() * 3) grow(sh);    // load <= 0.75
+        if (findSlot(sh, key) < 0) ++sh.count;
+        insertSlot(sh.slots, key, value);
+    }
+
+    Booking* find(uint64_t key) {
+        Shard& sh = shardFor(key);
+        lock_guard<mutex> g(sh.lock);
+        long i = findSlot(sh, key);
+        return i < 0 ? NULL : sh.slots[i].value;
+    }
+
+    bool erase(uint64_t key) {
+        Shard& sh = shardFor(key);
+        lock_guard<mutex> g(sh.lock);
+        long found = findSlot(sh, key);
+        if (found < 0) return false;
+        size_t mask = sh.slots.size() - 1;
+        size_t hole = (size_t)found;
+        size_t i    = (hole + 1) & mask;
+        // shift back later entries whose probe run passes through the hole
+        while (sh.slots[i].key != 0) {
+            size_t home = (size_t)(mix(sh.slots[i].key) >> 6) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                sh.slots[hole] = sh.slots[i];
+                hole = i;
+            }
+            i = (i + 1) & mask;
+        }
+        sh.slots[hole].key   = 0;
+        sh.slots[hole].value = NULL;
+        --sh.count;
+        return true;
+    }
+
+    size_t size() {
+        size_t n = 0;
+        for (int s = 0; s < SHARDS; ++s) {
+            lock_guard<mutex> g(shards[s].lock);
+            n += shards[s].count;
+        }
+        return n;
+    }
+};
+
+
+
+
+// Outstanding seat holds that expire after a TTL unless confirmed.
+// Expiry runs on a hierarchical timing wheel (4 levels of 64 slots), so
+// each tick only touches the slot that is due, however many holds exist.
+// Tokens encode the pool slot plus a generation, making confirm/release
+// O(1) and stale tokens harmless.
+class HoldManager {
+public:
+    typedef uint64_t Token;
+
+private:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS     = 1 << SLOT_BITS;
+    static const int LEVELS    = 4;
+    static const int NONE      = -1;
+
+    struct Hold {
+        Show*    show;
+        int      row, col;
+        int      count;         // adjacent seats from (row, col)
+        Paisa    fare;          // per seat, quoted when the seats were taken
+        uint64_t expireTick;
+        uint32_t gen;
+        bool     active;
+        int      bucket;        // level * SLOTS + slot, or NONE
+        int      prev, next;    // links within the bucket (or free list)
+    };
+
+    mutable mutex lock;
+    vector<Hold>  pool;
+    int           freeHead;
+    int           buckets[LEVELS * SLOTS];
+    uint64_t      currentTick;
+    size_t        activeCount;
+    uint64_t      ttlTicks;
+    int           tickMs;
+    chrono::steady_clock::time_point epoch;
+
+    void link(int idx) {
+        Hold& h = pool[idx];
+        if (h.expireTick <= currentTick) h.expireTick = currentTick + 1;
+        uint64_t delta = h.expireTick - currentTick;
+        uint64_t span  = (uint64_t)1 << (SLOT_BITS * LEVELS);
+        if (delta >= span) h.expireTick = currentTick + span - 1;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= ((uint64_t)1 << (SLOT_BITS * (level + 1)))) {
+            ++level;
+        }
+        int slot = (int)((h.expireTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+        h.bucket = level * SLOTS + slot;
+        h.prev   = NONE;
+        h.next   = buckets[h.bucket];
+        if (h.next != NONE) pool[h.next].prev = idx;
+        buckets[h.bucket] = idx;
+    }
+
+    void unlink(int idx) {
+        Hold& h = pool[idx];
+        if (h.prev != NONE) pool[h.prev].next = h.next;
+        else                buckets[h.bucket] = h.next;
+        if (h.next != NONE) pool[h.next].prev = h.prev;
+        h.bucket = NONE;
+    }
+
+    void freeSlot(int idx) {
+        Hold& h  = pool[idx];
+        h.active = false;
+        ++h.gen;
+        h.next   = freeHead;
+        freeHead = idx;
+        --activeCount;
+    }
+
+    // Find the live hold a token refers to, or NONE
+    int lookup(Token tok) const {
+        int idx = (int)(tok & 0xffffffffu) - 1;
+        if (idx < 0 || idx >= (int)pool.size()) return NONE;
+        const Hold& h = pool[idx];
+        if (!h.active || h.gen != (uint32_t)(tok >> 32)) return NONE;
+        return idx;
+    }
+
+    // Move every hold in a higher-level bucket down to finer slots
+    void cascade(int level) {
+        int bucket = level * SLOTS
+                   + (int)((currentTick >> (SLOT_BITS * level)) & (SLOTS - 1));
+        int idx = buckets[bucket];
+        buckets[bucket] = NONE;
+        while (idx != NONE) {
+            int next = pool[idx].next;
+            link(idx);
+            idx = next;
+        }
+    }
+
+    // Advance one tick and expire whatever lands in the due slot
+    size_t step() {
+        ++currentTick;
+        for (int level = 1; level < LEVELS; ++level) {
+            if ((currentTick & (((uint64_t)1 << (SLOT_BITS * level)) - 1)) != 0) break;
+            cascade(level);
+        }
+        int bucket = (int)(currentTick & (SLOTS - 1));
+        int idx = buckets[bucket];
+        buckets[bucket] = NONE;
+        size_t expired = 0;
+        while (idx != NONE) {
+            int next = pool[idx].next;
+            Hold& h = pool[idx];
+            h.bucket = NONE;
+            h.show->releaseBlock(h.row, h.col, h.count);
+            freeSlot(idx);
+            ++expired;
+            idx = next;
+        }
+        return expired;
+    }
+
+public:
+    HoldManager(int ttlMillis, int tickMillis = 100)
+        : freeHead(NONE), currentTick(0), activeCount(0),
+          ttlTicks((uint64_t)((ttlMillis + tickMillis - 1) / tickMillis)),
+          tickMs(tickMillis), epoch(chrono::steady_clock::now())
+    {
+        for (int i = 0; i < LEVELS * SLOTS; ++i) buckets[i] = NONE;
+    }
+
+    // Milliseconds since this manager was created (the wheel's clock)
+    uint64_t nowMs() const {
+        return (uint64_t)chrono::duration_cast<chrono::milliseconds>(
+            chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Hold a seat for the configured TTL; returns 0 if the seat is not free.
+    // The seat's fare is quoted once held and kept with the hold.
+    Token hold(Show* s, int r, int c) { return hold(s, r, c, nowMs()); }
+    Token hold(Show* s, int r, int c, uint64_t nowMillis) {
+        ScopedTimer timer(T_HOLD_SEATS);
+        if (!s->holdSeat(r, c)) return 0;
+        return track(s, r, c, 1, nowMillis);
+    }
+
+    // Hold the best block of n adjacent seats as one hold; 0 if none fits
+    Token holdBlock(Show* s, int n, const SeatPreference& pref, Seat& first) {
+        ScopedTimer timer(T_HOLD_SEATS);
+        if (!s->holdBestBlock(n, pref, first)) return 0;
+        return track(s, first.row, first.number, n, nowMs());
+    }
+
+    // Turn a hold into a sale; false if the hold expired or is unknown
+    bool confirm(Token tok) {
+        lock_guard<mutex> g(lock);
+        int idx = lookup(tok);
+        if (idx == NONE) return false;
+        Hold& h = pool[idx];
+        h.show->confirmBlock(h.row, h.col, h.count);
+        unlink(idx);
+        freeSlot(idx);
+        return true;
+    }
+
+    // Give a held seat back; false if the hold expired or is unknown
+    bool release(Token tok) {
+        lock_guard<mutex> g(lock);
+        int idx = lookup(tok);
+        if (idx == NONE) return false;
+        Hold& h = pool[idx];
+        h.show->releaseBlock(h.row, h.col, h.count);
+        unlink(idx);
+        freeSlot(idx);
+        return true;
+    }
+
+    // What a live hold covers and its fare per seat; false if it expired
+    // or is unknown
+    bool lookupHold(Token tok, Show*& s, int& r, int& c, int& n, Paisa& fare) const {
+        lock_guard<mutex> g(lock);
+        int idx = lookup(tok);
+        if (idx == NONE) return false;
+        const Hold& h = pool[idx];
+        s = h.show; r = h.row; c = h.col; n = h.count; fare = h.fare;
+        return true;
+    }
+
+    // Expire every hold due by the given time; returns how many expired
+    size_t advance() { return advance(nowMs()); }
+    size_t advance(uint64_t nowMillis) {
+        lock_guard<mutex> g(lock);
+        return advanceLocked(nowMillis);
+    }
+
+    size_t outstanding() const {
+        lock_guard<mutex> g(lock);
+        return activeCount;
+    }
+
+    // Forget every hold on a show being removed (marked first, so no new
+    // hold can start after this); returns how many were dropped
+    size_t dropShow(const Show* s) {
+        lock_guard<mutex> g(lock);
+        size_t dropped = 0;
+        for (size_t i = 0; i < pool.size(); ++i) {
+            if (!pool[i].active || pool[i].show != s) continue;
+            unlink((int)i);
+            freeSlot((int)i);
+            ++dropped;
+        }
+        return dropped;
+    }
+
+private:
+    // Start the TTL for seats the caller has already taken on the show
+    Token track(Show* s, int r, int c, int n, uint64_t nowMillis) {
+        Paisa fare = s->quote(r, PriceClock::current(), n);
+        lock_guard<mutex> g(lock);
+        if (s->isRemoved()) {           // lost a race with removeShow
+            s->releaseBlock(r, c, n);
+            return 0;
+        }
+        advanceLocked(nowMillis);
+        int idx;
+        if (freeHead != NONE) {
+            idx = freeHead;
+            freeHead = pool[idx].next;
+        } else {
+            idx = (int)pool.size();
+            Hold blank = { NULL, 0, 0, 0, 0, 0, 0, false, NONE, NONE, NONE };
+            pool.push_back(blank);
+        }
+        Hold& h = pool[idx];
+        h.show = s; h.row = r; h.col = c; h.count = n; h.fare = fare;
+        h.active = true;
+        h.expireTick = currentTick + (ttlTicks > 0 ? ttlTicks : 1);
+        link(idx);
+        ++activeCount;
+        return ((Token)h.gen << 32) | (Token)(idx + 1);
+    }
+
+    size_t advanceLocked(uint64_t nowMillis) {
+        uint64_t target = nowMillis / tickMs;
+        size_t expired = 0;
+        if (activeCount == 0 && target > currentTick) {
+            currentTick = target;   // nothing to expire, jump ahead
+        }
+        while (currentTick < target) expired += step();
+        if (expired) Metrics::count(C_HOLDS_EXPIRED, expired);
+        return expired;
+    }
+};
+
+
+
+
+// Admission control for on-sales. A show with an open line hands out
+// position tickets in arrival order (one atomic increment, so a million
+// clients queue as cheaply as ten) and lets them on to seat selection
+// at the pace of a token bucket: perSecond on average, up to burst at
+// once. Nothing is kept per client but a bit for each who left: a
+// ticket is admitted once the line's head has passed it, and its pass
+// lapses passSeconds later.
+// Whoever polls moves the head along; if another thread is already
+// doing that the caller just reads the result, so a poll never waits.
+class WaitingRoom {
+public:
+    typedef uint64_t Ticket;        // 1, 2, 3, ... per show; 0: no line, walk in
+
+    // LAPSED: the pass ran out, or the ticket is not from this line
+    enum Admission { NO_LINE, WAITING, ADMITTED, LAPSED };
+
+    struct Status {
+        Admission state;
+        uint64_t  ahead;            // clients still in front (WAITING)
+        double    waitSeconds;      // estimated from the admission rate
+        int       retryAfterMs;     // when to poll again (0 once decided)
+        Status() : state(NO_LINE), ahead(0), waitSeconds(0), retryAfterMs(0) {}
+    };
+
+    static const int MIN_RETRY_MS = 250;
+    static const int MAX_RETRY_MS = 30000;
+
+private:
+    static const int    LEFT_CHUNK_BITS  = 16;                      // 65536 tickets, 8 KB
+    static const size_t LEFT_CHUNK_WORDS = (1u << LEFT_CHUNK_BITS) / 64;
+    static const size_t LEFT_CHUNKS      = 1024;                    // 67M tickets a line
+
+    struct Line {
+        alignas(64) atomic<uint64_t> tail;  // tickets handed out (joiners)
+        alignas(64) atomic<uint64_t> head;  // tickets up to here are admitted
+        atomic<uint64_t> lapsedTo;          // passes up to here have lapsed
+        atomic<uint64_t> letIn;             // admitted on a token so far
+        // one bit per ticket that gave up its place, in chunks made on
+        // first use (tickets past the last chunk cannot leave)
+        atomic<atomic<uint64_t>*> leftChunks[LEFT_CHUNKS];
+        atomic_flag      pumping;
+        // owned by the pumping thread
+        double           tokens;
+        uint64_t         refilledAt;        // ns
+        deque<pair<uint64_t, uint64_t> > passes;   // (head, when) per advance
+        // fixed at open
+        double           perSecond, burst;
+        uint64_t         passNs;
+
+        Line(double rate, double b, uint64_t pass, uint64_t now)
+            : tail(0), head(0), lapsedTo(0), letIn(0), tokens(b), refilledAt(now),
+              perSecond(rate), burst(b), passNs(pass) {
+            pumping.clear();
+            for (size_t i = 0; i < LEFT_CHUNKS; ++i) leftChunks[i].store(NULL);
+        }
+        ~Line() {
+            for (size_t i = 0; i < LEFT_CHUNKS; ++i) delete[] leftChunks[i].load();
+        }
+
+        // Record that t left; false if it already had (or cannot)
+        bool markLeft(Ticket t) {
+            size_t c = (size_t)((t - 1) >> LEFT_CHUNK_BITS);
+            if (t == 0 || c >= LEFT_CHUNKS) return false;
+            atomic<uint64_t>* chunk = leftChunks[c].load(memory_order_acquire);
+            if (!chunk) {
+                atomic<uint64_t>* fresh = new atomic<uint64_t>[LEFT_CHUNK_WORDS];
+                for (size_t i = 0; i < LEFT_CHUNK_WORDS; ++i) fresh[i].store(0, memory_order_relaxed);
+                if (leftChunks[c].compare_exchange_strong(chunk, fresh, memory_order_acq_rel)) chunk = fresh;
+                else delete[] fresh;
+            }
+            size_t   i   = (size_t)((t - 1) & ((1u << LEFT_CHUNK_BITS) - 1));
+            uint64_t bit = (uint64_t)1 << (i % 64);
+            return !(chunk[i / 64].fetch_or(bit, memory_order_acq_rel) & bit);
+        }
+
+        bool hasLeft(Ticket t) const {
+            size_t c = (size_t)((t - 1) >> LEFT_CHUNK_BITS);
+            if (t == 0 || c >= LEFT_CHUNKS) return false;
+            const atomic<uint64_t>* chunk = leftChunks[c].load(memory_order_acquire);
+            if (!chunk) return false;
+            size_t i = (size_t)((t - 1) & ((1u << LEFT_CHUNK_BITS) - 1));
+            return (chunk[i / 64].load(memory_order_acquire) >> (i % 64)) & 1;
+        }
+    };
+
+    PublishedArray<Line> lines;     // by show id, NULL where none is open
+    Reclaimer            reclaimer;
+    mutex                change;    // open / close
+
+    Line* line(int showId) const { return showId < 0 ? NULL : lines.get(showId); }
+
+    // Refill the bucket and admit as many as it allows. A ticket that
+    // left is skipped without spending a token when the head reaches
+    // it. Advances closer than 1/256 of the pass apart share one lapse
+    // entry.
+    static void pump(Line& l, uint64_t now) {
+        if (l.pumping.test_and_set(memory_order_acquire)) return;
+        now = max(now, l.refilledAt);   // another poller may have read a later clock
+        l.tokens     = min(l.burst, l.tokens + (now - l.refilledAt) * l.perSecond * 1e-9);
+        l.refilledAt = now;
+        uint64_t from = l.head.load(memory_order_relaxed), head = from;
+        uint64_t tail = l.tail.load(memory_order_acquire);
+        uint64_t n    = 0;
+        while (head < tail) {
+            if (!l.hasLeft(head + 1)) {
+                if ((double)(n + 1) > l.tokens) break;
+                ++n;
+            }
+            ++head;
+        }
+        if (head > from) {
+            l.tokens -= (double)n;
+            l.head.store(head, memory_order_release);
+            l.letIn.store(l.letIn.load(memory_order_relaxed) + n, memory_order_relaxed);
+            if (!l.passes.empty() && now - l.passes.back().second < l.passNs / 256) l.passes.back() = make_pair(head, now);
+            else l.passes.push_back(make_pair(head, now));
+            Metrics::count(C_QUEUE_ADMITTED, n);
+        }
+        while (!l.passes.empty() && now - l.passes.front().second >= l.passNs) {
+            l.lapsedTo.store(l.passes.front().first, memory_order_release);
+            l.passes.pop_front();
+        }
+        l.pumping.clear(memory_order_release);
+    }
+
+    static Status status(const Line& l, Ticket t) {
+        Status s;
+        uint64_t head = l.head.load(memory_order_acquire);
+        if (t == 0 || t > l.tail.load(memory_order_acquire) || t <= l.lapsedTo.load(memory_order_acquire)) {
+            s.state = LAPSED;
+        }
+        else if (t <= head) s.state = l.hasLeft(t) ? LAPSED : ADMITTED;
+        else {
+            s.state        = WAITING;
+            s.ahead        = t - head - 1;
+            s.waitSeconds  = (t - head) / l.perSecond;
+            // poll again halfway through the wait
+            s.retryAfterMs = (int)max((double)MIN_RETRY_MS, min((double)MAX_RETRY_MS, s.waitSeconds * 500));
+        }
+        return s;
+    }
+
+public:
+    WaitingRoom() : lines(&reclaimer) {}
+
+    ~WaitingRoom() {
+        reclaimer.drain();
+        PublishedArray<Line>::View all = lines.view();
+        for (size_t i = 0; i < all.size(); ++i) delete all[i];
+    }
+
+    static uint64_t nowNanos() {
+        return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // Put a show on sale behind a line; replaces any line it had
+    // (whose tickets are then void)
+    bool open(int showId, double perSecond, double burst = 1, int passSeconds = 120,
+              uint64_t now = nowNanos()) {
+        if (showId < 0 || !(perSecond > 0) || passSeconds < 1) return false;
+        lock_guard<mutex> g(change);
+        if ((size_t)showId >= lines.size()) lines.resize(showId + 1);
+        Line* old = lines.get(showId);
+        lines.set(showId, new Line(perSecond, max(1.0, burst), (uint64_t)passSeconds * 1000000000ULL, now));
+        if (old) reclaimer.retire(old);
+        return true;
+    }
+
+    // Let everyone straight in again
+    bool close(int showId) {
+        lock_guard<mutex> g(change);
+        Line* old = line(showId);
+        if (!old) return false;
+        lines.set(showId, NULL);
+        reclaimer.retire(old);
+        return true;
+    }
+
+    bool isOpen(int showId) const {
+        Epoch::Guard guard;
+        return line(showId) != NULL;
+    }
+
+    // Take a place in the show's line (0 if it has none)
+    Ticket join(int showId, uint64_t now = nowNanos()) {
+        Epoch::Guard guard;
+        Line* l = line(showId);
+        if (!l) return 0;
+        Ticket t = l->tail.fetch_add(1, memory_order_acq_rel) + 1;
+        Metrics::count(C_QUEUE_JOINED);
+        pump(*l, now);
+        return t;
+    }
+
+    // Where a ticket stands; also moves the line along
+    Status check(int showId, Ticket t, uint64_t now = nowNanos()) {
+        Epoch::Guard guard;
+        Line* l = line(showId);
+        if (!l) return Status();
+        pump(*l, now);
+        return status(*l, t);
+    }
+
+    // May this ticket choose seats now? (always, if there is no line)
+    bool admitted(int showId, Ticket t, uint64_t now = nowNanos()) {
+        Admission a = check(showId, t, now).state;
+        return a == NO_LINE || a == ADMITTED;
+    }
+
+    // Give up a place for good; the line moves past it without spending
+    // a token. Leaving again, or after being admitted, does nothing.
+    void leave(int showId, Ticket t) {
+        Epoch::Guard guard;
+        Line* l = line(showId);
+        if (l && t > l->head.load(memory_order_acquire) && t <= l->tail.load(memory_order_acquire)) {
+            l->markLeft(t);
+        }
+    }
+
+    // Clients admitted so far (not counting those who left)
+    uint64_t admittedSoFar(int showId) const {
+        Epoch::Guard guard;
+        Line* l = line(showId);
+        return l ? l->letIn.load(memory_order_relaxed) : 0;
+    }
+
+    // Clients not yet admitted
+    uint64_t waiting(int showId) const {
+        Epoch::Guard guard;
+        Line* l = line(showId);
+        if (!l) return 0;
+        uint64_t head = l->head.load(memory_order_acquire);
+        uint64_t tail = l->tail.load(memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+};
+
+
+// One card charge handed to a payment gateway
+struct PaymentRequest {
+    uint64_t id;
+    Paisa    amount;
+    string   card;
+};
+
+// Money going back for one cancelled booking
+struct RefundRequest {
+    uint64_t bookingId;
+    Paisa    amount;
+};
+
+// What cancelling a set of bookings came to
+struct CancelResult {
+    size_t bookings;                // cancelled
+    size_t batches;
+    Paisa  refunded;
+    vector<uint64_t> refundFailed;  // booking ids the gateway refused
+    CancelResult() : bookings(0), batches(0), refunded(0) {}
+    void add(const CancelResult& o) {
+        bookings += o.bookings;
+        batches  += o.batches;
+        refunded += o.refunded;
+        refundFailed.insert(refundFailed.end(), o.refundFailed.begin(), o.refundFailed.end());
+    }
+};
+
+// Pluggable payment backend; charges (or refunds) a whole batch in one
+// round trip
+class PaymentGateway {
+public:
+    virtual ~PaymentGateway() {}
+    // Fill approved[i] for each request in the batch
+    virtual void chargeBatch(const vector<PaymentRequest>& batch,
+                             vector<bool>& approved) = 0;
+    // Fill refunded[i] for each refund in the batch
+    virtual void refundBatch(const vector<RefundRequest>& batch,
+                             vector<bool>& refunded) = 0;
+};
+
+// Stand-in gateway with a fixed round-trip latency and random declines
+class SimulatedGateway : public PaymentGateway {
+private:
+    int    latencyMs;
+    double failureRate;     // 0.0 .. 1.0
+
+public:
+    SimulatedGateway(int latencyMillis, double failRate)
+        : latencyMs(latencyMillis), failureRate(failRate) {}
+
+    void chargeBatch(const vector<PaymentRequest>& batch, vector<bool>& approved) {
+        static thread_local mt19937 rng((unsigned)hash<thread::id>()(this_thread::get_id()));
+        uniform_real_distribution<double> roll(0.0, 1.0);
+        this_thread::sleep_for(chrono::milliseconds(latencyMs));
+        approved.assign(batch.size(), true);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (failureRate > 0 && roll(rng) < failureRate) approved[i] = false;
+        }
+    }
+
+    // Refunds go back to a card already charged, so none are declined
+    void refundBatch(const vector<RefundRequest>& batch, vector<bool>& refunded) {
+        this_thread::sleep_for(chrono::milliseconds(latencyMs));
+        refunded.assign(batch.size(), true);
+    }
+};
+
+// Asynchronous payment stage: callers enqueue charges and get a future
+// back; worker threads drain the queue in batches of up to maxBatch and
+// run each request's completion (confirm or release the held seat).
+class PaymentPipeline {
+public:
+    // Called with the gateway verdict; returns whether the booking completed
+    typedef function<bool(bool approved)> Completion;
+
+private:
+    struct Pending {
+        PaymentRequest req;
+        Completion     onDone;
+        promise<bool>  result;
+        chrono::steady_clock::time_point submitted;
+    };
+
+    PaymentGateway&    gateway;
+    size_t             maxBatch;
+    mutex              lock;
+    condition_variable ready;
+    deque<Pending*>    queue;
+    vector<thread>     workers;
+    bool               stopping;
+    uint64_t           nextId;
+
+    void workerLoop() {
+        vector<Pending*>       batch;
+        vector<PaymentRequest> reqs;
+        vector<bool>           approved;
+        while (true) {
+            {
+                unique_lock<mutex> g(lock);
+                while (queue.empty() && !stopping) ready.wait(g);
+                if (queue.empty()) return;      // stopping and drained
+                batch.clear();
+                while (!queue.empty() && batch.size() < maxBatch) {
+                    batch.push_back(queue.front());
+                    queue.pop_front();
+                }
+            }
+            reqs.clear();
+            for (size_t i = 0; i < batch.size(); ++i) reqs.push_back(batch[i]->req);
+            {
+                ScopedTimer timer(T_GATEWAY_BATCH);
+                gateway.chargeBatch(reqs, approved);
+            }
+            for (size_t i = 0; i < batch.size(); ++i) {
+                bool ok = approved[i];
+                Metrics::count(ok ? C_PAYMENTS_APPROVED : C_PAYMENTS_DECLINED);
+                if (batch[i]->onDone) ok = batch[i]->onDone(ok);
+                Metrics::record(T_PAYMENT, (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                    chrono::steady_clock::now() - batch[i]->submitted).count());
+                batch[i]->result.set_value(ok);
+                delete batch[i];
+            }
+        }
+    }
+
+public:
+    PaymentPipeline(PaymentGateway& gw, int workerCount, size_t batchSize)
+        : gateway(gw), maxBatch(batchSize > 0 ? batchSize : 1),
+          stopping(false), nextId(0)
+    {
+        for (int i = 0; i < workerCount; ++i) {
+            workers.push_back(thread(&PaymentPipeline::workerLoop, this));
+        }
+    }
+
+    // Drains outstanding charges, then stops the workers
+    ~PaymentPipeline() {
+        {
+            lock_guard<mutex> g(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+    }
+
+    future<bool> submit(Paisa amount, const string& card, Completion onDone) {
+        Pending* p = new Pending();
+        p->req.amount = amount;
+        p->req.card   = card;
+        p->onDone     = onDone;
+        p->submitted  = chrono::steady_clock::now();
+        future<bool> f = p->result.get_future();
+        {
+            lock_guard<mutex> g(lock);
+            p->req.id = ++nextId;
+            queue.push_back(p);
+        }
+        ready.notify_one();
+        return f;
+    }
+
+    // Refund a batch in one gateway round trip on the calling thread
+    // (bulk cancellation brings its own threads); returns how many went
+    // through
+    size_t refund(const vector<RefundRequest>& batch, vector<bool>& refunded) {
+        if (batch.empty()) { refunded.clear(); return 0; }
+        {
+            ScopedTimer timer(T_GATEWAY_BATCH);
+            gateway.refundBatch(batch, refunded);
+        }
+        size_t ok = (size_t)count(refunded.begin(), refunded.end(), true);
+        Metrics::count(C_REFUNDS_ISSUED, ok);
+        Metrics::count(C_REFUNDS_FAILED, batch.size() - ok);
+        return ok;
+    }
+};
+
+// Console front end for a payment: collects card details, hands the card
+// to submit (which starts the charge) and waits for its completion
+class PaymentProcessor {
+public:
+    static bool processPayment(Paisa amount,
+                               function<future<bool>(const string& card)> submit) {
+        cout << "\n=== Payment Processing ===\n";
+        cout << "Amount to pay: PKR " << formatRupees(amount) << "\n";
+
+        cout << "Enter card number: ";
+        string card; cin >> card;
+
+        cout << "Enter expiry date (MM/YY): ";
+        string exp;  cin >> exp;
+
+        cout << "Enter CVV: ";
+        string cvv;  cin >> cvv;
+
+        cout << "Processing";
+        future<bool> done = submit(card);
+        while (done.wait_for(chrono::milliseconds(200)) != future_status::ready) {
+            cout << ".";
+            cout.flush();
+        }
+        bool ok = done.get();
+        cout << (ok ? "\nPayment successful!\n" : "\nPayment not completed.\n");
+        return ok;
+    }
+};
+
+
+
+
+
+
+// CRC-32 (IEEE) used to detect torn or corrupt journal frames
+inline uint32_t crc32(const char* data, size_t len) {
+    // built once, thread-safely, by whichever thread gets here first
+    static const vector<uint32_t> table = [] {
+        vector<uint32_t> t(256);
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            t[i] = c;
+        }
+        return t;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+// Little-endian field encoder for journal records
+class RecordWriter {
+private:
+    string buf;
+
+public:
+    void u8(uint8_t v)   { buf.push_back((char)v); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; ++i) buf.push_back((char)(v >> (8 * i))); }
+    void u64(uint64_t v) { for (int i = 0; i < 8; ++i) buf.push_back((char)(v >> (8 * i))); }
+    void i32(int v)      { u32((uint32_t)v); }
+    void f64(double v)   { uint64_t b; memcpy(&b, &v, sizeof b); u64(b); }
+    void str(const string& s) { u32((uint32_t)s.size()); buf += s; }
+    void raw(const char* p, size_t n) { buf.append(p, n); }
+
+    const string& data() const { return buf; }
+    void clear() { buf.clear(); }
+};
+
+// Decoder matching RecordWriter; ok() turns false on a short read
+class RecordReader {
+private:
+    const char* p;
+    const char* end;
+    bool        good;
+
+    bool need(size_t n) {
+        if (!good || (size_t)(end - p) < n) { good = false; return false; }
+        return true;
+    }
+
+public:
+    RecordReader(const char* data, size_t len) : p(data), end(data + len), good(true) {}
+
+    bool ok() const { return good; }
+
+    uint8_t u8() { return need(1) ? (uint8_t)*p++ : 0; }
+    uint32_t u32() {
+        if (!need(4)) return 0;
+        uint32_t v = 0;
+        for (int i = 0; i < 4; ++i) v |= (uint32_t)(unsigned char)p[i] << (8 * i);
+        p += 4;
+        return v;
+    }
+    uint64_t u64() {
+        if (!need(8)) return 0;
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i) v |= (uint64_t)(unsigned char)p[i] << (8 * i);
+        p += 8;
+        return v;
+    }
+    int    i32() { return (int)u32(); }
+    double f64() { uint64_t b = u64(); double v; memcpy(&v, &b, sizeof v); return v; }
+    string str() {
+        uint32_t n = u32();
+        if (!need(n)) return string();
+        string s(p, n);
+        p += n;
+        return s;
+    }
+};
+
+// Kinds of mutation recorded in the journal (and in snapshots)
+enum JournalOp {
+    J_ADD_CATEGORY    = 1,   // catId, name
+    J_REMOVE_CATEGORY = 2,   // catId
+    J_RENAME_CATEGORY = 3,   // catId, name
+    J_ADD_SHOW_V1     = 4,   // catId, showId, title, dateTime, rows, cols, f64 price in PKR (older stores)
+    J_REMOVE_SHOW     = 5,   // catId, showId
+    J_EDIT_SHOW       = 6,   // catId, showId, title, dateTime
+    J_BOOK_SEAT_V1    = 7,   // "BKnnnnn" string id, showId, row, col (older stores)
+    J_BOOK_SEAT_V2    = 8,   // u64 bookingId, showId, row, col (older stores)
+    J_CANCEL_BOOKING_V1 = 9, // u64 bookingId (older stores)
+    J_ADD_SHOW        = 10,  // catId, showId, title, dateTime, rows, cols, u64 price in paisa
+    J_BOOK_SEAT_V3    = 11,  // u64 bookingId, showId, row, col, u64 fare in paisa (older stores)
+    J_ADD_LAYOUT      = 12,  // layoutId, spec
+    J_ADD_SHOW_IN_LAYOUT = 13,  // catId, showId, title, dateTime, layoutId, u64 price in paisa
+    J_BOOK_SEAT       = 14,  // u64 bookingId, showId, row, col, u64 fare in paisa, u64 unix time sold
+    J_CANCEL_BOOKING  = 15,  // u64 bookingId, u64 unix time cancelled
+    J_CANCEL_BATCH    = 16   // u64 unix time cancelled, u32 count, count x u64 bookingId
+};
+
+// Thin wrappers over the platform's unbuffered file API
+#ifdef _WIN32
+static int  fileOpenAppend(const string& path) {
+    return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_APPEND | _O_BINARY, _S_IREAD | _S_IWRITE);
+}
+static bool fileWrite(int fd, const string& data) {
+    return _write(fd, data.data(), (unsigned)data.size()) == (int)data.size();
+}
+static bool fileSync(int fd)  { return _commit(fd) == 0; }
+static void fileClose(int fd) { _close(fd); }
+static bool fileReplace(const string& from, const string& to) {
+    return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+static int  fileOpenAppend(const string& path) {
+    return open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+}
+static bool fileWrite(int fd, const string& data) {
+    size_t done = 0;
+    while (done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if (n <= 0) return false;
+        done += (size_t)n;
+    }
+    return true;
+}
+static bool fileSync(int fd)  { return fsync(fd) == 0; }
+static void fileClose(int fd) { close(fd); }
+static bool fileReplace(const string& from, const string& to) {
+    return rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+static bool fileExists(const string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (f) fclose(f);
+    return f != NULL;
+}
+
+// Write a whole file durably: temp file, fsync, then atomic replace
+static bool fileWriteAtomic(const string& path, const string& data) {
+    string tmp = path + ".tmp";
+    remove(tmp.c_str());
+    int fd = fileOpenAppend(tmp);
+    if (fd < 0) return false;
+    bool ok = fileWrite(fd, data) && fileSync(fd);
+    fileClose(fd);
+    return ok && fileReplace(tmp, path);
+}
+
+// Writes Metrics::prometheus() every few seconds, and once more when
+// stopped: to stdout for path "-", else replacing the file (so a
+// scraper never sees half a dump)
+class MetricsDumper {
+private:
+    string             path;
+    int                intervalMs;
+    mutex              lock;
+    condition_variable wake;
+    bool               stopping;
+    thread             worker;
+
+    void dump() {
+        string text = Metrics::prometheus();
+        if (path == "-") { cout << text; cout.flush(); }
+        else fileWriteAtomic(path, text);
+    }
+
+    void run() {
+        unique_lock<mutex> g(lock);
+        while (!stopping) {
+            wake.wait_for(g, chrono::milliseconds(intervalMs));
+            g.unlock();
+            dump();
+            g.lock();
+        }
+    }
+
+public:
+    MetricsDumper(const string& p, int seconds)
+        : path(p), intervalMs(max(1, seconds) * 1000), stopping(false),
+          worker(&MetricsDumper::run, this) {}
+
+    ~MetricsDumper() {
+        {
+            lock_guard<mutex> g(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    const char* bytes;
+    size_t      length;
+#ifdef _WIN32
+    HANDLE      file, mapping;
+#endif
+
+public:
+    MappedFile() : bytes(NULL), length(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                           NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER sz;
+        GetFileSizeEx(file, &sz);
+        length  = (size_t)sz.QuadPart;
+        mapping = length ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        bytes   = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        if (!bytes) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+        length = (size_t)st.st_size;
+        void* p = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) { length = 0; return false; }
+        bytes = (const char*)p;
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (bytes || length) { CloseHandle(mapping); CloseHandle(file); }
+#else
+        if (bytes) munmap((void*)bytes, length);
+#endif
+        bytes  = NULL;
+        length = 0;
+    }
+
+    const char* data() const { return bytes; }
+    size_t      size() const { return length; }
+};
+
+// Snapshot image: a flat, versioned dump of the catalog, seat blocks and
+// booking table in native (little-endian) layout. Sections are 8-byte
+// aligned and refer to each other by file offset, so a mapped image is
+// used in place: each Show points straight at its seat block and only
+// copies it on the first booking. Shows with nothing sold share one
+// block per layout.
+static const uint32_t IMAGE_VERSION    = 6;
+static const uint32_t IMAGE_BYTE_ORDER = 0x01020304;
+
+struct ImageHeader {
+    char     magic[8];          // "TBSIMG\0\0"
+    uint32_t version;
+    uint32_t byteOrder;         // IMAGE_BYTE_ORDER as written
+    uint64_t lsn;               // last journal record covered
+    int32_t  nextCategoryId;
+    int32_t  nextShowId;
+    uint64_t categoryCount, showCount, bookingCount;
+    uint64_t categoriesOff, showsOff, bookingsOff, stringsOff, seatsOff;
+    uint64_t fileSize;
+    // version 5+: defined venue layouts
+    uint64_t layoutCount, layoutsOff;
+};
+
+// Size of the header of an image of the given version
+inline size_t imageHeaderSize(uint32_t version) {
+    return version >= 5 ? sizeof(ImageHeader) : offsetof(ImageHeader, layoutCount);
+}
+
+struct ImageLayout {
+    int32_t  id;
+    uint32_t specLen;
+    uint64_t specOff;
+};
+
+struct ImageCategory {
+    int32_t  id;
+    uint32_t nameLen;
+    uint64_t nameOff;
+    uint64_t firstShow;         // index into the show table
+    uint64_t showCount;
+};
+
+struct ImageShow {
+    int32_t  id;
+    int32_t  rows, cols;
+    int32_t  freeSeats;
+    int64_t  price;             // paisa; version 3 and older: a double in PKR
+    uint64_t titleOff, dateTimeOff;
+    uint32_t titleLen, dateTimeLen;
+    uint64_t seatsOff;          // Show seat block
+    // version 3+: the parsed schedule, so loading never re-parses dates
+    int64_t  startsAt, endsAt;
+    int32_t  scheduleKind;
+    int32_t  layoutId;          // version 5+: defined layout, 0 for plain rows x cols
+};
+
+// Size of a show record in an image of the given version
+inline size_t imageShowSize(uint32_t version) {
+    return version >= 3 ? sizeof(ImageShow) : offsetof(ImageShow, startsAt);
+}
+
+struct ImageBooking {
+    uint64_t id;
+    int32_t  showId;
+    int32_t  row, col;
+    int32_t  reserved;
+    // version 4+: what the seat sold for
+    int64_t  fare;
+    // version 6+: when, unix seconds (0 if unknown)
+    int64_t  soldAt;
+};
+
+// Version 1 images stored the booking id as text
+struct ImageBookingV1 {
+    char     id[16];            // NUL-padded "BKnnnnn"
+    int32_t  showId;
+    int32_t  row, col;
+    int32_t  reserved;
+};
+
+// Size of a booking record in an image of the given version
+inline size_t imageBookingSize(uint32_t version) {
+    return version == 1 ? sizeof(ImageBookingV1)
+         : version >= 6 ? sizeof(ImageBooking)
+         : version >= 4 ? offsetof(ImageBooking, soldAt) : offsetof(ImageBooking, fare);
+}
+
+
+
+
+// Append-only binary write-ahead journal.
+// Frame: [u32 length][u64 lsn][payload][u32 crc32 of lsn+payload].
+// append() buffers a frame and hands back its LSN; sync() makes it durable.
+// Concurrent sync() callers share one write+fsync (group commit), and
+// setGroupCommit(n) lets a single writer fsync only every n records.
+// A tap (replication) sees every record as it is appended, in LSN order.
+class BookingJournal {
+public:
+    typedef function<void(uint64_t, const string&)> Tap;
+
+private:
+    string             path;
+    int                fd;
+    mutable mutex      lock;
+    condition_variable flushed;
+    string             buffer;        // frames not yet written
+    uint64_t           nextLsn;
+    uint64_t           durableLsn;
+    size_t             pending;       // records in buffer
+    size_t             groupSize;
+    bool               flushing;
+    uint64_t           syncCount;
+    bool               failed;        // a write or fsync failed; nothing after durableLsn is kept
+    Tap                tap;
+    vector<pair<uint64_t, string> > untapped;   // buffered records the tap sees once durable
+
+    // Write and fsync everything buffered up to lsn, then show it to the
+    // tap in order; caller holds g. False once a write or fsync has
+    // failed: a frame may be half written, so the journal takes nothing
+    // more after that.
+    bool syncLocked(unique_lock<mutex>& g, uint64_t lsn) {
+        while (durableLsn < lsn && !failed) {
+            if (flushing) { flushed.wait(g); continue; }
+            flushing = true;
+            string out;
+            out.swap(buffer);
+            vector<pair<uint64_t, string> > written;
+            written.swap(untapped);
+            uint64_t upto = nextLsn - 1;
+            pending = 0;
+            g.unlock();
+            bool ok = fd < 0 || out.empty() || (fileWrite(fd, out) && fileSync(fd));
+            g.lock();
+            if (ok) {
+                durableLsn = upto;
+                for (size_t i = 0; i < written.size() && tap; ++i) tap(written[i].first, written[i].second);
+            }
+            else failed = true;
+            ++syncCount;
+            flushing = false;
+            flushed.notify_all();
+        }
+        return durableLsn >= lsn;
+    }
+
+public:
+    BookingJournal()
+        : fd(-1), nextLsn(1), durableLsn(0), pending(0),
+          groupSize(1), flushing(false), syncCount(0), failed(false) {}
+
+    ~BookingJournal() { close(); }
+
+    // Open (or create) the journal; new records continue after lastLsn
+    bool open(const string& p, uint64_t lastLsn) {
+        close();
+        path = p;
+        fd = fileOpenAppend(path);
+        nextLsn    = lastLsn + 1;
+        durableLsn = lastLsn;
+        failed     = false;
+        return fd >= 0;
+    }
+
+    void close() {
+        if (fd < 0) return;
+        flush();
+        fileClose(fd);
+        fd = -1;
+    }
+
+    bool isOpen() const { return fd >= 0; }
+
+    // Whether a write or fsync has failed (disk full, I/O error)
+    bool hasFailed() const {
+        lock_guard<mutex> g(lock);
+        return failed;
+    }
+
+    // Records per fsync for a single writer (1 = every record is durable)
+    void setGroupCommit(size_t n) { groupSize = n > 0 ? n : 1; }
+
+    uint64_t lastLsn() const {
+        lock_guard<mutex> g(lock);
+        return nextLsn - 1;
+    }
+
+    uint64_t syncs() const {
+        lock_guard<mutex> g(lock);
+        return syncCount;
+    }
+
+    // Encode one frame onto out (also used for snapshot files)
+    static void frame(uint64_t lsn, const string& payload, string& out) {
+        RecordWriter f;
+        f.u32((uint32_t)(8 + payload.size()));
+        f.u64(lsn);
+        f.raw(payload.data(), payload.size());
+        f.u32(crc32(f.data().data() + 4, 8 + payload.size()));
+        out += f.data();
+    }
+
+    // Buffer one record; fsyncs once groupSize records are waiting.
+    // Returns its LSN, or 0 if the journal has failed (the record is
+    // then not kept, and no tap sees it).
+    uint64_t append(const string& payload) {
+        unique_lock<mutex> g(lock);
+        if (failed) return 0;
+        uint64_t lsn = nextLsn++;
+        frame(lsn, payload, buffer);
+        if (tap) untapped.push_back(make_pair(lsn, payload));
+        if (++pending >= groupSize && !syncLocked(g, lsn)) return 0;
+        return lsn;
+    }
+
+    // Install (or with NULL remove) the tap; returns the last LSN it
+    // will not see. It sees each later record once it is on disk.
+    uint64_t setTap(const Tap& t) {
+        lock_guard<mutex> g(lock);
+        tap = t;
+        return nextLsn - 1;
+    }
+
+    // Run capture(lsn) while appends are blocked, like rotate() but
+    // leaving the file alone
+    void capture(const function<void(uint64_t)>& f) {
+        lock_guard<mutex> g(lock);
+        f(nextLsn - 1);
+    }
+
+    // Block until the record with this LSN is on disk; false if it
+    // never will be
+    bool sync(uint64_t lsn) {
+        unique_lock<mutex> g(lock);
+        return syncLocked(g, lsn);
+    }
+
+    bool flush() {
+        unique_lock<mutex> g(lock);
+        return syncLocked(g, nextLsn - 1);
+    }
+
+    // Flush, move the current file aside to oldPath and start a fresh one.
+    // capture(lsn) runs while appends are blocked, so it sees exactly the
+    // state covered by records up to lsn. Refuses if oldPath still exists
+    // (the previous snapshot never completed and still needs it), and
+    // if the file cannot be moved or a fresh one opened; records then
+    // keep going to the file they went to before.
+    bool rotate(const string& oldPath, const function<void(uint64_t)>& capture) {
+        unique_lock<mutex> g(lock);
+        if (fileExists(oldPath) || !syncLocked(g, nextLsn - 1)) return false;
+#ifdef _WIN32
+        if (fd >= 0) fileClose(fd);     // Windows will not move an open file
+        fd = -1;
+#endif
+        if (!fileReplace(path, oldPath)) {
+            if (fd < 0) fd = fileOpenAppend(path);
+            return false;
+        }
+        int fresh = fileOpenAppend(path);
+        if (fresh < 0) {
+            if (fd < 0) fd = fileOpenAppend(oldPath);   // startup replays it
+            return false;
+        }
+        if (fd >= 0) fileClose(fd);
+        fd = fresh;
+        capture(nextLsn - 1);
+        return true;
+    }
+
+    // Feed every intact frame of a journal file to apply(lsn, reader).
+    // Stops at the first torn or corrupt frame; returns frames applied.
+    static size_t replay(const string& file,
+                         const function<void(uint64_t, RecordReader&)>& apply) {
+        FILE* f = fopen(file.c_str(), "rb");
+        if (!f) return 0;
+        vector<char> chunk(1 << 20);
+        string       data;
+        size_t       pos = 0, applied = 0;
+        bool         done = false;
+        while (!done) {
+            size_t n = fread(&chunk[0], 1, chunk.size(), f);
+            if (n == 0) break;
+            data.erase(0, pos);
+            pos = 0;
+            data.append(&chunk[0], n);
+            while (data.size() - pos >= 4) {
+                RecordReader hdr(data.data() + pos, 4);
+                uint32_t len = hdr.u32();
+                if (len < 8) { done = true; break; }
+                if (data.size() - pos < 4 + (size_t)len + 4) break;
+                const char* body = data.data() + pos + 4;
+                RecordReader tail(body + len, 4);
+                if (tail.u32() != crc32(body, len)) { done = true; break; }
+                RecordReader rec(body, len);
+                uint64_t lsn = rec.u64();
+                apply(lsn, rec);
+                ++applied;
+                pos += 4 + len + 4;
+            }
+        }
+        fclose(f);
+        return applied;
+    }
+};
+
+
+
+
+// Booking core: catalog, seats, holds, payments, bookings and durable
+// state. It does no console I/O; the console front end, the benchmarks
+// and the workload driver all go through its public API.
+class BookingEngine {
+private:
+    LayoutLibrary        layouts;       // venue layouts shows share; outlive the shows
+    ObjectPool<Show>     showPool;      // declared first: outlive everything below
+    ObjectPool<Category> categoryPool;
+    Reclaimer            reclaimer;     // unlinked shows, categories and text
+
+    // The catalog is read without locks under an Epoch::Guard; one
+    // writer at a time (catalogWrite) changes it and retires what it
+    // replaces, so nothing a reader found is freed under it.
+    PublishedArray<Category> categories;
+    PublishedArray<Show>     showsById;     // indexed by show id; NULL once removed
+    mutex             catalogWrite;
+    ScheduleIndex     schedule;       // every show by start time
+    SearchIndex       searchIndex;    // titles and category names, built on first search
+    atomic<bool>      searchReady;
+    mutex             searchBuild;
+    vector<MappedFile*> images;       // snapshot images shows may point into
+    BookingLog        bookings;
+    BookingIndex      bookingIndex;   // booking id -> record
+    BookingIdGenerator bookingIds;
+    HoldManager       holds;          // seats awaiting payment
+    WaitingRoom       onSaleLines;    // admission to seat selection for hot shows
+    PricingPolicy     pricing;        // every show's fares are compiled from it
+    SimulatedGateway  gateway;
+    PaymentPipeline   payments;
+    SalesColumns      sales;          // every sale and cancellation, by column, for reports
+    atomic<size_t>    cancelled;      // bookings cancelled since start
+    atomic<bool>      readOnly;       // a replica: state changes only come from its primary
+
+    static const int  HOLD_TTL_MS = 10 * 60 * 1000;   // seat hold while paying
+    static const int  GATEWAY_LATENCY_MS = 500;
+    static const int  PAYMENT_WORKERS    = 4;
+    static const int  PAYMENT_BATCH      = 32;
+    static const size_t CANCEL_BATCH     = 4096;  // bookings per cancel record and refund round trip
+    static const uint64_t SNAPSHOT_MIN = 100000;   // journal records before a snapshot
+
+    // Durable state: snapshot + journal tail under storePath.*
+    string            storePath;
+    BookingJournal    journal;
+    bool              replaying;
+    bool              bulkLoading;    // snapshot and search index wait for endBulkLoad
+    bool              searchWasReady;
+    atomic<int>       nextCategoryId;
+    atomic<int>       nextShowId;
+    atomic<uint64_t>  sinceSnapshot;
+    atomic<uint64_t>  snapshotAfter;  // grows with state so compaction stays amortized O(1)
+
+    string journalPath()    const { return storePath + ".journal"; }
+    string oldJournalPath() const { return storePath + ".journal.old"; }
+    string snapshotPath()   const { return storePath + ".snapshot"; }
+
+    // Journal a mutation (not while replaying one); may trigger a
+    // snapshot. False if the journal could not keep it (see
+    // journalFailed).
+    bool logRecord(const RecordWriter& w) {
+        if (replaying || !journal.isOpen()) return true;
+        if (!journal.append(w.data())) return false;
+        if (sinceSnapshot.fetch_add(1) + 1 == snapshotAfter.load() && !bulkLoading) {
+            takeSnapshot();
+        }
+        return true;
+    }
+
+    int categoryIndex(int catId) const {
+        PublishedArray<Category>::View all = categories.view();
+        for (size_t i = 0; i < all.size(); ++i) {
+            if (all[i]->getId() == catId) return (int)i;
+        }
+        return -1;
+    }
+
+    Show* findShow(int showId) const {
+        return showId < 0 ? NULL : showsById.get(showId);
+    }
+
+    // Unlogged mutations shared by the live path and journal replay
+    Category* doAddCategory(int catId, const string& name) {
+        Category* cat = categoryPool.create(catId, name, showPool, &reclaimer);
+        categories.push_back(cat);
+        nextCategoryId.store(max(nextCategoryId.load(), catId + 1));
+        if (searchReady.load()) searchIndex.addCategory(catId, name);
+        return cat;
+    }
+
+    void doRenameCategory(int idx, const string& name) {
+        Category* cat = categories.get(idx);
+        if (searchReady.load()) searchIndex.addCategory(cat->getId(), name);
+        cat->setName(name);
+    }
+
+    // No new holds (so no new sales) on a show being removed
+    void stopSales(Show* s) {
+        s->markRemoved();
+        holds.dropShow(s);
+    }
+
+    // Unlink a show everywhere but its category, and drop its holds
+    void forgetShow(Show* s) {
+        stopSales(s);
+        showsById.set(s->getId(), NULL);
+        schedule.remove(s, s->getShowTime());
+        if (searchReady.load()) searchIndex.removeShow(s->getId());
+    }
+
+    // The bookings of shows whose sales were stopped: once payments
+    // already past their hold have recorded theirs (they run inside an
+    // epoch guard), cancel and refund every one, a batch at a time.
+    // Journaled before the removal, so replay frees the seats and nets
+    // the sales in the same categories.
+    CancelResult cancelStopped(const vector<int>& showIds) {
+        Epoch::synchronize();
+        vector<uint64_t> ids = bookingsFor(showIds);
+        CancelResult r;
+        for (size_t i = 0; i < ids.size(); i += CANCEL_BATCH) {
+            cancelAndRefund(&ids[i], min((size_t)CANCEL_BATCH, ids.size() - i), r);
+        }
+        return r;
+    }
+
+    void doRemoveCategory(int idx) {
+        Category* cat = categories.get(idx);
+        PublishedArray<Show>::View shows = cat->allShows();
+        for (size_t i = 0; i < shows.size(); ++i) forgetShow(shows[i]);
+        if (searchReady.load()) searchIndex.removeCategory(cat->getId());
+        categories.erase(idx);
+        ObjectPool<Category>* pool = &categoryPool;
+        reclaimer.retire([pool, cat]() { pool->destroy(cat); });    // and its shows with it
+    }
+
+    Show* doAddShow(Category* cat, int showId, const string& t, const string& dt,
+                    const ShowTime& when, const VenueLayout* layout, Paisa price) {
+        Show* s = cat->addShow(showId, t, dt, when, layout, price);
+        s->setPricing(&pricing);
+        showsById.resize(showId + 1);
+        showsById.set(showId, s);
+        schedule.add(s);
+        if (searchReady.load()) searchIndex.addShow(showId, t);
+        nextShowId.store(max(nextShowId.load(), showId + 1));
+        return s;
+    }
+
+    void doRemoveShow(Category* cat, int idx) {
+        forgetShow(cat->getShow(idx));
+        cat->removeShow(idx);
+    }
+
+    void doEditShow(Category* cat, int idx, const string& t, const string& dt) {
+        Show* s = cat->getShow(idx);
+        ShowTime old = s->getShowTime();
+        if (searchReady.load()) searchIndex.addShow(s->getId(), t);
+        cat->editShow(idx, t, dt);
+        schedule.remove(s, old);
+        schedule.add(s);
+    }
+
+    // Position of a show inside cat, or -1 if it belongs elsewhere
+    int showSlot(Category* cat, int showId) const {
+        Show* s = findShow(showId);
+        return (s && cat->getShow(s->getSlot()) == s) ? s->getSlot() : -1;
+    }
+
+    // Apply one journal or snapshot record
+    // Adds already present are skipped: a snapshot or replication image
+    // can be taken after a catalog change but before its record, so it
+    // may hold what the records after its LSN add.
+    void applyRecord(RecordReader& r) {
+        int op = r.u8();
+        if (op == J_ADD_CATEGORY) {
+            int id = r.i32();
+            string name = r.str();
+            if (r.ok() && categoryIndex(id) < 0) doAddCategory(id, name);
+        }
+        else if (op == J_REMOVE_CATEGORY) {
+            int idx = categoryIndex(r.i32());
+            if (r.ok() && idx >= 0) doRemoveCategory(idx);
+        }
+        else if (op == J_RENAME_CATEGORY) {
+            int idx = categoryIndex(r.i32());
+            string name = r.str();
+            if (r.ok() && idx >= 0) doRenameCategory(idx, name);
+        }
+        else if (op == J_ADD_SHOW || op == J_ADD_SHOW_V1) {
+            int catIdx = categoryIndex(r.i32());
+            int id = r.i32();
+            string t = r.str(), dt = r.str();
+            int rows = r.i32(), cols = r.i32();
+            Paisa price = (op == J_ADD_SHOW) ? (Paisa)r.u64() : paisaFromRupees(r.f64());
+            if (r.ok() && catIdx >= 0 && !findShow(id)) {
+                doAddShow(categories.get(catIdx), id, t, dt, parseShowTime(dt),
+                          layouts.plain(rows, cols), price);
+            }
+        }
+        else if (op == J_ADD_SHOW_IN_LAYOUT) {
+            int catIdx = categoryIndex(r.i32());
+            int id = r.i32();
+            string t = r.str(), dt = r.str();
+            const VenueLayout* layout = layouts.get(r.i32());
+            Paisa price = (Paisa)r.u64();
+            if (r.ok() && catIdx >= 0 && layout && !findShow(id)) {
+                doAddShow(categories.get(catIdx), id, t, dt, parseShowTime(dt), layout, price);
+            }
+        }
+        else if (op == J_ADD_LAYOUT) {
+            int id = r.i32();
+            string spec = r.str(), error;
+            if (r.ok()) layouts.define(spec, error, NULL, id);
+        }
+        else if (op == J_REMOVE_SHOW) {
+            int catIdx = categoryIndex(r.i32());
+            int id = r.i32();
+            if (r.ok() && catIdx >= 0) {
+                int si = showSlot(categories.get(catIdx), id);
+                if (si >= 0) doRemoveShow(categories.get(catIdx), si);
+            }
+        }
+        else if (op == J_EDIT_SHOW) {
+            int catIdx = categoryIndex(r.i32());
+            int id = r.i32();
+            string t = r.str(), dt = r.str();
+            int si = catIdx >= 0 ? showSlot(categories.get(catIdx), id) : -1;
+            if (r.ok() && si >= 0) doEditShow(categories.get(catIdx), si, t, dt);
+        }
+        else if (op == J_BOOK_SEAT || op == J_BOOK_SEAT_V3 || op == J_BOOK_SEAT_V2 || op == J_BOOK_SEAT_V1) {
+            uint64_t id = (op == J_BOOK_SEAT_V1) ? parseBookingID(r.str()) : r.u64();
+            Show* s = findShow(r.i32());
+            int row = r.i32(), col = r.i32();
+            // older records did not keep the fare (the show's base price
+            // was it) or the time
+            Paisa   fare   = (op == J_BOOK_SEAT || op == J_BOOK_SEAT_V3) ? (Paisa)r.u64()
+                                                                        : (s ? s->getPrice() : 0);
+            int64_t soldAt = (op == J_BOOK_SEAT) ? (int64_t)r.u64() : 0;
+            // a seat already sold means the snapshot covered this booking
+            if (r.ok() && s && s->bookSeat(row, col)) {
+                restoreBooking(id, s, row, col, fare, soldAt);
+            }
+        }
+        else if (op == J_CANCEL_BOOKING || op == J_CANCEL_BOOKING_V1) {
+            uint64_t id = r.u64();
+            int64_t  at = (op == J_CANCEL_BOOKING) ? (int64_t)r.u64() : 0;
+            if (r.ok()) doCancelBooking(id, at);     // no-op if the snapshot already dropped it
+        }
+        else if (op == J_CANCEL_BATCH) {
+            int64_t  at = (int64_t)r.u64();
+            uint32_t n  = r.u32();
+            vector<uint64_t> ids;
+            ids.reserve(min((size_t)n, (size_t)1 << 20));
+            for (uint32_t i = 0; i < n && r.ok(); ++i) ids.push_back(r.u64());
+            if (r.ok() && !ids.empty()) doCancelBookings(&ids[0], ids.size(), at, NULL);
+        }
+    }
+
+    // Map a snapshot image and build the catalog on top of it without
+    // copying seat state. Returns the LSN it covers (0 if none/invalid).
+    uint64_t loadImage(const string& path) {
+        MappedFile* img = new MappedFile();
+        if (!img->open(path)) { delete img; return 0; }
+        const char* base = img->data();
+        size_t      size = img->size();
+        const ImageHeader* h = (const ImageHeader*)base;
+        bool ok = size >= imageHeaderSize(1)
+               && memcmp(h->magic, "TBSIMG\0\0", 8) == 0
+               && h->version >= 1 && h->version <= IMAGE_VERSION
+               && size >= imageHeaderSize(h->version)
+               && h->byteOrder == IMAGE_BYTE_ORDER
+               && h->fileSize == size
+               && h->categoriesOff + h->categoryCount * sizeof(ImageCategory) <= size
+               && h->showsOff + h->showCount * imageShowSize(h->version) <= size
+               && h->bookingsOff + h->bookingCount * imageBookingSize(h->version) <= size
+               && (h->version < 5 || h->layoutsOff + h->layoutCount * sizeof(ImageLayout) <= size);
+        // layouts first: shows refer to them by number
+        if (ok && h->version >= 5) {
+            const ImageLayout* ls = (const ImageLayout*)(base + h->layoutsOff);
+            for (uint64_t i = 0; ok && i < h->layoutCount; ++i) {
+                string error;
+                ok = ls[i].specOff + ls[i].specLen <= size
+                  && layouts.define(string(base + ls[i].specOff, ls[i].specLen), error, NULL, ls[i].id);
+            }
+        }
+        const ImageCategory* cats  = (const ImageCategory*)(base + h->categoriesOff);
+        const char*          shows = base + h->showsOff;
+        size_t               showSize = imageShowSize(h->version);
+        for (uint64_t i = 0; ok && i < h->showCount; ++i) {
+            const ImageShow& s = *(const ImageShow*)(shows + i * showSize);
+            const VenueLayout* l = (h->version >= 5 && s.layoutId) ? layouts.get(s.layoutId) : NULL;
+            ok = s.rows > 0 && s.cols > 0
+              && (h->version < 5 || !s.layoutId || (l && l->getRows() == s.rows && l->getCols() == s.cols))
+              && s.titleOff + s.titleLen <= size && s.dateTimeOff + s.dateTimeLen <= size
+              && s.seatsOff % 8 == 0
+              && (h->version < 3 || (s.scheduleKind >= SCHEDULE_TBA && s.scheduleKind <= SCHEDULE_DAILY))
+              && s.seatsOff + SeatBlock::words(s.rows, s.cols) * 8 <= size;
+        }
+        for (uint64_t i = 0; ok && i < h->categoryCount; ++i) {
+            ok = cats[i].nameOff + cats[i].nameLen <= size
+              && cats[i].firstShow + cats[i].showCount <= h->showCount;
+        }
+        if (!ok) {
+            cerr << "Ignoring invalid snapshot image " << path << "\n";
+            delete img;
+            return 0;
+        }
+
+        showsById.resize(h->nextShowId);
+        for (uint64_t i = 0; i < h->categoryCount; ++i) {
+            Category* cat = doAddCategory(cats[i].id, string(base + cats[i].nameOff, cats[i].nameLen));
+            cat->reserve(cats[i].showCount);
+            for (uint64_t j = 0; j < cats[i].showCount; ++j) {
+                const ImageShow& s = *(const ImageShow*)(shows + (cats[i].firstShow + j) * showSize);
+                ShowTime st;
+                if (h->version >= 3) {
+                    st.kind  = (ScheduleKind)s.scheduleKind;
+                    st.start = (time_t)s.startsAt;
+                    st.end   = (time_t)s.endsAt;
+                } else {
+                    st = parseShowTime(string(base + s.dateTimeOff, s.dateTimeLen));
+                }
+                Paisa price = s.price;
+                if (h->version < 4) {
+                    double pkr;
+                    memcpy(&pkr, &s.price, sizeof pkr);
+                    price = paisaFromRupees(pkr);
+                }
+                const VenueLayout* layout = (h->version >= 5 && s.layoutId)
+                    ? layouts.get(s.layoutId) : layouts.plain(s.rows, s.cols);
+                Show* show = cat->addShow(showPool.create(s.id,
+                    base + s.titleOff, s.titleLen,
+                    base + s.dateTimeOff, s.dateTimeLen, st,
+                    s.rows, s.cols, layout, price,
+                    (const uint64_t*)(base + s.seatsOff), s.freeSeats));
+                show->setPricing(&pricing);
+                showsById.resize(s.id + 1);
+                showsById.set(s.id, show);
+                schedule.add(show);
+            }
+        }
+        nextCategoryId.store(max(nextCategoryId.load(), (int)h->nextCategoryId));
+        nextShowId.store(max(nextShowId.load(), (int)h->nextShowId));
+
+        if (h->version == 1) {
+            const ImageBookingV1* bk = (const ImageBookingV1*)(base + h->bookingsOff);
+            for (uint64_t i = 0; i < h->bookingCount; ++i) {
+                Show* s = findShow(bk[i].showId);
+                if (!s) continue;
+                string id(bk[i].id, strnlen(bk[i].id, sizeof bk[i].id));
+                restoreBooking(parseBookingID(id), s, bk[i].row, bk[i].col, s->getPrice(), 0);
+            }
+        } else {
+            const char* bk     = base + h->bookingsOff;
+            size_t      stride = imageBookingSize(h->version);
+            for (uint64_t i = 0; i < h->bookingCount; ++i) {
+                const ImageBooking& b = *(const ImageBooking*)(bk + i * stride);
+                Show* s = findShow(b.showId);
+                if (s) restoreBooking(b.id, s, b.row, b.col, h->version >= 4 ? b.fare : s->getPrice(),
+                                      h->version >= 6 ? b.soldAt : 0);
+            }
+        }
+        images.push_back(img);
+        return h->lsn;
+    }
+
+    // Load the latest snapshot image, then replay the journal tail after
+    // it. Returns false if there was no saved state at all.
+    bool recover() {
+        replaying = true;
+        uint64_t last = loadImage(snapshotPath());
+        const string tails[2] = { oldJournalPath(), journalPath() };
+        for (int i = 0; i < 2; ++i) {
+            BookingJournal::replay(tails[i], [&](uint64_t lsn, RecordReader& r) {
+                if (lsn <= last) return;    // already in the snapshot
+                last = lsn;
+                applyRecord(r);
+            });
+        }
+        replaying = false;
+        journal.open(journalPath(), last);
+        return last > 0;
+    }
+
+    // Build a snapshot image of the state covered by journal record lsn.
+    // Seat blocks are derived from the booking table (held seats come back
+    // free), so the image is consistent even while bookings are in flight.
+    // Works from one view of the catalog, so an admin edit meanwhile
+    // cannot make the counts disagree with the lists.
+    string encodeImage(uint64_t lsn) {
+        Epoch::Guard guard;
+        PublishedArray<Category>::View catalog = categories.view();
+        vector<size_t> counts(catalog.size());
+        vector<Show*>  order;
+        int            idLimit = nextShowId.load();
+        for (size_t i = 0; i < catalog.size(); ++i) {
+            PublishedArray<Show>::View shows = catalog[i]->allShows();
+            counts[i] = shows.size();
+            for (size_t j = 0; j < shows.size(); ++j) {
+                order.push_back(shows[j]);
+                idLimit = max(idLimit, shows[j]->getId() + 1);
+            }
+        }
+
+        ImageHeader h;
+        memset(&h, 0, sizeof h);
+        memcpy(h.magic, "TBSIMG\0\0", 8);
+        h.version        = IMAGE_VERSION;
+        h.byteOrder      = IMAGE_BYTE_ORDER;
+        h.lsn            = lsn;
+        h.nextCategoryId = nextCategoryId;
+        h.nextShowId     = idLimit;
+        h.categoryCount  = catalog.size();
+        h.showCount      = order.size();
+
+        // string pool
+        string strings;
+        vector<ImageCategory> cats(catalog.size());
+        vector<ImageShow>     shows(order.size());
+        size_t first = 0;
+        for (size_t i = 0; i < catalog.size(); ++i) {
+            string name = catalog[i]->getName();
+            cats[i].id        = catalog[i]->getId();
+            cats[i].nameLen   = (uint32_t)name.size();
+            cats[i].nameOff   = strings.size();
+            cats[i].firstShow = first;
+            cats[i].showCount = counts[i];
+            first += counts[i];
+            strings += name;
+        }
+
+        vector<const VenueLayout*> named = layouts.all();
+        vector<ImageLayout> layoutTable(named.size());
+        for (size_t i = 0; i < named.size(); ++i) {
+            layoutTable[i].id      = named[i]->getId();
+            layoutTable[i].specLen = (uint32_t)named[i]->getSpec().size();
+            layoutTable[i].specOff = strings.size();
+            strings += named[i]->getSpec();
+        }
+        h.layoutCount = named.size();
+
+        // seat blocks: a show with something sold gets its own, copied
+        // from its layout; the rest share their layout's pristine block
+        vector<char> sold(idLimit, 0);
+        bookings.forEach([&](const Booking& b) {
+            if (b.active() && b.showId >= 0 && b.showId < idLimit) sold[b.showId] = 1;
+        });
+        vector<size_t> blockAt(idLimit, 0);
+        vector<int>    slotOf(idLimit, -1);
+        vector<const VenueLayout*> layoutOf(order.size());
+        map<const VenueLayout*, size_t> pristineAt;
+        size_t seatWords = 0;
+        for (size_t i = 0; i < order.size(); ++i) {
+            Show* s = order[i];
+            string title = s->getTitle(), dt = s->getDateTime();
+            ImageShow& e = shows[i];
+            memset(&e, 0, sizeof e);
+            e.id = s->getId(); e.rows = s->getRows(); e.cols = s->getCols();
+            e.freeSeats = s->getCapacity();
+            e.price     = s->getPrice();
+            e.titleOff  = strings.size(); e.titleLen = (uint32_t)title.size(); strings += title;
+            e.dateTimeOff = strings.size(); e.dateTimeLen = (uint32_t)dt.size(); strings += dt;
+            e.scheduleKind = s->getShowTime().kind;
+            e.startsAt     = s->getShowTime().start;
+            e.endsAt       = s->getShowTime().end;
+            layoutOf[i] = s->getLayout() ? s->getLayout() : layouts.plain(e.rows, e.cols);
+            e.layoutId  = layoutOf[i]->getId();
+            slotOf[e.id] = (int)i;
+            if (sold[e.id]) {
+                blockAt[e.id] = seatWords;
+                seatWords += SeatBlock::words(e.rows, e.cols);
+            } else {
+                map<const VenueLayout*, size_t>::iterator it = pristineAt.find(layoutOf[i]);
+                if (it == pristineAt.end()) {
+                    it = pristineAt.insert(make_pair(layoutOf[i], seatWords)).first;
+                    seatWords += SeatBlock::words(e.rows, e.cols);
+                }
+                blockAt[e.id] = it->second;
+            }
+        }
+        vector<uint64_t> seats(seatWords);
+        for (size_t i = 0; i < order.size(); ++i) {
+            size_t words = SeatBlock::words(shows[i].rows, shows[i].cols);
+            memcpy(&seats[blockAt[shows[i].id]], layoutOf[i]->pristineBlock(), words * sizeof(uint64_t));
+        }
+
+        vector<ImageBooking> table;
+        table.reserve(bookings.size());
+        bookings.forEach([&](const Booking& b) {
+            if (!b.active() || !findShow(b.showId)) return;     // cancelled, or show removed
+            if (b.showId >= idLimit || slotOf[b.showId] < 0) return;
+            ImageShow& e = shows[slotOf[b.showId]];
+            if (!SeatBlock::sell(&seats[blockAt[b.showId]], e.rows, e.cols, b.row, b.col)) {
+                return;
+            }
+            --e.freeSeats;
+            ImageBooking ib;
+            memset(&ib, 0, sizeof ib);
+            ib.id = b.id;
+            ib.showId = b.showId; ib.row = b.row; ib.col = b.col;
+            ib.fare = b.fare;
+            ib.soldAt = b.soldAt;
+            table.push_back(ib);
+        });
+        h.bookingCount = table.size();
+
+        // lay the sections out, 8-byte aligned
+        size_t off = (sizeof h + 7) & ~(size_t)7;
+        h.categoriesOff = off; off += cats.size() * sizeof(ImageCategory);
+        h.showsOff      = off; off += shows.size() * sizeof(ImageShow);
+        h.bookingsOff   = off; off += table.size() * sizeof(ImageBooking);
+        h.layoutsOff    = off; off += layoutTable.size() * sizeof(ImageLayout);
+        h.stringsOff    = off; off += strings.size();
+        off = (off + 7) & ~(size_t)7;
+        h.seatsOff      = off; off += seats.size() * sizeof(uint64_t);
+        h.fileSize      = off;
+        for (size_t i = 0; i < cats.size(); ++i)  cats[i].nameOff += h.stringsOff;
+        for (size_t i = 0; i < layoutTable.size(); ++i) layoutTable[i].specOff += h.stringsOff;
+        for (size_t i = 0; i < shows.size(); ++i) {
+            shows[i].titleOff    += h.stringsOff;
+            shows[i].dateTimeOff += h.stringsOff;
+            shows[i].seatsOff     = h.seatsOff + blockAt[shows[i].id] * sizeof(uint64_t);
+        }
+
+        string out(h.fileSize, '\0');
+        memcpy(&out[0], &h, sizeof h);
+        if (!cats.empty())    memcpy(&out[h.categoriesOff], &cats[0], cats.size() * sizeof(ImageCategory));
+        if (!shows.empty())   memcpy(&out[h.showsOff], &shows[0], shows.size() * sizeof(ImageShow));
+        if (!table.empty())   memcpy(&out[h.bookingsOff], &table[0], table.size() * sizeof(ImageBooking));
+        if (!layoutTable.empty()) {
+            memcpy(&out[h.layoutsOff], &layoutTable[0], layoutTable.size() * sizeof(ImageLayout));
+        }
+        if (!strings.empty()) memcpy(&out[h.stringsOff], strings.data(), strings.size());
+        if (!seats.empty())   memcpy(&out[h.seatsOff], &seats[0], seats.size() * sizeof(uint64_t));
+        return out;
+    }
+
+    // Cancel an active booking and free its seat (unlogged); at is when
+    bool doCancelBooking(uint64_t id, int64_t at) { return doCancelBookings(&id, 1, at, NULL) == 1; }
+
+    // Cancel the active bookings among ids (unlogged). Their seats are
+    // freed by show and row, a run of adjacent seats at a time; the
+    // bookings cancelled are appended to *done.
+    size_t doCancelBookings(const uint64_t* ids, size_t n, int64_t at, vector<Booking*>* done) {
+        Epoch::Guard guard;
+        vector<Booking*> hit;
+        hit.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            Booking* b = bookingIndex.find(ids[i]);
+            int32_t expected = BOOKING_ACTIVE;
+            if (!b || !b->state.compare_exchange_strong(expected, BOOKING_CANCELLED)) continue;
+            bookingIndex.erase(ids[i]);
+            hit.push_back(b);
+        }
+        sort(hit.begin(), hit.end(), [](const Booking* a, const Booking* b) {
+            if (a->showId != b->showId) return a->showId < b->showId;
+            return a->row != b->row ? a->row < b->row : a->col < b->col;
+        });
+        Show* s = NULL;
+        for (size_t i = 0, j; i < hit.size(); i = j) {
+            const Booking* first = hit[i];
+            if (i == 0 || hit[i-1]->showId != first->showId) s = findShow(first->showId);
+            for (j = i + 1; j < hit.size() && hit[j]->showId == first->showId && hit[j]->row == first->row
+                            && hit[j]->col == hit[j-1]->col + 1; ++j) {}
+            if (s) s->refundSeats(first->row, first->col, (int)(j - i));
+            int catId = s ? s->getCategoryId() : -1;
+            for (size_t k = i; k < j; ++k) {
+                sales.cancelled(hit[k]->showId, catId, hit[k]->row, hit[k]->col, hit[k]->fare, at);
+            }
+        }
+        cancelled.fetch_add(hit.size(), memory_order_relaxed);
+        if (done) done->insert(done->end(), hit.begin(), hit.end());
+        return hit.size();
+    }
+
+    // Re-add a booking found in a snapshot or the journal
+    void restoreBooking(uint64_t id, Show* s, int r, int c, Paisa fare, int64_t soldAt) {
+        bookingIndex.insert(id, bookings.append(id, s->getId(), r, c, fare, soldAt));
+        sales.sold(s->getId(), s->getCategoryId(), r, c, fare, soldAt);
+        bookingIds.observe(id);
+    }
+
+public:
+    // Restores saved state from storePath.* or seeds the default catalog.
+    // Every show is priced by policy.
+    BookingEngine(const string& store = "booking",
+                  int gatewayLatencyMs = GATEWAY_LATENCY_MS,
+                  const PricingPolicy& policy = PricingPolicy::standard())
+        : searchReady(false), holds(HOLD_TTL_MS), pricing(policy),
+          gateway(gatewayLatencyMs, 0.0),
+          payments(gateway, PAYMENT_WORKERS, PAYMENT_BATCH), cancelled(0), readOnly(false),
+          storePath(store), replaying(false), bulkLoading(false), searchWasReady(false),
+          nextCategoryId(1), nextShowId(1), sinceSnapshot(0),
+          snapshotAfter(SNAPSHOT_MIN)
+    {
+        if (!recover()) {
+            journal.setGroupCommit(1000);
+            loadDefaultCatalog();
+            journal.flush();
+            journal.setGroupCommit(1);
+        }
+        snapshotAfter.store(max((uint64_t)SNAPSHOT_MIN, (uint64_t)bookings.size()));
+    }
+
+    ~BookingEngine() {
+        journal.close();
+        reclaimer.drain();
+        PublishedArray<Category>::View all = categories.view();
+        for (size_t i = 0; i < all.size(); ++i) {
+            categoryPool.destroy(all[i]);
+        }
+        for (size_t i = 0; i < images.size(); ++i) {
+            delete images[i];
+        }
+    }
+
+    // Records per journal fsync for single-threaded bulk work
+    void setJournalGroupCommit(size_t n) { journal.setGroupCommit(n); }
+    // False if the journal could not be written (disk full, I/O error)
+    bool flushJournal()                  { return journal.flush(); }
+    uint64_t journalLsn() const          { return journal.lastLsn(); }
+
+    // Replication. A primary ships its journal: the tap sees every record
+    // after the returned LSN, in order, and replicationImage encodes the
+    // state covered by records up to *lsn for a replica to start from.
+    uint64_t shipJournal(const BookingJournal::Tap& tap) { return journal.setTap(tap); }
+
+    string replicationImage(uint64_t& lsn) {
+        string image;
+        journal.capture([&](uint64_t at) { lsn = at; image = encodeImage(at); });
+        return image;
+    }
+
+    // On a replica: apply and journal (under the same LSN) one record
+    // shipped by the primary. False unless it is the next one.
+    bool applyShipped(uint64_t lsn, const char* payload, size_t len) {
+        lock_guard<mutex> g(catalogWrite);
+        if (lsn != journal.lastLsn() + 1 || journal.hasFailed()) return false;
+        RecordReader r(payload, len);
+        replaying = true;
+        applyRecord(r);
+        replaying = false;
+        if (!journal.append(string(payload, len))) return false;
+        if (sinceSnapshot.fetch_add(1) + 1 == snapshotAfter.load() && !bulkLoading) takeSnapshot();
+        return true;
+    }
+
+    // Replicas are read-only until promoted; the front ends check this
+    // (as is an engine whose journal failed)
+    void setReadOnly(bool on) { readOnly.store(on); }
+    bool isReadOnly() const   { return readOnly.load() || journal.hasFailed(); }
+
+    // The journal could not be written, so changes would be lost: the
+    // engine refuses them until restarted
+    bool journalFailed() const { return journal.hasFailed(); }
+
+    // Write a compact snapshot and drop the journal it covers
+    bool takeSnapshot() {
+        string image;
+        if (!journal.rotate(oldJournalPath(), [&](uint64_t lsn) {
+                image = encodeImage(lsn);
+            })) {
+            return false;
+        }
+        sinceSnapshot.store(0);
+        snapshotAfter.store(max((uint64_t)SNAPSHOT_MIN, (uint64_t)bookings.size()));
+        if (!fileWriteAtomic(snapshotPath(), image)) return false;
+        remove(oldJournalPath().c_str());
+        return true;
+    }
+
+    // Catalog mutations (journaled). Readers never wait for them; they
+    // wait only for each other.
+    Category* addCategory(const string& name) {
+        lock_guard<mutex> g(catalogWrite);
+        Category* cat = doAddCategory(nextCategoryId, name);
+        RecordWriter w;
+        w.u8(J_ADD_CATEGORY); w.i32(cat->getId()); w.str(name);
+        logRecord(w);
+        return cat;
+    }
+
+    // Remove a category and its shows. Their sales stop first, then
+    // every booking they had is cancelled and refunded (see *cancelled).
+    // Not from inside an Epoch::Guard.
+    bool removeCategory(int idx, CancelResult* cancelled = NULL) {
+        int catId;
+        vector<int> showIds;
+        {
+            lock_guard<mutex> g(catalogWrite);
+            if (idx < 0 || idx >= (int)categories.size() || journalFailed()) return false;
+            Category* cat = categories.get(idx);
+            catId = cat->getId();
+            PublishedArray<Show>::View shows = cat->allShows();
+            for (size_t i = 0; i < shows.size(); ++i) {
+                stopSales(shows[i]);
+                showIds.push_back(shows[i]->getId());
+            }
+        }
+        CancelResult r = cancelStopped(showIds);
+        if (cancelled) *cancelled = r;
+        lock_guard<mutex> g(catalogWrite);
+        idx = categoryIndex(catId);
+        if (idx < 0) return true;           // removed meanwhile
+        RecordWriter w;
+        w.u8(J_REMOVE_CATEGORY); w.i32(catId);
+        doRemoveCategory(idx);
+        logRecord(w);
+        return true;
+    }
+
+    bool renameCategory(int idx, const string& name) {
+        lock_guard<mutex> g(catalogWrite);
+        if (idx < 0 || idx >= (int)categories.size() || journalFailed()) return false;
+        doRenameCategory(idx, name);
+        RecordWriter w;
+        w.u8(J_RENAME_CATEGORY); w.i32(categories.get(idx)->getId()); w.str(name);
+        logRecord(w);
+        return true;
+    }
+
+    // Venue layouts. A spec is "RxC" then ';'-separated clauses:
+    // "aisle C,..", "blocked R:C[-C],..", "accessible R:C[-C],.." and
+    // "class R1-R2 NAME PCT%". Defining the same spec twice returns the
+    // first; NULL with error if it does not parse.
+    const VenueLayout* defineLayout(const string& spec, string& error) {
+        lock_guard<mutex> g(catalogWrite);
+        bool added = false;
+        const VenueLayout* l = layouts.define(spec, error, &added);
+        if (added) {
+            RecordWriter w;
+            w.u8(J_ADD_LAYOUT); w.i32(l->getId()); w.str(l->getSpec());
+            logRecord(w);
+        }
+        return l;
+    }
+
+    const VenueLayout* plainLayout(int rows, int cols) { return layouts.plain(rows, cols); }
+    const VenueLayout* findLayout(int id) const        { return layouts.get(id); }
+    vector<const VenueLayout*> definedLayouts() const  { return layouts.all(); }
+
+    Show* addShow(Category* cat, const string& t, const string& dt,
+                  int rows, int cols, Paisa price) {
+        return addShow(cat, t, dt, parseShowTime(dt), rows, cols, price);
+    }
+
+    // Same, with dt already parsed into when
+    Show* addShow(Category* cat, const string& t, const string& dt, const ShowTime& when,
+                  int rows, int cols, Paisa price) {
+        return addShow(cat, t, dt, when, layouts.plain(rows, cols), price);
+    }
+
+    // Show in a venue layout (plain or defined)
+    Show* addShow(Category* cat, const string& t, const string& dt, const ShowTime& when,
+                  const VenueLayout* layout, Paisa price) {
+        lock_guard<mutex> g(catalogWrite);
+        Show* s = doAddShow(cat, nextShowId, t, dt, when, layout, price);
+        RecordWriter w;
+        if (layout->getId() == 0) {
+            w.u8(J_ADD_SHOW); w.i32(cat->getId()); w.i32(s->getId());
+            w.str(t); w.str(dt); w.i32(layout->getRows()); w.i32(layout->getCols());
+        } else {
+            w.u8(J_ADD_SHOW_IN_LAYOUT); w.i32(cat->getId()); w.i32(s->getId());
+            w.str(t); w.str(dt); w.i32(layout->getId());
+        }
+        w.u64((uint64_t)price);
+        logRecord(w);
+        return s;
+    }
+
+    // Bracket a large batch of catalog additions. In between, shows are
+    // journaled as usual but neither trigger snapshots nor touch the
+    // search index; endBulkLoad rebuilds the index once (if it had been
+    // built) and compacts the journal into one snapshot. The catalog
+    // changes, like every other, from one thread at a time.
+    void beginBulkLoad(size_t expectedShows = 0) {
+        bulkLoading    = true;
+        searchWasReady = searchReady.load();
+        if (searchWasReady) {
+            lock_guard<mutex> g(searchBuild);
+            searchReady.store(false);
+            searchIndex.clear();
+        }
+        if (expectedShows) showsById.reserve(nextShowId + expectedShows);
+    }
+
+    void endBulkLoad() {
+        bulkLoading = false;
+        if (searchWasReady) buildSearchIndex();
+        journal.flush();
+        if (journal.isOpen() && sinceSnapshot.load() > 0) takeSnapshot();
+    }
+
+    // Remove a show, cancelling and refunding its bookings first as
+    // removeCategory does. Not from inside an Epoch::Guard.
+    bool removeShow(Category* cat, int idx, CancelResult* cancelled = NULL) {
+        int showId;
+        {
+            lock_guard<mutex> g(catalogWrite);
+            Show* s = cat->getShow(idx);
+            if (!s || journalFailed()) return false;
+            showId = s->getId();
+            stopSales(s);
+        }
+        CancelResult r = cancelStopped(vector<int>(1, showId));
+        if (cancelled) *cancelled = r;
+        lock_guard<mutex> g(catalogWrite);
+        idx = showSlot(cat, showId);
+        if (idx < 0) return true;           // removed meanwhile
+        RecordWriter w;
+        w.u8(J_REMOVE_SHOW); w.i32(cat->getId()); w.i32(showId);
+        doRemoveShow(cat, idx);
+        logRecord(w);
+        return true;
+    }
+
+    bool editShow(Category* cat, int idx, const string& t, const string& dt) {
+        lock_guard<mutex> g(catalogWrite);
+        Show* s = cat->getShow(idx);
+        if (!s || journalFailed()) return false;
+        doEditShow(cat, idx, t, dt);
+        RecordWriter w;
+        w.u8(J_EDIT_SHOW); w.i32(cat->getId()); w.i32(s->getId());
+        w.str(t); w.str(dt);
+        logRecord(w);
+        return true;
+    }
+
+    // Record a successful booking of a seat sold for fare. The record
+    // joins the in-memory log before the journal so a snapshot never
+    // misses a journaled booking. False if the journal did not keep it.
+    bool addBookingRecord(uint64_t id, Show* s, int r, int c, Paisa fare) {
+        int64_t now = (int64_t)time(NULL);
+        bookingIndex.insert(id, bookings.append(id, s->getId(), r, c, fare, now));
+        sales.sold(s->getId(), s->getCategoryId(), r, c, fare, now);
+        RecordWriter w;
+        w.u8(J_BOOK_SEAT); w.u64(id); w.i32(s->getId()); w.i32(r); w.i32(c);
+        w.u64((uint64_t)fare); w.u64((uint64_t)now);
+        return logRecord(w);
+    }
+
+    // Next unique booking ID (cheap from any thread)
+    uint64_t generateBookingID() {
+        ScopedTimer timer(T_BOOKING_ID);
+        return bookingIds.next();
+    }
+
+    // O(1) lookup by booking id; NULL if unknown
+    Booking* findBooking(uint64_t id) { return bookingIndex.find(id); }
+
+    // Bookings still active
+    size_t bookingCount() const { return bookings.size() - cancelled.load(memory_order_relaxed); }
+
+    // Visit every active booking in the order it was made
+    template <typename Visit>
+    void forEachBooking(Visit visit) const {
+        bookings.forEach([&](const Booking& b) { if (b.active()) visit(b); });
+    }
+
+    // Cancel a booking and free its seat; false if unknown or already cancelled
+    bool cancelBooking(uint64_t id) {
+        int64_t now = (int64_t)time(NULL);
+        if (journalFailed() || !doCancelBooking(id, now)) return false;
+        Metrics::count(C_BOOKINGS_CANCELLED);
+        RecordWriter w;
+        w.u8(J_CANCEL_BOOKING); w.u64(id); w.u64((uint64_t)now);
+        logRecord(w);
+        return true;
+    }
+
+    // Cancel a batch of bookings together: seats are freed a run at a
+    // time and one journal record covers the batch. Unknown or already
+    // cancelled ids are skipped; the refund owed for each booking
+    // cancelled is appended to refunds. Returns how many were cancelled.
+    size_t cancelBookings(const uint64_t* ids, size_t n, vector<RefundRequest>& refunds) {
+        int64_t now = (int64_t)time(NULL);
+        vector<Booking*> done;
+        if (journalFailed() || doCancelBookings(ids, n, now, &done) == 0) return 0;
+        Metrics::count(C_BOOKINGS_CANCELLED, done.size());
+        RecordWriter w;
+        w.u8(J_CANCEL_BATCH); w.u64((uint64_t)now); w.u32((uint32_t)done.size());
+        for (size_t i = 0; i < done.size(); ++i) {
+            w.u64(done[i]->id);
+            RefundRequest r = { done[i]->id, done[i]->fare };
+            refunds.push_back(r);
+        }
+        logRecord(w);
+        return done.size();
+    }
+
+    // Pay refunds back in one gateway round trip; the booking ids of any
+    // it refuses go to failed. Returns the amount refunded.
+    Paisa refund(const vector<RefundRequest>& batch, vector<uint64_t>& failed) {
+        vector<bool> ok;
+        payments.refund(batch, ok);
+        Paisa total = 0;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (ok[i]) total += batch[i].amount;
+            else       failed.push_back(batch[i].bookingId);
+        }
+        return total;
+    }
+
+    // Cancel one batch and refund it, adding what happened to result
+    void cancelAndRefund(const uint64_t* ids, size_t n, CancelResult& result) {
+        vector<RefundRequest> refunds;
+        result.bookings += cancelBookings(ids, n, refunds);
+        result.refunded += refund(refunds, result.refundFailed);
+        ++result.batches;
+    }
+
+    // Ids of the active bookings for these shows (also removed ones), a
+    // show's together and in booking order
+    vector<uint64_t> bookingsFor(const vector<int>& showIds) const {
+        vector<char> wanted;
+        for (size_t i = 0; i < showIds.size(); ++i) {
+            if (showIds[i] < 0) continue;
+            if ((size_t)showIds[i] >= wanted.size()) wanted.resize(showIds[i] + 1, 0);
+            wanted[showIds[i]] = 1;
+        }
+        vector<pair<int, uint64_t> > picked;
+        forEachBooking([&](const Booking& b) {
+            if ((size_t)b.showId < wanted.size() && wanted[b.showId]) picked.push_back(make_pair(b.showId, b.id));
+        });
+        stable_sort(picked.begin(), picked.end(),
+                    [](const pair<int, uint64_t>& a, const pair<int, uint64_t>& b) { return a.first < b.first; });
+        vector<uint64_t> ids(picked.size());
+        for (size_t i = 0; i < picked.size(); ++i) ids[i] = picked[i].second;
+        return ids;
+    }
+
+    // Sales ledger behind the reports (every sale and cancellation since
+    // the last snapshot, and the bookings the snapshot kept)
+    const SalesColumns& salesLedger() const { return sales; }
+
+    // Pointers from category(), categoryList(), findShowById() and
+    // showsBetween() stay valid while the caller holds an Epoch::Guard
+    size_t    categoryCount() const    { return categories.size(); }
+    Category* category(size_t i) const { return categories.get(i); }
+    PublishedArray<Category>::View categoryList() const { return categories.view(); }
+
+    // Unlinked objects not yet freed (some reader may still see them)
+    size_t retiredWaiting() { return reclaimer.waiting(); }
+
+    // Seats held for one customer while they pay
+    struct SeatHold {
+        HoldManager::Token token;       // 0 if nothing could be held
+        Show* show;
+        int   row, col, count;          // count adjacent seats from (row, col)
+        Paisa fare;                     // per seat, fixed when the seats were held
+        SeatHold() : token(0), show(NULL), row(0), col(0), count(0), fare(0) {}
+        Paisa amount() const { return fare * count; }
+    };
+
+    // Hold one chosen seat
+    SeatHold holdSeat(Show* s, int r, int c) {
+        return findHold(holds.hold(s, r, c));
+    }
+
+    // Hold the best block of n adjacent seats
+    SeatHold holdBestSeats(Show* s, int n, const SeatPreference& pref = SeatPreference()) {
+        Seat first;
+        return findHold(holds.holdBlock(s, n, pref, first));
+    }
+
+    // Current fare for a seat in row r of show s
+    Paisa quote(const Show* s, int r) const { return s->quote(r, PriceClock::current()); }
+
+    // Give held seats back without paying
+    bool releaseHold(const SeatHold& h) { return holds.release(h.token); }
+
+    // The hold a token stands for (token 0 if it expired or is unknown)
+    SeatHold findHold(HoldManager::Token tok) const {
+        SeatHold h;
+        if (tok && holds.lookupHold(tok, h.show, h.row, h.col, h.count, h.fare)) h.token = tok;
+        return h;
+    }
+
+    // Lines in front of seat selection for shows on sale
+    WaitingRoom& waitingRoom() { return onSaleLines; }
+
+    // Expire holds whose TTL has run out
+    size_t expireHolds() { return holds.advance(); }
+
+    // Charge card for a hold. When the gateway answers, an approval
+    // confirms the seats and records one booking per seat (their ids go
+    // to *ids, which must outlive the future); a decline releases them.
+    // If the journal cannot keep a booking, its seat and the rest of the
+    // hold go back and are refunded (seats it kept stay booked). The
+    // future says whether every seat was booked.
+    future<bool> pay(const SeatHold& h, const string& card, vector<uint64_t>* ids = NULL) {
+        SeatHold held = h;
+        return payments.submit(h.amount(), card, [this, held, ids](bool approved) {
+            Epoch::Guard guard;         // the show may be removed meanwhile
+            if (!approved) {
+                holds.release(held.token);
+                return false;
+            }
+            if (journalFailed()) {
+                holds.release(held.token);
+                refundCharge(held.amount());
+                return false;
+            }
+            if (!holds.confirm(held.token)) return false;   // the hold expired
+            for (int i = 0; i < held.count; ++i) {
+                uint64_t id = generateBookingID();
+                if (!addBookingRecord(id, held.show, held.row, held.col + i, held.fare)) {
+                    doCancelBookings(&id, 1, (int64_t)time(NULL), NULL);
+                    if (i + 1 < held.count) held.show->refundSeats(held.row, held.col + i + 1, held.count - i - 1);
+                    refundCharge(held.fare * (held.count - i));
+                    return false;
+                }
+                if (ids) ids->push_back(id);
+            }
+            return true;
+        });
+    }
+
+    // Give back a charge no booking came of
+    void refundCharge(Paisa amount) {
+        vector<RefundRequest> back(1);
+        back[0].bookingId = 0;
+        back[0].amount    = amount;
+        vector<bool> ok;
+        payments.refund(back, ok);
+    }
+
+    Show* findShowById(int showId) const { return findShow(showId); }
+
+    // Shows and categories matching every word of query; the last word
+    // may be partial (type-ahead). The index is built on the first call
+    // and kept up to date by the catalog mutations from then on.
+    vector<SearchHit> search(const string& query, size_t limit = 20) {
+        buildSearchIndex();
+        return searchIndex.search(query, limit);
+    }
+
+    // Most frequent indexed words starting with prefix
+    vector<string> suggestWords(const string& prefix, size_t limit = 8) {
+        buildSearchIndex();
+        return searchIndex.complete(prefix, limit);
+    }
+
+    void buildSearchIndex() {
+        if (searchReady.load()) return;
+        lock_guard<mutex> g(searchBuild);
+        if (searchReady.load()) return;
+        // in id order, so every posting list only ever grows at its end
+        Epoch::Guard guard;
+        PublishedArray<Show>::View shows = showsById.view();
+        for (size_t i = 0; i < shows.size(); ++i) {
+            if (shows[i]) searchIndex.addShow((int)i, shows[i]->getTitle());
+        }
+        PublishedArray<Category>::View all = categories.view();
+        for (size_t i = 0; i < all.size(); ++i) {
+            searchIndex.addCategory(all[i]->getId(), all[i]->getName());
+        }
+        searchReady.store(true);
+    }
+
+    // Shows in any category starting in [from, to), in start order
+    vector<Show*> showsBetween(time_t from, time_t to) const {
+        vector<Show*> out;
+        schedule.between(from, to, out);
+        return out;
+    }
+
+    // Built-in catalog used on first start (base prices in paisa)
+    void loadDefaultCatalog() {
+        // Movies
+        Category* movies = addCategory("Movies");
+        addShow(movies, "Umro Ayyar: A New Beginning",   "2025-04-14 10:00", 5, 10, 80000);
+        addShow(movies, "Paddington in Peru",            "2025-04-14 14:00", 5, 10, 75000);
+        addShow(movies, "Despicable Me 4",               "2025-04-14 18:00", 5, 10, 70000);
+        addShow(movies, "Khel Khel Mein",                "2025-04-15 10:00", 5, 10, 82000);
+        addShow(movies, "Lilo & Stitch",                 "2025-04-15 14:00", 5, 10, 77000);
+        addShow(movies, "The Family Plan 2",             "2025-04-15 18:00", 5, 10, 73000);
+        addShow(movies, "Dushman-e-Jaan",                "2025-04-16 10:00", 5, 10, 81000);
+        addShow(movies, "How to Train Your Dragon",      "2025-04-16 14:00", 5, 10, 76000);
+        addShow(movies, "Encanto",                       "2025-04-16 18:00", 5, 10, 72000);
+        addShow(movies, "Peechay Tou Dekho",             "2025-04-17 10:00", 5, 10, 83000);
+        addShow(movies, "The Super Mario Bros. Movie",   "2025-04-17 14:00", 5, 10, 78000);
+        addShow(movies, "Minions: The Rise of Gru",      "2025-04-17 18:00", 5, 10, 74000);
+        addShow(movies, "Laal Kabootar",                 "2025-04-18 10:00", 5, 10, 84000);
+        addShow(movies, "Wish",                          "2025-04-18 14:00", 5, 10, 79000);
+        addShow(movies, "Kung Fu Panda 4",               "2025-04-18 18:00", 5, 10, 75000);
+
+        // Concerts
+        Category* concerts = addCategory("Concerts");
+        addShow(concerts, "Pakistan Fest 2025 @ Jilani Park, Lahore",      "2025-02-14 to 02-16", 10, 20, 250000);
+        addShow(concerts, "Shaam-e-Suroor (Qawwali & DJ Night)",           "2025-05-14",           8, 16, 180000);
+        addShow(concerts, "Soundwaves S1 (Mustafa Zahid Live)",            "2025-05-18",           8, 16, 200000);
+        addShow(concerts, "Colour Fest Islamabad",                        "2025-05-24",           8, 16, 150000);
+        addShow(concerts, "Soul Fest @ Dring Stadium, Bahawalpur",        "2025-05-24 to 05-25",  8, 16, 160000);
+        addShow(concerts, "PSL X Opening Ceremony ft. Abida Parveen",     "2025-04-11",           8, 16, 300000);
+        addShow(concerts, "MHB Tribute to Nusrat Fateh Ali Khan",         "2025-04-19",           8, 16, 220000);
+        addShow(concerts, "Mekaal Hasan Band Live @ Lok Virsa",           "2025-04-26",           8, 16, 210000);
+        addShow(concerts, "Biggest Sufi & Qawwali Night 2025",            "2025-02-01",           8, 16, 190000);
+        addShow(concerts, "6th Sindh Sufi Melo 2025",                     "2025-02-08 to 02-09",  8, 16, 175000);
+        addShow(concerts, "Banjo ke Rung: Ustad Sabzal ke Sang",          "2024-04-27",           8, 16, 160000);
+        addShow(concerts, "The Raah e Ishq Live Show",                    "2024-05-25",           8, 16, 170000);
+        addShow(concerts, "Mehfil-e-Qawwali",                             "2024-06-02",           8, 16, 155000);
+        addShow(concerts, "Summer Fiesta (Aima Baig, Bilal & DJ Night)",  "TBA",                  8, 16,     0);
+        addShow(concerts, "MediaBiz Music Fest (Gul Panra Live)",         "2019-04-27",           8, 16, 140000);
+
+        // Buses
+        Category* buses = addCategory("Buses");
+        addShow(buses, "Lahore to Islamabad (Business Class)",    "07:00–11:00", 5, 4, 120000);
+        addShow(buses, "Karachi to Multan (Economy Class)",       "09:30–15:15", 5, 4,  85000);
+        addShow(buses, "Islamabad to Peshawar (Executive Class)", "18:00–20:30", 5, 4, 100000);
+        addShow(buses, "Rawalpindi to Swat (Economy Class)",      "08:00–12:00", 5, 4,  90000);
+        addShow(buses, "Multan to Lahore (Business Class)",       "17:00–20:00", 5, 4, 115000);
+        addShow(buses, "Quetta to Karachi (Sleeper Class)",       "21:00–07:00", 5, 4, 140000);
+        addShow(buses, "Peshawar to Muzaffarabad (Std Class)",    "10:00–15:00", 5, 4,  95000);
+        addShow(buses, "Hyderabad to Sukkur (Economy Class)",     "06:30–10:45", 5, 4,  80000);
+        addShow(buses, "Faisalabad to Rawalpindi (Business)",     "13:00–17:30", 5, 4, 110000);
+        addShow(buses, "Sialkot to Lahore (Economy Class)",       "07:30–09:00", 5, 4,  70000);
+        addShow(buses, "Gilgit to Islamabad (Executive Class)",   "06:00–12:00", 5, 4, 130000);
+        addShow(buses, "Bahawalpur to Karachi (Sleeper)",         "20:00–06:00", 5, 4, 145000);
+        addShow(buses, "Gwadar to Quetta (Standard Class)",       "16:00–22:00", 5, 4, 125000);
+        addShow(buses, "Skardu to Lahore (Business Class)",       "09:00–15:00", 5, 4, 135000);
+        addShow(buses, "Kashmir to Islamabad (Economy Class)",    "11:00–14:30", 5, 4,  78000);
+    }
+};
+
+
+
+
+// ---------------------------------------------------------------------
+// Bulk catalog import: a season of shows from one CSV or JSON file.
+//
+// CSV has one show per line:
+//   category,title,when,rows,cols,price
+// An optional header line may name the columns in any order. Fields may
+// be quoted ("..."), with "" standing for a quote inside a field.
+// JSON is an array of objects, or one object per line, with the same keys:
+//   {"category":"Buses","title":"Lahore to Islamabad","when":"07:00-11:00",
+//    "rows":5,"cols":4,"price":1200}
+// Prices are in rupees, with at most two decimals. "when" accepts any
+// format parseShowTime understands, or "TBA".
+//
+// The file is read in chunks. Each chunk is cut at record boundaries,
+// one piece per thread, and the pieces are parsed and validated in
+// parallel. Meanwhile the calling thread inserts the previous chunk's
+// shows, all inside one BookingEngine bulk load.
+// ---------------------------------------------------------------------
+
+// One validated show from an import file
+struct CatalogRow {
+    string   category, title, when;
+    ShowTime time;
+    int      rows, cols;
+    Paisa    price;
+};
+
+class CatalogImporter {
+public:
+    enum Format { IMPORT_CSV, IMPORT_JSON };
+
+    struct Problem {
+        size_t line;            // where the record starts (1-based)
+        string message;
+    };
+
+    struct Result {
+        Format format;
+        size_t records, imported, rejected, categoriesAdded;
+        vector<Problem> problems;       // the first MAX_PROBLEMS
+        Result() : format(IMPORT_CSV), records(0), imported(0), rejected(0), categoriesAdded(0) {}
+    };
+
+    static const int    MAX_ROWS = 1000;
+    static const int    MAX_COLS = 1000;
+    static const size_t MAX_PROBLEMS = 20;
+
+private:
+    enum Column { COL_CATEGORY, COL_TITLE, COL_WHEN, COL_ROWS, COL_COLS, COL_PRICE, COLUMNS };
+
+    static const char* columnName(int c) {
+        static const char* const names[COLUMNS] = { "category", "title", "when", "rows", "cols", "price" };
+        return names[c];
+    }
+
+    // One thread's share of a chunk, and what it made of it
+    struct Piece {
+        const char*        begin;
+        const char*        end;
+        vector<CatalogRow> rows;
+        vector<Problem>    problems;    // lines counted from the piece start (0-based)
+        size_t             records, rejected, lines;
+        Piece() : begin(NULL), end(NULL), records(0), rejected(0), lines(0) {}
+    };
+
+    struct Chunk {
+        string         text;            // whole records only
+        size_t         firstLine;
+        vector<Piece>  pieces;
+        vector<thread> workers;
+    };
+
+    BookingEngine& engine;
+    int            threads;
+    size_t         chunkBytes;
+    Format         format;
+    vector<int>    columns;         // CSV field -> column
+    int            jsonBase;        // nesting depth of the records (1 inside an array)
+    int            startDepth;      // nesting depth at the start of the next chunk
+    FILE*          in;
+    bool           atEof;
+    string         carry;           // start of a record the last chunk cut off
+    size_t         nextLine;
+    unordered_map<string, Category*> byName;
+
+    static string& trim(string& s) {
+        size_t e = s.size();
+        while (e > 0 && isspace((unsigned char)s[e-1])) --e;
+        s.resize(e);
+        size_t b = 0;
+        while (b < e && isspace((unsigned char)s[b])) ++b;
+        if (b) s.erase(0, b);
+        return s;
+    }
+
+    static bool readInt(const string& s, int lo, int hi, int& out) {
+        if (s.empty() || s.size() > 9) return false;
+        int v = 0;
+        for (size_t i = 0; i < s.size(); ++i) {
+            if (s[i] < '0' || s[i] > '9') return false;
+            v = v * 10 + (s[i] - '0');
+        }
+        if (v < lo || v > hi) return false;
+        out = v;
+        return true;
+    }
+
+    // Check one record's fields and fill row (taking their text);
+    // "" or why it was rejected
+    static string makeRow(string* field, CatalogRow& row) {
+        row.category.swap(trim(field[COL_CATEGORY]));
+        row.title.swap(trim(field[COL_TITLE]));
+        row.when.swap(trim(field[COL_WHEN]));
+        if (row.category.empty()) return "missing category";
+        if (row.title.empty())    return "missing title";
+        row.time = parseShowTime(row.when);
+        if (row.time.kind == SCHEDULE_TBA) {
+            string upper = row.when;
+            for (size_t i = 0; i < upper.size(); ++i) upper[i] = (char)toupper((unsigned char)upper[i]);
+            if (upper != "TBA") return "bad date/time '" + row.when + "'";
+        }
+        if (!readInt(trim(field[COL_ROWS]), 1, MAX_ROWS, row.rows)) {
+            return "rows must be 1-" + toString((int)MAX_ROWS) + ", not '" + trim(field[COL_ROWS]) + "'";
+        }
+        if (!readInt(trim(field[COL_COLS]), 1, MAX_COLS, row.cols)) {
+            return "cols must be 1-" + toString((int)MAX_COLS) + ", not '" + trim(field[COL_COLS]) + "'";
+        }
+        if (!parseRupees(trim(field[COL_PRICE]), row.price)) {
+            return "bad price '" + trim(field[COL_PRICE]) + "'";
+        }
+        return "";
+    }
+
+    // ---- CSV ----
+
+    // Split the record at p into fields (reusing their buffers) and move
+    // p past its line end
+    static void csvRecord(const char*& p, const char* end, vector<string>& fields) {
+        size_t n = 0;
+        while (true) {
+            if (n == fields.size()) fields.push_back(string());
+            string& f = fields[n++];
+            f.clear();
+            if (p < end && *p == '"') {
+                for (++p; p < end; ) {
+                    const char* q = (const char*)memchr(p, '"', end - p);
+                    if (!q) q = end;
+                    f.append(p, q);
+                    p = q + (q < end);
+                    if (p < end && *p == '"') { f += '"'; ++p; }
+                    else break;
+                }
+            }
+            const char* q = p;
+            while (q < end && *q != ',' && *q != '\n') ++q;
+            f.append(p, q);
+            p = q + (q < end);
+            if (q == end || *q == '\n') break;
+        }
+        fields.resize(n);
+        string& last = fields.back();
+        if (!last.empty() && last[last.size() - 1] == '\r') last.resize(last.size() - 1);
+    }
+
+    void parseCsv(Piece& piece) const {
+        const char* p = piece.begin;
+        vector<string> fields;
+        string field[COLUMNS];
+        size_t line = 0;
+        while (p < piece.end) {
+            const char* start = p;
+            csvRecord(p, piece.end, fields);
+            size_t at = line;
+            line += count(start, p, '\n');
+            if (fields.size() == 1 && trim(fields[0]).empty()) continue;
+            ++piece.records;
+            string problem;
+            if (fields.size() != columns.size()) {
+                problem = "expected " + toString(columns.size()) + " fields, found " + toString(fields.size());
+            } else {
+                for (size_t i = 0; i < fields.size(); ++i) field[columns[i]].swap(fields[i]);
+                piece.rows.push_back(CatalogRow());
+                problem = makeRow(field, piece.rows.back());
+                if (!problem.empty()) piece.rows.pop_back();
+            }
+            if (!problem.empty()) reject(piece, at, problem);
+        }
+    }
+
+    // ---- JSON ----
+
+    struct JsonCursor {
+        const char* p;
+        const char* end;
+        size_t      line;
+    };
+
+    static void skipSpace(JsonCursor& c, const char* also = "") {
+        while (c.p < c.end && (isspace((unsigned char)*c.p) || (*c.p && strchr(also, *c.p)))) {
+            if (*c.p == '\n') ++c.line;
+            ++c.p;
+        }
+    }
+
+    static void putUtf8(string& out, uint32_t cp) {
+        if (cp < 0x80)         out += (char)cp;
+        else if (cp < 0x800)   out += (char)(0xC0 | cp >> 6);
+        else if (cp < 0x10000) out += (char)(0xE0 | cp >> 12);
+        else                   out += (char)(0xF0 | cp >> 18);
+        for (int shift = cp < 0x800 ? 0 : cp < 0x10000 ? 6 : 12; cp >= 0x80 && shift >= 0; shift -= 6) {
+            out += (char)(0x80 | ((cp >> shift) & 0x3F));
+        }
+    }
+
+    static bool hex4(JsonCursor& c, uint32_t& cp) {
+        if (c.end - c.p < 4) return false;
+        cp = 0;
+        for (int i = 0; i < 4; ++i) {
+            char ch = *c.p++;
+            int  v  = isdigit((unsigned char)ch) ? ch - '0'
+                    : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10
+                    : (ch >= 'A' && ch <= 'F') ? ch - 'A' + 10 : -1;
+            if (v < 0) return false;
+            cp = cp << 4 | v;
+        }
+        return true;
+    }
+
+    static bool jsonString(JsonCursor& c, string& out) {
+        out.clear();
+        if (c.p >= c.end || *c.p != '"') return false;
+        for (++c.p; c.p < c.end; ) {
+            const char* run = c.p;
+            while (c.p < c.end && *c.p != '"' && *c.p != '\\') ++c.p;
+            out.append(run, c.p);
+            if (c.p >= c.end) return false;
+            char ch = *c.p++;
+            if (ch == '"') return true;
+            if (c.p >= c.end) return false;
+            ch = *c.p++;
+            uint32_t cp;
+            switch (ch) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                    if (!hex4(c, cp)) return false;
+                    if (cp >= 0xD800 && cp < 0xDC00) {      // surrogate pair
+                        uint32_t lo;
+                        if (c.end - c.p < 6 || c.p[0] != '\\' || c.p[1] != 'u') return false;
+                        c.p += 2;
+                        if (!hex4(c, lo) || lo < 0xDC00 || lo > 0xDFFF) return false;
+                        cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    }
+                    putUtf8(out, cp);
+                    break;
+                default: out += ch;                         // \" \\ \/
+            }
+        }
+        return false;
+    }
+
+    // Skip any value; objects and arrays are skipped whole
+    static void skipValue(JsonCursor& c) {
+        int depth = 0;
+        bool inString = false, escaped = false;
+        for (; c.p < c.end; ++c.p) {
+            char ch = *c.p;
+            if (ch == '\n') ++c.line;
+            if (inString) {
+                if (escaped)          escaped = false;
+                else if (ch == '\\')  escaped = true;
+                else if (ch == '"')   inString = false;
+                continue;
+            }
+            if (ch == '"') inString = true;
+            else if (ch == '{' || ch == '[') ++depth;
+            else if (ch == '}' || ch == ']') {
+                if (depth == 0) return;             // the end of the enclosing value
+                if (--depth == 0) { ++c.p; return; }
+            }
+            else if (depth == 0 && (ch == ',' || isspace((unsigned char)ch))) return;
+        }
+    }
+
+    // Read one object into field[]; false on a syntax error
+    static bool jsonObject(JsonCursor& c, string* field, bool* seen) {
+        if (c.p >= c.end || *c.p != '{') return false;
+        ++c.p;
+        string key;
+        skipSpace(c);
+        if (c.p < c.end && *c.p == '}') { ++c.p; return true; }
+        while (c.p < c.end) {
+            skipSpace(c);
+            if (!jsonString(c, key)) return false;
+            skipSpace(c);
+            if (c.p >= c.end || *c.p != ':') return false;
+            ++c.p;
+            skipSpace(c);
+            int col = -1;
+            for (int k = 0; k < COLUMNS; ++k) if (key == columnName(k)) col = k;
+            if (col >= 0 && c.p < c.end && *c.p == '"') {
+                if (!jsonString(c, field[col])) return false;
+                seen[col] = true;
+            } else {
+                const char* v = c.p;
+                skipValue(c);
+                if (c.p == v) return false;
+                if (col >= 0) {
+                    field[col].assign(v, c.p);
+                    seen[col] = field[col] != "null";
+                }
+            }
+            skipSpace(c);
+            if (c.p < c.end && *c.p == ',') { ++c.p; continue; }
+            if (c.p < c.end && *c.p == '}') { ++c.p; return true; }
+            return false;
+        }
+        return false;
+    }
+
+    void parseJson(Piece& piece) const {
+        JsonCursor c = { piece.begin, piece.end, 0 };
+        string field[COLUMNS];
+        bool   seen[COLUMNS];
+        while (true) {
+            skipSpace(c, ",[]");
+            if (c.p >= c.end) break;
+            size_t at = c.line;
+            const char* start = c.p;
+            ++piece.records;
+            string problem;
+            for (int k = 0; k < COLUMNS; ++k) seen[k] = false;
+            if (*c.p != '{') problem = "expected an object";
+            else if (!jsonObject(c, field, seen)) problem = "malformed object";
+            for (int k = 0; k < COLUMNS && problem.empty(); ++k) {
+                if (!seen[k]) problem = string("missing \"") + columnName(k) + "\"";
+            }
+            if (problem.empty()) {
+                piece.rows.push_back(CatalogRow());
+                problem = makeRow(field, piece.rows.back());
+                if (problem.empty()) continue;
+                piece.rows.pop_back();
+            }
+            reject(piece, at, problem);
+            c.p = start;                    // resynchronize after the bad value
+            c.line = at;
+            skipValue(c);
+            if (c.p == start) ++c.p;
+        }
+    }
+
+    static void reject(Piece& piece, size_t line, const string& problem) {
+        ++piece.rejected;
+        if (piece.problems.size() < MAX_PROBLEMS) {
+            Problem pr = { line, problem };
+            piece.problems.push_back(pr);
+        }
+    }
+
+    // ---- chunking ----
+
+    // Where the pieces of text end: each at the first record boundary
+    // past an even share of the text, the last at the final boundary
+    // (the end of the text once the file is exhausted).
+    vector<size_t> cutPoints(const string& text, int parts) const {
+        vector<size_t> cuts;
+        size_t share = text.size() / parts + 1, last = 0;
+        bool quoted = false, inString = false, escaped = false;
+        int  depth = startDepth;
+        for (size_t i = 0; i < text.size(); ++i) {
+            char ch = text[i];
+            bool boundary = false;
+            if (format == IMPORT_CSV) {
+                if (ch == '"')                  quoted = !quoted;
+                else if (ch == '\n' && !quoted) boundary = true;
+            }
+            else if (inString) {
+                if (escaped)          escaped = false;
+                else if (ch == '\\')  escaped = true;
+                else if (ch == '"')   inString = false;
+            }
+            else if (ch == '"')              inString = true;
+            else if (ch == '{' || ch == '[') ++depth;
+            else if (ch == '}' || ch == ']') boundary = --depth == jsonBase && ch == '}';
+            if (!boundary) continue;
+            last = i + 1;
+            if (last >= share * (cuts.size() + 1) && (int)cuts.size() < parts - 1) cuts.push_back(last);
+        }
+        if (atEof) last = text.size();
+        if (cuts.empty() || cuts.back() != last) cuts.push_back(last);
+        return cuts;
+    }
+
+    // Read the next chunk of whole records and start parsing it
+    // (NULL once the file is exhausted)
+    Chunk* startChunk() {
+        if (atEof && carry.empty()) return NULL;
+        Chunk* c = new Chunk();
+        c->text.swap(carry);
+        c->firstLine = nextLine;
+        vector<size_t> cuts;
+        while (true) {
+            size_t have = c->text.size();
+            if (!atEof) {
+                c->text.resize(have + chunkBytes);
+                size_t got = fread(&c->text[have], 1, chunkBytes, in);
+                c->text.resize(have + got);
+                if (got < chunkBytes) atEof = true;
+            }
+            cuts = cutPoints(c->text, threads);
+            if (cuts.back() > 0 || atEof) break;    // else one record outgrew the chunk
+        }
+        carry.assign(c->text, cuts.back(), string::npos);
+        c->text.resize(cuts.back());
+        if (c->text.empty()) { delete c; return NULL; }
+        nextLine  += count(c->text.begin(), c->text.end(), '\n');
+        startDepth = jsonBase;
+
+        const char* base = c->text.data();
+        c->pieces.resize(cuts.size());
+        for (size_t i = 0; i < cuts.size(); ++i) {
+            c->pieces[i].begin = base + (i ? cuts[i-1] : 0);
+            c->pieces[i].end   = base + cuts[i];
+        }
+        for (size_t i = 0; i < c->pieces.size(); ++i) {
+            Piece* piece = &c->pieces[i];
+            c->workers.push_back(thread([this, piece]() {
+                if (format == IMPORT_CSV) parseCsv(*piece);
+                else                      parseJson(*piece);
+                piece->lines = count(piece->begin, piece->end, '\n');
+            }));
+        }
+        return c;
+    }
+
+    Category* category(const string& name, Result& result) {
+        unordered_map<string, Category*>::iterator it = byName.find(name);
+        if (it != byName.end()) return it->second;
+        ++result.categoriesAdded;
+        return byName[name] = engine.addCategory(name);
+    }
+
+    // Add a parsed chunk's shows, in file order
+    void insert(Chunk& c, Result& result) {
+        size_t line = c.firstLine;
+        unordered_map<Category*, size_t> added;
+        vector<Category*> cats;
+        for (size_t i = 0; i < c.pieces.size(); ++i) {
+            const Piece& piece = c.pieces[i];
+            result.records  += piece.records;
+            result.rejected += piece.rejected;
+            for (size_t k = 0; k < piece.problems.size() && result.problems.size() < MAX_PROBLEMS; ++k) {
+                Problem pr = { line + piece.problems[k].line, piece.problems[k].message };
+                result.problems.push_back(pr);
+            }
+            line += piece.lines;
+            for (size_t k = 0; k < piece.rows.size(); ++k) {
+                cats.push_back(category(piece.rows[k].category, result));
+                ++added[cats.back()];
+            }
+        }
+        for (unordered_map<Category*, size_t>::iterator it = added.begin(); it != added.end(); ++it) {
+            it->first->reserve(it->first->getCount() + it->second);
+        }
+        size_t n = 0;
+        for (size_t i = 0; i < c.pieces.size(); ++i) {
+            const vector<CatalogRow>& rows = c.pieces[i].rows;
+            for (size_t k = 0; k < rows.size(); ++k, ++n) {
+                engine.addShow(cats[n], rows[k].title, rows[k].when, rows[k].time,
+                               rows[k].rows, rows[k].cols, rows[k].price);
+            }
+        }
+        result.imported += n;
+    }
+
+    // Sniff the format from the first bytes and take a CSV header off
+    void readHead() {
+        carry.resize(4096);
+        carry.resize(fread(&carry[0], 1, carry.size(), in));
+        if (carry.size() < 4096) atEof = true;
+        if (carry.compare(0, 3, "\xEF\xBB\xBF") == 0) carry.erase(0, 3);
+        size_t first = carry.find_first_not_of(" \t\r\n");
+        format   = (first != string::npos && (carry[first] == '[' || carry[first] == '{')) ? IMPORT_JSON : IMPORT_CSV;
+        jsonBase = (format == IMPORT_JSON && carry[first] == '[') ? 1 : 0;
+        startDepth = 0;
+        columns.clear();
+        for (int k = 0; k < COLUMNS; ++k) columns.push_back(k);
+        if (format != IMPORT_CSV) return;
+
+        size_t eol;
+        while ((eol = carry.find('\n')) == string::npos && !atEof) {
+            char buf[4096];
+            size_t got = fread(buf, 1, sizeof buf, in);
+            carry.append(buf, got);
+            if (got < sizeof buf) atEof = true;
+        }
+        const char* p = carry.data();
+        vector<string> fields;
+        csvRecord(p, p + carry.size(), fields);
+        vector<int> named;
+        for (size_t i = 0; i < fields.size(); ++i) {
+            string f = trim(fields[i]);
+            for (size_t j = 0; j < f.size(); ++j) f[j] = (char)tolower((unsigned char)f[j]);
+            for (int k = 0; k < COLUMNS; ++k) {
+                if (f == columnName(k) && find(named.begin(), named.end(), k) == named.end()) named.push_back(k);
+            }
+            if (named.size() != i + 1) return;      // not a header: data from line 1
+        }
+        if (named.size() != COLUMNS) return;
+        columns = named;
+        carry.erase(0, p - carry.data());
+        nextLine = 2;
+    }
+
+public:
+    // threads 0 means one per core
+    CatalogImporter(BookingEngine& e, int parseThreads = 0, size_t chunk = 8 << 20)
+        : engine(e), threads(parseThreads > 0 ? parseThreads : (int)thread::hardware_concurrency()),
+          chunkBytes(chunk), format(IMPORT_CSV), jsonBase(0), startDepth(0),
+          in(NULL), atEof(false), nextLine(1)
+    {
+        if (threads < 1) threads = 1;
+    }
+
+    // Import every valid record of path; false only if it cannot be read.
+    // Bad records are counted, and the first few described, in result.
+    bool importFile(const string& path, Result& result) {
+        in = fopen(path.c_str(), "rb");
+        if (!in) return false;
+        atEof    = false;
+        nextLine = 1;
+        readHead();
+        result.format = format;
+
+        byName.clear();
+        for (size_t i = 0; i < engine.categoryCount(); ++i) {
+            byName[engine.category(i)->getName()] = engine.category(i);
+        }
+        engine.beginBulkLoad();
+        Chunk* current = startChunk();
+        while (current) {
+            for (size_t i = 0; i < current->workers.size(); ++i) current->workers[i].join();
+            Chunk* next = startChunk();         // parses while this one is inserted
+            insert(*current, result);
+            delete current;
+            current = next;
+        }
+        engine.endBulkLoad();
+        fclose(in);
+        in = NULL;
+        return true;
+    }
+};
+
+
+// ---------------------------------------------------------------------
+// Cancellation and refunds, one booking or a whole postponed show at a
+// time. The bookings picked are cut into batches; worker threads each
+// take a batch, cancel it in the engine (seats freed a run at a time,
+// one journal record for the batch) and refund it in one gateway round
+// trip. Nothing here locks the engine, so bookings on other shows carry
+// on meanwhile, and a selection by show also reaches bookings whose show
+// was deleted.
+// ---------------------------------------------------------------------
+class BulkCanceller {
+public:
+    typedef CancelResult Result;
+
+private:
+    BookingEngine& engine;
+    int            threads;
+    size_t         batchSize;
+
+    Result run(const vector<uint64_t>& ids) {
+        Result result;
+        size_t batches = (ids.size() + batchSize - 1) / batchSize;
+        atomic<size_t> next(0);
+        mutex lock;
+        auto work = [&]() {
+            Result mine;
+            for (size_t b; (b = next.fetch_add(1)) < batches; ) {
+                size_t from = b * batchSize;
+                engine.cancelAndRefund(&ids[from], min(batchSize, ids.size() - from), mine);
+            }
+            lock_guard<mutex> g(lock);
+            result.add(mine);
+        };
+        vector<thread> pool;
+        for (size_t i = 1; i < min((size_t)threads, batches); ++i) pool.push_back(thread(work));
+        work();
+        for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+        return result;
+    }
+
+public:
+    // Refund round trips overlap, so by default there are at least four
+    // workers whatever the core count
+    BulkCanceller(BookingEngine& e, int workers = 0, size_t batch = 4096)
+        : engine(e), threads(workers > 0 ? workers : max(4, (int)thread::hardware_concurrency())),
+          batchSize(batch > 0 ? batch : 1) {}
+
+    // These bookings (unknown or already cancelled ids are skipped)
+    Result cancel(const vector<uint64_t>& ids) { return run(ids); }
+
+    Result cancelBooking(uint64_t id) { return run(vector<uint64_t>(1, id)); }
+
+    // Every active booking for these shows, a show's bookings together
+    Result cancelShows(const vector<int>& showIds) { return run(engine.bookingsFor(showIds)); }
+
+    Result cancelShow(int showId) { return cancelShows(vector<int>(1, showId)); }
+
+    // Every show in the category now
+    Result cancelCategory(int categoryId) {
+        vector<int> ids;
+        {
+            Epoch::Guard guard;
+            PublishedArray<Category>::View all = engine.categoryList();
+            for (size_t i = 0; i < all.size(); ++i) {
+                if (all[i]->getId() != categoryId) continue;
+                PublishedArray<Show>::View shows = all[i]->allShows();
+                for (size_t j = 0; j < shows.size(); ++j) ids.push_back(shows[j]->getId());
+            }
+        }
+        return cancelShows(ids);
+    }
+
+    // Every show starting in [from, to)
+    Result cancelBetween(time_t from, time_t to) {
+        vector<int> ids;
+        {
+            Epoch::Guard guard;
+            vector<Show*> shows = engine.showsBetween(from, to);
+            for (size_t i = 0; i < shows.size(); ++i) ids.push_back(shows[i]->getId());
+        }
+        return cancelShows(ids);
+    }
+};
+
+
+
+
+// Fixed-size ring for exactly one producer thread and one consumer
+// thread. Each side owns one index and keeps a cached copy of the other,
+// so the shared cache lines are only read when the ring looks full/empty.
+template <typename T>
+class SpscRing {
+private:
+    vector<T>  slots;
+    size_t     mask;
+    alignas(64) atomic<size_t> head;    // next slot to read (consumer)
+    size_t     cachedTail;
+    alignas(64) atomic<size_t> tail;    // next slot to write (producer)
+    size_t     cachedHead;
+
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscRing(size_t capacity)
+        : head(0), cachedTail(0), tail(0), cachedHead(0)
+    {
+        size_t n = 2;
+        while (n < capacity) n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    bool push(const T& item) {
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - cachedHead == slots.size()) {
+            cachedHead = head.load(memory_order_acquire);
+            if (t - cachedHead == slots.size()) return false;
+        }
+        slots[t & mask] = item;
+        tail.store(t + 1, memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t h = head.load(memory_order_relaxed);
+        if (h == cachedTail) {
+            cachedTail = tail.load(memory_order_acquire);
+            if (h == cachedTail) return false;
+        }
+        item = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Shard-per-core mode over a BookingEngine. Every show belongs to one
+// shard thread, picked by a hash of its id, and only that thread touches
+// its seats; it also keeps the ids of the bookings made on its shows.
+// Each client (one per producer thread) has its own request ring to every
+// shard and reply ring back, so every ring has one producer and one
+// consumer and needs no lock. Work spanning shows, like listing every
+// booking, is sent to all shards and the answers gathered.
+class ShardedBooking {
+public:
+    enum RequestKind { SHARD_BOOK, SHARD_CANCEL, SHARD_COLLECT };
+
+    struct Request {
+        RequestKind       kind;
+        int               showId;     // routes the request (ignored by COLLECT)
+        int               seats;      // BOOK: adjacent seats wanted
+        uint64_t          bookingId;  // CANCEL
+        uint64_t          tag;        // echoed in the reply
+        vector<uint64_t>* out;        // COLLECT: the shard appends its booking ids
+    };
+
+    struct Reply {
+        uint64_t tag;
+        bool     ok;
+        int      row, col, count;     // BOOK: the seats booked
+        uint64_t bookingId;           // BOOK: booking of the first seat
+    };
+
+    class Client {
+    private:
+        ShardedBooking& owner;
+        int             index;
+        size_t          nextShard;    // where poll() looks first
+
+    public:
+        Client(ShardedBooking& o, int i) : owner(o), index(i), nextShard(0) {}
+
+        // Queue a request for one shard (spins while its ring is full)
+        void submitTo(int shard, const Request& req) {
+            SpscRing<Request>& ring = *owner.shards[shard]->in[index];
+            while (!ring.push(req)) this_thread::yield();
+        }
+
+        // Queue a request for the shard that owns its show
+        void submit(const Request& req) { submitTo(owner.shardOf(req.showId), req); }
+
+        // Take one finished reply from any shard; false if none is ready
+        bool poll(Reply& reply) {
+            size_t n = owner.shards.size();
+            for (size_t k = 0; k < n; ++k) {
+                size_t s = (nextShard + k) % n;
+                if (owner.shards[s]->out[index]->pop(reply)) {
+                    nextShard = s + 1;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Submit and wait for the answer (no other request in flight)
+        Reply call(const Request& req) {
+            submit(req);
+            Reply reply;
+            while (!poll(reply)) this_thread::yield();
+            return reply;
+        }
+
+        // Every active booking id, gathered from all shards
+        vector<uint64_t> bookingIds() {
+            vector<vector<uint64_t> > parts(owner.shards.size());
+            for (size_t s = 0; s < parts.size(); ++s) {
+                Request req = { SHARD_COLLECT, 0, 0, 0, 0, &parts[s] };
+                submitTo((int)s, req);
+            }
+            Reply reply;
+            for (size_t got = 0; got < parts.size(); ) {
+                if (poll(reply)) ++got;
+                else this_thread::yield();
+            }
+            vector<uint64_t> all;
+            for (size_t s = 0; s < parts.size(); ++s) all.insert(all.end(), parts[s].begin(), parts[s].end());
+            return all;
+        }
+    };
+
+private:
+    static const size_t RING_SIZE = 256;
+
+    struct Shard {
+        vector<SpscRing<Request>*> in;      // one per client
+        vector<SpscRing<Reply>*>   out;
+        vector<uint64_t>           bookings;    // ids made on this shard's shows
+        thread                     worker;
+    };
+
+    BookingEngine&  engine;
+    vector<Shard*>  shards;
+    vector<Client*> clients;
+    atomic<bool>    running;
+
+    Reply execute(Shard& shard, const Request& req) {
+        Reply reply = { req.tag, false, 0, 0, 0, 0 };
+        if (req.kind == SHARD_COLLECT) {
+            for (size_t i = 0; i < shard.bookings.size(); ++i) {
+                Booking* b = engine.findBooking(shard.bookings[i]);
+                if (b && b->active()) req.out->push_back(shard.bookings[i]);
+            }
+            reply.ok = true;
+            return reply;
+        }
+        Epoch::Guard guard;
+        Show* s = engine.findShowById(req.showId);
+        if (!s) return reply;
+        if (req.kind == SHARD_BOOK) {
+            Seat first;
+            if (!s->bookBestBlock(req.seats, SeatPreference(), first)) return reply;
+            Paisa fare = s->quote(first.row, PriceClock::current(), req.seats);
+            for (int i = 0; i < req.seats; ++i) {
+                uint64_t id = engine.generateBookingID();
+                engine.addBookingRecord(id, s, first.row, first.number + i, fare);
+                shard.bookings.push_back(id);
+                if (i == 0) reply.bookingId = id;
+            }
+            reply.ok  = true;
+            reply.row = first.row; reply.col = first.number; reply.count = req.seats;
+        }
+        else if (req.kind == SHARD_CANCEL) {
+            reply.ok = engine.cancelBooking(req.bookingId);
+        }
+        return reply;
+    }
+
+    void run(Shard* shard) {
+        int idle = 0;
+        Request req;
+        while (true) {
+            bool busy = false;
+            for (size_t c = 0; c < shard->in.size(); ++c) {
+                // a handful at a time per client keeps them fair
+                for (int k = 0; k < 32 && shard->in[c]->pop(req); ++k) {
+                    Reply reply = execute(*shard, req);
+                    while (!shard->out[c]->push(reply)) this_thread::yield();
+                    busy = true;
+                }
+            }
+            if (busy) { idle = 0; continue; }
+            if (!running.load(memory_order_acquire)) break;
+            if (++idle < 64) continue;
+            this_thread::yield();
+        }
+    }
+
+public:
+    ShardedBooking(BookingEngine& e, int shardCount, int clientCount)
+        : engine(e), running(true)
+    {
+        shardCount  = max(1, shardCount);
+        clientCount = max(1, clientCount);
+        for (int s = 0; s < shardCount; ++s) {
+            Shard* shard = new Shard();
+            for (int c = 0; c < clientCount; ++c) {
+                shard->in.push_back(new SpscRing<Request>(RING_SIZE));
+                shard->out.push_back(new SpscRing<Reply>(RING_SIZE));
+            }
+            shards.push_back(shard);
+        }
+        // existing bookings go to the shard that owns their show
+        engine.forEachBooking([this](const Booking& b) {
+            shards[shardOf(b.showId)]->bookings.push_back(b.id);
+        });
+        for (int c = 0; c < clientCount; ++c) clients.push_back(new Client(*this, c));
+        for (int s = 0; s < shardCount; ++s) {
+            shards[s]->worker = thread(&ShardedBooking::run, this, shards[s]);
+        }
+    }
+
+    // Stops once every queued request is answered
+    ~ShardedBooking() {
+        running.store(false, memory_order_release);
+        for (size_t s = 0; s < shards.size(); ++s) {
+            shards[s]->worker.join();
+            for (size_t c = 0; c < clients.size(); ++c) {
+                delete shards[s]->in[c];
+                delete shards[s]->out[c];
+            }
+            delete shards[s];
+        }
+        for (size_t c = 0; c < clients.size(); ++c) delete clients[c];
+    }
+
+    int     shardCount()  const { return (int)shards.size(); }
+    Client& client(int i)       { return *clients[i]; }
+
+    // Owning shard: a stable mix of the show id (fmix32 from MurmurHash3)
+    int shardOf(int showId) const {
+        uint32_t h = (uint32_t)showId;
+        h ^= h >> 16; h *= 0x85ebca6bu;
+        h ^= h >> 13; h *= 0xc2b2ae35u;
+        h ^= h >> 16;
+        return (int)(h % shards.size());
+    }
+};
+
+
+
+
+// Console front end: the admin and user dashboards, driving a BookingEngine
+class TicketBookingSystem {
+private:
+    BookingEngine engine;
+    const string  adminUser = "admin";
+    const string  adminPass = "admin";
+
+    void printBooking(const Booking& b) const {
+        Show* s = engine.findShowById(b.showId);
+        cout << "ID: " << formatBookingID(b.id)
+             << ", Show: " << (s ? s->getTitle() : string("(removed)"))
+             << ", When: " << (s ? s->getDateTime() : string("-"))
+             << ", Seat: [" << b.row << "," << b.col << "]"
+             << ", Paid: PKR " << formatRupees(b.fare) << "\n";
+    }
+
+    // Revenue, seats and occupancy per category, the best-selling shows
+    // and sales per hour over the last day, all from the sales ledger
+    void printSalesReport() const {
+        const SalesColumns& ledger = engine.salesLedger();
+        if (ledger.rows() == 0) {
+            cout << "No sales yet.\n";
+            return;
+        }
+        size_t catLimit = 1, showLimit = 1;
+        for (size_t i = 0; i < engine.categoryCount(); ++i) {
+            Category* cat = engine.category(i);
+            catLimit = max(catLimit, (size_t)cat->getId() + 1);
+            for (int j = 0; j < cat->getCount(); ++j) {
+                showLimit = max(showLimit, (size_t)cat->getShow(j)->getId() + 1);
+            }
+        }
+        SalesTotals         all    = ledger.totals();
+        vector<SalesTotals> byCat  = ledger.groupBy(SALES_BY_CATEGORY, catLimit);
+        vector<SalesTotals> byShow = ledger.groupBy(SALES_BY_SHOW, showLimit);
+
+        cout << "\nSales: " << all.seats << " seats, PKR " << formatRupees(all.revenue) << "\n";
+        for (size_t i = 0; i < engine.categoryCount(); ++i) {
+            Category* cat = engine.category(i);
+            long long capacity = 0;
+            for (int j = 0; j < cat->getCount(); ++j) capacity += cat->getShow(j)->getCapacity();
+            const SalesTotals& t = byCat[cat->getId()];
+            cout << "  " << cat->getName() << ": " << t.seats << " seats, PKR " << formatRupees(t.revenue)
+                 << ", " << (capacity ? (double)(t.seats * 1000 / capacity) / 10 : 0.0) << "% full\n";
+        }
+
+        vector<int> best;
+        for (size_t id = 0; id < byShow.size(); ++id) if (byShow[id].seats > 0) best.push_back((int)id);
+        size_t top = min(best.size(), (size_t)5);
+        partial_sort(best.begin(), best.begin() + top, best.end(), [&](int a, int b) {
+            return byShow[a].revenue > byShow[b].revenue;
+        });
+        if (top) cout << "Best sellers:\n";
+        for (size_t i = 0; i < top; ++i) {
+            Show* s = engine.findShowById(best[i]);
+            if (!s) continue;
+            const SalesTotals& t = byShow[best[i]];
+            cout << "  " << s->getTitle() << " (" << s->getDateTime() << "): " << t.seats << "/"
+                 << s->getCapacity() << " seats, PKR " << formatRupees(t.revenue) << "\n";
+        }
+
+        time_t now = time(NULL);
+        time_t from = now - now % 3600 - 23 * 3600;
+        vector<SalesTotals> hours = ledger.byTime(from, 3600, 24);
+        bool header = false;
+        for (size_t h = 0; h < hours.size(); ++h) {
+            if (!hours[h].seats && !hours[h].revenue) continue;
+            if (!header) { cout << "Last 24 hours:\n"; header = true; }
+            time_t at = from + (time_t)h * 3600;
+            char buf[32];
+            strftime(buf, sizeof buf, "%Y-%m-%d %H:00", localtime(&at));
+            cout << "  " << buf << "  " << hours[h].seats << " seats, PKR " << formatRupees(hours[h].revenue) << "\n";
+        }
+    }
+
+    void printCancelResult(const CancelResult& r) {
+        cout << r.bookings << " booking(s) cancelled, PKR " << formatRupees(r.refunded) << " refunded.\n";
+        if (!r.refundFailed.empty()) {
+            cout << "Refunds refused for " << r.refundFailed.size() << " booking(s), e.g. "
+                 << formatBookingID(r.refundFailed[0]) << ".\n";
+        }
+    }
+
+    // Cancel and refund one booking, a show, a category or every show in
+    // a date range
+    void cancelMenu() {
+        cout << "\n--- Cancel Bookings ---\n"
+             << "1. One booking\n"
+             << "2. Every booking for a show\n"
+             << "3. Every booking in a category\n"
+             << "4. Every booking for shows between two dates\n"
+             << "0. Back\n"
+             << "Choice: ";
+        int sub; cin >> sub;
+        BulkCanceller canceller(engine);
+        BulkCanceller::Result r;
+        if (sub == 1) {
+            cout << "Enter booking ID to cancel: ";
+            string text; cin >> text;
+            r = canceller.cancelBooking(parseBookingID(text));
+            if (!r.bookings) {
+                cout << "No active booking with that ID.\n";
+                return;
+            }
+        }
+        else if (sub == 2 || sub == 3) {
+            for (size_t i = 0; i < engine.categoryCount(); ++i) {
+                cout << (i+1) << ". " << engine.category(i)->getName() << "\n";
+            }
+            cout << "Enter category number: ";
+            int ci; cin >> ci;
+            if (ci < 1 || ci > (int)engine.categoryCount()) {
+                cout << "Invalid number.\n";
+                return;
+            }
+            Category* cat = engine.category(ci-1);
+            if (sub == 3) {
+                cout << "Cancel every booking in " << cat->getName() << "? (y/n): ";
+                char yn; cin >> yn;
+                if (yn != 'y' && yn != 'Y') return;
+                r = canceller.cancelCategory(cat->getId());
+            } else {
+                cat->listAllShows();
+                cout << "Enter show number: ";
+                int si; cin >> si;
+                Show* s = cat->getShow(si-1);
+                if (!s) {
+                    cout << "Invalid number.\n";
+                    return;
+                }
+                r = canceller.cancelShow(s->getId());
+            }
+        }
+        else if (sub == 4) {
+            cout << "From date (YYYY-MM-DD): ";
+            string a; cin >> a;
+            cout << "To date (YYYY-MM-DD, inclusive): ";
+            string b; cin >> b;
+            ShowTime from = parseShowTime(a), to = parseShowTime(b);
+            if (from.kind != SCHEDULE_DATED || to.kind != SCHEDULE_DATED || to.end < from.start) {
+                cout << "Invalid dates.\n";
+                return;
+            }
+            r = canceller.cancelBetween(from.start, to.end + 1);
+        }
+        else {
+            if (sub != 0) cout << "Invalid choice.\n";
+            return;
+        }
+        printCancelResult(r);
+    }
+
+    // Admin dashboard
+    void adminMenu() {
+        while (true) {
+            cout << "\n--- Admin Menu ---\n"
+                 << "1. View booked tickets\n"
+                 << "2. New Booking & Manage categories\n"
+                 << "3. Find booking by ID\n"
+                 << "4. Cancel bookings\n"
+                 << "5. Sales report\n"
+                 << "0. Logout\n"
+                 << "Choice: ";
+            int choice; cin >> choice;
+
+            if (choice == 1) {
+                if (engine.bookingCount() == 0) {
+                    cout << "No bookings have been made yet.\n";
+                } else {
+                    cout << "\nBooked Tickets:\n";
+                    ScopedTimer timer(T_ADMIN_LISTING);
+                    size_t n = 0;
+                    engine.forEachBooking([&](const Booking& b) {
+                        cout << ++n << ". ";
+                        printBooking(b);
+                    });
+                }
+            }
+            else if (choice == 2) {
+                // Category management
+                while (true) {
+                    cout << "\n--- Book Tickets ---\n";
+                    for (size_t i = 0; i < engine.categoryCount(); ++i) {
+                        cout << (i+1) << ". " << engine.category(i)->getName() << "\n";
+                    }
+                    
+                    // Add new Category
+                    cout << "\n--- Manage Categories ---\n";
+                    cout << (engine.categoryCount()+1)
+                         << ". Add new category\n"
+                         << (engine.categoryCount()+2)
+                         << ". Delete category\n"
+                         << (engine.categoryCount()+3)
+                         << ". Rename category\n"
+                         << (engine.categoryCount()+4)
+                         << ". Back\n"
+                         << "Choice: ";
+                    int c; cin >> c;
+
+					
+                    int n = (int)engine.categoryCount();
+                    if (c >= 1 && c <= n) {
+                        // manage a specific category
+                        Category* cat = engine.category(c-1);
+                        while (true) {
+                            cout << "\n--- Category: " << cat->getName() << " ---\n"
+                                 << "1. List shows\n"
+                                 << "2. Add show\n"
+                                 << "3. Edit show\n"
+                                 << "4. Delete show\n"
+                                 << "5. Waiting room (on-sale)\n"
+                                 << "0. Back\n"
+                                 << "Choice: ";
+                            int sub; cin >> sub;
+                            if (sub == 1) {
+                                cat->listAllShows();
+                            }
+                            else if (sub == 2) {
+                                string t, dt;
+                                int r, co;
+                                double p;
+                                cout << "Enter new show title: ";
+                                cin.ignore(); getline(cin, t);
+                                cout << "Enter date/time: ";
+                                getline(cin, dt);
+                                cout << "Enter rows and cols: ";
+                                cin >> r >> co;
+                                cout << "Enter ticket price (PKR): ";
+                                cin >> p;
+                                engine.addShow(cat, t, dt, r, co, paisaFromRupees(p));
+                                cout << "Show added.\n";
+                            }
+                            else if (sub == 3) {
+                                cat->listAllShows();
+                                cout << "Enter show number to edit: ";
+                                int si; cin >> si;
+                                if (si < 1 || si > cat->getCount()) {
+                                    cout << "Invalid number.\n";
+                                } else {
+                                    string nt, ndt;
+                                    cout << "Enter new title: ";
+                                    cin.ignore(); getline(cin, nt);
+                                    cout << "Enter new date/time: ";
+                                    getline(cin, ndt);
+                                    engine.editShow(cat, si-1, nt, ndt);
+                                    cout << "Show updated.\n";
+                                }
+                            }
+                            else if (sub == 4) {
+                                cat->listAllShows();
+                                cout << "Enter show number to delete: ";
+                                int si; cin >> si;
+                                CancelResult r;
+                                if (!engine.removeShow(cat, si-1, &r)) {
+                                    cout << "Invalid number.\n";
+                                    continue;
+                                }
+                                cout << "Show deleted.\n";
+                                if (r.bookings) printCancelResult(r);
+                            }
+                            else if (sub == 5) {
+                                cat->listAllShows();
+                                cout << "Enter show number: ";
+                                int si; cin >> si;
+                                Show* s = cat->getShow(si-1);
+                                if (!s) {
+                                    cout << "Invalid number.\n";
+                                    continue;
+                                }
+                                WaitingRoom& room = engine.waitingRoom();
+                                if (room.isOpen(s->getId())) {
+                                    cout << room.waiting(s->getId()) << " waiting. Close the line? (y/n): ";
+                                    char yn; cin >> yn;
+                                    if (yn == 'y' || yn == 'Y') room.close(s->getId());
+                                    continue;
+                                }
+                                double rate, burst;
+                                cout << "Customers let in per second: ";
+                                cin >> rate;
+                                cout << "At most at once: ";
+                                cin >> burst;
+                                cout << (room.open(s->getId(), rate, burst) ? "Waiting room open.\n"
+                                                                            : "Invalid rate.\n");
+                            }
+                            else if (sub == 0) {
+                                break;
+                            }
+                            else {
+                                cout << "Invalid choice.\n";
+                            }
+                        }
+                    }
+                    else if (c == n+1) {
+                        // add category
+                        cout << "Enter new category name: ";
+                        string nm;
+                        cin.ignore(); getline(cin, nm);
+                        engine.addCategory(nm);
+                        cout << "Category added.\n";
+                    }
+                    else if (c == n+2) {
+                        // delete category
+                        cout << "Enter category number to delete: ";
+                        int di; cin >> di;
+                        CancelResult r;
+                        if (engine.removeCategory(di-1, &r)) {
+                            cout << "Category deleted.\n";
+                            if (r.bookings) printCancelResult(r);
+                        } else {
+                            cout << "Invalid number.\n";
+                        }
+                    }
+                    else if (c == n+3) {
+                        // rename category
+                        cout << "Enter category number to rename: ";
+                        int ri; cin >> ri;
+                        if (ri >= 1 && ri <= n) {
+                            cout << "Enter new name: ";
+                            string nn;
+                            cin.ignore(); getline(cin, nn);
+                            engine.renameCategory(ri-1, nn);
+                            cout << "Category renamed.\n";
+                        } else {
+                            cout << "Invalid number.\n";
+                        }
+                    }
+                    else if (c == n+4) {
+                        break;
+                    }
+                    else {
+                        cout << "Invalid choice.\n";
+                    }
+                }
+            }
+            else if (choice == 3) {
+                cout << "Enter booking ID: ";
+                string text; cin >> text;
+                Booking* b = engine.findBooking(parseBookingID(text));
+                if (!b) {
+                    cout << "No booking with that ID.\n";
+                } else {
+                    printBooking(*b);
+                }
+            }
+            else if (choice == 4) {
+                cancelMenu();
+            }
+            else if (choice == 5) {
+                printSalesReport();
+            }
+            else if (choice == 0) {
+                cout << "Logging out of admin.\n";
+                break;
+            }
+            else {
+                cout << "Invalid choice.\n";
+            }
+        }
+    }
+
+    // User dashboard
+    void userMenu() {
+        while (true) {
+            cout << "\n--- User Menu ---\n";
+            for (size_t i = 0; i < engine.categoryCount(); ++i) {
+                cout << (i+1) << ". " << engine.category(i)->getName() << "\n";
+            }
+            cout << (engine.categoryCount()+1) << ". Search shows\n";
+            cout << (engine.categoryCount()+2) << ". Back to main menu\n";
+            cout << "Select category: ";
+            int c; cin >> c;
+            if (c == (int)engine.categoryCount()+2) break;
+            Show* sel = NULL;
+            if (c == (int)engine.categoryCount()+1) {
+                sel = searchShows();
+                if (!sel) continue;
+            } else {
+                if (c < 1 || c > (int)engine.categoryCount()) {
+                    cout << "Invalid category.\n";
+                    continue;
+                }
+                Category* cat = engine.category(c-1);
+                cout << "\n--- " << cat->getName() << " ---\n";
+                cat->listShows();
+                cout << "Select show number (or 0 to go back): ";
+                int s; cin >> s;
+                if (s == 0) continue;
+                sel = cat->getShow(s-1);
+                if (!sel) {
+                    cout << "Invalid show.\n";
+                    continue;
+                }
+            }
+            if (!waitYourTurn(sel)) continue;
+            engine.expireHolds();
+            sel->displayAvailableSeats();
+            cout << "Number of seats: ";
+            int party; cin >> party;
+            if (party < 1) {
+                cout << "Invalid number of seats.\n";
+                continue;
+            }
+            BookingEngine::SeatHold hold;
+            if (party == 1) {
+                cout << "Enter row and seat number to book: ";
+                int r, co; cin >> r >> co;
+                hold = engine.holdSeat(sel, r, co);
+            } else {
+                // groups get the best adjacent block rather than picking seats
+                hold = engine.holdBestSeats(sel, party);
+                if (hold.token) {
+                    cout << "Best available: row " << hold.row << ", seats "
+                         << hold.col << "-" << (hold.col + party - 1) << "\n";
+                }
+            }
+            if (!hold.token) {
+                cout << (party == 1 ? "Seat unavailable.\n"
+                                    : "Not enough adjacent seats left together.\n");
+                continue;
+            }
+            vector<uint64_t> ids;
+            BookingEngine& core = engine;
+            bool paid = PaymentProcessor::processPayment(hold.amount(),
+                [&core, &hold, &ids](const string& card) { return core.pay(hold, card, &ids); });
+            if (!paid) {
+                cout << "Booking not completed; the seats have been released.\n";
+                continue;
+            }
+            for (size_t i = 0; i < ids.size(); ++i) {
+                cout << "\nBooking confirmed! Seat [" << hold.row << "," << (hold.col + (int)i)
+                     << "] ID = " << formatBookingID(ids[i]);
+            }
+            cout << "\n";
+        }
+    }
+
+    // Queue for a show that is on sale; false if the pass lapsed
+    bool waitYourTurn(const Show* s) {
+        WaitingRoom& room = engine.waitingRoom();
+        WaitingRoom::Ticket t = room.join(s->getId());
+        while (true) {
+            WaitingRoom::Status st = room.check(s->getId(), t);
+            if (st.state == WaitingRoom::NO_LINE || st.state == WaitingRoom::ADMITTED) return true;
+            if (st.state == WaitingRoom::LAPSED) {
+                cout << "Your place in line has lapsed; please try again.\n";
+                return false;
+            }
+            cout << "This show is on sale: " << st.ahead << " ahead of you, about "
+                 << (long long)ceil(st.waitSeconds) << " s to wait...\n";
+            this_thread::sleep_for(chrono::milliseconds(st.retryAfterMs));
+        }
+    }
+
+    // Search titles and category names; returns the show picked, or NULL
+    Show* searchShows() {
+        cout << "Search for: ";
+        string query;
+        cin >> ws;
+        getline(cin, query);
+        vector<SearchHit> hits = engine.search(query, 20);
+        vector<Show*> shows;
+        for (size_t i = 0; i < hits.size(); ++i) {
+            if (hits[i].isCategory) {
+                for (size_t k = 0; k < engine.categoryCount(); ++k) {
+                    if (engine.category(k)->getId() == hits[i].id) {
+                        cout << "Category: " << engine.category(k)->getName()
+                             << " (option " << (k+1) << " in the menu)\n";
+                    }
+                }
+            }
+            else if (Show* s = engine.findShowById(hits[i].id)) {
+                shows.push_back(s);
+                cout << shows.size() << ". " << s->getTitle() << " at " << s->getDateTime()
+                     << " (" << s->seatsLeft() << " seats left)\n";
+            }
+        }
+        if (hits.empty()) {
+            cout << "No matches.\n";
+            return NULL;
+        }
+        if (shows.empty()) return NULL;
+        cout << "Select show number (or 0 to go back): ";
+        int n; cin >> n;
+        if (n < 1 || n > (int)shows.size()) return NULL;
+        return shows[n-1];
+    }
+
+    // Display help information
+    void displayHelp() {
+        cout << "\n=== Help ===\n";
+        cout << "1. Select 'Admin Login' to manage shows and bookings (admin credentials required).\n";
+        cout << "2. Select 'User' to browse categories and book tickets, or search by title.\n";
+        cout << "3. Follow on-screen prompts to select shows, seats, and complete payment.\n";
+        cout << "   Booking more than one seat picks the best block of adjacent seats for you.\n";
+        cout << "4. For support, use the 'Contact Us' option.\n";
+    }
+
+    // Display contact information
+    void displayContact() {
+        cout << "\n=== Contact Us ===\n";
+        cout << "FAST University Islamabad\n";
+        cout << "Phone: (051) 111 128 128\n";
+        cout << "Email: info@fastbookingsystem.com\n";
+    }
+
+public:
+    TicketBookingSystem(const string& store = "booking") : engine(store) {}
+
+    // Entry point
+    void run() {
+        while (true) {
+            cout << "\n**********************************\n";
+            cout << "       FAST BOOKING SYSTEM       \n";
+            cout << "**********************************\n";
+            cout << "Address: FAST University Islamabad\n";
+            cout << "Contact: (051) 111 128 128\n";
+            cout << "\n=== Main Menu ===\n";
+            cout << "1. Admin Login\n";
+            cout << "2. User\n";
+            cout << "3. Help\n";
+            cout << "4. Contact Us\n";
+            cout << "0. Exit\n";
+            cout << "Choice: ";
+            int choice; cin >> choice;
+
+            if (choice == 1) {
+                // Admin authentication
+                cout << "Username: ";
+                string u; cin >> u;
+                cout << "Password: ";
+                string p; cin >> p;
+                if (u == adminUser && p == adminPass && engine.journalFailed()) {
+                    cout << "Could not write the journal; no changes can be saved until a restart.\n";
+                } else if (u == adminUser && p == adminPass) {
+                    cout << "Login successful.\n";
+                    adminMenu();
+                } else {
+                    cout << "Invalid credentials.\n";
+                }
+            }
+            else if (choice == 2) {
+                userMenu();
+            }
+            else if (choice == 3) {
+                displayHelp();
+            }
+            else if (choice == 4) {
+                displayContact();
+            }
+            else if (choice == 0) {
+                cout << "Goodbye!\n";
+                break;
+            }
+            else {
+                cout << "Invalid choice.\n";
+            }
+        }
+    }
+};
+
+
+// ---------------------------------------------------------------------
+// HTTP/1.1 front end (Linux): one epoll event loop thread owns every
+// socket (non-blocking, level-triggered); a small fixed pool of workers
+// runs the handlers against the in-process engine. Each connection
+// sends its parsed requests to the workers in batches, one batch at a
+// time, so pipelined requests are answered in order while different
+// connections are served in parallel. Keep-alive is the HTTP/1.1
+// default; "Connection: close" or HTTP/1.0 closes after the response.
+// ---------------------------------------------------------------------
+
+struct HttpRequest {
+    string method;
+    string path;                // without the query string
+    string query;               // after '?', not decoded
+    string authorization;       // the Authorization header, as sent
+    bool   keepAlive;
+    HttpRequest() : keepAlive(true) {}
+
+    // %XX and '+' decoded
+    static string urlDecode(const string& text) {
+        string out;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '+') out += ' ';
+            else if (text[i] == '%' && i + 2 < text.size() && isxdigit((unsigned char)text[i+1])
+                     && isxdigit((unsigned char)text[i+2])) {
+                out += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+                i += 2;
+            }
+            else out += text[i];
+        }
+        return out;
+    }
+
+    // Value of name=value in the query string, decoded ("" if absent)
+    string param(const string& name) const {
+        size_t pos = 0;
+        while (pos <= query.size()) {
+            size_t end = query.find('&', pos);
+            if (end == string::npos) end = query.size();
+            size_t eq = query.find('=', pos);
+            if (eq != string::npos && eq < end && query.compare(pos, eq - pos, name) == 0
+                                              && eq - pos == name.size()) {
+                return urlDecode(query.substr(eq + 1, end - eq - 1));
+            }
+            pos = end + 1;
+        }
+        return "";
+    }
+};
+
+struct HttpResponse {
+    int    status;
+    string body;                // JSON unless contentType says otherwise
+    const char* contentType;
+    HttpResponse() : status(200), contentType("application/json") {}
+};
+
+inline const char* httpReason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 400: return "Bad Request";
+    case 402: return "Payment Required";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 429: return "Too Many Requests";
+    case 431: return "Request Header Fields Too Large";
+    case 503: return "Service Unavailable";
+    default:  return "Internal Server Error";
+    }
+}
+
+inline void appendHttpResponse(string& out, const HttpResponse& r, bool keepAlive) {
+    out += "HTTP/1.1 " + toString(r.status) + " " + httpReason(r.status) + "\r\n";
+    out += string("Content-Type: ") + r.contentType + "\r\nContent-Length: " + toString(r.body.size()) + "\r\n";
+    if (!keepAlive) out += "Connection: close\r\n";
+    out += "\r\n";
+    out += r.body;
+}
+
+// Parse one request from the front of buf. Returns the bytes consumed,
+// 0 if the request is not complete yet, or -1 (with status set) if the
+// request is malformed and the connection should be dropped.
+inline long parseHttpRequest(const string& buf, size_t from, HttpRequest& req, int& status) {
+    static const size_t MAX_HEADER = 16 * 1024;
+    size_t end = buf.find("\r\n\r\n", from);
+    if (end == string::npos) {
+        if (buf.size() - from > MAX_HEADER) { status = 431; return -1; }
+        return 0;
+    }
+    size_t lineEnd = buf.find("\r\n", from);
+    size_t sp1 = buf.find(' ', from);
+    size_t sp2 = sp1 == string::npos ? string::npos : buf.find(' ', sp1 + 1);
+    if (sp2 == string::npos || sp2 > lineEnd) { status = 400; return -1; }
+    req.method = buf.substr(from, sp1 - from);
+    string target  = buf.substr(sp1 + 1, sp2 - sp1 - 1);
+    string version = buf.substr(sp2 + 1, lineEnd - sp2 - 1);
+    if (version != "HTTP/1.1" && version != "HTTP/1.0") { status = 400; return -1; }
+    size_t q = target.find('?');
+    req.path  = target.substr(0, q);
+    req.query = q == string::npos ? "" : target.substr(q + 1);
+    req.keepAlive = version == "HTTP/1.1";
+
+    size_t contentLength = 0;
+    for (size_t pos = lineEnd + 2; pos < end; ) {
+        size_t next  = buf.find("\r\n", pos);
+        size_t colon = buf.find(':', pos);
+        if (colon != string::npos && colon < next) {
+            string name = buf.substr(pos, colon - pos);
+            for (size_t i = 0; i < name.size(); ++i) name[i] = (char)tolower((unsigned char)name[i]);
+            size_t v = colon + 1;
+            while (v < next && buf[v] == ' ') ++v;
+            string value = buf.substr(v, next - v);
+            if (name == "authorization") req.authorization = value;
+            for (size_t i = 0; i < value.size(); ++i) value[i] = (char)tolower((unsigned char)value[i]);
+            if (name == "content-length") contentLength = (size_t)strtoul(value.c_str(), NULL, 10);
+            if (name == "connection") {
+                if (value == "close")      req.keepAlive = false;
+                if (value == "keep-alive") req.keepAlive = true;
+            }
+        }
+        pos = next + 2;
+    }
+    size_t total = end + 4 + contentLength - from;     // bodies are accepted and ignored
+    if (buf.size() - from < total) return 0;
+    return (long)total;
+}
+
+// JSON string literal. Text that is not valid UTF-8 is taken as
+// Windows-1252, which is how the built-in catalog is encoded.
+inline string jsonString(const string& s) {
+    static const uint16_t cp1252[32] = {
+        0x20AC, 0x81, 0x201A, 0x192, 0x201E, 0x2026, 0x2020, 0x2021,
+        0x2C6, 0x2030, 0x160, 0x2039, 0x152, 0x8D, 0x17D, 0x8F,
+        0x90, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+        0x2DC, 0x2122, 0x161, 0x203A, 0x153, 0x9D, 0x17E, 0x178 };
+    bool utf8 = true;
+    for (size_t i = 0; i < s.size() && utf8; ) {
+        unsigned char c = (unsigned char)s[i];
+        int extra = c < 0x80 ? 0 : (c >> 5) == 6 ? 1 : (c >> 4) == 14 ? 2 : (c >> 3) == 30 ? 3 : -1;
+        if (extra < 0 || i + extra >= s.size() + (extra == 0)) { utf8 = false; break; }
+        for (int k = 1; k <= extra; ++k) {
+            if (((unsigned char)s[i + k] >> 6) != 2) utf8 = false;
+        }
+        i += extra + 1;
+    }
+    string out = "\"";
+    char esc[8];
+    for (size_t i = 0; i < s.size(); ++i) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') { out += '\\'; out += (char)c; }
+        else if (c < 0x20) { snprintf(esc, sizeof esc, "\\u%04x", c); out += esc; }
+        else if (c >= 0x80 && !utf8) {
+            snprintf(esc, sizeof esc, "\\u%04x", c < 0xA0 ? cp1252[c - 0x80] : c);
+            out += esc;
+        }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+// A node's part in replication, as the HTTP API reports it
+// (GET /replication) and promotes it (POST /replication/promote)
+class ReplicationRole {
+public:
+    virtual ~ReplicationRole() {}
+    virtual string statusJson() const = 0;
+    virtual bool   promote() { return false; }     // only a replica can
+};
+
+// REST routes over a BookingEngine (all bodies are JSON but /metrics):
+//   GET    /categories                      categories with show counts
+//   GET    /categories/{id}/shows           shows in a category
+//   GET    /shows/{id}                      one show with seats left
+//   GET    /shows/{id}/seats                seat map: '.' free, 'H' held, 'X' sold, '#' no seat
+//   GET    /shows/{id}/seats?since=V        changes after version V as [row, col,
+//                                           count, state], or the map if V is too old
+//   POST   /shows/{id}/queue                join the show's waiting room, get a ticket
+//   GET    /shows/{id}/queue/{ticket}       where the ticket stands
+//   DELETE /shows/{id}/queue/{ticket}       leave the line
+//   POST   /shows/{id}/holds?seats=N        hold the best N adjacent seats
+//   POST   /shows/{id}/holds?row=R&col=C    hold one chosen seat
+//   POST   /holds/{token}/pay?card=NUMBER   pay; books every held seat
+//   DELETE /holds/{token}                   give a hold back
+//   POST   /shows/{id}/bookings?seats=N&card=NUMBER   hold and pay in one go
+//   GET    /bookings/{id}                   look a booking up
+//   DELETE /bookings/{id}                   cancel a booking and refund it (admin)
+//   POST   /cancellations?show=ID           cancel and refund a show's bookings (admin)
+//          (or ?category=ID, or ?from=DATE&to=DATE for the shows between)
+//   GET    /search?q=TEXT[&limit=N]         shows and categories matching as you type
+//   GET    /suggest?q=PREFIX                word completions
+//   GET    /metrics                         counters and latencies, Prometheus text
+//   GET    /replication                     this node's role, journal LSN and lag
+//   POST   /replication/promote             make a replica writable
+// While a show is on sale its holds and bookings also need &ticket=T with
+// an admitted ticket, or get 429 and the ticket's status. Admin routes
+// need the server's admin token as a bearer credential, or get 403.
+class BookingHttpApi {
+private:
+    BookingEngine&   engine;
+    ReplicationRole* replication;   // NULL: a standalone node
+    string           adminToken;    // empty: no admin routes
+
+    static void error(HttpResponse& resp, int status, const string& message) {
+        resp.status = status;
+        resp.body   = "{\"error\":" + jsonString(message) + "}";
+    }
+
+    static string showJson(const Show* s) {
+        return "{\"id\":" + toString(s->getId())
+             + ",\"title\":" + jsonString(s->getTitle())
+             + ",\"when\":" + jsonString(s->getDateTime())
+             + ",\"price\":" + formatRupees(s->getPrice())
+             + ",\"fares\":" + faresJson(s)
+             + ",\"rows\":" + toString(s->getRows())
+             + ",\"cols\":" + toString(s->getCols())
+             + ",\"seatsLeft\":" + toString(s->seatsLeft()) + "}";
+    }
+
+    // Current fare per row, front first
+    static string faresJson(const Show* s) {
+        PriceClock clock = PriceClock::current();
+        string out = "[";
+        for (int r = 1; r <= s->getRows(); ++r) {
+            out += (r > 1 ? "," : "") + formatRupees(s->quote(r, clock));
+        }
+        return out + "]";
+    }
+
+    static string holdJson(const BookingEngine::SeatHold& h) {
+        return "{\"hold\":\"" + toString(h.token) + "\""
+             + ",\"show\":" + toString(h.show->getId())
+             + ",\"row\":" + toString(h.row)
+             + ",\"col\":" + toString(h.col)
+             + ",\"seats\":" + toString(h.count)
+             + ",\"fare\":" + formatRupees(h.fare)
+             + ",\"amount\":" + formatRupees(h.amount()) + "}";
+    }
+
+    static string queueJson(WaitingRoom::Ticket t, const WaitingRoom::Status& st) {
+        static const char* const states[] = { "open", "waiting", "admitted", "lapsed" };
+        return "{\"ticket\":\"" + toString(t) + "\""
+             + ",\"state\":\"" + states[st.state] + "\""
+             + ",\"ahead\":" + toString(st.ahead)
+             + ",\"waitSecs\":" + toString((long long)ceil(st.waitSeconds))
+             + ",\"retryAfterMs\":" + toString(st.retryAfterMs) + "}";
+    }
+
+    // Seat requests for a show on sale need an admitted ticket=
+    bool admitted(const HttpRequest& req, const Show* s, HttpResponse& resp) {
+        WaitingRoom& room = engine.waitingRoom();
+        long long t = 0;
+        if (!number(req.param("ticket"), t)) t = 0;
+        WaitingRoom::Status st = room.check(s->getId(), (WaitingRoom::Ticket)t);
+        if (st.state == WaitingRoom::NO_LINE || st.state == WaitingRoom::ADMITTED) return true;
+        Metrics::count(C_QUEUE_TURNED_AWAY);
+        resp.status = 429;
+        resp.body   = queueJson((WaitingRoom::Ticket)t, st);
+        return false;
+    }
+
+    static bool number(const string& text, long long& out) {
+        if (text.empty() || text.size() > 18) return false;
+        for (size_t i = 0; i < text.size(); ++i) if (!isdigit((unsigned char)text[i])) return false;
+        out = atoll(text.c_str());
+        return true;
+    }
+
+    // Split "/a/b/c" into {"a", "b", "c"}
+    static vector<string> segments(const string& path) {
+        vector<string> out;
+        size_t pos = 1;
+        while (pos <= path.size()) {
+            size_t end = path.find('/', pos);
+            if (end == string::npos) end = path.size();
+            if (end > pos) out.push_back(path.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return out;
+    }
+
+    BookingEngine::SeatHold holdFor(const HttpRequest& req, Show* s) {
+        long long n = 0, r = 0, c = 0;
+        if (number(req.param("row"), r) && number(req.param("col"), c)) {
+            return engine.holdSeat(s, (int)r, (int)c);
+        }
+        if (!number(req.param("seats"), n)) n = 1;
+        return engine.holdBestSeats(s, (int)n);
+    }
+
+    void pay(const BookingEngine::SeatHold& h, const string& card, HttpResponse& resp) {
+        vector<uint64_t> ids;
+        if (!engine.pay(h, card, &ids).get()) {
+            error(resp, 402, "payment declined or hold expired");
+            return;
+        }
+        resp.status = 201;
+        resp.body = "{\"bookings\":[";
+        for (size_t i = 0; i < ids.size(); ++i) {
+            if (i) resp.body += ",";
+            resp.body += "{\"id\":\"" + formatBookingID(ids[i]) + "\",\"row\":" + toString(h.row)
+                       + ",\"col\":" + toString(h.col + (int)i) + "}";
+        }
+        resp.body += "],\"amount\":" + formatRupees(h.amount()) + "}";
+    }
+
+    static void cancelJson(const BulkCanceller::Result& r, HttpResponse& resp) {
+        resp.body = "{\"cancelled\":" + toString(r.bookings) + ",\"batches\":" + toString(r.batches)
+                  + ",\"refunded\":" + formatRupees(r.refunded) + ",\"refundFailed\":[";
+        for (size_t i = 0; i < r.refundFailed.size(); ++i) {
+            resp.body += (i ? ",\"" : "\"") + formatBookingID(r.refundFailed[i]) + "\"";
+        }
+        resp.body += "]}";
+    }
+
+    // Admin routes need "Authorization: Bearer TOKEN" with the token the
+    // server was started with; 403 otherwise. Compared in constant time.
+    bool isAdmin(const HttpRequest& req, HttpResponse& resp) const {
+        string want = "Bearer " + adminToken;
+        const string& got = req.authorization;
+        unsigned char diff = got.size() != want.size();
+        for (size_t i = 0; i < want.size(); ++i) diff |= (unsigned char)(want[i] ^ (i < got.size() ? got[i] : 0));
+        if (!adminToken.empty() && !diff) return true;
+        error(resp, 403, "admin credential required");
+        return false;
+    }
+
+public:
+    BookingHttpApi(BookingEngine& e, ReplicationRole* r = NULL, const string& admin = "")
+        : engine(e), replication(r), adminToken(admin) {}
+
+    void handle(const HttpRequest& req, HttpResponse& resp) {
+        ScopedTimer timer(T_HTTP_REQUEST);
+        Epoch::Guard guard;             // catalog pointers stay valid for the request
+        vector<string> seg = segments(req.path);
+        long long id = 0;
+        bool get = req.method == "GET", post = req.method == "POST";
+
+        if (seg.size() == 1 && seg[0] == "replication" && get) {
+            resp.body = replication ? replication->statusJson() : "{\"role\":\"standalone\"}";
+            return;
+        }
+        if (seg.size() == 2 && seg[0] == "replication" && seg[1] == "promote" && post) {
+            if (!replication || !replication->promote()) { error(resp, 409, "not a replica"); return; }
+            resp.body = replication->statusJson();
+            return;
+        }
+        if (!get && engine.isReadOnly()) {
+            error(resp, 503, engine.journalFailed() ? "cannot write the journal: changes are refused"
+                                                     : "read-only replica: send changes to the primary");
+            return;
+        }
+
+        if (seg.size() == 1 && seg[0] == "categories" && get) {
+            resp.body = "[";
+            PublishedArray<Category>::View all = engine.categoryList();
+            for (size_t i = 0; i < all.size(); ++i) {
+                Category* cat = all[i];
+                if (i) resp.body += ",";
+                resp.body += "{\"id\":" + toString(cat->getId()) + ",\"name\":" + jsonString(cat->getName())
+                           + ",\"shows\":" + toString(cat->getCount()) + "}";
+            }
+            resp.body += "]";
+        }
+        else if (seg.size() == 3 && seg[0] == "categories" && seg[2] == "shows" && get
+                 && number(seg[1], id)) {
+            Category* cat = NULL;
+            PublishedArray<Category>::View all = engine.categoryList();
+            for (size_t i = 0; i < all.size() && !cat; ++i) {
+                if (all[i]->getId() == id) cat = all[i];
+            }
+            if (!cat) { error(resp, 404, "no such category"); return; }
+            resp.body = "[";
+            PublishedArray<Show>::View shows = cat->allShows();
+            for (size_t i = 0; i < shows.size(); ++i) {
+                if (i) resp.body += ",";
+                resp.body += showJson(shows[i]);
+            }
+            resp.body += "]";
+        }
+        else if (seg.size() >= 2 && seg[0] == "shows" && number(seg[1], id)) {
+            Show* s = engine.findShowById((int)id);
+            if (!s) { error(resp, 404, "no such show"); return; }
+            if (seg.size() == 2 && get) {
+                resp.body = showJson(s);
+            }
+            else if (seg.size() == 3 && seg[2] == "seats" && get) {
+                long long since = 0;
+                vector<SeatChange> delta;
+                uint64_t upTo = 0;
+                if (number(req.param("since"), since) && s->changesSince((uint64_t)since, delta, upTo)) {
+                    resp.body = "{\"show\":" + toString(s->getId()) + ",\"version\":" + toString(upTo)
+                              + ",\"changes\":[";
+                    for (size_t i = 0; i < delta.size(); ++i) {
+                        const SeatChange& ch = delta[i];
+                        resp.body += (i ? ",[" : "[") + toString(ch.row) + "," + toString(ch.col) + ","
+                                   + toString(ch.count) + ",\""
+                                   + (ch.state == SEAT_FREE ? "." : ch.state == SEAT_HELD ? "H" : "X") + "\"]";
+                    }
+                    resp.body += "]}";
+                    return;
+                }
+                // first poll, or too far behind: the whole map
+                resp.body = "{\"show\":" + toString(s->getId()) + ",\"version\":" + toString(s->getSeatVersion())
+                          + ",\"seats\":[";
+                for (int r = 1; r <= s->getRows(); ++r) {
+                    string row(s->getCols(), '.');
+                    for (int c = 1; c <= s->getCols(); ++c) {
+                        SeatState st = s->seatState(r, c);
+                        if (st != SEAT_FREE) row[c-1] = st == SEAT_HELD ? 'H' : s->isBlocked(r, c) ? '#' : 'X';
+                    }
+                    resp.body += (r > 1 ? ",\"" : "\"") + row + "\"";
+                }
+                resp.body += "]}";
+            }
+            else if (seg.size() == 3 && seg[2] == "queue" && post) {
+                WaitingRoom& room = engine.waitingRoom();
+                WaitingRoom::Ticket t = room.join(s->getId());
+                if (t) resp.status = 201;
+                resp.body = queueJson(t, room.check(s->getId(), t));
+            }
+            else if (seg.size() == 4 && seg[2] == "queue") {
+                WaitingRoom& room = engine.waitingRoom();
+                long long t = 0;
+                if (!number(seg[3], t)) { error(resp, 404, "no such ticket"); return; }
+                if (get) resp.body = queueJson((WaitingRoom::Ticket)t, room.check(s->getId(), (WaitingRoom::Ticket)t));
+                else if (req.method == "DELETE") {
+                    room.leave(s->getId(), (WaitingRoom::Ticket)t);
+                    resp.body = "{\"left\":true}";
+                }
+                else error(resp, 405, "unsupported");
+            }
+            else if (seg.size() == 3 && seg[2] == "holds" && post) {
+                if (!admitted(req, s, resp)) return;
+                engine.expireHolds();
+                BookingEngine::SeatHold h = holdFor(req, s);
+                if (!h.token) { error(resp, 409, "seats not available"); return; }
+                resp.status = 201;
+                resp.body   = holdJson(h);
+            }
+            else if (seg.size() == 3 && seg[2] == "bookings" && post) {
+                if (!admitted(req, s, resp)) return;
+                engine.expireHolds();
+                BookingEngine::SeatHold h = holdFor(req, s);
+                if (!h.token) { error(resp, 409, "seats not available"); return; }
+                pay(h, req.param("card"), resp);
+            }
+            else error(resp, seg.size() == 3 ? 405 : 404, "unsupported");
+        }
+        else if (seg.size() >= 2 && seg[0] == "holds" && number(seg[1], id)) {
+            BookingEngine::SeatHold h = engine.findHold((HoldManager::Token)id);
+            if (!h.token) { error(resp, 404, "no such hold (expired?)"); return; }
+            if (seg.size() == 3 && seg[2] == "pay" && post) {
+                pay(h, req.param("card"), resp);
+            }
+            else if (seg.size() == 2 && req.method == "DELETE") {
+                engine.releaseHold(h);
+                resp.body = "{\"released\":true}";
+            }
+            else if (seg.size() == 2 && get) {
+                resp.body = holdJson(h);
+            }
+            else error(resp, 405, "unsupported");
+        }
+        else if (seg.size() == 1 && seg[0] == "search" && get) {
+            long long limit = 20;
+            if (!number(req.param("limit"), limit) || limit > 1000) limit = 20;
+            vector<SearchHit> hits = engine.search(req.param("q"), (size_t)limit);
+            string cats, shows;
+            for (size_t i = 0; i < hits.size(); ++i) {
+                if (hits[i].isCategory) {
+                    PublishedArray<Category>::View all = engine.categoryList();
+                    for (size_t k = 0; k < all.size(); ++k) {
+                        Category* cat = all[k];
+                        if (cat->getId() != hits[i].id) continue;
+                        cats += (cats.empty() ? "" : ",") + string("{\"id\":") + toString(cat->getId())
+                              + ",\"name\":" + jsonString(cat->getName()) + "}";
+                    }
+                }
+                else if (Show* s = engine.findShowById(hits[i].id)) {
+                    shows += (shows.empty() ? "" : ",") + showJson(s);
+                }
+            }
+            resp.body = "{\"categories\":[" + cats + "],\"shows\":[" + shows + "]}";
+        }
+        else if (seg.size() == 1 && seg[0] == "suggest" && get) {
+            vector<string> words = engine.suggestWords(req.param("q"));
+            resp.body = "[";
+            for (size_t i = 0; i < words.size(); ++i) resp.body += (i ? "," : "") + jsonString(words[i]);
+            resp.body += "]";
+        }
+        else if (seg.size() == 1 && seg[0] == "metrics" && get) {
+            resp.contentType = "text/plain; version=0.0.4";
+            resp.body = Metrics::prometheus();
+        }
+        else if (seg.size() == 2 && seg[0] == "bookings" && get) {
+            Booking* b = engine.findBooking(parseBookingID(seg[1]));
+            if (!b) { error(resp, 404, "no such booking"); return; }
+            Show* s = engine.findShowById(b->showId);
+            resp.body = "{\"id\":\"" + formatBookingID(b->id) + "\",\"show\":" + toString(b->showId)
+                      + ",\"title\":" + (s ? jsonString(s->getTitle()) : string("null"))
+                      + ",\"when\":" + (s ? jsonString(s->getDateTime()) : string("null"))
+                      + ",\"row\":" + toString(b->row) + ",\"col\":" + toString(b->col)
+                      + ",\"fare\":" + formatRupees(b->fare) + "}";
+        }
+        else if (seg.size() == 2 && seg[0] == "bookings" && req.method == "DELETE") {
+            if (!isAdmin(req, resp)) return;
+            BulkCanceller::Result r = BulkCanceller(engine).cancelBooking(parseBookingID(seg[1]));
+            if (!r.bookings) { error(resp, 404, "no such booking"); return; }
+            cancelJson(r, resp);
+        }
+        else if (seg.size() == 1 && seg[0] == "cancellations" && post) {
+            if (!isAdmin(req, resp)) return;
+            BulkCanceller canceller(engine);
+            string from = req.param("from"), to = req.param("to");
+            if (number(req.param("show"), id)) {
+                cancelJson(canceller.cancelShow((int)id), resp);
+            }
+            else if (number(req.param("category"), id)) {
+                cancelJson(canceller.cancelCategory((int)id), resp);
+            }
+            else if (!from.empty() && !to.empty()) {
+                ShowTime a = parseShowTime(from), b = parseShowTime(to);
+                if (a.kind != SCHEDULE_DATED || b.kind != SCHEDULE_DATED || b.end < a.start) {
+                    error(resp, 400, "from and to must be dates, from first");
+                    return;
+                }
+                cancelJson(canceller.cancelBetween(a.start, b.end + 1), resp);
+            }
+            else error(resp, 400, "give show, category, or from and to");
+        }
+        else error(resp, 404, "no such resource");
+    }
+};
+
+#ifdef __linux__
+
+class HttpServer {
+public:
+    typedef function<void(const HttpRequest&, HttpResponse&)> Handler;
+
+private:
+    struct Connection {
+        int      fd;
+        uint64_t gen;           // tells a reused fd from the one a reply was for
+        string   in, out;
+        size_t   outPos;
+        bool     busy;          // a batch is with the workers
+        bool     closing;       // close once the output is flushed
+        bool     writing;       // EPOLLOUT registered
+    };
+
+    struct Job {
+        int      fd;
+        uint64_t gen;
+        vector<HttpRequest> requests;
+    };
+
+    struct Reply {
+        int      fd;
+        uint64_t gen;
+        string   out;
+        bool     close;
+    };
+
+    Handler             handler;
+    int                 workerCount;
+    int                 listenFd, epollFd, wakeFd;
+    int                 boundPort;
+    atomic<bool>        running;
+    thread              loopThread;
+    vector<thread>      workers;
+    vector<Connection*> conns;          // indexed by fd
+    uint64_t            nextGen;
+
+    mutex               jobLock;
+    condition_variable  jobReady;
+    deque<Job>          jobs;
+    bool                stopping;
+
+    mutex               replyLock;
+    vector<Reply>       replies;
+
+    static void setNonBlocking(int fd) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    void watch(Connection* c, bool wantWrite) {
+        if (c->writing == wantWrite) return;
+        epoll_event ev;
+        ev.events  = wantWrite ? EPOLLIN | EPOLLOUT : EPOLLIN;
+        ev.data.fd = c->fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->writing = wantWrite;
+    }
+
+    void closeConnection(Connection* c) {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, c->fd, NULL);
+        ::close(c->fd);
+        conns[c->fd] = NULL;
+        delete c;
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) return;     // EAGAIN, or out of descriptors for now
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            if (fd >= (int)conns.size()) conns.resize(fd + 1, NULL);
+            Connection* c = new Connection();
+            c->fd = fd; c->gen = ++nextGen; c->outPos = 0;
+            c->busy = c->closing = c->writing = false;
+            conns[fd] = c;
+            epoll_event ev;
+            ev.events  = EPOLLIN;
+            ev.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+        }
+    }
+
+    // Write what we can; false if the connection was closed
+    bool flush(Connection* c) {
+        while (c->outPos < c->out.size()) {
+            ssize_t n = ::send(c->fd, c->out.data() + c->outPos, c->out.size() - c->outPos, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+                closeConnection(c);
+                return false;
+            }
+            c->outPos += (size_t)n;
+        }
+        if (c->outPos == c->out.size()) {
+            c->out.clear();
+            c->outPos = 0;
+            if (c->closing && !c->busy) { closeConnection(c); return false; }
+        }
+        watch(c, !c->out.empty());
+        return true;
+    }
+
+    // Hand every complete buffered request to the workers as one batch
+    void dispatch(Connection* c) {
+        if (c->busy || c->closing) return;
+        Job job;
+        job.fd = c->fd; job.gen = c->gen;
+        size_t pos = 0;
+        while (true) {
+            HttpRequest req;
+            int status = 400;
+            long used = parseHttpRequest(c->in, pos, req, status);
+            if (used == 0) break;
+            if (used < 0) {
+                HttpResponse bad;
+                bad.status = status;
+                bad.body   = "{\"error\":\"malformed request\"}";
+                c->closing = true;
+                if (job.requests.empty()) {     // otherwise answered after the batch
+                    appendHttpResponse(c->out, bad, false);
+                    flush(c);
+                    return;
+                }
+                break;
+            }
+            pos += (size_t)used;
+            bool last = !req.keepAlive;
+            job.requests.push_back(req);
+            if (last) break;
+        }
+        c->in.erase(0, pos);
+        if (job.requests.empty()) return;
+        c->busy = true;
+        {
+            lock_guard<mutex> g(jobLock);
+            jobs.push_back(job);
+        }
+        jobReady.notify_one();
+    }
+
+    void readFrom(Connection* c) {
+        char buf[16384];
+        while (true) {
+            ssize_t n = ::recv(c->fd, buf, sizeof buf, 0);
+            if (n > 0) { c->in.append(buf, (size_t)n); continue; }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            // peer closed (or reset): finish what is in flight, then close
+            c->closing = true;
+            if (!c->busy && c->out.empty()) closeConnection(c);
+            return;
+        }
+        dispatch(c);
+    }
+
+    void deliverReplies() {
+        uint64_t count;
+        if (::read(wakeFd, &count, sizeof count) < 0) {}   // just drains the counter
+        vector<Reply> ready;
+        {
+            lock_guard<mutex> g(replyLock);
+            ready.swap(replies);
+        }
+        for (size_t i = 0; i < ready.size(); ++i) {
+            Reply& r = ready[i];
+            Connection* c = r.fd < (int)conns.size() ? conns[r.fd] : NULL;
+            if (!c || c->gen != r.gen) continue;   // client went away meanwhile
+            c->busy = false;
+            c->out += r.out;
+            if (r.close) c->closing = true;
+            if (!flush(c)) continue;
+            dispatch(c);    // more pipelined requests may be waiting
+            if (c->closing && !c->busy && c->out.empty()) closeConnection(c);
+        }
+    }
+
+    void loop() {
+        epoll_event events[256];
+        while (running.load()) {
+            int n = epoll_wait(epollFd, events, 256, 100);
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == listenFd) { acceptAll(); continue; }
+                if (fd == wakeFd)   { deliverReplies(); continue; }
+                Connection* c = fd < (int)conns.size() ? conns[fd] : NULL;
+                if (!c) continue;
+                if (events[i].events & EPOLLOUT) {
+                    if (!flush(c)) continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) readFrom(c);
+            }
+        }
+    }
+
+    void work() {
+        while (true) {
+            Job job;
+            {
+                unique_lock<mutex> g(jobLock);
+                jobReady.wait(g, [this]() { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            Reply reply;
+            reply.fd = job.fd; reply.gen = job.gen; reply.close = false;
+            for (size_t i = 0; i < job.requests.size(); ++i) {
+                HttpResponse resp;
+                handler(job.requests[i], resp);
+                appendHttpResponse(reply.out, resp, job.requests[i].keepAlive);
+                if (!job.requests[i].keepAlive) { reply.close = true; break; }
+            }
+            {
+                lock_guard<mutex> g(replyLock);
+                replies.push_back(reply);
+            }
+            uint64_t one = 1;
+            if (::write(wakeFd, &one, sizeof one) < 0) {}   // loop drains it
+        }
+    }
+
+public:
+    HttpServer(Handler h, int workerThreads = 4)
+        : handler(h), workerCount(workerThreads), listenFd(-1), epollFd(-1), wakeFd(-1),
+          boundPort(0), running(false), nextGen(0), stopping(false) {}
+
+    ~HttpServer() { stop(); }
+
+    // Listen on 127.0.0.1:port (0 picks a free port) and start serving
+    bool start(int port, bool anyAddress = false) {
+        listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) return false;
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons((uint16_t)port);
+        addr.sin_addr.s_addr = htonl(anyAddress ? INADDR_ANY : INADDR_LOOPBACK);
+        socklen_t len = sizeof addr;
+        if (bind(listenFd, (sockaddr*)&addr, sizeof addr) < 0 || listen(listenFd, SOMAXCONN) < 0
+            || getsockname(listenFd, (sockaddr*)&addr, &len) < 0) {
+            ::close(listenFd);
+            listenFd = -1;
+            return false;
+        }
+        boundPort = ntohs(addr.sin_port);
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd  = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev;
+        ev.events = EPOLLIN; ev.data.fd = listenFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN; ev.data.fd = wakeFd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &ev);
+
+        running.store(true);
+        for (int i = 0; i < workerCount; ++i) workers.push_back(thread(&HttpServer::work, this));
+        loopThread = thread(&HttpServer::loop, this);
+        return true;
+    }
+
+    int port() const { return boundPort; }
+
+    void stop() {
+        if (!running.exchange(false)) return;
+        loopThread.join();
+        {
+            lock_guard<mutex> g(jobLock);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+        workers.clear();
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (conns[i]) { ::close(conns[i]->fd); delete conns[i]; }
+        }
+        conns.clear();
+        ::close(listenFd); ::close(epollFd); ::close(wakeFd);
+    }
+};
+
+// ---------------------------------------------------------------------
+// Replication by log shipping. The primary hands every journal record,
+// in LSN order, to a backlog in memory; one thread per replica sends it
+// a snapshot image if it has nothing (or is further behind than the
+// backlog reaches), then the records after it. A replica applies them
+// in order, journals them under the same LSNs and acknowledges; it
+// serves reads only until it is promoted.
+//
+// Messages, both ways, are [u8 type][u32 length][body]:
+//   replica -> primary  'H' hello      u64 last LSN it holds (0: none)
+//                       'A' ack        u64 LSN applied and durable
+//   primary -> replica  'S' snapshot   u64 LSN, image
+//                       'R' records    u64 primary's last LSN, journal frames
+//                       'B' beat       u64 primary's last LSN (while idle)
+// Addresses are "host:port" over TCP or "unix:/path".
+// ---------------------------------------------------------------------
+static bool replicationAddress(const string& address, sockaddr_storage& sa, socklen_t& len) {
+    memset(&sa, 0, sizeof sa);
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un* un = (sockaddr_un*)&sa;
+        string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof un->sun_path) return false;
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path.c_str(), path.size() + 1);
+        len = sizeof(sockaddr_un);
+        return true;
+    }
+    size_t colon = address.rfind(':');
+    string host  = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+    int    port  = atoi(address.c_str() + (colon == string::npos ? 0 : colon + 1));
+    sockaddr_in* in = (sockaddr_in*)&sa;
+    in->sin_family = AF_INET;
+    in->sin_port   = htons((uint16_t)port);
+    len = sizeof(sockaddr_in);
+    return port >= 0 && port < 65536 && inet_pton(AF_INET, host.c_str(), &in->sin_addr) == 1;
+}
+
+// Listening socket for address; bound gets the address it really has
+// (the port chosen for ":0"). -1 on failure.
+static int replicationListen(const string& address, string& bound) {
+    sockaddr_storage sa;
+    socklen_t len;
+    if (!replicationAddress(address, sa, len)) return -1;
+    int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    if (sa.ss_family == AF_UNIX) unlink(((sockaddr_un*)&sa)->sun_path);
+    else setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (bind(fd, (sockaddr*)&sa, len) < 0 || listen(fd, 16) < 0 || getsockname(fd, (sockaddr*)&sa, &len) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    bound = address;
+    if (sa.ss_family == AF_INET) {
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &((sockaddr_in*)&sa)->sin_addr, host, sizeof host);
+        bound = string(host) + ":" + toString(ntohs(((sockaddr_in*)&sa)->sin_port));
+    }
+    return fd;
+}
+
+static int replicationConnect(const string& address) {
+    sockaddr_storage sa;
+    socklen_t len;
+    if (!replicationAddress(address, sa, len)) return -1;
+    int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (sockaddr*)&sa, len) < 0) {
+        ::close(fd);
+        return -1;
+    }
+    int one = 1;
+    if (sa.ss_family == AF_INET) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    return fd;
+}
+
+static bool sendAll(int fd, const char* p, size_t n) {
+    while (n > 0) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= (size_t)k;
+    }
+    return true;
+}
+
+static bool recvAll(int fd, char* p, size_t n) {
+    while (n > 0) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR) continue;
+        if (k <= 0) return false;
+        p += k;
+        n -= (size_t)k;
+    }
+    return true;
+}
+
+static bool sendMessage(int fd, char type, const string& body) {
+    RecordWriter h;
+    h.u8((uint8_t)type);
+    h.u32((uint32_t)body.size());
+    return sendAll(fd, h.data().data(), h.data().size()) && sendAll(fd, body.data(), body.size());
+}
+
+static bool readMessage(int fd, char& type, string& body) {
+    char head[5];
+    if (!recvAll(fd, head, sizeof head)) return false;
+    RecordReader r(head + 1, 4);
+    type = head[0];
+    body.resize(r.u32());
+    return body.empty() || recvAll(fd, &body[0], body.size());
+}
+
+static string lsnBody(uint64_t lsn) {
+    RecordWriter w;
+    w.u64(lsn);
+    return w.data();
+}
+
+// The primary's recent journal frames, oldest dropped first once they
+// pass the byte limit. LSNs in it are consecutive.
+class ReplicationBacklog {
+private:
+    mutable mutex      lock;
+    condition_variable grew;
+    deque<pair<uint64_t, string> > frames;
+    size_t             bytes, limit;
+    uint64_t           last;            // newest LSN handed in
+    bool               closed;
+
+public:
+    explicit ReplicationBacklog(size_t limitBytes)
+        : bytes(0), limit(limitBytes), last(0), closed(false) {}
+
+    void reset(uint64_t lsn) {
+        lock_guard<mutex> g(lock);
+        frames.clear();
+        bytes  = 0;
+        last   = lsn;
+        closed = false;
+    }
+
+    void add(uint64_t lsn, const string& payload) {
+        string f;
+        BookingJournal::frame(lsn, payload, f);
+        lock_guard<mutex> g(lock);
+        bytes += f.size();
+        frames.push_back(make_pair(lsn, string()));
+        frames.back().second.swap(f);
+        last = lsn;
+        while (bytes > limit && frames.size() > 1) {
+            bytes -= frames.front().second.size();
+            frames.pop_front();
+        }
+        grew.notify_all();
+    }
+
+    // Wake every reader for good
+    void close() {
+        lock_guard<mutex> g(lock);
+        closed = true;
+        grew.notify_all();
+    }
+
+    uint64_t lastLsn() const {
+        lock_guard<mutex> g(lock);
+        return last;
+    }
+
+    // Whether records from LSN `from` on can still be sent from here
+    bool reaches(uint64_t from) const {
+        lock_guard<mutex> g(lock);
+        return from > last || (!frames.empty() && frames.front().first <= from);
+    }
+
+    // Append the frames from LSN `from` on (about maxBytes of them) to
+    // out, waiting up to waitMs for the first; upto gets the last LSN
+    // added. False once `from` has been dropped or the backlog closed.
+    bool read(uint64_t from, string& out, uint64_t& upto, size_t maxBytes, int waitMs) {
+        unique_lock<mutex> g(lock);
+        grew.wait_for(g, chrono::milliseconds(waitMs), [&]() { return last >= from || closed; });
+        if (closed) return false;
+        if (last < from) return true;
+        if (frames.empty() || frames.front().first > from) return false;
+        for (size_t i = (size_t)(from - frames.front().first); i < frames.size() && out.size() < maxBytes; ++i) {
+            out += frames[i].second;
+            upto = frames[i].first;
+        }
+        return true;
+    }
+};
+
+// Ships an engine's journal to any number of replicas
+class ReplicationPrimary : public ReplicationRole {
+private:
+    struct Follower {
+        int              fd;
+        string           peer;
+        atomic<uint64_t> acked;         // durable on the replica
+        atomic<bool>     done;
+        thread           worker;
+    };
+
+    static const size_t BACKLOG_BYTES = 256 << 20;
+    static const size_t BATCH_BYTES   = 256 << 10;
+    static const int    BEAT_MS       = 200;
+
+    BookingEngine&     engine;
+    ReplicationBacklog backlog;
+    vector<int>        listenFds;
+    vector<string>     addresses;
+    vector<thread>     acceptors;
+    mutable mutex      followersLock;
+    vector<Follower*>  followers;
+    atomic<bool>       running;
+    atomic<uint64_t>   shipped;         // records sent, all replicas together
+
+    ReplicationPrimary(const ReplicationPrimary&);
+    ReplicationPrimary& operator=(const ReplicationPrimary&);
+
+    void acceptLoop(int lfd) {
+        while (running.load()) {
+            int fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                break;      // stop() shut the socket down
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+            sockaddr_storage sa;
+            socklen_t len = sizeof sa;
+            string peer = "local";
+            if (getpeername(fd, (sockaddr*)&sa, &len) == 0 && sa.ss_family == AF_INET) {
+                char host[INET_ADDRSTRLEN];
+                inet_ntop(AF_INET, &((sockaddr_in*)&sa)->sin_addr, host, sizeof host);
+                peer = string(host) + ":" + toString(ntohs(((sockaddr_in*)&sa)->sin_port));
+            }
+            Follower* f = new Follower;
+            f->fd = fd;
+            f->peer = peer;
+            f->acked.store(0);
+            f->done.store(false);
+            lock_guard<mutex> g(followersLock);
+            for (size_t i = 0; i < followers.size(); ) {
+                if (!followers[i]->done.load()) { ++i; continue; }
+                followers[i]->worker.join();
+                delete followers[i];
+                followers.erase(followers.begin() + i);
+            }
+            followers.push_back(f);
+            f->worker = thread(&ReplicationPrimary::serve, this, f);
+        }
+    }
+
+    // Take in whatever acks have arrived, without waiting
+    static bool readAcks(Follower* f, string& in) {
+        char buf[512];
+        ssize_t k;
+        while ((k = recv(f->fd, buf, sizeof buf, MSG_DONTWAIT)) > 0) in.append(buf, (size_t)k);
+        if (k == 0) return false;
+        size_t pos = 0;
+        for (; in.size() - pos >= 13; pos += 13) {
+            RecordReader r(in.data() + pos + 5, 8);
+            if (in[pos] == 'A') f->acked.store(r.u64());
+        }
+        in.erase(0, pos);
+        return true;
+    }
+
+    void serve(Follower* f) {
+        char   type;
+        string body, acks;
+        uint64_t next = 0;
+        if (readMessage(f->fd, type, body) && type == 'H') {
+            RecordReader r(body.data(), body.size());
+            next = r.u64() + 1;
+        }
+        if (next == 1 || !backlog.reaches(next)) {
+            uint64_t lsn = 0;
+            string image = engine.replicationImage(lsn);
+            if (next == 0 || !sendMessage(f->fd, 'S', lsnBody(lsn) + image)) next = 0;
+            else next = lsn + 1;
+        }
+        while (next && running.load()) {
+            string   out = lsnBody(backlog.lastLsn());
+            uint64_t upto = 0;
+            if (!backlog.read(next, out, upto, BATCH_BYTES, BEAT_MS)) break;    // fell out of the backlog
+            bool sent = upto ? sendMessage(f->fd, 'R', out) : sendMessage(f->fd, 'B', out.substr(0, 8));
+            if (!sent || !readAcks(f, acks)) break;
+            if (upto) {
+                shipped.fetch_add(upto - next + 1, memory_order_relaxed);
+                next = upto + 1;
+            }
+        }
+        ::close(f->fd);
+        f->done.store(true);
+    }
+
+public:
+    explicit ReplicationPrimary(BookingEngine& e)
+        : engine(e), backlog(BACKLOG_BYTES), running(false), shipped(0) {}
+
+    ~ReplicationPrimary() { stop(); }
+
+    // Start listening on address (more than once for several); the first
+    // call starts shipping. False if it cannot listen there.
+    bool listenOn(const string& address) {
+        string bound;
+        int fd = replicationListen(address, bound);
+        if (fd < 0) return false;
+        if (!running.exchange(true)) {
+            ReplicationBacklog* b = &backlog;
+            backlog.reset(engine.shipJournal([b](uint64_t lsn, const string& payload) {
+                b->add(lsn, payload);
+            }));
+        }
+        listenFds.push_back(fd);
+        addresses.push_back(bound);
+        acceptors.push_back(thread(&ReplicationPrimary::acceptLoop, this, fd));
+        return true;
+    }
+
+    void stop() {
+        if (!running.exchange(false)) return;
+        engine.shipJournal(BookingJournal::Tap());
+        backlog.close();
+        for (size_t i = 0; i < listenFds.size(); ++i) shutdown(listenFds[i], SHUT_RDWR);
+        for (size_t i = 0; i < acceptors.size(); ++i) acceptors[i].join();
+        for (size_t i = 0; i < listenFds.size(); ++i) {
+            ::close(listenFds[i]);
+            if (addresses[i].compare(0, 5, "unix:") == 0) unlink(addresses[i].c_str() + 5);
+        }
+        lock_guard<mutex> g(followersLock);
+        for (size_t i = 0; i < followers.size(); ++i) {
+            if (!followers[i]->done.load()) shutdown(followers[i]->fd, SHUT_RDWR);
+            followers[i]->worker.join();
+            delete followers[i];
+        }
+        followers.clear();
+        listenFds.clear();
+        addresses.clear();
+        acceptors.clear();
+    }
+
+    // Where replicas connect (with the real port for ":0")
+    const vector<string>& listening() const { return addresses; }
+    uint64_t recordsShipped() const         { return shipped.load(memory_order_relaxed); }
+
+    // Lowest LSN every connected replica has made durable
+    uint64_t slowestAck() const {
+        lock_guard<mutex> g(followersLock);
+        uint64_t low = UINT64_MAX;
+        for (size_t i = 0; i < followers.size(); ++i) {
+            if (!followers[i]->done.load()) low = min(low, followers[i]->acked.load());
+        }
+        return low == UINT64_MAX ? backlog.lastLsn() : low;
+    }
+
+    string statusJson() const {
+        uint64_t last = backlog.lastLsn();
+        string out = "{\"role\":\"primary\",\"lsn\":" + toString(last) + ",\"listening\":[";
+        for (size_t i = 0; i < addresses.size(); ++i) out += (i ? "," : "") + jsonString(addresses[i]);
+        out += "],\"replicas\":[";
+        lock_guard<mutex> g(followersLock);
+        bool first = true;
+        for (size_t i = 0; i < followers.size(); ++i) {
+            if (followers[i]->done.load()) continue;
+            uint64_t acked = followers[i]->acked.load();
+            out += (first ? "" : ",") + string("{\"peer\":") + jsonString(followers[i]->peer)
+                 + ",\"acked\":" + toString(acked)
+                 + ",\"lagRecords\":" + toString(last > acked ? last - acked : 0) + "}";
+            first = false;
+        }
+        return out + "]}";
+    }
+};
+
+// A read-only copy of a primary's engine, kept current from its journal
+class ReplicaNode : public ReplicationRole {
+private:
+    string           primary, store;
+    int              gatewayLatencyMs;  // < 0: the engine's default
+    BookingEngine*   engine;
+    mutable mutex    fdLock;
+    int              fd;
+    thread           follower;
+    atomic<bool>     following, connected, promoted;
+    atomic<uint64_t> applied, primaryLsn;
+    atomic<int64_t>  behindSince;       // steady-clock ns; 0 while caught up
+    mutable mutex    problemLock;
+    string           problem;           // why it stopped following, if it did
+
+    ReplicaNode(const ReplicaNode&);
+    ReplicaNode& operator=(const ReplicaNode&);
+
+    static int64_t steadyNanos() {
+        return (int64_t)chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void noteLag() {
+        if (applied.load() >= primaryLsn.load()) behindSince.store(0);
+        else if (behindSince.load() == 0) behindSince.store(steadyNanos());
+    }
+
+    void giveUp(const string& why) {
+        lock_guard<mutex> g(problemLock);
+        problem = why;
+        following.store(false);
+    }
+
+    // Apply the journal frames of one 'R' message; false on a gap or a
+    // corrupt frame
+    bool applyFrames(const string& body) {
+        RecordReader head(body.data(), body.size());
+        uint64_t primaryLast = head.u64();
+        size_t   pos = 8;
+        while (body.size() - pos >= 16) {
+            RecordReader hdr(body.data() + pos, 4);
+            uint32_t len = hdr.u32();
+            if (len < 8 || body.size() - pos < 4 + (size_t)len + 4) return false;
+            const char* rec = body.data() + pos + 4;
+            RecordReader tail(rec + len, 4);
+            if (tail.u32() != crc32(rec, len)) return false;
+            RecordReader lsnOf(rec, 8);
+            uint64_t lsn = lsnOf.u64();
+            if (lsn > applied.load()) {     // older ones came before a reconnect
+                if (!engine->applyShipped(lsn, rec + 8, len - 8)) return false;
+                applied.store(lsn);
+            }
+            pos += 4 + len + 4;
+        }
+        primaryLsn.store(max(primaryLast, applied.load()));
+        return pos == body.size();
+    }
+
+    void follow() {
+        char   type;
+        string body;
+        while (following.load()) {
+            int s;
+            {
+                lock_guard<mutex> g(fdLock);
+                s = fd;
+            }
+            if (s < 0) {
+                s = replicationConnect(primary);
+                if (s < 0 || !sendMessage(s, 'H', lsnBody(applied.load()))) {
+                    if (s >= 0) ::close(s);
+                    for (int i = 0; i < 20 && following.load(); ++i) this_thread::sleep_for(chrono::milliseconds(10));
+                    continue;
+                }
+                lock_guard<mutex> g(fdLock);
+                if (!following.load()) { ::close(s); break; }
+                fd = s;
+                connected.store(true);
+            }
+            if (!readMessage(s, type, body)) {
+                lock_guard<mutex> g(fdLock);
+                ::close(fd);
+                fd = -1;
+                connected.store(false);
+                continue;
+            }
+            if (type == 'B') {
+                RecordReader r(body.data(), body.size());
+                primaryLsn.store(max(r.u64(), applied.load()));
+            } else if (type == 'R') {
+                if (!applyFrames(body)) { giveUp("gap or corrupt record from the primary"); break; }
+                if (!engine->flushJournal()) { giveUp("cannot write the journal"); break; }
+                sendMessage(s, 'A', lsnBody(applied.load()));
+            } else {
+                giveUp("fell behind the primary's backlog: restart the replica");
+                break;
+            }
+            noteLag();
+        }
+        lock_guard<mutex> g(fdLock);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+        connected.store(false);
+    }
+
+public:
+    ReplicaNode(int gatewayLatency = -1)
+        : gatewayLatencyMs(gatewayLatency), engine(NULL), fd(-1), following(false),
+          connected(false), promoted(false), applied(0), primaryLsn(0), behindSince(0) {}
+
+    ~ReplicaNode() {
+        stopFollowing();
+        delete engine;
+    }
+
+    // Fetch the primary's current image into storePath.snapshot (dropping
+    // whatever the store held), open the engine on it and follow from
+    // there. False if the primary cannot be reached.
+    bool start(const string& primaryAddress, const string& storePath) {
+        primary = primaryAddress;
+        store   = storePath;
+        int s = replicationConnect(primary);
+        char   type = 0;
+        string body;
+        if (s < 0 || !sendMessage(s, 'H', lsnBody(0)) || !readMessage(s, type, body)
+            || type != 'S' || body.size() < 8) {
+            if (s >= 0) ::close(s);
+            return false;
+        }
+        RecordReader r(body.data(), 8);
+        uint64_t lsn = r.u64();
+        remove((store + ".journal").c_str());
+        remove((store + ".journal.old").c_str());
+        if (!fileWriteAtomic(store + ".snapshot", body.substr(8))) {
+            ::close(s);
+            return false;
+        }
+        body.clear();
+        engine = gatewayLatencyMs < 0 ? new BookingEngine(store) : new BookingEngine(store, gatewayLatencyMs);
+        engine->setReadOnly(true);
+        engine->setJournalGroupCommit((size_t)1 << 30);    // flushed once per batch instead
+        applied.store(lsn);
+        primaryLsn.store(lsn);
+        fd = s;
+        connected.store(true);
+        following.store(true);
+        follower = thread(&ReplicaNode::follow, this);
+        return true;
+    }
+
+    BookingEngine& getEngine() { return *engine; }
+
+    uint64_t appliedLsn() const { return applied.load(); }
+    uint64_t lagRecords() const {
+        uint64_t p = primaryLsn.load(), a = applied.load();
+        return p > a ? p - a : 0;
+    }
+    // How long it has been behind the primary (0 while caught up)
+    double lagSeconds() const {
+        int64_t since = behindSince.load();
+        return since ? (double)(steadyNanos() - since) / 1e9 : 0.0;
+    }
+
+    void stopFollowing() {
+        following.store(false);
+        {
+            lock_guard<mutex> g(fdLock);
+            if (fd >= 0) shutdown(fd, SHUT_RDWR);
+        }
+        if (follower.joinable()) follower.join();
+    }
+
+    // Stop following and take writes; the journal carries on from the
+    // last LSN applied
+    bool promote() {
+        if (!engine) return false;
+        if (promoted.exchange(true)) return true;
+        stopFollowing();
+        engine->flushJournal();
+        engine->setJournalGroupCommit(1);
+        engine->setReadOnly(false);
+        return true;
+    }
+
+    string statusJson() const {
+        string why;
+        {
+            lock_guard<mutex> g(problemLock);
+            why = problem;
+        }
+        return string("{\"role\":\"") + (promoted.load() ? "promoted" : "replica") + "\""
+             + ",\"primary\":" + jsonString(primary)
+             + ",\"connected\":" + (connected.load() ? "true" : "false")
+             + ",\"lsn\":" + toString(applied.load())
+             + ",\"primaryLsn\":" + toString(primaryLsn.load())
+             + ",\"lagRecords\":" + toString(lagRecords())
+             + ",\"lagMs\":" + toString((long long)(lagSeconds() * 1000))
+             + (why.empty() ? string() : ",\"problem\":" + jsonString(why)) + "}";
+    }
+};
+
+#endif  // __linux__
+
+
+
+// ---------------------------------------------------------------------
+// Benchmarks (run with: <program> --bench <name> [args...])
+// ---------------------------------------------------------------------
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static int benchArg(int argc, char* argv[], int i, int def) {
+    return (i < argc) ? atoi(argv[i]) : def;
+}
+
+#ifdef TBS_COUNT_ALLOCATIONS
+// Build with -DTBS_COUNT_ALLOCATIONS to count heap allocations
+static atomic<uint64_t> heapAllocations(0);
+
+void* operator new(size_t n) {
+    heapAllocations.fetch_add(1, memory_order_relaxed);
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw bad_alloc();
+}
+void operator delete(void* p) noexcept          { free(p); }
+void operator delete(void* p, size_t) noexcept  { free(p); }
+
+static bool     countingAllocations() { return true; }
+static uint64_t allocationsSoFar()    { return heapAllocations.load(); }
+#else
+static bool     countingAllocations() { return false; }
+static uint64_t allocationsSoFar()    { return 0; }
+#endif
+
+// Resident set size of this process in bytes (0 where unsupported)
+static size_t residentBytes() {
+#ifdef _WIN32
+    return 0;
+#else
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    long pages = 0, resident = 0;
+    int got = fscanf(f, "%ld %ld", &pages, &resident);
+    fclose(f);
+    return got == 2 ? (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) : 0;
+#endif
+}
+
+// Highest resident set size since the last resetPeakResident(), in
+// bytes (0 where unsupported)
+static size_t peakResidentBytes() {
+#ifdef __linux__
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return 0;
+    char   line[256];
+    size_t kb = 0;
+    while (fgets(line, sizeof line, f)) {
+        if (strncmp(line, "VmHWM:", 6) == 0) kb = (size_t)strtoull(line + 6, NULL, 10);
+    }
+    fclose(f);
+    return kb * 1024;
+#else
+    return 0;
+#endif
+}
+
+// Give freed heap back to the OS and restart the peak from the current
+// resident size, so back-to-back runs each get their own peak
+static void resetPeakResident() {
+#ifdef __linux__
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (f) { fputs("5", f); fclose(f); }
+#endif
+}
+
+// q-th quantile of nanosecond samples, in microseconds (reorders ns)
+static double percentileMicros(vector<uint64_t>& ns, double q) {
+    if (ns.empty()) return 0.0;
+    size_t i = min(ns.size() - 1, (size_t)(q * ns.size()));
+    nth_element(ns.begin(), ns.begin() + i, ns.end());
+    return ns[i] / 1000.0;
+}
+
+// Thread counts 1, 2, 4, ... up to maxThreads (default: the core count)
+static vector<int> threadSteps(int maxThreads = 0) {
+    int cores = maxThreads > 0 ? maxThreads : (int)thread::hardware_concurrency();
+    if (cores < 1) cores = 1;
+    vector<int> steps;
+    for (int t = 1; t < cores; t *= 2) steps.push_back(t);
+    steps.push_back(cores);
+    return steps;
+}
+
+// N threads hammer one hot show; every thread tries every seat starting at
+// a different offset, so each seat is fought over by all threads.
+// args: [rows] [cols] [maxThreads]
+static int benchConcurrentBooking(int argc, char* argv[]) {
+    int rows = benchArg(argc, argv, 0, 1000);
+    int cols = benchArg(argc, argv, 1, 100);
+    int seats = rows * cols;
+    bool ok = true;
+
+    cout << "concurrent booking: " << rows << "x" << cols << " seats\n";
+    vector<int> steps = threadSteps(benchArg(argc, argv, 2, 0));
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        Show show(0, "Hot Show", "TBA", rows, cols, 100000);
+        BookingLog log;
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(thread([&, t]() {
+                int offset = (int)((long long)seats * t / threads);
+                for (int k = 0; k < seats; ++k) {
+                    int idx = (offset + k) % seats;
+                    int r = idx / cols + 1, c = idx % cols + 1;
+                    if (show.bookSeat(r, c)) {
+                        log.append(0, show.getId(), r, c, show.getPrice(), 0);
+                    }
+                }
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+        double secs = secondsSince(start);
+
+        // every seat sold exactly once, nothing left over
+        vector<char> seen(seats, 0);
+        bool oversold = false;
+        log.forEach([&](const Booking& b) {
+            if (seen[(b.row - 1) * cols + (b.col - 1)]++) oversold = true;
+        });
+        Seat s;
+        bool good = !oversold && (int)log.size() == seats
+                 && show.seatsLeft() == 0 && !show.findNextFreeSeat(1, 1, s);
+        ok = ok && good;
+        cout << "  threads=" << threads
+             << " bookings=" << log.size()
+             << " secs=" << secs
+             << " bookings/sec=" << (long long)(log.size() / secs)
+             << (good ? " OK" : " OVERSOLD") << "\n";
+    }
+    return ok ? 0 : 1;
+}
+
+// Shard-per-core vs one big lock: N client threads book blocks of 1-2
+// seats on random shows. The baseline serializes every booking on one
+// mutex over the engine and a shared id list, as the console did; the
+// sharded run has N shard threads owning the shows, fed through SPSC
+// rings with up to 64 requests in flight per client. Both record every
+// booking in the engine (journal group commit 10000).
+// args: [shows] [bookings] [maxThreads]  (default 1000 200000 cores)
+static int benchSharded(int argc, char* argv[]) {
+    int shows    = max(1, benchArg(argc, argv, 0, 1000));
+    int requests = benchArg(argc, argv, 1, 200000);
+    vector<int> steps = threadSteps(benchArg(argc, argv, 2, 0));
+    const string store = "bench_shards";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    bool ok = true;
+
+    cout << "sharded engine: shows=" << shows << " bookings=" << requests
+         << " (parties of 1-2)\n";
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        for (int mode = 0; mode < 2; ++mode) {
+            for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+            BookingEngine engine(store, 0);
+            engine.setJournalGroupCommit(10000);
+            size_t before = engine.bookingCount();
+            Category* cat = engine.addCategory("Sharded");
+            vector<int> ids(shows);
+            for (int i = 0; i < shows; ++i) {
+                ids[i] = engine.addShow(cat, "Shard show " + toString(i), "2025-06-01 20:00",
+                                        20, 50, 100000)->getId();
+            }
+            atomic<long long> seats(0);
+            vector<thread> workers;
+            chrono::steady_clock::time_point start;
+            double secs;
+            if (mode == 0) {
+                mutex big;
+                vector<uint64_t> all;
+                start = chrono::steady_clock::now();
+                for (int t = 0; t < threads; ++t) {
+                    workers.push_back(thread([&, t]() {
+                        mt19937 rng(t + 1);
+                        for (int k = t; k < requests; k += threads) {
+                            int n = 1 + (int)(rng() % 2);
+                            Show* s = engine.findShowById(ids[rng() % shows]);
+                            lock_guard<mutex> g(big);
+                            Seat first;
+                            if (!s->bookBestBlock(n, SeatPreference(), first)) continue;
+                            Paisa fare = s->quote(first.row, PriceClock::current(), n);
+                            for (int i = 0; i < n; ++i) {
+                                uint64_t id = engine.generateBookingID();
+                                engine.addBookingRecord(id, s, first.row, first.number + i, fare);
+                                all.push_back(id);
+                            }
+                            seats += n;
+                        }
+                    }));
+                }
+                for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+                secs = secondsSince(start);
+                ok = ok && all.size() == (size_t)seats.load();
+            }
+            else {
+                ShardedBooking sharded(engine, threads, threads);
+                start = chrono::steady_clock::now();
+                for (int t = 0; t < threads; ++t) {
+                    workers.push_back(thread([&, t]() {
+                        ShardedBooking::Client& client = sharded.client(t);
+                        mt19937 rng(t + 1);
+                        int inFlight = 0;
+                        long long mine = 0;
+                        ShardedBooking::Reply reply;
+                        for (int k = t; k < requests || inFlight > 0; k += threads) {
+                            if (k < requests) {
+                                ShardedBooking::Request req = { ShardedBooking::SHARD_BOOK,
+                                    ids[rng() % shows], 1 + (int)(rng() % 2), 0, (uint64_t)k, NULL };
+                                client.submit(req);
+                                ++inFlight;
+                            }
+                            while (inFlight > 0 && (inFlight >= 64 || k >= requests)) {
+                                if (!client.poll(reply)) { this_thread::yield(); continue; }
+                                --inFlight;
+                                if (reply.ok) mine += reply.count;
+                            }
+                            while (inFlight > 0 && client.poll(reply)) {
+                                --inFlight;
+                                if (reply.ok) mine += reply.count;
+                            }
+                        }
+                        seats += mine;
+                    }));
+                }
+                for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+                secs = secondsSince(start);
+                // admin listing as scatter-gather across the shards
+                ok = ok && sharded.client(0).bookingIds().size() == engine.bookingCount();
+            }
+            ok = ok && engine.bookingCount() - before == (size_t)seats.load();
+            cout << "  threads=" << threads << (mode == 0 ? " mutex:   " : " sharded: ")
+                 << "bookings/sec=" << (long long)(requests / secs)
+                 << " seats=" << seats.load() << " secs=" << secs << "\n";
+        }
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    cout << (ok ? "  counts match OK\n" : "  counts MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Place N holds spread over a minute of simulated time, confirm a third,
+// release a third and let the rest expire through the timing wheel.
+// args: [holds]
+static int benchHoldExpiry(int argc, char* argv[]) {
+    int n    = benchArg(argc, argv, 0, 2000000);
+    int cols = 1000;
+    int rows = (n + cols - 1) / cols;
+    const int ttlMs = 60000, tickMs = 10, spreadMs = 60000;
+    Show show(0, "Stadium", "TBA", rows, cols, 100000);
+    HoldManager holds(ttlMs, tickMs);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    int confirmed = 0;
+    for (int i = 0; i < n; ++i) {
+        uint64_t now = (uint64_t)i * spreadMs / n;
+        HoldManager::Token tok = holds.hold(&show, i / cols + 1, i % cols + 1, now);
+        if (i % 3 == 0)      { holds.confirm(tok); ++confirmed; }
+        else if (i % 3 == 1) { holds.release(tok); }
+    }
+    double placeSecs = secondsSince(start);
+    size_t pending = holds.outstanding();
+
+    start = chrono::steady_clock::now();
+    size_t expired = holds.advance(spreadMs + ttlMs + tickMs);
+    double expireSecs = secondsSince(start);
+    uint64_t ticks = (uint64_t)(spreadMs + ttlMs) / tickMs;
+
+    bool ok = expired == pending && holds.outstanding() == 0
+           && show.seatsLeft() == rows * cols - confirmed;
+    cout << "hold expiry: holds=" << n
+         << " place+confirm/release secs=" << placeSecs
+         << " ops/sec=" << (long long)(n / placeSecs) << "\n"
+         << "  expired=" << expired << " ticks=" << ticks
+         << " secs=" << expireSecs
+         << " ns/tick=" << (long long)(expireSecs * 1e9 / ticks)
+         << (ok ? " OK" : " MISMATCH") << "\n";
+    return ok ? 0 : 1;
+}
+
+// On-sale simulator: a million clients storm one show. First the raw
+// cost of the line: 1..N threads join and then poll every ticket once.
+// Then one on-sale in simulated time: arrivals spread over the first
+// minute, each client polls when its last answer said to, a few give
+// up when told the wait is long, and the admitted must never outrun
+// the bucket (perSecond per second plus burst), however often tickets
+// leave. Reports polls per client and how far the estimated wait was
+// from the real one.
+// args: [clients] [perSecond] [burst] [maxThreads]  (default 1000000 2000 500 cores)
+static int benchWaitingRoom(int argc, char* argv[]) {
+    int    clients = max(1, benchArg(argc, argv, 0, 1000000));
+    double rate    = max(1, benchArg(argc, argv, 1, 2000));
+    double burst   = max(1, benchArg(argc, argv, 2, 500));
+    vector<int> steps = threadSteps(benchArg(argc, argv, 3, 0));
+    const uint64_t MS = 1000000;
+    bool ok = true;
+
+    cout << "waiting room: clients=" << clients << " perSecond=" << rate << " burst=" << burst << "\n";
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        WaitingRoom room;
+        room.open(0, rate, burst);
+        vector<vector<WaitingRoom::Ticket> > tickets(threads);
+        atomic<long long> admitted(0);
+        size_t rssBefore = residentBytes();
+        vector<thread> workers;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(thread([&, t]() {
+                tickets[t].reserve(clients / threads + 1);
+                for (int k = t; k < clients; k += threads) tickets[t].push_back(room.join(0));
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+        double joinSecs = secondsSince(start);
+        size_t rssQueued = residentBytes();
+        workers.clear();
+        start = chrono::steady_clock::now();
+        for (int t = 0; t < threads; ++t) {
+            workers.push_back(thread([&, t]() {
+                long long mine = 0;
+                for (size_t k = 0; k < tickets[t].size(); ++k) {
+                    mine += room.check(0, tickets[t][k]).state == WaitingRoom::ADMITTED;
+                }
+                admitted += mine;
+            }));
+        }
+        for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+        double checkSecs = secondsSince(start);
+        // every ticket distinct and the line exactly as long as the joins
+        vector<char> seen(clients + 1, 0);
+        bool good = room.waiting(0) + (uint64_t)admitted.load() <= (uint64_t)clients;
+        for (int t = 0; t < threads; ++t) {
+            for (size_t k = 0; k < tickets[t].size(); ++k) {
+                WaitingRoom::Ticket x = tickets[t][k];
+                if (x < 1 || x > (uint64_t)clients || seen[x]++) good = false;
+            }
+        }
+        ok = ok && good;
+        cout << "  threads=" << threads
+             << " joins/sec=" << (long long)(clients / joinSecs)
+             << " polls/sec=" << (long long)(clients / checkSecs)
+             << " queued MB=" << (double)(rssQueued > rssBefore ? rssQueued - rssBefore : 0) / (1 << 20)
+             << " (tickets kept by the clients)"
+             << (good ? " OK" : " DUPLICATE TICKETS") << "\n";
+    }
+
+    // Leaving must not move anyone else up for free: against a line of
+    // one a second, one ticket leaves a thousand times and a thousand
+    // more join and leave straight away
+    {
+        const int SECS = 10;
+        WaitingRoom slow;
+        uint64_t at = 1000 * MS;
+        slow.open(0, 1, 1, 120, at);
+        vector<WaitingRoom::Ticket> queued(1000);
+        for (size_t i = 0; i < queued.size(); ++i) queued[i] = slow.join(0, at);
+        for (int i = 0; i < 1000; ++i) {
+            slow.leave(0, queued[1]);
+            slow.leave(0, slow.join(0, at));
+        }
+        uint64_t in = 0, end = at + (uint64_t)SECS * 1000 * MS;
+        for (int sec = 1; sec <= SECS; ++sec) slow.check(0, queued[0], at + (uint64_t)sec * 1000 * MS);
+        for (size_t i = 0; i < queued.size(); ++i) in += slow.check(0, queued[i], end).state == WaitingRoom::ADMITTED;
+        uint64_t limit = (uint64_t)SECS + 1;    // perSecond x secs + burst
+        bool held = in <= limit && slow.admittedSoFar(0) <= limit;
+        ok = ok && held;
+        cout << "  repeated leaves: admitted in " << SECS << " secs=" << in << " (limit " << limit << ")"
+             << (held ? " OK" : " OVER LIMIT") << "\n";
+    }
+
+    // The on-sale, in simulated time with 10 ms steps
+    const uint64_t STEP = 10 * MS;
+    struct Client {
+        WaitingRoom::Ticket ticket;
+        uint64_t joined;
+        double   estimate;          // seconds, as told on joining
+    };
+    WaitingRoom room;
+    uint64_t t0 = 1000 * MS;
+    room.open(0, rate, burst, 120, t0);
+    mt19937 rng(42);
+    vector<Client> who(clients);
+    vector<vector<int> > due;       // clients to poll, by step
+    auto schedule = [&](int c, uint64_t at) {
+        size_t step = (size_t)((at - t0 + STEP - 1) / STEP);
+        if (step >= due.size()) due.resize(step + 1);
+        due[step].push_back(c);
+    };
+    for (int c = 0; c < clients; ++c) schedule(c, t0 + (uint64_t)(rng() % 60000) * MS);
+
+    vector<double> errors, waits;
+    long long polls = 0, gaveUp = 0, done = 0, peak = 0;
+    uint64_t  letInBefore = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (size_t step = 0; step < due.size(); ++step) {
+        uint64_t now = t0 + step * STEP;
+        if (step % 100 == 0) {
+            uint64_t letIn = room.admittedSoFar(0);
+            peak = max(peak, (long long)(letIn - letInBefore));
+            letInBefore = letIn;
+        }
+        vector<int> batch;
+        batch.swap(due[step]);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            int c = batch[i];
+            Client& cl = who[c];
+            WaitingRoom::Status st;
+            if (!cl.ticket) {
+                cl.ticket = room.join(0, now);
+                cl.joined = now;
+                st = room.check(0, cl.ticket, now);
+                cl.estimate = st.waitSeconds;
+                // one in fifty walks off when told to wait over five minutes
+                if (st.state == WaitingRoom::WAITING && st.waitSeconds > 300 && rng() % 50 == 0) {
+                    room.leave(0, cl.ticket);
+                    ++gaveUp;
+                    continue;
+                }
+            }
+            else st = room.check(0, cl.ticket, now);
+            ++polls;
+            if (st.state == WaitingRoom::WAITING) {
+                schedule(c, now + (uint64_t)st.retryAfterMs * MS);
+                continue;
+            }
+            if (st.state == WaitingRoom::ADMITTED) {
+                double waited = (now - cl.joined) * 1e-9;
+                waits.push_back(waited);
+                errors.push_back(fabs(waited - cl.estimate));
+            }
+            ++done;
+        }
+    }
+    double simSecs = secondsSince(start);
+    bool paced = peak <= (long long)(rate + burst);
+    ok = ok && paced && done + gaveUp == clients;
+    sort(waits.begin(), waits.end());
+    sort(errors.begin(), errors.end());
+    size_t n = waits.size();
+    cout << "  on-sale: admitted=" << n << " gave up=" << gaveUp
+         << " polls/client=" << (double)polls / clients
+         << " simulated secs=" << (double)due.size() * STEP * 1e-9
+         << " (ideal " << max(60.0, (clients - gaveUp - burst) / rate) << ")"
+         << " wall secs=" << simSecs << "\n"
+         << "  admitted in the busiest second=" << peak << " (limit " << (long long)(rate + burst) << ")"
+         << (paced ? " OK" : " OVER LIMIT") << "\n";
+    if (n) {
+        cout << "  wait secs p50=" << waits[n / 2] << " p99=" << waits[n * 99 / 100]
+             << " max=" << waits[n - 1]
+             << "; estimate off by p50=" << errors[n / 2] << " p99=" << errors[n * 99 / 100] << "\n";
+    }
+    return ok ? 0 : 1;
+}
+
+// Same simulated gateway latency, sequential one-at-a-time charges versus
+// the batched pipeline confirming holds from its completions.
+// args: [payments] [latencyMs] [workers] [batch]
+static int benchPaymentPipeline(int argc, char* argv[]) {
+    int n       = benchArg(argc, argv, 0, 2000);
+    int latency = benchArg(argc, argv, 1, 2);
+    int workers = benchArg(argc, argv, 2, 4);
+    int batch   = benchArg(argc, argv, 3, 64);
+    int cols    = 100;
+    SimulatedGateway gateway(latency, 0.05);
+
+    // sequential: hold, charge one request, confirm or release
+    int seqN = min(n, 500);     // keep the slow path bounded
+    Show seqShow(0, "Seq", "TBA", (seqN + cols - 1) / cols, cols, 100000);
+    HoldManager seqHolds(60000);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<PaymentRequest> one(1);
+    vector<bool> approved;
+    for (int i = 0; i < seqN; ++i) {
+        HoldManager::Token tok = seqHolds.hold(&seqShow, i / cols + 1, i % cols + 1);
+        one[0].id = i; one[0].amount = 100000;
+        gateway.chargeBatch(one, approved);
+        if (approved[0]) seqHolds.confirm(tok); else seqHolds.release(tok);
+    }
+    double seqSecs = secondsSince(start);
+
+    // pipelined: submit everything, completions confirm or release
+    Show pipeShow(0, "Pipe", "TBA", (n + cols - 1) / cols, cols, 100000);
+    HoldManager pipeHolds(60000);
+    atomic<int> confirmed(0);
+    start = chrono::steady_clock::now();
+    {
+        PaymentPipeline pipeline(gateway, workers, batch);
+        vector<future<bool> > results;
+        for (int i = 0; i < n; ++i) {
+            HoldManager::Token tok = pipeHolds.hold(&pipeShow, i / cols + 1, i % cols + 1);
+            results.push_back(pipeline.submit(100000, "4111", [&pipeHolds, &confirmed, tok](bool ok) {
+                if (!ok) { pipeHolds.release(tok); return false; }
+                if (pipeHolds.confirm(tok)) { ++confirmed; return true; }
+                return false;
+            }));
+        }
+        for (size_t i = 0; i < results.size(); ++i) results[i].wait();
+    }
+    double pipeSecs = secondsSince(start);
+    bool ok = pipeHolds.outstanding() == 0
+           && pipeShow.seatsLeft() == pipeShow.getRows() * cols - confirmed.load();
+
+    cout << "payment pipeline: gateway latency=" << latency << "ms failure=5%\n"
+         << "  sequential: payments=" << seqN << " secs=" << seqSecs
+         << " payments/sec=" << (long long)(seqN / seqSecs) << "\n"
+         << "  pipelined:  payments=" << n << " workers=" << workers
+         << " batch=" << batch << " secs=" << pipeSecs
+         << " payments/sec=" << (long long)(n / pipeSecs)
+         << (ok ? " OK" : " MISMATCH") << "\n";
+    return ok ? 0 : 1;
+}
+
+// Walk a policy's rules for one seat the way a quote would without the
+// compiled tables: the baseline for benchPricing, and its check
+static Paisa walkPricingRules(const PricingPolicy& p, const Show& s, int r, const PriceClock& clock) {
+    Paisa fare  = p.rowFare(s.getPrice(), r, s.getRows());
+    int   seats = s.getRows() * s.getCols();
+    int   pct   = (int)((int64_t)(seats - s.seatsLeft()) * 100 / seats);
+    long long left = s.secondsToStart(clock);
+    long long h    = left <= 0 ? 0 : min(left / 3600, (long long)INT_MAX);
+    Paisa v    = fare * PricingPolicy::stepAt(p.occupancy, pct) * PricingPolicy::stepAt(p.hoursLeft, (int)h);
+    Paisa unit = (Paisa)100000000 * p.roundTo;
+    return (v + unit / 2) / unit * p.roundTo;
+}
+
+// Quotes/sec while a booker thread keeps moving every show's occupancy
+// (booking blocks until a show is nearly full, then refunding half). The
+// shows start from one hour to a week out, with some daily departures.
+// Each thread count runs the compiled per-show tables and then the rule
+// walk; afterwards every row of every show is checked for both agreeing.
+// args: [shows] [maxThreads] [millisPerRun]  (default 1000 cores 1000)
+static int benchPricing(int argc, char* argv[]) {
+    int n     = max(1, benchArg(argc, argv, 0, 1000));
+    int ms    = benchArg(argc, argv, 2, 1000);
+    int rows  = 20, cols = 50;
+    PricingPolicy policy = PricingPolicy::standard();
+    PriceClock    clock  = PriceClock::current();
+    vector<Show*> shows(n);
+    for (int i = 0; i < n; ++i) {
+        string when;
+        if (i % 10 == 0) {
+            when = (i / 10 % 2 ? "07:00-11:00" : "21:30-23:00");
+        } else {
+            time_t at = clock.now + 3600 * (1 + (time_t)(i * 7919 % 168));
+            char buf[32];
+            strftime(buf, sizeof buf, "%Y-%m-%d %H:%M", localtime(&at));
+            when = buf;
+        }
+        shows[i] = new Show(i, "Show " + toString(i), when, rows, cols, 50000 + 1000 * (i % 50));
+        shows[i]->setPricing(&policy);
+    }
+
+    atomic<bool> stop(false);
+    atomic<long long> booked(0);
+    thread booker([&]() {
+        mt19937 rng(7);
+        vector<vector<Seat> > sold(n);
+        while (!stop.load(memory_order_relaxed)) {
+            int i = (int)(rng() % n);
+            Show* s = shows[i];
+            Seat first;
+            int party = 1 + (int)(rng() % 4);
+            if (s->seatsLeft() > rows * cols / 20 && s->bookBestBlock(party, SeatPreference(), first)) {
+                for (int k = 0; k < party; ++k) sold[i].push_back(Seat(first.row, first.number + k));
+                booked.fetch_add(party, memory_order_relaxed);
+                continue;
+            }
+            for (size_t k = sold[i].size() / 2; k < sold[i].size(); ++k) {
+                s->refundSeat(sold[i][k].row, sold[i][k].number);
+            }
+            sold[i].resize(sold[i].size() / 2);
+        }
+    });
+
+    cout << "pricing: shows=" << n << " seats/show=" << rows * cols
+         << " (front rows dearer, surge with occupancy, last-minute discounts)\n";
+    vector<int> steps = threadSteps(benchArg(argc, argv, 1, 0));
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        double rate[2];
+        for (int walk = 0; walk < 2; ++walk) {
+            atomic<bool> done(false);
+            atomic<long long> quotes(0), total(0);     // total keeps the quotes live
+            long long bookedBefore = booked.load();
+            vector<thread> workers;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (int t = 0; t < threads; ++t) {
+                workers.push_back(thread([&, t]() {
+                    mt19937 rng(t + 1);
+                    long long count = 0, sum = 0;
+                    while (!done.load(memory_order_relaxed)) {
+                        for (int k = 0; k < 1024; ++k) {
+                            const Show* s = shows[rng() % n];
+                            int r = 1 + (int)(rng() % rows);
+                            PriceClock now = PriceClock::current();
+                            sum += walk ? walkPricingRules(policy, *s, r, now) : s->quote(r, now);
+                        }
+                        count += 1024;
+                    }
+                    quotes.fetch_add(count);
+                    total.fetch_add(sum);
+                }));
+            }
+            this_thread::sleep_for(chrono::milliseconds(ms));
+            done.store(true);
+            for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+            double secs = secondsSince(start);
+            rate[walk] = quotes.load() / secs;
+            cout << "  threads=" << threads << (walk ? " rule walk: " : " compiled:  ")
+                 << "quotes/sec=" << (long long)rate[walk]
+                 << " bookings/sec=" << (long long)((booked.load() - bookedBefore) / secs) << "\n";
+        }
+        cout << "  threads=" << threads << " speedup=" << rate[0] / rate[1] << "x\n";
+    }
+    stop.store(true);
+    booker.join();
+
+    long long mismatches = 0;
+    clock = PriceClock::current();
+    for (int i = 0; i < n; ++i) {
+        for (int r = 1; r <= rows; ++r) {
+            if (shows[i]->quote(r, clock) != walkPricingRules(policy, *shows[i], r, clock)) ++mismatches;
+        }
+    }
+    Paisa lo = shows[1]->quote(rows, clock), hi = lo;
+    for (int i = 0; i < n; ++i) {
+        for (int r = 1; r <= rows; ++r) {
+            lo = min(lo, shows[i]->quote(r, clock));
+            hi = max(hi, shows[i]->quote(r, clock));
+        }
+    }
+    cout << "  fares now: PKR " << formatRupees(lo) << " .. " << formatRupees(hi)
+         << " mismatches=" << mismatches << (mismatches ? " MISMATCH" : " OK") << "\n";
+    for (int i = 0; i < n; ++i) delete shows[i];
+    return mismatches ? 1 : 0;
+}
+
+// Journal append throughput per group-commit size, then recovery time
+// for a store holding N bookings (journal replay and snapshot load).
+// args: [bookings]
+static int benchJournal(int argc, char* argv[]) {
+    int n = benchArg(argc, argv, 0, 1000000);
+    const string store = "bench_store";
+    const size_t groups[] = { 1, 8, 64, 512, 4096 };
+    RecordWriter w;
+    w.u8(J_BOOK_SEAT); w.u64(1); w.i32(1); w.i32(1); w.i32(1); w.u64(100000); w.u64(1735689600);
+
+    cout << "journal append (" << w.data().size() << "-byte records):\n";
+    for (size_t gi = 0; gi < sizeof groups / sizeof groups[0]; ++gi) {
+        size_t g     = groups[gi];
+        size_t count = min((size_t)200000, 2000 * g);
+        remove((store + ".journal").c_str());
+        BookingJournal j;
+        j.open(store + ".journal", 0);
+        j.setGroupCommit(g);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (size_t i = 0; i < count; ++i) j.append(w.data());
+        j.flush();
+        double secs = secondsSince(start);
+        cout << "  group=" << g << " records=" << count
+             << " fsyncs=" << j.syncs()
+             << " records/sec=" << (long long)(count / secs) << "\n";
+    }
+
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    int cols = 1000, rows = (n + cols - 1) / cols;
+    {
+        BookingEngine sys(store);
+        Category* cat = sys.addCategory("Bench");
+        Show* s = sys.addShow(cat, "Stadium", "TBA", rows, cols, 100000);
+        sys.setJournalGroupCommit(4096);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            int r = i / cols + 1, c = i % cols + 1;
+            s->bookSeat(r, c);
+            sys.addBookingRecord((uint64_t)i + 1, s, r, c, s->getPrice());
+        }
+        sys.flushJournal();
+        cout << "wrote " << n << " bookings in " << secondsSince(start) << " secs\n";
+    }
+
+    bool ok = true;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    {
+        BookingEngine sys(store);
+        double secs = secondsSince(start);
+        ok = ok && sys.bookingCount() >= (size_t)n;
+        cout << "recovery from journal: bookings=" << sys.bookingCount()
+             << " secs=" << secs << "\n";
+        start = chrono::steady_clock::now();
+        sys.takeSnapshot();
+        cout << "snapshot written in " << secondsSince(start) << " secs\n";
+    }
+    start = chrono::steady_clock::now();
+    {
+        BookingEngine sys(store);
+        double secs = secondsSince(start);
+        ok = ok && sys.bookingCount() >= (size_t)n;
+        cout << "recovery from snapshot: bookings=" << sys.bookingCount()
+             << " secs=" << secs << "\n";
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return ok ? 0 : 1;
+}
+
+// Startup cost of building N shows the way the built-in catalog does
+// (one heap Show and seat map at a time) versus replaying the journal and
+// versus mapping a snapshot image of the same catalog.
+// args: [shows] [rows] [cols]
+static int benchStartup(int argc, char* argv[]) {
+    int n    = benchArg(argc, argv, 0, 200000);
+    int rows = benchArg(argc, argv, 1, 8);
+    int cols = benchArg(argc, argv, 2, 16);
+    const string store = "bench_startup";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    vector<string> titles(n);
+    for (int i = 0; i < n; ++i) titles[i] = "Show number " + toString(i);
+
+    // second round is the one reported, so every path sees a warm heap
+    chrono::steady_clock::time_point start;
+    for (int round = 0; round < 2; ++round) {
+        start = chrono::steady_clock::now();
+        ObjectPool<Show> pool;
+        Category cat(1, "Bench", pool);
+        for (int i = 0; i < n; ++i) {
+            cat.addShow(i + 1, titles[i], "2025-05-24 20:00", rows, cols, 150000);
+        }
+        if (round == 1) {
+            cout << "constructor path: shows=" << cat.getCount()
+                 << " secs=" << secondsSince(start) << "\n";
+        }
+    }
+
+    {
+        BookingEngine sys(store);
+        sys.setJournalGroupCommit(4096);
+        Category* cat = sys.addCategory("Bench");
+        for (int i = 0; i < n; ++i) {
+            sys.addShow(cat, titles[i], "2025-05-24 20:00", rows, cols, 150000);
+        }
+        sys.flushJournal();
+    }
+    start = chrono::steady_clock::now();
+    {
+        BookingEngine sys(store);
+        cout << "journal replay:   secs=" << secondsSince(start) << "\n";
+        sys.takeSnapshot();
+    }
+    start = chrono::steady_clock::now();
+    bool ok;
+    {
+        BookingEngine sys(store);
+        double secs = secondsSince(start);
+        Show* s = sys.findShowById(n);
+        ok = s && s->seatsLeft() == rows * cols && s->bookSeat(1, 1);
+        cout << "mapped snapshot:  secs=" << secs
+             << (ok ? " OK" : " MISMATCH") << "\n";
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return ok ? 0 : 1;
+}
+
+// Booking-id index: build with generated ids, then time random hits and
+// misses. Values are dummy pointers so only the index itself is measured.
+// args: [sizes...]  (default 1000000 10000000; 100000000 needs ~4 GB)
+static int benchLookup(int argc, char* argv[]) {
+    vector<long long> sizes;
+    for (int i = 0; i < argc; ++i) sizes.push_back(atoll(argv[i]));
+    if (sizes.empty()) { sizes.push_back(1000000); sizes.push_back(10000000); }
+    const int probes = 2000000;
+    bool ok = true;
+    for (size_t si = 0; si < sizes.size(); ++si) {
+        long long n = sizes[si];
+        BookingIdGenerator ids;
+        BookingIndex index;
+        vector<uint64_t> keys;
+        keys.reserve((size_t)n);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (long long i = 0; i < n; ++i) {
+            uint64_t id = ids.next();
+            keys.push_back(id);
+            index.insert(id, (Booking*)(uintptr_t)(id * 8));
+        }
+        double buildSecs = secondsSince(start);
+
+        mt19937_64 rng(42);
+        vector<uint64_t> hits(probes), misses(probes);
+        for (int i = 0; i < probes; ++i) {
+            hits[i]   = keys[rng() % keys.size()];
+            misses[i] = keys.back() + 1 + rng() % (uint64_t)n;
+        }
+        size_t found = 0;
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < probes; ++i) found += index.find(hits[i]) != NULL;
+        double hitSecs = secondsSince(start);
+        start = chrono::steady_clock::now();
+        for (int i = 0; i < probes; ++i) found += index.find(misses[i]) != NULL;
+        double missSecs = secondsSince(start);
+
+        ok = ok && found == (size_t)probes && index.size() == (size_t)n;
+        cout << "booking index: bookings=" << n
+             << " inserts/sec=" << (long long)(n / buildSecs)
+             << " hit ns=" << hitSecs * 1e9 / probes
+             << " miss ns=" << missSecs * 1e9 / probes
+             << (found == (size_t)probes ? " OK" : " MISMATCH") << "\n";
+    }
+    return ok ? 0 : 1;
+}
+
+// Schedule index: shows with random start times over a year, then
+// "next three days" and one-hour range queries through the index vs a
+// scan of every show.
+// args: [shows] [queries]  (default 1000000 200)
+static int benchSchedule(int argc, char* argv[]) {
+    int n       = benchArg(argc, argv, 0, 1000000);
+    int queries = benchArg(argc, argv, 1, 200);
+    const time_t year = 365 * 24 * 3600;
+    time_t base = localEpoch(2025, 1, 1, 0);
+
+    mt19937_64 rng(7);
+    vector<string> texts(n);
+    for (int i = 0; i < n; ++i) {
+        time_t at = base + (time_t)(rng() % (uint64_t)(year / 60)) * 60;
+        tm local = *localtime(&at);
+        char buf[32];
+        strftime(buf, sizeof buf, "%Y-%m-%d %H:%M", &local);
+        texts[i] = buf;
+    }
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ObjectPool<Show> pool;
+    Category cat(0, "Bench", pool);
+    cat.reserve(n);
+    for (int i = 0; i < n; ++i) cat.addShow(i, "Show", texts[i], 1, 8, 10000);
+    double buildSecs = secondsSince(start);
+
+    const time_t spans[2] = { 3 * 24 * 3600, 3600 };
+    const char*  names[2] = { "3 days", "1 hour" };
+    bool ok = true;
+    cout << "schedule: shows=" << n << " build+parse/sec=" << (long long)(n / buildSecs) << "\n";
+    for (int k = 0; k < 2; ++k) {
+        vector<time_t> from(queries);
+        for (int q = 0; q < queries; ++q) from[q] = base + (time_t)(rng() % (uint64_t)year);
+
+        vector<Show*> found;
+        size_t indexed = 0, scanned = 0;
+        start = chrono::steady_clock::now();
+        for (int q = 0; q < queries; ++q) {
+            found.clear();
+            indexed += cat.showsBetween(from[q], from[q] + spans[k], found);
+        }
+        double indexSecs = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (int q = 0; q < queries; ++q) {
+            found.clear();
+            for (int i = 0; i < cat.getCount(); ++i) {
+                time_t at = cat.getShow(i)->getShowTime().start;
+                if (at >= from[q] && at < from[q] + spans[k]) found.push_back(cat.getShow(i));
+            }
+            scanned += found.size();
+        }
+        double scanSecs = secondsSince(start);
+
+        ok = ok && indexed == scanned;
+        cout << "  range " << names[k]
+             << ": avg hits=" << indexed / queries
+             << " indexed us=" << indexSecs * 1e6 / queries
+             << " scan us=" << scanSecs * 1e6 / queries
+             << " speedup=" << scanSecs / indexSecs << "x"
+             << (indexed == scanned ? " OK" : " MISMATCH") << "\n";
+    }
+    return ok ? 0 : 1;
+}
+
+// Naive best-available search: try every start seat, check every seat
+static bool naiveBestBlock(const Show& s, int n, const SeatPreference& pref, Seat& out) {
+    double best = -1;
+    for (int r = 1; r <= s.getRows(); ++r) {
+        for (int c = 1; c + n - 1 <= s.getCols(); ++c) {
+            int k = 0;
+            while (k < n && s.seatState(r, c + k) == SEAT_FREE) ++k;
+            if (k < n) continue;
+            double cost = s.blockCost(pref, r, c, n);
+            if (best < 0 || cost < best) { best = cost; out = Seat(r, c); }
+        }
+    }
+    return best >= 0;
+}
+
+// Group seat allocation on a large venue with most seats sold: the
+// run-hint allocator vs the naive scan, first searching for parties of
+// 2-10, then booking parties of 2-4 until a fixed number are placed.
+// args: [rows] [cols] [occupancyPercent] [queries]  (default 250 400 90 1000)
+static int benchSeatAllocator(int argc, char* argv[]) {
+    int rows    = benchArg(argc, argv, 0, 250);
+    int cols    = benchArg(argc, argv, 1, 400);
+    int percent = benchArg(argc, argv, 2, 90);
+    int queries = benchArg(argc, argv, 3, 1000);
+
+    // two identical venues with the same seats sold at random
+    Show fast(0, "Allocator", "TBA", rows, cols, 500.0);
+    Show slow(1, "Naive", "TBA", rows, cols, 500.0);
+    vector<int> order(rows * cols);
+    for (size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+    mt19937 rng(11);
+    shuffle(order.begin(), order.end(), rng);
+    size_t sold = order.size() * percent / 100;
+    for (size_t i = 0; i < sold; ++i) {
+        fast.bookSeat(order[i] / cols + 1, order[i] % cols + 1);
+        slow.bookSeat(order[i] / cols + 1, order[i] % cols + 1);
+    }
+
+    SeatPreference pref;
+    vector<int> sizes(queries);
+    for (int q = 0; q < queries; ++q) sizes[q] = 2 + (int)(rng() % 9);
+    vector<Seat> got(queries);
+    vector<bool> found(queries);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int q = 0; q < queries; ++q) found[q] = fast.findBestBlock(sizes[q], pref, got[q]);
+    double fastSecs = secondsSince(start);
+
+    bool ok = true;
+    int  hits = 0;
+    start = chrono::steady_clock::now();
+    for (int q = 0; q < queries; ++q) {
+        Seat s;
+        bool f = naiveBestBlock(slow, sizes[q], pref, s);
+        hits += f;
+        ok = ok && f == found[q]
+           && (!f || fast.blockCost(pref, got[q].row, got[q].number, sizes[q])
+                  == slow.blockCost(pref, s.row, s.number, sizes[q]));
+    }
+    double slowSecs = secondsSince(start);
+
+    cout << "seat allocator: seats=" << rows * cols << " occupancy=" << percent << "%"
+         << " parties 2-10 found=" << hits << "/" << queries << "\n"
+         << "  search: allocator us=" << fastSecs * 1e6 / queries
+         << " naive us=" << slowSecs * 1e6 / queries
+         << " speedup=" << slowSecs / fastSecs << "x" << (ok ? " OK" : " MISMATCH") << "\n";
+
+    // now book parties of 2-4 on both venues
+    int groups = queries;
+    int fastBooked = 0, slowBooked = 0;
+    start = chrono::steady_clock::now();
+    for (int g = 0; g < groups; ++g) {
+        Seat s;
+        fastBooked += fast.bookBestBlock(2 + g % 3, pref, s) ? 2 + g % 3 : 0;
+    }
+    fastSecs = secondsSince(start);
+    start = chrono::steady_clock::now();
+    for (int g = 0; g < groups; ++g) {
+        Seat s;
+        if (naiveBestBlock(slow, 2 + g % 3, pref, s) && slow.holdBlock(s.row, s.number, 2 + g % 3)) {
+            slow.confirmBlock(s.row, s.number, 2 + g % 3);
+            slowBooked += 2 + g % 3;
+        }
+    }
+    slowSecs = secondsSince(start);
+    ok = ok && fastBooked == slowBooked && fast.seatsLeft() == slow.seatsLeft();
+    cout << "  book:   allocator groups/sec=" << (long long)(groups / fastSecs)
+         << " naive groups/sec=" << (long long)(groups / slowSecs)
+         << " seats booked=" << fastBooked
+         << (fastBooked == slowBooked ? " OK" : " MISMATCH") << "\n";
+    return ok ? 0 : 1;
+}
+
+// Polling a seat map: a client refreshing a busy show either re-fetches
+// the whole (compressed) map each time or asks for the changes since the
+// version it has. Between refreshes the show takes `changes` seat
+// transitions: holds of 1-4 seats, mostly paid for, some released, and
+// refunds once it is 90% sold. Both clients are checked against the show.
+// args: [rows] [cols] [refreshes]  (default 100 200 500)
+static int benchSeatMapRefresh(int argc, char* argv[]) {
+    int rows      = benchArg(argc, argv, 0, 100);
+    int cols      = benchArg(argc, argv, 1, 200);
+    int refreshes = benchArg(argc, argv, 2, 500);
+    const int rates[] = { 1, 10, 100, 2000 };
+
+    cout << "seat map refresh: seats=" << rows * cols
+         << " raw 2-bit map bytes=" << (rows * cols + 3) / 4 << "\n";
+    bool ok = true;
+    for (size_t k = 0; k < sizeof rates / sizeof rates[0]; ++k) {
+        Show show(0, "Refresh", "TBA", rows, cols, 50000);
+        mt19937 rng(5);
+        vector<int> order(rows * cols);
+        for (size_t i = 0; i < order.size(); ++i) order[i] = (int)i;
+        shuffle(order.begin(), order.end(), rng);
+        for (size_t i = 0; i < order.size() * 6 / 10; ++i) {     // start 60% sold
+            show.bookSeat(order[i] / cols + 1, order[i] % cols + 1);
+        }
+        vector<Seat> sold;
+        SeatPreference pref;
+
+        SeatMapReplica fullClient, deltaClient;
+        string first;
+        show.encodeSeatUpdate(0, first);        // also starts the change log
+        deltaClient.apply(first);
+        double fullSecs = 0, deltaSecs = 0;
+        size_t fullBytes = 0, deltaBytes = 0, fallbacks = 0;
+        for (int r = 0; r < refreshes; ++r) {
+            uint64_t target = show.getSeatVersion() + rates[k];
+            while (show.getSeatVersion() < target) {
+                Seat s;
+                int n = 1 + (int)(rng() % 4);
+                if (show.seatsLeft() < rows * cols / 10 && !sold.empty()) {
+                    size_t pick = rng() % sold.size();
+                    show.refundSeat(sold[pick].row, sold[pick].number);
+                    sold[pick] = sold.back();
+                    sold.pop_back();
+                }
+                else if (show.holdBestBlock(n, pref, s)) {
+                    if (rng() % 5 == 0) show.releaseBlock(s.row, s.number, n);
+                    else {
+                        show.confirmBlock(s.row, s.number, n);
+                        for (int i = 0; i < n; ++i) sold.push_back(Seat(s.row, s.number + i));
+                    }
+                }
+            }
+
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            string full;
+            show.encodeSeatMap(full);
+            ok = fullClient.apply(full) && ok;
+            fullSecs  += secondsSince(start);
+            fullBytes += full.size();
+
+            start = chrono::steady_clock::now();
+            string delta;
+            show.encodeSeatUpdate(deltaClient.getVersion(), delta);
+            ok = deltaClient.apply(delta) && ok;
+            deltaSecs  += secondsSince(start);
+            deltaBytes += delta.size();
+            fallbacks  += delta[0] != 'D';
+        }
+        for (int r = 1; r <= rows; ++r) {
+            for (int c = 1; c <= cols; ++c) {
+                ok = ok && fullClient.state(r, c) == show.seatState(r, c)
+                        && deltaClient.state(r, c) == show.seatState(r, c);
+            }
+        }
+        cout << "  changes/refresh=" << rates[k]
+             << "  full: bytes=" << fullBytes / refreshes
+             << " us=" << fullSecs * 1e6 / refreshes
+             << "  delta: bytes=" << deltaBytes / refreshes
+             << " us=" << deltaSecs * 1e6 / refreshes
+             << " full fallbacks=" << fallbacks << "\n";
+    }
+    cout << (ok ? "  replicas match OK\n" : "  replicas MISMATCH\n");
+    return ok ? 0 : 1;
+}
+
+// Type-ahead over a large catalog: index N synthetic titles (bus routes,
+// concerts and films in English, Roman Urdu and Urdu script), then type
+// prefixes of random titles one character at a time and time each
+// search, next to a linear scan of every title. Also times incremental
+// re-indexing of edited titles.
+// args: [shows] [queries]  (default 1000000 2000)
+static int benchSearch(int argc, char* argv[]) {
+    int n       = benchArg(argc, argv, 0, 1000000);
+    int queries = benchArg(argc, argv, 1, 2000);
+    static const char* const cities[] = { "Lahore", "Islamabad", "Karachi", "Multan", "Peshawar",
+        "Quetta", "Faisalabad", "Rawalpindi", "Sialkot", "Hyderabad", "Gujranwala", "Murree",
+        "Skardu", "Gilgit", "Bahawalpur", "Sukkur", "\xd9\x84\xd8\xa7\xdb\x81\xd9\x88\xd8\xb1",
+        "\xda\xa9\xd8\xb1\xd8\xa7\xda\x86\xdb\x8c" };
+    static const char* const classes[] = { "Business Class", "Economy Class", "Executive",
+        "Sleeper", "Luxury" };
+    static const char* const artists[] = { "Atif Aslam", "Abida Parveen", "Ali Zafar",
+        "Nusrat Fateh Ali Khan", "Rahat Fateh Ali Khan", "Hadiqa Kiani", "Strings", "Junoon",
+        "Noori", "Noor Jehan", "Momina Mustehsan", "Aima Baig", "Bilal Saeed", "Asim Azhar" };
+    static const char* const events[] = { "Live", "Qawwali Night", "Unplugged", "Mehfil",
+        "Concert", "Tour", "\xd9\x82\xd9\x88\xd8\xa7\xd9\x84\xdb\x8c" };
+    static const char* const films[] = { "Umro Ayyar", "Maula Jatt", "Jawani Phir Nahi Ani",
+        "Teefa in Trouble", "Parey Hut Love", "Superstar", "Quaid e Azam Zindabad", "Joyland",
+        "Paddington", "Inside Out", "Moana", "Gladiator", "Wicked", "Despicable Me" };
+#define PICK(list) list[rng() % (sizeof list / sizeof list[0])]
+    mt19937 rng(21);
+    vector<string> titles(n);
+    for (int i = 0; i < n; ++i) {
+        switch (rng() % 3) {
+        case 0:
+            titles[i] = string(PICK(cities)) + " to " + PICK(cities) + " (" + PICK(classes) + ")";
+            break;
+        case 1:
+            titles[i] = string(PICK(artists)) + " " + PICK(events) + " " + PICK(cities)
+                      + " " + toString(2020 + rng() % 10);
+            break;
+        default:
+            titles[i] = string(PICK(films)) + (rng() % 2 ? " Part " + toString(1 + rng() % 5000) : "");
+            break;
+        }
+    }
+#undef PICK
+
+    size_t rssBefore = residentBytes();
+    SearchIndex index;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) index.addShow(i, titles[i]);
+    double buildSecs = secondsSince(start);
+    cout << "search index: shows=" << n << " words=" << index.wordCount()
+         << " build secs=" << buildSecs
+         << " rss MB=" << (residentBytes() - rssBefore) / (1024.0 * 1024.0) << "\n";
+
+    // Type each picked title's first few words one character at a time
+    vector<uint64_t> ns;
+    size_t results = 0, misses = 0;
+    for (int q = 0; q < queries; ++q) {
+        const string& t = titles[rng() % n];
+        size_t stop = min(t.size(), (size_t)(3 + rng() % 20));
+        for (size_t len = 1; len <= stop; ++len) {
+            if (len < t.size() && (t[len] & 0xC0) == 0x80) continue;    // mid-character
+            string typed = t.substr(0, len);
+            chrono::steady_clock::time_point s = chrono::steady_clock::now();
+            vector<SearchHit> hits = index.search(typed, 10);
+            ns.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - s).count());
+            results += hits.size();
+            misses  += hits.empty();
+        }
+    }
+    cout << "  type-ahead: searches=" << ns.size()
+         << " p50 us=" << percentileMicros(ns, 0.50)
+         << " p99 us=" << percentileMicros(ns, 0.99)
+         << " p999 us=" << percentileMicros(ns, 0.999)
+         << " max us=" << percentileMicros(ns, 1.0)
+         << " avg hits=" << (double)results / ns.size()
+         << " empty=" << misses << "\n";
+
+    // The same kind of query as a scan: lower-cased substring of every title
+    int scans = max(1, queries / 100);
+    start = chrono::steady_clock::now();
+    size_t scanned = 0;
+    for (int q = 0; q < scans; ++q) {
+        string typed = titles[rng() % n].substr(0, 6);
+        for (size_t k = 0; k < typed.size(); ++k) typed[k] = (char)tolower((unsigned char)typed[k]);
+        size_t found = 0;
+        for (int i = 0; i < n && found < 10; ++i) {
+            string low = titles[i];
+            for (size_t k = 0; k < low.size(); ++k) low[k] = (char)tolower((unsigned char)low[k]);
+            found += low.find(typed) != string::npos;
+            ++scanned;
+        }
+    }
+    double scanSecs = secondsSince(start);
+    cout << "  linear scan (stops at 10 hits): us/query=" << scanSecs * 1e6 / scans
+         << " titles read/query=" << scanned / scans << "\n";
+
+    // Worst case for a scan: a word no title has
+    start = chrono::steady_clock::now();
+    size_t found = 0;
+    for (int i = 0; i < n; ++i) {
+        string low = titles[i];
+        for (size_t k = 0; k < low.size(); ++k) low[k] = (char)tolower((unsigned char)low[k]);
+        found += low.find("zzyzx") != string::npos;
+    }
+    double missScan = secondsSince(start);
+    start = chrono::steady_clock::now();
+    found += index.search("zzyzx", 10).size();
+    cout << "  no match: scan us=" << missScan * 1e6
+         << " index us=" << secondsSince(start) * 1e6 << "\n";
+
+    // Incremental upkeep: retitle shows
+    int edits = min(n, 100000);
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < edits; ++i) {
+        int id = (int)(rng() % n);
+        string next = titles[(id + 1) % n];
+        index.addShow(id, next);
+        titles[id] = next;
+    }
+    double editSecs = secondsSince(start);
+    cout << "  edits/sec=" << (long long)(edits / editSecs) << "\n";
+
+    // spot-check: every word of a title finds it
+    bool ok = found == 0;
+    for (int q = 0; q < 200 && ok; ++q) {
+        int id = (int)(rng() % n);
+        vector<SearchHit> hits = index.search(titles[id], (size_t)n, false);
+        bool seen = false;
+        for (size_t i = 0; i < hits.size() && !seen; ++i) seen = !hits[i].isCategory && hits[i].id == id;
+        ok = seen;
+    }
+    cout << (ok ? "  lookups OK\n" : "  lookups MISSED\n");
+    return ok ? 0 : 1;
+}
+
+// One heap object per booking, as bookings were stored before the log
+// became dense
+struct HeapBooking {
+    uint64_t id;
+    Show*    show;
+    int      showId;
+    int      row, col;
+    Paisa    fare;
+    int64_t  soldAt;
+    uint64_t seq;
+};
+
+// Booking storage for N bookings: the dense log vs a heap object per
+// booking behind a pointer vector. Reports RSS growth, heap allocations,
+// one pass over every record (the admin listing loop) and teardown.
+// Allocation counts need a build with -DTBS_COUNT_ALLOCATIONS.
+// args: [bookings]  (default 10000000)
+static int benchMemory(int argc, char* argv[]) {
+    long long n = benchArg(argc, argv, 0, 10000000);
+    Show show(1, "Bench", "TBA", 1000, 1000, 100000);
+    const char* names[2] = { "dense log", "heap objects" };
+    uint64_t sums[2] = { 0, 0 };
+
+    cout << "booking storage: bookings=" << n << "\n";
+    // dense first: its chunks go straight back to the OS afterwards
+    for (int layout = 0; layout < 2; ++layout) {
+        size_t   rss0    = residentBytes();
+        uint64_t allocs0 = allocationsSoFar();
+        BookingLog*           log  = NULL;
+        vector<HeapBooking*>* heap = NULL;
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (layout == 0) {
+            log = new BookingLog();
+            for (long long i = 0; i < n; ++i) {
+                log->append((uint64_t)i + 1, show.getId(), (int)(i / 1000 % 1000) + 1, (int)(i % 1000) + 1,
+                            show.getPrice(), 0);
+            }
+        } else {
+            heap = new vector<HeapBooking*>();
+            for (long long i = 0; i < n; ++i) {
+                HeapBooking* b = new HeapBooking;
+                b->id = (uint64_t)i + 1; b->show = &show; b->showId = show.getId();
+                b->row = (int)(i / 1000 % 1000) + 1; b->col = (int)(i % 1000) + 1;
+                b->fare = show.getPrice(); b->soldAt = 0; b->seq = (uint64_t)i;
+                heap->push_back(b);
+            }
+        }
+        double fillSecs = secondsSince(start);
+        size_t   rss1    = residentBytes();
+        uint64_t allocs1 = allocationsSoFar();
+
+        start = chrono::steady_clock::now();
+        uint64_t sum = 0;
+        if (log) {
+            log->forEach([&](const Booking& b) { sum += b.id + b.row; });
+        } else {
+            for (size_t i = 0; i < heap->size(); ++i) sum += (*heap)[i]->id + (*heap)[i]->row;
+        }
+        double scanSecs = secondsSince(start);
+        sums[layout] = sum;
+
+        start = chrono::steady_clock::now();
+        if (log) {
+            delete log;
+        } else {
+            for (size_t i = 0; i < heap->size(); ++i) delete (*heap)[i];
+            delete heap;
+        }
+        double freeSecs = secondsSince(start);
+
+        cout << "  " << names[layout] << ":"
+             << " rss MB=" << (double)(rss1 - rss0) / (1 << 20)
+             << " bytes/booking=" << (double)(rss1 - rss0) / n;
+        if (countingAllocations()) cout << " allocations=" << allocs1 - allocs0;
+        cout << " fill secs=" << fillSecs
+             << " scan ns/booking=" << scanSecs * 1e9 / n
+             << " teardown secs=" << freeSecs << "\n";
+    }
+    return sums[0] == sums[1] ? 0 : 1;
+}
+
+// Scheduled trips on one coach layout (12 rows of 2+2 around an aisle,
+// two wheelchair spaces, a front class): every trip allocating its own
+// seat block and fare table, against every trip sharing the layout's
+// pristine block and fares until its first seat is sold. Then a share
+// of the trips sells one seat each.
+// args: [trips] [bookedPercent]  (default 1000000 1)
+static int benchTrips(int argc, char* argv[]) {
+    long long n   = benchArg(argc, argv, 0, 1000000);
+    int       pct = max(0, min(100, benchArg(argc, argv, 1, 1)));
+    const string spec = "12x5; aisle 3; accessible 12:1-2; class 1-3 Front 120%";
+    LayoutLibrary library;
+    string error;
+    const VenueLayout* coach = library.define(spec, error);
+    if (!coach) { cerr << "layout: " << error << "\n"; return 1; }
+    PricingPolicy policy = PricingPolicy::standard();
+    ShowTime when = parseShowTime("2025-06-01 08:00");
+    const char* names[2] = { "shared layout", "own seat block" };
+
+    cout << "scheduled trips: trips=" << n << " layout=\"" << spec << "\" seats/trip="
+         << coach->getCapacity() << " show object bytes=" << sizeof(Show) << " booked=" << pct << "%\n";
+    int failures = 0;
+    // both sets stay alive to the end, so neither reuses the other's heap
+    ObjectPool<Show> pools[2];
+    vector<Show*>    sets[2];
+    for (int mode = 0; mode < 2; ++mode) {
+        ObjectPool<Show>* pool  = &pools[mode];
+        vector<Show*>&    trips = sets[mode];
+        trips.reserve(n);
+        size_t   rss0    = residentBytes();
+        uint64_t allocs0 = allocationsSoFar();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (long long i = 0; i < n; ++i) {
+            Show* s = mode == 0 ? pool->create((int)i + 1, "Lahore - Islamabad", "2025-06-01 08:00", when,
+                                               coach, (Paisa)250000)
+                                : pool->create((int)i + 1, "Lahore - Islamabad", "2025-06-01 08:00", when,
+                                               coach->getRows(), coach->getCols(), (Paisa)250000);
+            s->setPricing(&policy);
+            trips.push_back(s);
+        }
+        double   createSecs = secondsSince(start);
+        size_t   rss1    = residentBytes();
+        uint64_t allocs1 = allocationsSoFar();
+
+        long long every = pct ? 100 / pct : 0, booked = 0;
+        start = chrono::steady_clock::now();
+        for (long long i = 0; every && i < n; i += every) {
+            booked += trips[i]->bookSeat(1, 1) ? 1 : 0;
+        }
+        double bookSecs = secondsSince(start);
+        size_t rss2 = residentBytes();
+        // the aisle is not a seat in the shared layout
+        if (mode == 0 && trips[0]->bookSeat(1, 3)) ++failures;
+
+        cout << "  " << names[mode] << ":"
+             << " create secs=" << createSecs
+             << " trips/sec=" << (createSecs > 0 ? n / createSecs : 0)
+             << " rss MB=" << (double)(rss1 - rss0) / (1 << 20)
+             << " bytes/trip=" << (double)(rss1 - rss0) / n;
+        if (countingAllocations()) cout << " allocations/trip=" << (double)(allocs1 - allocs0) / n;
+        cout << " | booked=" << booked
+             << " secs=" << bookSecs
+             << " rss growth MB=" << (double)(rss2 - rss1) / (1 << 20)
+             << " seats left=" << trips[n - 1]->seatsLeft() << "\n";
+        if (booked != (every ? (n + every - 1) / every : 0)) ++failures;
+    }
+    for (int mode = 0; mode < 2; ++mode) {
+        for (size_t i = 0; i < sets[mode].size(); ++i) pools[mode].destroy(sets[mode][i]);
+    }
+    return failures ? 1 : 0;
+}
+
+// Sales reports over the columnar ledger: N rows (a sale in one of 8
+// categories and 10000 shows over 30 days, every 50th a cancellation),
+// then at each thread count the plain sum and the SSE2 sum of the whole
+// ledger, a filtered sum (one category, one week), group-by category
+// and show, and sales per hour. Each query runs 3 times; the best
+// counts. The simple sum aims at 1e9 rows/sec per core.
+// args: [rows] [maxThreads]  (default 50000000 cores)
+static int benchSales(int argc, char* argv[]) {
+    long long n = benchArg(argc, argv, 0, 50000000);
+    vector<int> steps = threadSteps(benchArg(argc, argv, 1, 0));
+    const int     CATEGORIES = 8, SHOWS = 10000, DAYS = 30;
+    const int64_t start = 1735689600;       // 2025-01-01 00:00 UTC
+
+    SalesColumns ledger;
+    mt19937_64 rng(42);
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    for (long long i = 0; i < n; ++i) {
+        uint64_t x    = rng();
+        int      show = (int)(x % SHOWS);
+        int64_t  at   = start + (int64_t)((x >> 20) % (DAYS * 86400));
+        Paisa    fare = 50000 + (Paisa)((x >> 48) % 200) * 1000;
+        if (i % 50 == 49) ledger.cancelled(show, show % CATEGORIES, 1, 1, fare, at);
+        else              ledger.sold(show, show % CATEGORIES, 1 + (int)(x >> 56) % 20, 1, fare, at);
+    }
+    double fillSecs = secondsSince(t0);
+    cout << "sales ledger: rows=" << n << " fill secs=" << fillSecs
+         << " MB=" << (double)residentBytes() / (1 << 20) << "\n";
+
+    SalesFilter week;
+    week.categoryId = 3;
+    week.from = start + 7 * 86400;
+    week.to   = start + 14 * 86400;
+    const char* names[6] = { "sum plain", "sum sse2", "filtered sum", "by category", "by show", "by hour" };
+    SalesTotals reference = ledger.totals(SalesFilter(), 1, false);
+    int failures = 0;
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        cout << "  threads=" << threads << "\n";
+        for (int q = 0; q < 6; ++q) {
+            double best = 1e30;
+            SalesTotals got;
+            for (int rep = 0; rep < 3; ++rep) {
+                chrono::steady_clock::time_point qs = chrono::steady_clock::now();
+                got = SalesTotals();
+                if (q <= 1) {
+                    got = ledger.totals(SalesFilter(), threads, q == 1);
+                } else if (q == 2) {
+                    got = ledger.totals(week, threads);
+                } else if (q == 5) {
+                    vector<SalesTotals> h = ledger.byTime(start, 3600, DAYS * 24, SalesFilter(), threads);
+                    for (size_t k = 0; k < h.size(); ++k) got.add(h[k]);
+                } else {
+                    vector<SalesTotals> g = ledger.groupBy(q == 3 ? SALES_BY_CATEGORY : SALES_BY_SHOW,
+                                                           q == 3 ? CATEGORIES : SHOWS, SalesFilter(), threads);
+                    for (size_t k = 0; k < g.size(); ++k) got.add(g[k]);
+                }
+                best = min(best, secondsSince(qs));
+            }
+            if (q == 2) {
+                if (got.seats != ledger.groupBy(SALES_BY_CATEGORY, CATEGORIES, week, 1)[3].seats) ++failures;
+            } else if (got.revenue != reference.revenue || got.seats != reference.seats) {
+                ++failures;
+            }
+            double perCore = n / best / threads;
+            cout << "    " << names[q] << ": secs=" << best << " rows/sec=" << n / best
+                 << " rows/sec/core=" << perCore;
+            if (q == 1) cout << (perCore >= 1e9 ? " (target met)" : " (below 1e9 target)");
+            cout << "\n";
+        }
+    }
+    cout << "  net seats=" << reference.seats << " revenue PKR=" << formatRupees(reference.revenue)
+         << (failures ? " MISMATCH" : " OK") << "\n";
+    return failures ? 1 : 0;
+}
+
+// Cancelling a postponed show: N bookings on one show, then a sample
+// cancelled one at a time (a journal record and a gateway round trip
+// each) and the rest in one bulk cancel by show, batched and refunded
+// in parallel. Meanwhile one thread keeps booking another show; its
+// bookings/sec and latency are shown idle and during the bulk cancel.
+// Then the store is reopened to check the cancellations were journaled.
+// args: [bookings] [threads] [batch] [gatewayMs]  (default 1000000 0 4096 5)
+static int benchCancel(int argc, char* argv[]) {
+    int    n         = max(1000, benchArg(argc, argv, 0, 1000000));
+    int    threads   = benchArg(argc, argv, 1, 0);
+    size_t batch     = (size_t)max(1, benchArg(argc, argv, 2, 4096));
+    int    gatewayMs = max(0, benchArg(argc, argv, 3, 5));
+    const int cols = 1000, singles = 200;
+
+    const string store = "bench_cancel";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    int    failures = 0;
+    int    postponedId, capacity;
+    size_t kept;
+    {
+        BookingEngine engine(store, gatewayMs);
+        Category* cat = engine.addCategory("Concerts");
+        Show* postponed = engine.addShow(cat, "Summer Fiesta", "TBA", (n + cols - 1) / cols, cols, 150000);
+        Show* other     = engine.addShow(cat, "Open Mic", "2025-06-01 20:00", 1000, cols, 50000);
+        postponedId = postponed->getId();
+        capacity    = postponed->seatsLeft();
+        engine.setJournalGroupCommit(4096);
+        chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            int r = i / cols + 1, c = i % cols + 1;
+            postponed->bookSeat(r, c);
+            engine.addBookingRecord((uint64_t)i + 1, postponed, r, c, engine.quote(postponed, r));
+        }
+        engine.flushJournal();
+        cout << "cancel: bookings=" << n << " gateway ms=" << gatewayMs
+             << " (filled in " << secondsSince(t0) << " secs)\n";
+
+        // One booking at a time, as the console used to
+        Paisa expected = 0;
+        engine.forEachBooking([&](const Booking& b) { expected += b.fare; });
+        vector<RefundRequest> refunds;
+        vector<uint64_t>      failed;
+        Paisa refunded = 0;
+        t0 = chrono::steady_clock::now();
+        for (int i = 0; i < singles; ++i) {
+            uint64_t id = (uint64_t)n - i;
+            refunds.clear();
+            failures += engine.cancelBookings(&id, 1, refunds) != 1;
+            refunded += engine.refund(refunds, failed);
+        }
+        double singleSecs = secondsSince(t0);
+        cout << "  one at a time: " << singles << " cancels in " << singleSecs << " secs, "
+             << (long long)(singles / singleSecs) << "/sec (" << n / (singles / singleSecs)
+             << " secs for all)\n";
+
+        // A booker on another show, idle and then during the bulk cancel
+        atomic<int>  phase(0);              // 0 idle, 1 bulk, 2 stop
+        atomic<bool> bulkStarted(false);
+        vector<uint64_t> lat[2];
+        long long counts[2] = { 0, 0 };
+        double    secs[2]   = { 0, 0 };
+        thread booker([&]() {
+            uint64_t id = (uint64_t)n + 1;
+            int seat = 0;
+            for (int p = 0; p < 2; ++p) {
+                chrono::steady_clock::time_point ps = chrono::steady_clock::now();
+                while (phase.load() == p) {
+                    chrono::steady_clock::time_point a = chrono::steady_clock::now();
+                    int r = seat / cols + 1, c = seat % cols + 1;
+                    if (other->bookSeat(r, c)) engine.addBookingRecord(id++, other, r, c, other->getPrice());
+                    seat = (seat + 1) % (1000 * cols);
+                    lat[p].push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::steady_clock::now() - a).count());
+                    ++counts[p];
+                }
+                secs[p] = secondsSince(ps);
+                if (p == 0) while (!bulkStarted.load()) this_thread::yield();
+            }
+        });
+        this_thread::sleep_for(chrono::milliseconds(300));
+        phase = 1;
+        bulkStarted = true;
+        BulkCanceller canceller(engine, threads, batch);
+        t0 = chrono::steady_clock::now();
+        BulkCanceller::Result r = canceller.cancelShow(postponedId);
+        double bulkSecs = secondsSince(t0);
+        phase = 2;
+        booker.join();
+        engine.flushJournal();
+        refunded += r.refunded;
+
+        cout << "  bulk by show: " << r.bookings << " cancels in " << bulkSecs << " secs, "
+             << (long long)(r.bookings / bulkSecs) << "/sec, batches=" << r.batches
+             << " refund failures=" << r.refundFailed.size() << "\n";
+        const char* names[2] = { "idle", "during bulk cancel" };
+        for (int p = 0; p < 2; ++p) {
+            cout << "  other show bookings " << names[p] << ": " << (long long)(counts[p] / secs[p]) << "/sec"
+                 << " p50 us=" << percentileMicros(lat[p], 0.50)
+                 << " p99 us=" << percentileMicros(lat[p], 0.99)
+                 << " max us=" << percentileMicros(lat[p], 1.0) << "\n";
+        }
+
+        SalesFilter f;
+        f.showId = postponedId;
+        SalesTotals left = engine.salesLedger().totals(f, 1);
+        kept = engine.bookingCount();
+        bool ok = r.bookings == (size_t)(n - singles) && refunded == expected && r.refundFailed.empty()
+               && postponed->seatsLeft() == capacity && left.seats == 0 && left.revenue == 0
+               && kept == (size_t)(counts[0] + counts[1]);
+        cout << "  refunded PKR " << formatRupees(refunded) << " seats left=" << postponed->seatsLeft()
+             << "/" << capacity << (ok ? " OK" : " MISMATCH") << "\n";
+        failures += !ok;
+    }
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    {
+        BookingEngine engine(store, 0);
+        Epoch::Guard guard;
+        Show* s = engine.findShowById(postponedId);
+        bool ok = s && s->seatsLeft() == capacity && engine.bookingCount() == kept;
+        cout << "  reopened in " << secondsSince(t0) << " secs: bookings=" << engine.bookingCount()
+             << (ok ? " OK" : " MISMATCH") << "\n";
+        failures += !ok;
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return failures ? 1 : 0;
+}
+
+// Catalog reads against a busy admin: N reader threads look up random
+// shows by id and read title, time and seats left (every 16th read lists
+// a whole category) while one writer edits shows nonstop, and now and
+// then replaces a show or renames a category. The baseline puts the
+// catalog behind a reader-writer lock; the published catalog needs only
+// an epoch guard per read.
+// args: [shows] [maxThreads] [ms]  (default 10000 cores 1000)
+static int benchCatalog(int argc, char* argv[]) {
+    int shows = max(16, benchArg(argc, argv, 0, 10000));
+    vector<int> steps = threadSteps(benchArg(argc, argv, 1, 0));
+    int ms = max(10, benchArg(argc, argv, 2, 1000));
+    const int cats = 8;
+    const string store = "bench_catalog";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    bool ok = true;
+
+    cout << "catalog reads under edits: shows=" << shows << " ms=" << ms << "\n";
+    for (size_t si = 0; si < steps.size(); ++si) {
+        int threads = steps[si];
+        for (int mode = 0; mode < 2; ++mode) {
+            for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+            BookingEngine engine(store, 0);
+            engine.setJournalGroupCommit(10000);
+            for (int c = 0; c < cats; ++c) engine.addCategory("Genre " + toString(c));
+            int firstId = 0;
+            for (int i = 0; i < shows; ++i) {
+                Show* s = engine.addShow(engine.category(i % cats), "Show " + toString(i),
+                                         "2025-06-01 20:00", 10, 20, 100000);
+                if (i == 0) firstId = s->getId();
+            }
+            atomic<int>       lastId(firstId + shows - 1);
+            shared_mutex      catalogLock;      // baseline only
+            atomic<bool>      stop(false), torn(false);
+            atomic<long long> reads(0), misses(0), sink(0);
+            long long edits = 0;
+
+            // One read; false if the id had been removed
+            auto readOnce = [&](mt19937& rng, long long k) -> bool {
+                if (k % 16 == 0) {
+                    Category* cat = engine.category(rng() % cats);
+                    if (cat->getName().empty()) torn = true;
+                    PublishedArray<Show>::View all = cat->allShows();
+                    long long seats = 0;
+                    for (size_t i = 0; i < all.size(); ++i) seats += all[i]->seatsLeft();
+                    sink.fetch_add(seats, memory_order_relaxed);
+                    return true;
+                }
+                int span = lastId.load(memory_order_relaxed) - firstId + 1;
+                Show* s = engine.findShowById(firstId + (int)(rng() % span));
+                if (!s) return false;
+                if (s->getTitle().empty() || s->getDateTime().empty()) torn = true;
+                sink.fetch_add(s->seatsLeft(), memory_order_relaxed);
+                return true;
+            };
+
+            thread writer([&]() {
+                mt19937 rng(7);
+                const string when[2] = { "2025-06-01 20:00", "2025-06-02 21:30" };
+                for (long long n = 0; !stop.load(memory_order_relaxed); ++n) {
+                    unique_lock<shared_mutex> g(catalogLock, defer_lock);
+                    if (mode == 0) g.lock();
+                    Category* cat = engine.category(rng() % cats);
+                    int idx = (int)(rng() % cat->getCount());
+                    if (n % 64 == 63) {
+                        engine.removeShow(cat, idx);
+                        Show* s = engine.addShow(cat, "Replacement " + toString(n), when[0],
+                                                 10, 20, 100000);
+                        lastId.store(s->getId(), memory_order_relaxed);
+                    }
+                    else if (n % 256 == 255) {
+                        engine.renameCategory((int)(rng() % cats), "Genre " + toString(n));
+                    }
+                    else {
+                        engine.editShow(cat, idx, "Edited " + toString(n), when[n & 1]);
+                    }
+                    edits = n + 1;
+                }
+            });
+            vector<thread> readers;
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            for (int t = 0; t < threads; ++t) {
+                readers.push_back(thread([&, t]() {
+                    mt19937 rng(t + 1);
+                    long long k = 0, missed = 0;
+                    while (!stop.load(memory_order_relaxed)) {
+                        bool found;
+                        if (mode == 0) {
+                            shared_lock<shared_mutex> g(catalogLock);
+                            found = readOnce(rng, k);
+                        }
+                        else {
+                            Epoch::Guard g;
+                            found = readOnce(rng, k);
+                        }
+                        missed += !found;
+                        ++k;
+                    }
+                    reads += k;
+                    misses += missed;
+                }));
+            }
+            this_thread::sleep_for(chrono::milliseconds(ms));
+            stop = true;
+            for (size_t i = 0; i < readers.size(); ++i) readers[i].join();
+            writer.join();
+            double secs = secondsSince(start);
+
+            ok = ok && !torn.load();
+            cout << "  threads=" << threads << (mode == 0 ? " rwlock: " : " epoch:  ")
+                 << "reads/sec=" << (long long)(reads.load() / secs)
+                 << " edits/sec=" << (long long)(edits / secs)
+                 << " removed-id reads=" << misses.load()
+                 << " retired-waiting=" << engine.retiredWaiting()
+                 << (torn.load() ? " TORN" : " OK") << "\n";
+        }
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return ok ? 0 : 1;
+}
+
+// A season of generated shows, as CSV or as a JSON array. Every 1000th
+// row has an impossible date and must be rejected.
+static void writeImportFile(const string& path, int n, bool json) {
+    static const char* const cities[8] =
+        { "Lahore", "Karachi", "Islamabad", "Multan", "Peshawar", "Quetta", "Sialkot", "Hyderabad" };
+    static const char* const kinds[4] = { "Business Class", "Economy Class", "Live", "Premiere" };
+    static const int monthDays[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return;
+    fputs(json ? "[\n" : "category,title,when,rows,cols,price\n", f);
+    char when[32];
+    for (int i = 0; i < n; ++i) {
+        int day = i % 365, mo = 0;
+        while (day >= monthDays[mo]) day -= monthDays[mo++];
+        if (i % 1000 == 999)  snprintf(when, sizeof when, "2025-02-30 10:00");
+        else if (i % 4 == 3)  snprintf(when, sizeof when, "%02d:%02d-%02d:30", 6 + i % 12, (i % 2) * 30, 10 + i % 12);
+        else                  snprintf(when, sizeof when, "2025-%02d-%02d %02d:00", mo + 1, day + 1, 10 + i % 12);
+        string cat   = "Season " + toString(i % 40 + 1);
+        string title = string(cities[i % 8]) + " to " + cities[i / 8 % 8] + " " + toString(i)
+                     + " (" + kinds[i % 4] + ")";
+        int rows = 5 + i % 6, cols = 4 + i % 8;
+        long long paisa = 50000 + (i % 200) * 1250;
+        if (json) {
+            fprintf(f, "%s{\"category\":\"%s\",\"title\":\"%s\",\"when\":\"%s\",\"rows\":%d,\"cols\":%d,\"price\":%lld.%02lld}",
+                    i ? ",\n" : "", cat.c_str(), title.c_str(), when, rows, cols, paisa / 100, paisa % 100);
+        } else {
+            fprintf(f, "%s,\"%s\",%s,%d,%d,%lld.%02lld\n",
+                    cat.c_str(), title.c_str(), when, rows, cols, paisa / 100, paisa % 100);
+        }
+    }
+    fputs(json ? "\n]\n" : "", f);
+    fclose(f);
+}
+
+// Bulk import of a generated season: shows/sec and peak memory for CSV
+// and JSON at 1..N parse threads, against the one-show-at-a-time path
+// (a line at a time through addShow, with the search index live).
+// args: [rows] [maxThreads]
+static int benchImport(int argc, char* argv[]) {
+    int n = benchArg(argc, argv, 0, 1000000);
+    vector<int> steps = threadSteps(benchArg(argc, argv, 1, 0));
+    const string store = "bench_import";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    const string sources[2] = { "bench_import.csv", "bench_import.json" };
+    size_t invalid = n / 1000, bytes[2];
+    for (int j = 0; j < 2; ++j) {
+        writeImportFile(sources[j], n, j == 1);
+        struct stat st;
+        bytes[j] = stat(sources[j].c_str(), &st) == 0 ? (size_t)st.st_size : 0;
+    }
+    cout << "catalog import: rows=" << n << " invalid=" << invalid
+         << " csv MB=" << (double)bytes[0] / (1 << 20)
+         << " json MB=" << (double)bytes[1] / (1 << 20) << "\n";
+    bool ok = true;
+
+    {
+        for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+        resetPeakResident();
+        size_t rss0 = residentBytes();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        size_t added = 0;
+        {
+            BookingEngine engine(store);
+            engine.setJournalGroupCommit(4096);
+            engine.search("warm");              // the index is live from here on
+            unordered_map<string, Category*> cats;
+            FILE* in = fopen(sources[0].c_str(), "r");
+            char  buf[512];
+            if (!in || !fgets(buf, sizeof buf, in)) return 1;     // header
+            while (fgets(buf, sizeof buf, in)) {
+                string line(buf, strcspn(buf, "\n"));
+                vector<string> f;
+                istringstream fields(line);
+                for (string part; getline(fields, part, ','); ) f.push_back(part);
+                if (f.size() != 6) continue;
+                string title = f[1].substr(1, f[1].size() - 2);
+                ShowTime st = parseShowTime(f[2]);
+                Paisa price;
+                if (st.kind == SCHEDULE_TBA || !parseRupees(f[5], price)) continue;
+                Category*& cat = cats[f[0]];
+                if (!cat) cat = engine.addCategory(f[0]);
+                engine.addShow(cat, title, f[2], atoi(f[3].c_str()), atoi(f[4].c_str()), price);
+                ++added;
+            }
+            fclose(in);
+            engine.flushJournal();
+        }
+        double secs = secondsSince(start);
+        cout << "  one at a time:    threads=1 shows=" << added
+             << " secs=" << secs << " shows/sec=" << (long long)(added / secs)
+             << " peak MB=" << (double)(peakResidentBytes() - rss0) / (1 << 20) << "\n";
+    }
+
+    for (int j = 0; j < 2; ++j) {
+        for (size_t t = 0; t < steps.size(); ++t) {
+            for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+            resetPeakResident();
+            size_t rss0 = residentBytes();
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            CatalogImporter::Result r;
+            bool found;
+            {
+                BookingEngine engine(store);
+                engine.setJournalGroupCommit(4096);
+                CatalogImporter importer(engine, steps[t]);
+                found = importer.importFile(sources[j], r);
+                found = found && !engine.search("Lahore Karachi 17").empty();
+            }
+            double secs = secondsSince(start);
+            bool good = found && r.imported == (size_t)n - invalid && r.rejected == invalid;
+            ok = ok && good;
+            cout << "  " << (j ? "json" : "csv ") << " bulk import: threads=" << steps[t]
+                 << " shows=" << r.imported << " rejected=" << r.rejected
+                 << " secs=" << secs << " shows/sec=" << (long long)(r.imported / secs)
+                 << " peak MB=" << (double)(peakResidentBytes() - rss0) / (1 << 20)
+                 << (good ? " OK" : " MISMATCH") << "\n";
+        }
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    for (int j = 0; j < 2; ++j) remove(sources[j].c_str());
+    return ok ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------
+// Workload driver: replays a mix of user and admin operations against a
+// BookingEngine and reports latency percentiles per operation type as
+// JSON lines, one object per operation type plus a total.
+//
+// Workload files are plain text, one operation per line:
+//   shows <count> <rows> <cols>    venue setup, first line
+//   browse <show>                  walk the free seats of a show
+//   hold <show> <party>            hold the best block of party seats
+//   pay                            pay for the oldest outstanding hold
+//   release                        give the oldest outstanding hold back
+//   cancel                         cancel the most recent booking
+//   edit <show>                    admin edits the show's title
+// Shows are numbered 0..count-1 within the workload. '#' starts a comment.
+// ---------------------------------------------------------------------
+
+enum WorkloadOpKind { OP_BROWSE, OP_HOLD, OP_PAY, OP_RELEASE, OP_CANCEL, OP_EDIT, OP_KINDS };
+static const char* const WORKLOAD_OP_NAMES[OP_KINDS] =
+    { "browse", "hold", "pay", "release", "cancel", "edit" };
+
+struct WorkloadOp {
+    WorkloadOpKind kind;
+    int            show;
+    int            party;
+};
+
+struct Workload {
+    int shows, rows, cols;
+    vector<WorkloadOp> ops;
+    Workload() : shows(0), rows(0), cols(0) {}
+};
+
+// Synthetic mix: 40% browse, 25% hold, 20% pay, 5% release, 5% cancel,
+// 5% edit. Shows are picked with a Zipf(skew) distribution (0 = uniform),
+// so a few hot shows take most of the traffic; parties are 1-6 seats.
+static Workload makeWorkload(int ops, int shows, double skew, unsigned seed) {
+    Workload w;
+    w.shows = shows; w.rows = 30; w.cols = 40;
+    vector<double> cdf(shows);
+    double total = 0;
+    for (int i = 0; i < shows; ++i) cdf[i] = (total += 1.0 / pow(i + 1.0, skew));
+    mt19937 rng(seed);
+    uniform_real_distribution<double> unit(0.0, total);
+    int pending = 0;
+    w.ops.reserve(ops);
+    for (int i = 0; i < ops; ++i) {
+        WorkloadOp op;
+        op.show  = (int)(lower_bound(cdf.begin(), cdf.end(), unit(rng)) - cdf.begin());
+        op.show  = min(op.show, shows - 1);
+        op.party = 1 + (int)(rng() % 6);
+        int roll = (int)(rng() % 100);
+        if      (roll < 40) op.kind = OP_BROWSE;
+        else if (roll < 65) op.kind = OP_HOLD;
+        else if (roll < 85) op.kind = OP_PAY;
+        else if (roll < 90) op.kind = OP_RELEASE;
+        else if (roll < 95) op.kind = OP_CANCEL;
+        else                op.kind = OP_EDIT;
+        if ((op.kind == OP_PAY || op.kind == OP_RELEASE) && pending == 0) op.kind = OP_HOLD;
+        if (op.kind == OP_HOLD) ++pending;
+        if (op.kind == OP_PAY || op.kind == OP_RELEASE) --pending;
+        w.ops.push_back(op);
+    }
+    return w;
+}
+
+static bool writeWorkload(const Workload& w, const string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    fprintf(f, "shows %d %d %d\n", w.shows, w.rows, w.cols);
+    for (size_t i = 0; i < w.ops.size(); ++i) {
+        const WorkloadOp& op = w.ops[i];
+        fprintf(f, "%s", WORKLOAD_OP_NAMES[op.kind]);
+        if (op.kind == OP_BROWSE || op.kind == OP_EDIT) fprintf(f, " %d", op.show);
+        if (op.kind == OP_HOLD) fprintf(f, " %d %d", op.show, op.party);
+        fprintf(f, "\n");
+    }
+    return fclose(f) == 0;
+}
+
+// Parse a workload file; false (with a message) on the first bad line
+static bool readWorkload(const string& path, Workload& w) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) { cerr << "Cannot open workload " << path << "\n"; return false; }
+    char line[256];
+    int  lineNo = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof line, f)) {
+        ++lineNo;
+        istringstream in(line);
+        string word;
+        if (!(in >> word) || word[0] == '#') continue;
+        WorkloadOp op = { OP_KINDS, 0, 1 };
+        if (word == "shows") {
+            ok = (bool)(in >> w.shows >> w.rows >> w.cols) && w.shows > 0 && w.rows > 0 && w.cols > 0;
+            continue;
+        }
+        for (int k = 0; k < OP_KINDS; ++k) if (word == WORKLOAD_OP_NAMES[k]) op.kind = (WorkloadOpKind)k;
+        if (op.kind == OP_BROWSE || op.kind == OP_EDIT) ok = (bool)(in >> op.show);
+        if (op.kind == OP_HOLD) ok = (bool)(in >> op.show >> op.party);
+        ok = ok && op.kind != OP_KINDS && w.shows > 0 && op.show >= 0 && op.show < w.shows;
+        if (ok) w.ops.push_back(op);
+    }
+    fclose(f);
+    if (!ok) cerr << path << ":" << lineNo << ": bad workload line\n";
+    return ok;
+}
+
+// Run a workload on a fresh engine (store files removed before and after)
+static int runWorkload(const Workload& w, const string& label) {
+    const string store = "bench_workload";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    int failures = 0;
+    {
+        BookingEngine engine(store, 0);     // instant gateway: measure the system, not the bank
+        engine.setJournalGroupCommit(1000);
+        Category* cat = engine.addCategory("Workload");
+        vector<Show*> shows(w.shows);
+        for (int i = 0; i < w.shows; ++i) {
+            shows[i] = engine.addShow(cat, "Workload show " + toString(i), "2025-06-01 20:00",
+                                      w.rows, w.cols, 100000);
+        }
+        engine.flushJournal();
+        engine.setJournalGroupCommit(1);
+
+        deque<BookingEngine::SeatHold> pending;
+        vector<uint64_t> booked;
+        vector<uint64_t> latency[OP_KINDS];
+        vector<int>      edits(w.shows, 0);
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < w.ops.size(); ++i) {
+            const WorkloadOp& op = w.ops[i];
+            Show* s = shows[op.show];
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            switch (op.kind) {
+            case OP_BROWSE: {
+                Seat seat(1, 1);
+                int seen = 0;
+                while (s->findNextFreeSeat(seat.row, seat.number, seat)) { ++seen; ++seat.number; }
+                failures += seen != s->seatsLeft();
+                break;
+            }
+            case OP_HOLD: {
+                BookingEngine::SeatHold h = engine.holdBestSeats(s, op.party);
+                if (h.token) pending.push_back(h);
+                break;
+            }
+            case OP_PAY:
+                if (!pending.empty()) {
+                    vector<uint64_t> ids;
+                    failures += !engine.pay(pending.front(), "4111111111111111", &ids).get();
+                    booked.insert(booked.end(), ids.begin(), ids.end());
+                    pending.pop_front();
+                }
+                break;
+            case OP_RELEASE:
+                if (!pending.empty()) {
+                    failures += !engine.releaseHold(pending.front());
+                    pending.pop_front();
+                }
+                break;
+            case OP_CANCEL:
+                if (!booked.empty()) {
+                    failures += !engine.cancelBooking(booked.back());
+                    booked.pop_back();
+                }
+                break;
+            case OP_EDIT:
+                engine.editShow(cat, s->getSlot(),
+                                "Workload show " + toString(op.show) + " v" + toString(++edits[op.show]),
+                                s->getDateTime());
+                break;
+            default:
+                break;
+            }
+            latency[op.kind].push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start).count());
+        }
+        double wall = secondsSince(begin);
+
+        for (int k = 0; k < OP_KINDS; ++k) {
+            vector<uint64_t>& ns = latency[k];
+            double busy = 0;
+            for (size_t i = 0; i < ns.size(); ++i) busy += ns[i];
+            cout << "{\"bench\":\"" << label << "\",\"op\":\"" << WORKLOAD_OP_NAMES[k] << "\""
+                 << ",\"count\":" << ns.size()
+                 << ",\"ops_per_sec\":" << (busy > 0 ? (long long)(ns.size() * 1e9 / busy) : 0)
+                 << ",\"p50_us\":"  << percentileMicros(ns, 0.50)
+                 << ",\"p99_us\":"  << percentileMicros(ns, 0.99)
+                 << ",\"p999_us\":" << percentileMicros(ns, 0.999)
+                 << ",\"max_us\":"  << percentileMicros(ns, 1.0) << "}\n";
+        }
+        cout << "{\"bench\":\"" << label << "\",\"op\":\"all\""
+             << ",\"count\":" << w.ops.size()
+             << ",\"ops_per_sec\":" << (long long)(w.ops.size() / wall)
+             << ",\"secs\":" << wall
+             << ",\"bookings\":" << engine.bookingCount()
+             << ",\"failures\":" << failures << "}\n";
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return failures == 0 ? 0 : 1;
+}
+
+// Synthetic workload; optionally saved for later replays.
+// args: [ops] [shows] [zipfSkew] [saveAs]  (default 100000 1000 1.0)
+static int benchWorkload(int argc, char* argv[]) {
+    int    ops   = benchArg(argc, argv, 0, 100000);
+    int    shows = benchArg(argc, argv, 1, 1000);
+    double skew  = argc > 2 ? atof(argv[2]) : 1.0;
+    Workload w = makeWorkload(ops, max(shows, 1), skew, 42);
+    if (argc > 3 && !writeWorkload(w, argv[3])) {
+        cerr << "Cannot write workload " << argv[3] << "\n";
+        return 1;
+    }
+    return runWorkload(w, "workload");
+}
+
+// Recorded workload.  args: <file>
+static int benchReplay(int argc, char* argv[]) {
+    Workload w;
+    if (argc < 1 || !readWorkload(argv[0], w)) return 2;
+    return runWorkload(w, "replay");
+}
+
+#ifdef __linux__
+
+// One client connection of the HTTP load generator
+struct LoadClient {
+    int    fd;
+    string out, in;
+    size_t outPos;
+    int    sent, done, inFlight;
+    vector<chrono::steady_clock::time_point> sentAt;   // per pipelined request
+};
+
+// Loopback HTTP load: an in-process server and an epoll client that keeps
+// `connections` keep-alive sockets busy, each with up to `pipeline`
+// requests outstanding (70% GET /shows/{id}, 20% seat maps, 10% category
+// lists).  args: [connections] [requestsPerConnection] [pipeline]
+//                [workers]  (default: 1000 and 10000 connections, 50, 1, 4)
+static int benchHttp(int argc, char* argv[]) {
+    vector<int> steps;
+    if (argc > 0) steps.push_back(benchArg(argc, argv, 0, 1000));
+    else { steps.push_back(1000); steps.push_back(10000); }
+    int perConn  = benchArg(argc, argv, 1, 50);
+    int pipeline = max(1, benchArg(argc, argv, 2, 1));
+    int workers  = max(1, benchArg(argc, argv, 3, 4));
+
+    // Both ends of every connection live in this process
+    rlimit lim;
+    getrlimit(RLIMIT_NOFILE, &lim);
+    lim.rlim_cur = lim.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &lim);
+    getrlimit(RLIMIT_NOFILE, &lim);
+    int maxConns = (int)min((rlim_t)1000000, (lim.rlim_cur - 64) / 2);
+
+    const string store = "bench_http";
+    const string files[4] = { store + ".journal", store + ".journal.old",
+                              store + ".snapshot", store + ".snapshot.tmp" };
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    int failures = 0;
+    {
+        BookingEngine engine(store, 0);     // seeds the default catalog
+        vector<int> showIds;
+        for (size_t i = 0; i < engine.categoryCount(); ++i) {
+            Category* cat = engine.category(i);
+            for (int j = 0; j < cat->getCount(); ++j) showIds.push_back(cat->getShow(j)->getId());
+        }
+        BookingHttpApi api(engine);
+        HttpServer server([&api](const HttpRequest& q, HttpResponse& r) { api.handle(q, r); }, workers);
+        if (showIds.empty() || !server.start(0)) {
+            cerr << "Cannot start the HTTP server\n";
+            return 1;
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family      = AF_INET;
+        addr.sin_port        = htons((uint16_t)server.port());
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        for (size_t k = 0; k < steps.size(); ++k) {
+            int n = steps[k];
+            if (n > maxConns) {
+                cout << "# " << n << " connections need " << 2 * n << " descriptors; open-file limit is "
+                     << lim.rlim_cur << ", running " << maxConns << "\n";
+                n = maxConns;
+            }
+            mt19937 rng(7);
+            int ep = epoll_create1(EPOLL_CLOEXEC);
+            vector<LoadClient> clients(n);
+            vector<uint64_t> latency;
+            latency.reserve((size_t)n * perConn);
+            int finished = 0;
+            size_t errors = 0;
+
+            // Fill a client's pipeline up to the depth
+            auto refill = [&](LoadClient& c) {
+                while (c.inFlight < pipeline && c.sent < perConn) {
+                    unsigned pick = rng() % 10;
+                    int show = showIds[rng() % showIds.size()];
+                    string path = pick < 7 ? "/shows/" + toString(show)
+                                : pick < 9 ? "/shows/" + toString(show) + "/seats"
+                                : string("/categories");
+                    c.out += "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+                    c.sentAt.push_back(chrono::steady_clock::now());
+                    ++c.sent; ++c.inFlight;
+                }
+            };
+            auto flushClient = [&](LoadClient& c) {
+                while (c.outPos < c.out.size()) {
+                    ssize_t w = ::send(c.fd, c.out.data() + c.outPos, c.out.size() - c.outPos, MSG_NOSIGNAL);
+                    if (w <= 0) break;
+                    c.outPos += (size_t)w;
+                }
+                if (c.outPos == c.out.size()) { c.out.clear(); c.outPos = 0; }
+                epoll_event ev;
+                ev.events = c.out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT;
+                ev.data.u32 = (uint32_t)(&c - &clients[0]);
+                epoll_ctl(ep, EPOLL_CTL_MOD, c.fd, &ev);
+            };
+
+            chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+            for (int i = 0; i < n; ++i) {
+                LoadClient& c = clients[i];
+                c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                c.outPos = 0; c.sent = c.done = c.inFlight = 0;
+                if (c.fd < 0) { ++errors; ++finished; continue; }
+                int one = 1;
+                setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+                if (connect(c.fd, (sockaddr*)&addr, sizeof addr) < 0 && errno != EINPROGRESS) {
+                    ::close(c.fd); c.fd = -1; ++errors; ++finished;
+                    continue;
+                }
+                refill(c);
+                epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT;     // EPOLLOUT fires once connected
+                ev.data.u32 = (uint32_t)i;
+                epoll_ctl(ep, EPOLL_CTL_ADD, c.fd, &ev);
+            }
+
+            vector<epoll_event> events(1024);
+            char buf[65536];
+            while (finished < n) {
+                int ready = epoll_wait(ep, &events[0], (int)events.size(), 5000);
+                if (ready <= 0) { cerr << "HTTP bench stalled\n"; errors += n - finished; break; }
+                for (int e = 0; e < ready; ++e) {
+                    LoadClient& c = clients[events[e].data.u32];
+                    if (c.fd < 0) continue;
+                    if (events[e].events & (EPOLLERR | EPOLLHUP)) {
+                        ::close(c.fd); c.fd = -1; ++errors; ++finished;
+                        continue;
+                    }
+                    if (events[e].events & EPOLLOUT) flushClient(c);
+                    if (!(events[e].events & EPOLLIN)) continue;
+                    ssize_t got;
+                    while ((got = ::recv(c.fd, buf, sizeof buf, 0)) > 0) c.in.append(buf, (size_t)got);
+                    // Take every complete response off the front
+                    size_t pos = 0;
+                    while (true) {
+                        size_t hdr = c.in.find("\r\n\r\n", pos);
+                        if (hdr == string::npos) break;
+                        size_t cl = c.in.find("Content-Length: ", pos);
+                        if (cl == string::npos || cl > hdr) { ++errors; break; }
+                        size_t total = hdr + 4 + strtoul(c.in.c_str() + cl + 16, NULL, 10);
+                        if (c.in.size() < total) break;
+                        if (c.in.compare(pos, 12, "HTTP/1.1 200") != 0) ++errors;
+                        latency.push_back((uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+                            chrono::steady_clock::now() - c.sentAt[c.done]).count());
+                        ++c.done; --c.inFlight;
+                        pos = total;
+                    }
+                    c.in.erase(0, pos);
+                    if (c.done == perConn) {
+                        ::close(c.fd); c.fd = -1; ++finished;
+                        continue;
+                    }
+                    if (got == 0) { ::close(c.fd); c.fd = -1; ++errors; ++finished; continue; }
+                    size_t before = c.out.size();
+                    refill(c);
+                    if (c.out.size() != before) flushClient(c);
+                }
+            }
+            double wall = secondsSince(begin);
+            for (int i = 0; i < n; ++i) if (clients[i].fd >= 0) ::close(clients[i].fd);
+            ::close(ep);
+            failures += errors != 0;
+
+            cout << "{\"bench\":\"http\",\"connections\":" << n
+                 << ",\"pipeline\":" << pipeline
+                 << ",\"workers\":" << workers
+                 << ",\"requests\":" << latency.size()
+                 << ",\"req_per_sec\":" << (long long)(latency.size() / wall)
+                 << ",\"p50_us\":"  << percentileMicros(latency, 0.50)
+                 << ",\"p99_us\":"  << percentileMicros(latency, 0.99)
+                 << ",\"p999_us\":" << percentileMicros(latency, 0.999)
+                 << ",\"max_us\":"  << percentileMicros(latency, 1.0)
+                 << ",\"errors\":"  << errors << "}\n";
+        }
+        server.stop();
+    }
+    for (int i = 0; i < 4; ++i) remove(files[i].c_str());
+    return failures == 0 ? 0 : 1;
+}
+
+// Log shipping on loopback: a primary and R replicas in this process
+// (over TCP and a unix socket in turn) while T threads read seats left
+// from the replicas. The primary books N seats; the bench reports how
+// fast the records reach every replica, the worst lag seen, and replica
+// reads/sec while replicating and once idle, then checks each replica
+// matches. Last it stops the primary, promotes replica 1, books on it,
+// and brings up a fresh replica from it.
+// args: [bookings] [replicas] [readerThreads]  (default 200000 2 2)
+static int benchReplication(int argc, char* argv[]) {
+    int n        = max(1000, benchArg(argc, argv, 0, 200000));
+    int replicas = max(1, benchArg(argc, argv, 1, 2));
+    int readers  = max(1, benchArg(argc, argv, 2, 2));
+    const int cols = 1000, extra = 1000;
+
+    vector<string> stores;
+    stores.push_back("bench_repl");
+    for (int i = 0; i <= replicas; ++i) stores.push_back("bench_repl_r" + toString(i + 1));
+    auto clean = [&]() {
+        for (size_t i = 0; i < stores.size(); ++i) {
+            remove((stores[i] + ".journal").c_str());
+            remove((stores[i] + ".journal.old").c_str());
+            remove((stores[i] + ".snapshot").c_str());
+            remove((stores[i] + ".snapshot.tmp").c_str());
+        }
+    };
+    clean();
+    int failures = 0;
+    {
+        BookingEngine* engine = new BookingEngine(stores[0], 0);
+        Category* cat = engine->addCategory("Replicated");
+        Show* show = engine->addShow(cat, "Stadium", "2025-06-01 20:00", (n + extra) / cols + 2, cols, 100000);
+        int showId = show->getId();
+        engine->setJournalGroupCommit(4096);
+
+        ReplicationPrimary* primary = new ReplicationPrimary(*engine);
+        if (!primary->listenOn("127.0.0.1:0") || !primary->listenOn("unix:bench_repl.sock")) {
+            cerr << "Cannot listen for replicas\n";
+            return 1;
+        }
+        vector<ReplicaNode*> nodes;
+        for (int i = 0; i < replicas; ++i) {
+            nodes.push_back(new ReplicaNode(0));
+            if (!nodes[i]->start(primary->listening()[i % 2], stores[i + 1])) {
+                cerr << "Replica " << i + 1 << " cannot copy the primary\n";
+                return 1;
+            }
+        }
+
+        // Readers spread over the replicas; a sampler records the worst lag
+        atomic<bool>      stop(false);
+        atomic<long long> reads(0), sink(0);
+        atomic<uint64_t>  worstLag(0);
+        vector<thread> threads;
+        for (int t = 0; t < readers; ++t) {
+            threads.push_back(thread([&, t]() {
+                long long k = 0;
+                for (; !stop.load(memory_order_relaxed); ++k) {
+                    Epoch::Guard guard;
+                    Show* s = nodes[(t + k) % replicas]->getEngine().findShowById(showId);
+                    if (s) sink.fetch_add(s->seatsLeft(), memory_order_relaxed);
+                    if ((k & 255) == 255) reads.fetch_add(256, memory_order_relaxed);
+                }
+                reads.fetch_add(k & 255, memory_order_relaxed);
+            }));
+        }
+        atomic<bool> sampling(true);
+        thread sampler([&]() {
+            while (sampling.load()) {
+                uint64_t last = engine->journalLsn();
+                for (int i = 0; i < replicas; ++i) {
+                    uint64_t a = nodes[i]->appliedLsn();
+                    if (last > a && last - a > worstLag.load()) worstLag.store(last - a);
+                }
+                this_thread::sleep_for(chrono::milliseconds(1));
+            }
+        });
+        auto caughtUp = [&](BookingEngine& from, vector<ReplicaNode*>& to, int waitSecs) -> bool {
+            chrono::steady_clock::time_point limit = chrono::steady_clock::now() + chrono::seconds(waitSecs);
+            for (size_t i = 0; i < to.size(); ++i) {
+                while (to[i]->appliedLsn() < from.journalLsn()) {
+                    if (chrono::steady_clock::now() > limit) return false;
+                    this_thread::sleep_for(chrono::microseconds(200));
+                }
+            }
+            return true;
+        };
+
+        uint64_t firstLsn = engine->journalLsn();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < n; ++i) {
+            int r = i / cols + 1, c = i % cols + 1;
+            show->bookSeat(r, c);
+            engine->addBookingRecord((uint64_t)i + 1, show, r, c, show->getPrice());
+        }
+        engine->flushJournal();
+        double writeSecs = secondsSince(start);
+        if (!caughtUp(*engine, nodes, 60)) ++failures;
+        double replSecs = secondsSince(start);
+        long long busyReads = reads.load();
+        sampling = false;
+        sampler.join();
+
+        reads = 0;
+        chrono::steady_clock::time_point idle = chrono::steady_clock::now();
+        this_thread::sleep_for(chrono::milliseconds(1000));
+        long long idleReads = reads.load();
+        double idleSecs = secondsSince(idle);
+        stop = true;
+        for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+
+        uint64_t records = engine->journalLsn() - firstLsn;
+        cout << "replication: bookings=" << n << " replicas=" << replicas
+             << " readers=" << readers << " records=" << records << "\n"
+             << "  primary write secs=" << writeSecs
+             << " all replicas caught up secs=" << replSecs
+             << " records/sec=" << (long long)(records / replSecs)
+             << " shipped=" << primary->recordsShipped()
+             << " worst lag records=" << worstLag.load() << "\n"
+             << "  replica reads/sec while replicating=" << (long long)(busyReads / replSecs)
+             << " idle=" << (long long)(idleReads / idleSecs) << "\n";
+
+        SalesTotals want = engine->salesLedger().totals(SalesFilter(), 1);
+        for (int i = 0; i < replicas; ++i) {
+            BookingEngine& e = nodes[i]->getEngine();
+            SalesTotals got = e.salesLedger().totals(SalesFilter(), 1);
+            Show* s = e.findShowById(showId);
+            bool same = e.bookingCount() == engine->bookingCount() && s
+                     && s->seatsLeft() == show->seatsLeft()
+                     && got.revenue == want.revenue && got.seats == want.seats;
+            cout << "  replica " << i + 1 << " (" << primary->listening()[i % 2] << "): lsn="
+                 << nodes[i]->appliedLsn() << " bookings=" << e.bookingCount()
+                 << (same ? " OK" : " MISMATCH") << "\n";
+            if (!same) ++failures;
+        }
+
+        // Fail over: the primary goes away, replica 1 takes writes and
+        // ships to a new replica
+        primary->stop();
+        delete primary;
+        delete engine;
+        ReplicaNode* promoted = nodes[0];
+        start = chrono::steady_clock::now();
+        bool ok = promoted->promote();
+        double promoteSecs = secondsSince(start);
+        BookingEngine& next = promoted->getEngine();
+        Show* s2 = next.findShowById(showId);
+        ReplicationPrimary* second = new ReplicationPrimary(next);
+        ok = ok && s2 && !next.isReadOnly() && second->listenOn("unix:bench_repl.sock");
+        ReplicaNode* fresh = new ReplicaNode(0);
+        ok = ok && fresh->start(second->listening()[0], stores[replicas + 1]);
+        for (int i = n; ok && i < n + extra; ++i) {
+            int r = i / cols + 1, c = i % cols + 1;
+            s2->bookSeat(r, c);
+            next.addBookingRecord((uint64_t)i + 1, s2, r, c, s2->getPrice());
+        }
+        next.flushJournal();
+        vector<ReplicaNode*> downstream(1, fresh);
+        ok = ok && caughtUp(next, downstream, 30)
+                && fresh->getEngine().bookingCount() == (size_t)(n + extra)
+                && next.bookingCount() == (size_t)(n + extra)
+                && fresh->getEngine().isReadOnly();
+        cout << "  promote secs=" << promoteSecs << " bookings after failover=" << next.bookingCount()
+             << " new replica bookings=" << (ok ? fresh->getEngine().bookingCount() : 0)
+             << (ok ? " OK" : " FAILED") << "\n";
+        if (!ok) ++failures;
+        delete fresh;
+        second->stop();
+        delete second;
+        for (int i = 0; i < replicas; ++i) delete nodes[i];
+    }
+    clean();
+    return failures ? 1 : 0;
+}
+
+#else
+
+static int benchHttp(int, char*[]) {
+    cout << "The HTTP server needs Linux (epoll).\n";
+    return 2;
+}
+
+static int benchReplication(int, char*[]) {
+    cout << "Replication needs Linux.\n";
+    return 2;
+}
+
+#endif  // __linux__
+
+static int runBenchmark(const string& name, int argc, char* argv[]) {
+    if (name == "concurrent") return benchConcurrentBooking(argc, argv);
+    if (name == "shards")     return benchSharded(argc, argv);
+    if (name == "holds")      return benchHoldExpiry(argc, argv);
+    if (name == "waitingroom") return benchWaitingRoom(argc, argv);
+    if (name == "payment")    return benchPaymentPipeline(argc, argv);
+    if (name == "pricing")    return benchPricing(argc, argv);
+    if (name == "journal")    return benchJournal(argc, argv);
+    if (name == "startup")    return benchStartup(argc, argv);
+    if (name == "import")     return benchImport(argc, argv);
+    if (name == "catalog")    return benchCatalog(argc, argv);
+    if (name == "lookup")     return benchLookup(argc, argv);
+    if (name == "schedule")   return benchSchedule(argc, argv);
+    if (name == "allocator")  return benchSeatAllocator(argc, argv);
+    if (name == "seatmap")    return benchSeatMapRefresh(argc, argv);
+    if (name == "search")     return benchSearch(argc, argv);
+    if (name == "memory")     return benchMemory(argc, argv);
+    if (name == "trips")      return benchTrips(argc, argv);
+    if (name == "sales")      return benchSales(argc, argv);
+    if (name == "cancel")     return benchCancel(argc, argv);
+    if (name == "workload")   return benchWorkload(argc, argv);
+    if (name == "replay")     return benchReplay(argc, argv);
+    if (name == "http")       return benchHttp(argc, argv);
+    if (name == "replication") return benchReplication(argc, argv);
+    cout << "Unknown benchmark: " << name << "\n"
+         << "Available: concurrent, shards, holds, waitingroom, payment, pricing, journal, startup,\n"
+         << "           import, catalog, lookup, schedule, allocator, seatmap, search, memory,\n"
+         << "           trips, sales, cancel, workload, replay, http, replication\n";
+    return 2;
+}
+
+
+// Everything but --metrics: benchmarks, tools, the server or the console
+static int runMode(int argc, char* argv[]) {
+    if (argc >= 3 && string(argv[1]) == "--bench") {
+        return runBenchmark(argv[2], argc - 3, argv + 3);
+    }
+    if (argc >= 2 && string(argv[1]) == "--write-snapshot") {
+        // Compact <store>.journal into a mappable <store>.snapshot image
+        BookingEngine sys(argc >= 3 ? argv[2] : "booking");
+        bool ok = sys.takeSnapshot();
+        cout << (ok ? "Snapshot written: " : "Snapshot failed: ")
+             << sys.bookingCount() << " bookings\n";
+        return ok ? 0 : 1;
+    }
+    if (argc >= 3 && string(argv[1]) == "--import") {
+        // Bulk-load shows from a CSV or JSON file: --import <file> [store] [threads]
+        BookingEngine engine(argc >= 4 ? argv[3] : "booking");
+        engine.setJournalGroupCommit(4096);
+        CatalogImporter importer(engine, argc >= 5 ? atoi(argv[4]) : 0);
+        CatalogImporter::Result r;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (!importer.importFile(argv[2], r)) {
+            cerr << "Cannot read " << argv[2] << "\n";
+            return 1;
+        }
+        double secs = secondsSince(start);
+        for (size_t i = 0; i < r.problems.size(); ++i) {
+            cerr << argv[2] << ":" << r.problems[i].line << ": " << r.problems[i].message << "\n";
+        }
+        if (r.rejected > r.problems.size()) {
+            cerr << "... and " << r.rejected - r.problems.size() << " more rejected\n";
+        }
+        cout << "Imported " << r.imported << " of " << r.records << " shows ("
+             << (r.format == CatalogImporter::IMPORT_JSON ? "JSON" : "CSV") << ", "
+             << r.categoriesAdded << " new categories) in " << secs << " s\n";
+        return r.rejected ? 3 : 0;
+    }
+    if (argc >= 2 && string(argv[1]) == "--serve") {
+#ifdef __linux__
+        // JSON API over HTTP/1.1: --serve [port] [store] [showId:perSecond[:burst]...]
+        // (each of the last puts a show on sale behind a waiting room).
+        // The admin routes take the token in TBS_ADMIN_TOKEN; without one
+        // they are off.
+        int port = argc >= 3 ? atoi(argv[2]) : 8080;
+        BookingEngine engine(argc >= 4 ? argv[3] : "booking");
+        for (int i = 4; i < argc; ++i) {
+            int showId = 0;
+            double rate = 0, burst = 1;
+            if (sscanf(argv[i], "%d:%lf:%lf", &showId, &rate, &burst) < 2
+                || !engine.findShowById(showId) || !engine.waitingRoom().open(showId, rate, burst)) {
+                cerr << "Bad on-sale line " << argv[i] << " (want showId:perSecond[:burst])\n";
+                return 1;
+            }
+        }
+        const char* admin = getenv("TBS_ADMIN_TOKEN");
+        BookingHttpApi api(engine, NULL, admin ? admin : "");
+        HttpServer server([&api](const HttpRequest& q, HttpResponse& r) { api.handle(q, r); });
+        if (!server.start(port, true)) {
+            cerr << "Cannot listen on port " << port << "\n";
+            return 1;
+        }
+        cout << "Serving on port " << server.port() << " (press Enter to stop)\n";
+        string line;
+        getline(cin, line);
+        server.stop();
+        if (!engine.flushJournal()) {
+            cerr << "Could not write the journal; recent changes were not saved\n";
+            return 1;
+        }
+        return 0;
+#else
+        cout << "The HTTP server needs Linux (epoll).\n";
+        return 2;
+#endif
+    }
+    if (argc >= 3 && (string(argv[1]) == "--primary" || string(argv[1]) == "--replica")) {
+#ifdef __linux__
+        // --primary <listen address> [port] [store]: serve HTTP and ship the
+        // journal to replicas; --replica <primary address> [port] [store]:
+        // serve reads from a copy kept current (addresses: host:port or
+        // unix:/path)
+        bool   isPrimary = string(argv[1]) == "--primary";
+        int    port  = argc >= 4 ? atoi(argv[3]) : 8080;
+        string store = argc >= 5 ? argv[4] : (isPrimary ? "booking" : "replica");
+        BookingEngine*      engine = NULL;
+        ReplicationPrimary* primary = NULL;
+        ReplicaNode         replica;
+        if (isPrimary) {
+            engine  = new BookingEngine(store);
+            primary = new ReplicationPrimary(*engine);
+            if (!primary->listenOn(argv[2])) {
+                cerr << "Cannot listen for replicas on " << argv[2] << "\n";
+                delete primary;
+                delete engine;
+                return 1;
+            }
+        } else if (!replica.start(argv[2], store)) {
+            cerr << "Cannot copy the primary at " << argv[2] << "\n";
+            return 1;
+        }
+        BookingEngine& served = isPrimary ? *engine : replica.getEngine();
+        const char* admin = getenv("TBS_ADMIN_TOKEN");
+        BookingHttpApi api(served, isPrimary ? (ReplicationRole*)primary : &replica, admin ? admin : "");
+        HttpServer server([&api](const HttpRequest& q, HttpResponse& r) { api.handle(q, r); });
+        int status = 0;
+        if (server.start(port, true)) {
+            cout << (isPrimary ? "Primary (replicas connect to " + primary->listening()[0] + ")"
+                               : "Replica of " + string(argv[2]))
+                 << " serving on port " << server.port() << " (press Enter to stop)\n";
+            string line;
+            getline(cin, line);
+            server.stop();
+        } else {
+            cerr << "Cannot listen on port " << port << "\n";
+            status = 1;
+        }
+        if (isPrimary) primary->stop();
+        else           replica.stopFollowing();
+        if (!served.flushJournal()) {
+            cerr << "Could not write the journal; recent changes were not saved\n";
+            status = 1;
+        }
+        delete primary;
+        delete engine;
+        return status;
+#else
+        cout << "Replication needs Linux.\n";
+        return 2;
+#endif
+    }
+    TicketBookingSystem app;
+    app.run();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    // --metrics <file|-> [seconds] may come before any mode
+    MetricsDumper* dumper = NULL;
+    if (argc >= 3 && string(argv[1]) == "--metrics") {
+        int skip = 2, seconds = 10;
+        if (argc >= 4 && isdigit((unsigned char)argv[3][0])) { seconds = atoi(argv[3]); skip = 3; }
+        dumper = new MetricsDumper(argv[2], seconds);
+        argv[skip] = argv[0];
+        argc -= skip;
+        argv += skip;
+    }
+    int status = runMode(argc, argv);
+    delete dumper;      // final dump
+    return status;
+}